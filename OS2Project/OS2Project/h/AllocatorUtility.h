@@ -9,37 +9,61 @@
 #include "Definitions.h" // Block size
 #include "Buddy.h" // buddy_header_s
 #include "SlabStructs.h" // slab_header_s
+#include <cstdint> // uint64_t
+#include <stdexcept> // invalid_argument
 
 namespace os2bn140314d {
 
-	#pragma region Header union
+	#pragma region Header struct
 
 	/**
 	 * \brief All the data needed for the allocator. Kept in the first block of allocated memory
+	 *
+	 * Each part starts in its own cache line, so the locks of the allocators and of the console
+	 * are not shared between them. The header is placed at the first aligned address of the block.
 	 */
-	struct header_s {
+	struct alignas(CACHE_L1_LINE_SIZE) header_s {
 		buddy_header_s buddy_header_;	/**< Header used by the buddy allocator */
 		slab_header_s slab_header_;		/**< Header used by the slab allocator */
-		std::mutex write_mutex_;		/**< Mutex used for console output mutual exclusion */
+		alignas(CACHE_L1_LINE_SIZE) std::mutex write_mutex_;	/**< Mutex used for console output mutual exclusion */
 
 		/**
 		 * \brief Initialize the allocator header
 		 * \param first_pool_block Pointer to the first block available
 		 * \size_in_blocks Size of the pool in blocks
-		 * \throw invalid_argument Thrown when size is too small
+		 * \return True if the header was initialized, false if the size is too small
 		 */
-		void initialize(Block *first_pool_block, size_t size_in_blocks) throw (std::invalid_argument);
+		bool initialize(Block *first_pool_block, size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Prepare the header of a pool mapped again in a new process
+		 *
+		 * Locks are initialized again, and the state of the process that wrote the pool is dropped
+		 */
+		void reattach() noexcept;
 	};
 
 	/**
-	 * \brief First block of allocated memory
+	 * \brief Struct representing the first block of the file holding a persistent pool
+	 *
+	 * The pool is mapped at the start of the range reserved for the persistent pools, which is at the same address in every process,
+	 * so the pointers in its metadata stay valid. The sizes of the headers change with the layout of the metadata, and a pool of another layout is refused.
 	 */
-	union Header {
-		header_s header_;
-		Block block_;
-		~Header() = delete;
+	struct persistent_pool_s {
+		static const uint64_t MAGIC = 0x6c6f6f706d656d6b;	/**< Marks the file as a pool */
+
+		uint64_t magic_;						/**< Equal to \c MAGIC in a pool file */
+		size_t header_size_;					/**< Size of the allocator header when the pool was created */
+		size_t cache_size_;						/**< Size of the cache header when the pool was created */
+		size_t slab_size_;						/**< Size of the slab header when the pool was created */
+		void *address_;							/**< Start of the reserved range the file is mapped at */
+		size_t size_in_blocks_;					/**< Size of the file in blocks, including this block */
+		void *root_;							/**< Object the users find their data from, or nullptr */
+		bool clean_;							/**< True if the pool was detached, false while it is in use */
 	};
 
+	static_assert(sizeof(header_s) + CACHE_L1_LINE_SIZE <= BLOCK_SIZE, "Aligned allocator header must fit in one block");
+
 	#pragma endregion 
 
 	/**
@@ -50,7 +74,7 @@ namespace os2bn140314d {
 
 		#pragma region Public interface
 
-		static const size_t MIN_SIZE_IN_BLOCKS = 3; /**< Minimal size of the allocator in blocks */
+		static const size_t MIN_SIZE_IN_BLOCKS = 4; /**< Minimal size of the allocator in blocks */
 
 		/**
 		 * \brief Initialize the allocator
@@ -58,7 +82,29 @@ namespace os2bn140314d {
 		 * \param size_in_blocks Size of the memory in blocks
 		 * \throw invalid_argument Thrown when size is not valid
 		 */
-		static void initialize(void *memory_start, int size_in_blocks) throw (std::invalid_argument);
+		static void initialize(void *memory_start, int size_in_blocks);
+
+		/**
+		 * \brief Give one more memory region to the allocator
+		 * \param memory_start Pointer to the memory which the allocator can use
+		 * \param size_in_blocks Size of the memory in blocks
+		 * \throw invalid_argument Thrown when size is not valid, or there is no more space for regions
+		 */
+		static void addRegion(void *memory_start, int size_in_blocks);
+
+		/**
+		 * \brief Give one more huge page aligned memory region to the allocator
+		 * \param memory_start Pointer to the memory which the allocator can use, or nullptr if the region should be mapped from the system
+		 * \param size_in_blocks Size of the memory in blocks
+		 * \throw invalid_argument Thrown when size is not valid, the region could not be mapped, or there is no more space for regions
+		 */
+		static void addHugeRegion(void *memory_start, int size_in_blocks);
+
+		/**
+		 * \brief Set the size of the regions mapped when the allocator runs out of memory
+		 * \param size_in_blocks Minimal size of each new region in blocks, 0 to disable growing
+		 */
+		static void setAutoGrow(int size_in_blocks) noexcept;
 		
 		/**
 		 * \brief Get the pointer to memory used by the allocator
@@ -68,6 +114,8 @@ namespace os2bn140314d {
 
 		/**
 		 * \brief Get the pointer to the block where the passed memory is located
+		 * \param memory Pointer to the memory inside one of the regions
+		 * \return Pointer to the block
 		 */
 		static const Block *blockStart(const void *memory) noexcept;
 
@@ -81,6 +129,25 @@ namespace os2bn140314d {
 		 */
 		static void writeUnlock() noexcept;
 
+		/**
+		 * \brief Lock the whole allocator before the process forks
+		 *
+		 * The child gets a copy of the memory with only the forking thread, so no lock may be held
+		 * in the middle of a change. Locks of the sampling pools are taken first, since they
+		 * allocate while holding them, then the slab allocator, and the buddy allocator last.
+		 */
+		static void prepareFork() noexcept;
+
+		/**
+		 * \brief Unlock the allocator after the process forked
+		 * \param child True in the child process, false in the parent
+		 *
+		 * Console mutex is not locked for the fork, since it is taken while holding the cache mutexes,
+		 * the child initializes it again instead. Active slabs of the threads that do not exist
+		 * in the child stay taken.
+		 */
+		static void finishFork(bool child) noexcept;
+
 		/**
 		 * \brief Get the reference to the header block
 		 * \return Reference to the header block
@@ -99,10 +166,74 @@ namespace os2bn140314d {
 		 */
 		static slab_header_s &slabHeader() noexcept;
 
+		/**
+		 * \brief Reserve the address range the persistent pools are mapped at
+		 * \param address Start of the range, or nullptr for \c KMEM_PERSISTENT_ADDRESS
+		 * \param size_in_blocks Size of the range in blocks
+		 * \return True if the range was reserved, false if a part of it is taken, or a range is already reserved
+		 */
+		static bool reservePersistent(void *address, int size_in_blocks) noexcept;
+
+		/**
+		 * \brief Initialize the allocator in a file, which keeps the pool after the process exits
+		 * \param path Path of the file, created or truncated
+		 * \param size_in_blocks Size of the file in blocks, the first one holds the description of the pool
+		 * \return True if the allocator was initialized, false if the size is not valid, or the file could not be mapped
+		 */
+		static bool initializePersistent(const char *path, int size_in_blocks) noexcept;
+
+		/**
+		 * \brief Map the pool of the file again, at the start of the reserved range
+		 * \param path Path of the file
+		 * \return True if the pool is attached, false otherwise
+		 *
+		 * The pool is refused if it was not detached, has another layout, or was created in a range at another address
+		 */
+		static bool attach(const char *path) noexcept;
+
+		/**
+		 * \brief Write the persistent pool to its file, and unmap it, keeping its range reserved
+		 * \return True if the pool was detached, false if the allocator is not persistent, or holds memory outside of the file
+		 *
+		 * Deferred objects are released, and the calling thread returns its slabs and charges.
+		 * Other threads must have exited, and the allocator is not used until the pool is attached again.
+		 */
+		static bool detach() noexcept;
+
+		/**
+		 * \brief Check if the allocator lives in a file
+		 * \return True if the pool is persistent, false otherwise
+		 */
+		static bool isPersistent() noexcept;
+
+		/**
+		 * \brief Set the object the users find their data from after the pool is attached
+		 * \param root Pointer to the object in the pool, or nullptr
+		 * \return True if the root was set, false if the allocator is not persistent
+		 */
+		static bool setRoot(void *root) noexcept;
+
+		/**
+		 * \brief Get the object set by \c setRoot
+		 * \return Pointer to the object, or nullptr if there is none, or the allocator is not persistent
+		 */
+		static void *root() noexcept;
+
 		#pragma endregion
 
 	private:
 		static void *memory_start_;
+		static header_s *header_;	/**< Header placed at the first aligned address of the memory */
+		static persistent_pool_s *pool_;	/**< Description of the persistent pool, or nullptr if the allocator is not persistent */
+		static void *reserved_;				/**< Start of the range reserved for the persistent pools, or nullptr if none is reserved */
+		static size_t reserved_blocks_;		/**< Size of the reserved range in blocks */
+
+		/**
+		 * \brief Make sure the range for the pool is reserved, reserving it at \c KMEM_PERSISTENT_ADDRESS if none is
+		 * \param size_in_blocks Size of the pool in blocks
+		 * \return True if the pool fits in the reserved range, false otherwise
+		 */
+		static bool reserveFor(size_t size_in_blocks) noexcept;
 
 		#pragma region Delete constructors
 		
@@ -7,7 +7,6 @@
 #define _blocklist_h_
 
 #include "Definitions.h" // Block
-#include <stdexcept> // Exceptions
 
 namespace os2bn140314d {
 
@@ -22,25 +21,24 @@ namespace os2bn140314d {
 		/**
 		 * \brief Insert one block into the list
 		 * \param head Reference to the pointer to the beginning of the list
-		 * \param new_block Pointer to the block which should be inserted
+		 * \param new_block Pointer to the block which should be inserted, nothing is inserted if it is nullptr
 		 */
-		static void insert(Block *&head, Block *new_block) throw (std::invalid_argument);
+		static void insert(Block *&head, Block *new_block) noexcept;
 
 		/**
 		 * \brief Remove one block from the list, and return it
 		 * \param head Pointer to the head of the list
-		 * \return Pointer to the removed block
-		 * \throw underflow_error Thrown when the list is empty
+		 * \return Pointer to the removed block, or nullptr if the list is empty
 		 */
-		static Block *remove(Block *&head) throw (std::underflow_error);
+		static Block *remove(Block *&head) noexcept;
 
 		/**
 		 * \brief Remove one specific block from the list
 		 * \param head Pointer to the head of the list
 		 * \param block Pointer to the block
-		 * \throw invalid_argument Thrown when the list is empty
+		 * \return True if the block was removed, false if it is nullptr or not in the list
 		 */
-		static void remove(Block *&head, Block *block) throw (std::invalid_argument);
+		static bool remove(Block *&head, Block *block) noexcept;
 
 		#pragma endregion 
 
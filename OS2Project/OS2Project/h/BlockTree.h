@@ -0,0 +1,108 @@
+/**
+* \file BlockTree.h
+* \brief File providing the functions for the manipulation of the address ordered trees of free blocks
+*/
+
+#ifndef _blocktree_h_
+#define _blocktree_h_
+
+#include <cstdint> // uint64_t, uintptr_t
+#include "Definitions.h" // Block
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Helper class keeping the unused blocks ordered by their addresses
+	 *
+	 * Blocks form a treap, a binary search tree by the address which is also a heap by the priority
+	 * computed from the address, so the tree is balanced on average without storing the priorities.
+	 * The children are kept in \c left and \c right of the block info
+	 */
+	class BlockTree final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Insert one block into the tree
+		 * \param root Reference to the pointer to the root of the tree
+		 * \param new_block Pointer to the block which should be inserted, nothing is inserted if it is nullptr
+		 */
+		static void insert(Block *&root, Block *new_block) noexcept;
+
+		/**
+		 * \brief Remove the block with the lowest address from the tree, and return it
+		 * \param root Reference to the pointer to the root of the tree
+		 * \return Pointer to the removed block, or nullptr if the tree is empty
+		 */
+		static Block *remove(Block *&root) noexcept;
+
+		/**
+		 * \brief Remove one specific block from the tree
+		 * \param root Reference to the pointer to the root of the tree
+		 * \param block Pointer to the block
+		 * \return True if the block was removed, false if it is nullptr or not in the tree
+		 */
+		static bool remove(Block *&root, Block *block) noexcept;
+
+		/**
+		 * \brief Get the block with the lowest address
+		 * \param root Pointer to the root of the tree
+		 * \return Pointer to the block, or nullptr if the tree is empty
+		 */
+		static Block *first(Block *root) noexcept;
+
+		/**
+		 * \brief Count the blocks in the tree
+		 * \param root Pointer to the root of the tree
+		 * \return Number of blocks
+		 */
+		static size_t count(const Block *root) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Check if the first block is at the lower address
+		 */
+		static bool before(const Block *lhs, const Block *rhs) noexcept;
+
+		/**
+		 * \brief Get the heap priority of the block, derived from its address
+		 */
+		static uint64_t priority(const Block *block) noexcept;
+
+		/**
+		 * \brief Split the tree into the blocks below the key and the rest
+		 * \param root Pointer to the root of the tree
+		 * \param key Pointer to the block the tree is split at
+		 * \param left Set to the root of the blocks with the lower addresses
+		 * \param right Set to the root of the other blocks
+		 */
+		static void split(Block *root, const Block *key, Block *&left, Block *&right) noexcept;
+
+		/**
+		 * \brief Merge two trees, all blocks of the first one are at the lower addresses
+		 * \param left Pointer to the root of the first tree
+		 * \param right Pointer to the root of the second tree
+		 * \return Pointer to the root of the merged tree
+		 */
+		static Block *merge(Block *left, Block *right) noexcept;
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		BlockTree() = delete;
+		BlockTree(const BlockTree &) = delete;
+		void operator=(const BlockTree &) = delete;
+
+		#pragma endregion
+
+	};
+
+}
+#endif
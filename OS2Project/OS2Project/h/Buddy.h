@@ -6,11 +6,33 @@
 #ifndef _buddy_h_
 #define _buddy_h_
 
-#include <stdexcept> // Exceptions
 #include <mutex> // mutex
+#include <atomic> // atomic
 #include "Definitions.h" // Constants
 
 namespace os2bn140314d {
+
+	/**
+	 * \brief Sets of free lists kept by the buddy allocator, each served by its own regions
+	 */
+	enum BuddyPool : size_t {
+		NORMAL_POOL = 0,	/**< Regions given by the user, and regions mapped on exhaustion */
+		HUGE_POOL = 1,		/**< Huge page aligned regions, backed by huge pages where the system allows it */
+		RESERVE_POOL = 2	/**< Contiguous reserve inside the normal pool, lent to the movable allocations, which fall back to the normal pool */
+	};
+
+	const size_t NUMBER_OF_POOLS = 2; /**< Number of pools whose free lists are kept in the header, the lists of the reserve are kept apart */
+
+	/**
+	 * \brief Orders in which the free blocks of one size are handed out
+	 */
+	enum FreeListPolicy : unsigned char {
+		LIFO_POLICY = 0,		/**< Block freed last is allocated first, while its memory is likely in the processor cache */
+		ADDRESS_POLICY = 1,		/**< Block with the lowest address is allocated first, so the live blocks gather at the start of the regions */
+		HYBRID_POLICY = 2		/**< Long lived allocations, such as the slabs, take the block with the lowest address, the others the block freed last */
+	};
+
+	const size_t NUMBER_OF_POLICIES = 3;
 	
 	/**
 	 * \brief Utility class providing interface for the buddy allocator
@@ -22,35 +44,178 @@ namespace os2bn140314d {
 		/**
 		 * \brief Allocate memory of at least the given size
 		 * \param size Size in blocks
-		 * \throw bad_alloc Thrown when there is not enough memory
-		 * \throw invalid_argument Thrown when passed size is 0
+		 * \return Pointer to the memory, or nullptr if the size is 0 or there is not enough memory
+		 *
+		 * Allocations of the users are made through this function, and they are sampled by the heap profiler.
+		 * The allocator takes its own memory through the other overload. Like \c allocatePowerOfTwo, this may take the reserve back
+		 */
+		static void *allocate(size_t size) noexcept;
+
+		/**
+		 * \brief Allocate the memory of the size 2^size
+		 * \param power 2^power is size in blocks
+		 * \return Pointer to the memory, or nullptr if there is not enough memory
+		 *
+		 * When the normal pool has no block of the size, a part of the reserve is taken back, moving the objects
+		 * of the movable caches. It must not be called with a lock of the allocator held
+		 */
+		static void *allocatePowerOfTwo(size_t power) noexcept;
+
+		/**
+		 * \brief Allocate memory of at least the given size
+		 * \param size Size in blocks
+		 * \param zeroed Set to true if the memory is known to be filled with zeros, false otherwise
+		 * \param pool Pool from which the memory is allocated
+		 * \param long_lived True if the memory is kept for long, as the slabs are, false otherwise
+		 * \return Pointer to the memory, or nullptr if the size is 0 or there is not enough memory
 		 */
-		static void *allocate(size_t size) throw (std::bad_alloc, std::invalid_argument);
+		static void *allocate(size_t size, bool &zeroed, BuddyPool pool = NORMAL_POOL, bool long_lived = false) noexcept;
 
 		/**
 		 * \brief Allocate the memory of the size 2^size
 		 * \param power 2^power is size in blocks
-		 * \throw bad_alloc Thrown when there is not enough memory
+		 * \param zeroed Set to true if the memory is known to be filled with zeros, false otherwise
+		 * \param pool Pool from which the memory is allocated
+		 * \param long_lived True if the memory is kept for long, as the slabs are, false otherwise
+		 * \return Pointer to the memory, or nullptr if there is not enough memory
+		 *
+		 * Failures return without unwinding, so running out of memory costs no more than a successful allocation.
+		 * Sizes with the hybrid policy place the long lived memory at the lowest free address.
+		 * The reserve is never taken back here, the allocator calls this with the locks of the caches held
 		 */
-		static void *allocatePowerOfTwo(size_t power) throw (std::bad_alloc);
+		static void *allocatePowerOfTwo(size_t power, bool &zeroed, BuddyPool pool = NORMAL_POOL, bool long_lived = false) noexcept;
 
 		/**
 		 * \brief Deallocate memory
 		 * \param memory Pointer to the memory obtained by allocation
 		 * \param size Size of the memory passed to \c allocate
-		 * \throw invalid_argument Thrown when pointer is out of range
+		 * \return True if the memory was deallocated, false if the pointer is out of range or the size is not valid
 		 */
-		static void deallocate(void *memory, size_t size) throw (std::invalid_argument);
+		static bool deallocate(void *memory, size_t size) noexcept;
 
 		/**
 		 * \brief Deallocate memory
 		 * \param memory Pointer to the memory obtained by allocation
 		 * \param power Power of the memory passed to \c allocatePowerOfTwo
-		 * \throw invalid_argument Thrown when pointer is out of range
+		 * \return True if the memory was deallocated, false if the pointer is out of range or the power is not valid
 		 */
-		static void deallocatePowerOfTwo(void *memory, size_t power) throw (std::invalid_argument);
+		static bool deallocatePowerOfTwo(void *memory, size_t power) noexcept;
 
-		#pragma endregion 
+		/**
+		 * \brief Give one more memory region to the allocator
+		 * \param memory Pointer to the start of the region
+		 * \param size Size of the region in blocks
+		 * \return True if the region was added, false if the size is too small or the allocator can not manage more regions
+		 */
+		static bool addRegion(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Give one more huge page aligned region to the allocator
+		 * \param memory Pointer to the start of the region, or nullptr if the region should be mapped from the system
+		 * \param size Size of the region in blocks
+		 * \return True if the region was added, false if the size is too small, the allocator
+		 * can not manage more regions, or the region could not be mapped
+		 *
+		 * The usable memory starts at a huge page aligned address, and the metadata is kept
+		 * outside of it, so the biggest blocks of the region are aligned to huge pages
+		 */
+		static bool addHugeRegion(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Set how the huge page regions mapped by the allocator are backed
+		 * \param explicit_pages True if explicit huge pages should be requested, false if transparent huge pages should be advised
+		 */
+		static void setHugePageBacking(bool explicit_pages) noexcept;
+
+		/**
+		 * \brief Set the size of the regions mapped from the operating system when the allocator runs out of memory
+		 * \param size Minimal size of each new region in blocks, 0 to disable growing
+		 */
+		static void setAutoGrow(size_t size) noexcept;
+
+		/**
+		 * \brief Set the owner of the allocated memory, used for finding the slab of an object
+		 * \param memory Pointer to the memory obtained by allocation
+		 * \param size Size of the memory in blocks
+		 * \param owner Pointer to the owner, nullptr to clear
+		 */
+		static void setOwner(void *memory, size_t size, const void *owner) noexcept;
+
+		/**
+		 * \brief Get the owner of the block where the passed memory is located
+		 * \param memory Pointer to the memory
+		 * \return Pointer to the owner, or nullptr if the memory has no owner or is not managed by the allocator
+		 */
+		static const void *owner(const void *memory) noexcept;
+
+		/**
+		 * \brief Set the policy for returning idle free blocks to the operating system
+		 * \param power Blocks of the size 2^power and greater are purged, \c POWERS_OF_TWO to disable purging
+		 * \param decay_milliseconds Time a block must stay free before it is purged
+		 * \param lazy True if the pages may be reclaimed lazily, in which case purged blocks are not known to be zeroed
+		 */
+		static void setPurgePolicy(size_t power, long long decay_milliseconds, bool lazy) noexcept;
+
+		/**
+		 * \brief Purge all the blocks waiting in the purge list, without waiting for their decay interval
+		 * \return Number of purged blocks
+		 */
+		static size_t purge() noexcept;
+
+		/**
+		 * \brief Purge the blocks whose decay interval has passed
+		 * \return Number of purged blocks
+		 *
+		 * Called from the slow paths of the caches, so a pool without buddy deallocations still returns
+		 * its idle blocks. Unless the oldest block is due, only the time is read, without the mutex
+		 */
+		static size_t purgeIdle() noexcept;
+
+		/**
+		 * \brief Set the order in which the free blocks of one size are allocated
+		 * \param power Size of the blocks is 2^power
+		 * \param policy Policy of the free lists of that size
+		 * \return True if the policy was set, false if the size or the policy is out of range, or there is no block for the lists of the hybrid policy
+		 *
+		 * The free blocks of that size already in the lists are moved to the new order
+		 */
+		static bool setFreeListPolicy(size_t power, FreeListPolicy policy) noexcept;
+
+		/**
+		 * \brief Get the share of the free memory that can not serve an allocation of the given size
+		 * \param power Size of the allocation is 2^power blocks
+		 * \return Number from 0 to 1, 0 if there is no free memory
+		 *
+		 * This is the unusable free space index, the blocks smaller than the allocation
+		 * count as unusable however many of them there are
+		 */
+		static double fragmentation(size_t power) noexcept;
+
+		/**
+		 * \brief Set the number of the small free blocks each processor keeps
+		 * \param high Number of blocks of each size a processor keeps at most, 0 if the processors should keep none
+		 * \param batch Number of blocks of each size moved between a processor and the lists at once, at most \c high
+		 * \return True if the numbers were set, false if the batch is 0 or greater than the high watermark
+		 *
+		 * Blocks already kept by the processors are returned to the lists
+		 */
+		static bool setCpuPages(size_t high, size_t batch) noexcept;
+
+		/**
+		 * \brief Set aside a contiguous block of the normal pool, lent only to the movable allocations
+		 * \param power 2^power is size of the reserve in blocks
+		 * \param min_power Allocations of the size 2^min_power and greater may take the reserve back
+		 * \return True if the reserve was made, false if there already is one, \c min_power is greater than \c power,
+		 * or there is no free block of that size
+		 *
+		 * Allocations from \c RESERVE_POOL, which only the slabs of the movable caches use, borrow the reserve first.
+		 * The reserve keeps its free blocks sorted by address, so they gather at its start. When the normal pool can not
+		 * serve a big enough allocation of the user, the part of the reserve with the fewest borrowed blocks is emptied by moving
+		 * the objects of its slabs to the slabs in the normal pool, and the allocation is served from there
+		 */
+		static bool reserveContiguous(size_t power, size_t min_power) noexcept;
+
+		#pragma endregion
 
 		#pragma region Helpers
 
@@ -71,10 +236,9 @@ namespace os2bn140314d {
 		/**
 		* \brief Return the smallest power of two greater or equal to the number
 		* \param number Number to compare
-		* \return Power of two
-		* \throw overflow_error Thrown if no greater power of two in \c size_t range
+		* \return Power of two, or 0 if no greater power of two is in \c size_t range
 		*/
-		static size_t greaterOrEqualPowerOfTwo(size_t number) throw (std::overflow_error);
+		static size_t greaterOrEqualPowerOfTwo(size_t number) noexcept;
 
 		/**
 		* \brief Return the greatest power of two smaller or equal to the number
@@ -86,18 +250,16 @@ namespace os2bn140314d {
 		/**
 		* \brief Conversion from y to x in 2^x = y
 		* \param number y in equation
-		* \return x in equation
-		* \throw invalid_argument Thrown when number is not a power of two
+		* \return x in equation, or \c NULL_INDEX if the number is not a power of two
 		*/
-		static size_t sizeToPower(size_t number) throw (std::invalid_argument);
+		static size_t sizeToPower(size_t number) noexcept;
 
 		/**
 		* \brief Conversion from x to y in 2^x = y
 		* \param power x in equation
-		* \return y in equation
-		* \throw out_of_range Thrown when y is not in \c size_t range
+		* \return y in equation, or 0 if y is not in \c size_t range
 		*/
-		static size_t powerToSize(size_t power) throw (std::out_of_range);
+		static size_t powerToSize(size_t power) noexcept;
 
 		#pragma endregion 
 
@@ -129,80 +291,293 @@ namespace os2bn140314d {
 		 * \brief Allocate a number of blocks
 		 * \param index Starting index of the blocks that should be allocated
 		 * \param size_in_blocks Number of blocks that should be allocated
-		 * \throw out_of_range Thrown when allocated blocks are not in range
-		 * \remarks Does not check if memory was already allocated
+		 * \remarks Blocks must be in range. Does not check if memory was already allocated
 		 */
-		void allocate(size_t index, size_t size_in_blocks) throw (std::out_of_range);
+		void allocate(size_t index, size_t size_in_blocks) noexcept;
 
 		/**
 		 * \brief Deallocate a number of blocks
 		 * \param index Starting index of the blocks that should be allocated
 		 * \param size_in_blocks Number of blocks that should be allocated
-		 * \throw out_of_range Thrown when allocated blocks are not in range
-		 * \remarks Does not check if memory was already free
+		 * \remarks Blocks must be in range. Does not check if memory was already free
 		 */
-		void deallocate(size_t index, size_t size_in_blocks) throw (std::out_of_range);
+		void deallocate(size_t index, size_t size_in_blocks) noexcept;
 
 		/**
 		 * \brief Check whether the block is free
 		 * \param index Index of a block
 		 * \return True if block is free, false otherwise
-		 * \throw out_of_range Thrown when block index is out of range
+		 * \remarks Block index must be in range
 		 */
-		bool isFree(size_t index) const throw (std::out_of_range);
+		bool isFree(size_t index) const noexcept;
 
 		/**
 		 * \brief Get the index of a byte where the block's bit is located
 		 * \param index Index of the block
 		 * \return Index of a byte
-		 * \throw out_of_range Thrown when block index is out of range
 		 */
-		static size_t indexOfByte(size_t index) throw (std::out_of_range);
+		static size_t indexOfByte(size_t index) noexcept;
 
 		/**
 		 * \brief Get the mask (form -> 0*10*) of the blocks bit
 		 * \param index Index of the block
 		 * \return Mask with one bit set
-		 * \throw out_of_range Thrown when block index is out of range
 		 */
-		static byte mask(size_t index) throw (std::out_of_range);
+		static byte mask(size_t index) noexcept;
 
 		/**
 		 * \brief Set or reset a specific bit
 		 * \param index Index where the value should be inserted
 		 * \value Value which should be inserted
-		 * \throw out_of_range Thrown when index is out of range
+		 * \remarks Index must be in range
 		 */
-		void insertValue(size_t index, bool value) throw (std::out_of_range);
+		void insertValue(size_t index, bool value) noexcept;
 		
 		/**
 		 * \brief Set or reset a part of the bitmap
 		 * \param index Starting index
 		 * \param size_in_blocks Number of elements
 		 * \param value Value which is inserted (1 - set, 0 - reset)
-		 * \throw out_of_range Thrown when index is not in range
+		 * \remarks Indexes must be in range
 		 */
-		void insertValues(size_t index, size_t size_in_blocks, bool value) throw (std::out_of_range);
+		void insertValues(size_t index, size_t size_in_blocks, bool value) noexcept;
+	};
+
+	struct buddy_header_s;
+
+	/**
+	 * \brief One contiguous memory region managed by the buddy allocator
+	 *
+	 * The first blocks of the region hold its bitmaps and the table of block owners,
+	 * the rest of the region is the memory pool itself
+	 */
+	struct buddy_region_s {
+		Block *memory_;						/**< Pointer to the start of the memory pool of the region */
+		size_t number_of_blocks_;			/**< Number of blocks available in the pool of the region */
+		BitMapBlock *bitmaps_;				/**< Pointer to the array of bitmaps of the region */
+		size_t number_of_bitmaps_;			/**< Number of bitmap blocks used by the region */
+		const void **owners_;				/**< Table with the owner of each block of the pool, used for the slab lookup */
+		BuddyPool pool_;					/**< Pool whose free lists hold the blocks of the region */
+
+		/**
+		 * \brief Initialize the region, and insert its blocks into the lists of buddies
+		 * \param metadata Pointer to the blocks where the bitmaps and the owner table are kept
+		 * \param memory Pointer to the first block of the pool
+		 * \param size_in_blocks Number of blocks in the pool
+		 * \param pool Pool whose free lists hold the blocks of the region
+		 * \param header Header whose free lists get the blocks
+		 * \return True if the region was initialized, false if the size is too small
+		 */
+		bool initialize(Block *metadata, Block *memory, size_t size_in_blocks, BuddyPool pool, buddy_header_s &header) noexcept;
+
+		/**
+		 * \brief Calculate the number of blocks needed for the bitmaps and the owner table of the region
+		 * \param size_in_blocks Number of blocks in the region
+		 * \return Number of metadata blocks
+		 */
+		static size_t numOfMetadataBlocks(size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Calculate the number of blocks a region needs to hold a block of the given size
+		 * \param power 2^power is size in blocks
+		 * \return Number of blocks in the region
+		 */
+		static size_t regionSizeFor(size_t power) noexcept;
+
+		/**
+		 * \brief Mark a number of blocks as allocated or free in the bitmaps
+		 * \param block Pointer to the first block
+		 * \param size_in_blocks Number of blocks
+		 * \param value Value which is inserted (1 - allocated, 0 - free)
+		 * \remarks The region must be responsible for the blocks
+		 */
+		void mark(Block *block, size_t size_in_blocks, bool value) noexcept;
+
+		/**
+		 * \brief Calculate the index of bitmap where the information about the block is stored
+		 * \param block Pointer to the block
+		 * \remarks The region must be responsible for the block
+		 */
+		size_t indexOfBitmap(const Block *block) const noexcept;
+
+		/**
+		 * \brief Calculate the index of block inside the bitmap
+		 * \param block Pointer to the block
+		 * \remarks The region must be responsible for the block
+		 */
+		size_t indexInBitmap(const Block *block) const noexcept;
+
+		/**
+		 * \brief Get the left buddy of the block.
+		 * \param block Pointer to the block
+		 * \param power Block size
+		 * \return If the block itself is the left buddy, the block, left buddy otherwise
+		 * \remarks The region must be responsible for the block, the buddy may be out of its range
+		 */
+		Block *leftBuddy(Block *block, size_t power) const noexcept;
+
+		/**
+		 * \brief Get the right buddy of the block.
+		 * \param block Pointer to the block
+		 * \param power Block size
+		 * \return If the block itself is the right buddy, the block, right buddy otherwise
+		 * \remarks The region must be responsible for the block, the buddy may be out of its range
+		 */
+		Block *rightBuddy(Block *block, size_t power) const noexcept;
+
+		/**
+		 * \brief Check if the block is free
+		 * \param block Pointer to the block
+		 * \return True if block is free, false otherwise
+		 * \remarks The region must be responsible for the block
+		 */
+		bool isFree(const Block *block) const noexcept;
+
+		/**
+		 * \brief Check if the region is responsible for the block
+		 * \param block Pointer to the block
+		 * \return True if the block is in range, false otherwise
+		 */
+		bool isInRange(const void *block) const noexcept;
+
+		/**
+		 * \brief Get the start of the block where the passed memory is located
+		 * \param memory Pointer to the memory inside the region
+		 * \return Pointer to the block
+		 */
+		const Block *blockStart(const void *memory) const noexcept;
+
+		/**
+		 * \brief Get the reference to the owner entry of the block where the passed memory is located
+		 * \param memory Pointer to the memory inside the region
+		 * \return Reference to the owner entry
+		 */
+		const void *&owner(const void *memory) const noexcept;
+	};
+
+	/**
+	 * \brief Struct representing the free blocks of one size kept by one processor
+	 *
+	 * Kept blocks stay marked as allocated, so they do not merge with their buddies,
+	 * and they are linked through their info like the blocks in the free lists
+	 */
+	struct cpu_page_list_s {
+		std::atomic<bool> locked_;				/**< Lock held while the blocks are changed */
+		size_t count_;							/**< Number of blocks kept */
+		Block *blocks_;							/**< List of the kept blocks, the last freed one is first */
+
+		/**
+		 * \brief Initialize the list
+		 */
+		void initialize() noexcept;
+
+		/**
+		 * \brief Lock the list
+		 *
+		 * The lock is only contended when the thread is moved to another processor
+		 * in the middle of the operation, so spinning is cheaper than a mutex
+		 */
+		void lock() noexcept;
+
+		/**
+		 * \brief Unlock the list
+		 */
+		void unlock() noexcept;
+	};
+
+	/**
+	 * \brief Struct describing the contiguous reserve, kept in one block taken from the normal pool
+	 *
+	 * The reserve is one block of the normal pool, so its free blocks merge up to it and never with the blocks outside
+	 */
+	struct buddy_reserve_s {
+		Block *memory_;							/**< First block of the reserve */
+		size_t power_;							/**< Size of the reserve is 2^power blocks */
+		size_t min_power_;						/**< Smallest size of the allocations that may take the reserve back */
+		bool reclaiming_;						/**< True while an allocation empties a part of the reserve, nothing is lent meanwhile */
+		Block *pointers_[POWERS_OF_TWO];		/**< Roots of the trees of the free blocks of the reserve, for each size */
+
+		/**
+		 * \brief Check if the block is in the reserve
+		 * \param block Pointer to the block
+		 * \return True if the block is in the reserve, false otherwise
+		 */
+		bool contains(const void *block) const noexcept;
+	};
+
+	/**
+	 * \brief Struct with the lists of the hybrid policy, kept in one block taken from the normal pool when the policy is first set
+	 *
+	 * Free blocks of the sizes with the hybrid policy are both in the tree ordered by address and in these lists,
+	 * which keep them in the order of freeing
+	 */
+	struct buddy_recent_s {
+		Block *lists_[NUMBER_OF_POOLS][POWERS_OF_TWO];	/**< Heads of the lists, the block freed last first, for each pool and size */
 	};
 
+	static_assert(sizeof(buddy_recent_s) <= BLOCK_SIZE, "Lists of the hybrid policy must fit in one block");
+
 	/**
 	 * \brief Header needed by the buddy allocator
+	 *
+	 * Regions are kept in a two level table. The first level is the array of regions,
+	 * which is only appended to, so lookups do not need the lock. The second level is the
+	 * table of block owners kept inside each region.
+	 *
+	 * The regions read by the lookups, the mutex, and the free lists changed under it
+	 * start in separate cache lines, so allocating does not invalidate the lookups of other threads.
 	 */
-	struct buddy_header_s {
-		Block *pointers_[POWERS_OF_TWO];	/**< Array of pointers to the heads of the lists for each size */
-		size_t number_of_bitmaps_;			/**< Number of bitmap blocks used by the allocator */
-		BitMapBlock *bitmaps_;				/**< Pointer to the array of bitmaps used by the allocator */
-		Block *memory_;						/**< Pointer to the start of the memory pool available for the allocator */
-		size_t number_of_blocks_;			/**< Number of blocks available in the pool */
-		std::mutex mutex_;					/**< Mutex used for mutual exclusion */
+	struct alignas(CACHE_L1_LINE_SIZE) buddy_header_s {
+		static const size_t MAX_REGIONS = 32; /**< Maximal number of regions the buddy allocator can manage */
+		static const size_t CPU_PAGE_POWERS = 4; /**< Sizes of the normal pool kept by the processors, from one block to 2^(CPU_PAGE_POWERS - 1) */
+		static const size_t DEFAULT_CPU_HIGH = 64; /**< Default number of blocks of each size a processor keeps at most */
+		static const size_t DEFAULT_CPU_BATCH = 16; /**< Default number of blocks of each size moved to or from a processor at once */
+		static const long long NO_PURGE_DUE = 0x7fffffffffffffffLL; /**< Due time of the empty purge list */
+
+		/**
+		 * \brief Lists of the free blocks kept by one processor
+		 */
+		struct cpu_pages_s {
+			cpu_page_list_s lists_[CPU_PAGE_POWERS];
+		};
+
+		static const size_t MAX_CPUS = BLOCK_SIZE / sizeof(std::atomic<cpu_pages_s *>);
+
+		buddy_region_s regions_[MAX_REGIONS];	/**< Array of regions managed by the allocator */
+		std::atomic<size_t> number_of_regions_;	/**< Number of regions in use */
+
+		std::atomic<std::atomic<cpu_pages_s *> *> cpus_;	/**< Block with the pointers to the lists of each processor, allocated on the first use */
+		size_t number_of_cpus_;					/**< Number of processors with their own lists */
+		std::atomic<size_t> cpu_high_;			/**< Number of blocks of each size a processor keeps at most, 0 if the processors keep none */
+		std::atomic<size_t> cpu_batch_;			/**< Number of blocks of each size moved to or from a processor at once */
+		std::atomic<size_t> cpu_powers_;		/**< Bit for each size the processors keep, sizes with the free lists sorted by address are not kept */
+
+		std::atomic<buddy_reserve_s *> reserve_;	/**< Contiguous reserve, or nullptr if there is none */
+
+		alignas(CACHE_L1_LINE_SIZE) std::mutex mutex_;	/**< Mutex used for mutual exclusion */
+
+		alignas(CACHE_L1_LINE_SIZE) Block *pointers_[NUMBER_OF_POOLS][POWERS_OF_TWO];	/**< Array of pointers to the heads of the lists, or the roots of the trees, for each pool and size */
+		size_t auto_grow_blocks_;				/**< Minimal size of a region mapped on exhaustion, 0 if the allocator does not grow */
+		bool explicit_huge_pages_;				/**< True if huge page regions are mapped with explicit huge pages */
+		size_t mapped_regions_;					/**< Bit for each region whose pool the allocator mapped as private anonymous memory, which reads as zeros once purged */
+
+		size_t purge_power_;					/**< Blocks of this size and greater are purged, \c POWERS_OF_TWO if purging is disabled */
+		long long purge_decay_;					/**< Time in milliseconds a block must stay free before it is purged */
+		bool purge_lazy_;						/**< True if pages are reclaimed lazily */
+		Block *purge_first_;					/**< Oldest block waiting to be purged */
+		Block *purge_last_;						/**< Newest block waiting to be purged */
+		std::atomic<long long> purge_due_;		/**< Time in milliseconds when the oldest block in the purge list is due, \c NO_PURGE_DUE if the list is empty */
+
+		FreeListPolicy policies_[POWERS_OF_TWO];				/**< Policy of the free lists of each size */
+		buddy_recent_s *recent_;								/**< Lists of the hybrid policy, or nullptr until the policy is first set */
 
 		/**
 		 * \brief Initialize the struct
 		 * \param first_block Pointer to the first block available to the buddy allocator
 		 * \param size_in_blocks Number of blocks available to the buddy allocator
-		 * \throw invalid_argument Thrown when size is too small
+		 * \return True if the struct was initialized, false if the size is too small
 		 */
-		void initialize(Block *first_block, size_t size_in_blocks) throw (std::invalid_argument);
+		bool initialize(Block *first_block, size_t size_in_blocks) noexcept;
 
 		/**
 		 * \brief Initialize pointers to the lists of buddies
@@ -210,11 +585,270 @@ namespace os2bn140314d {
 		void initializePointers() noexcept;
 
 		/**
-		 * \brief Initialize the bitmaps
-		 * \param first_block Pointer to the first block available to the buddy allocator
-		 * \param size_in_blocks Number of blocks available to the buddy allocator
+		 * \brief Add one more region to the allocator
+		 * \param first_block Pointer to the first block of the region
+		 * \param size_in_blocks Number of blocks in the region
+		 * \param mapped True if the allocator mapped the region itself, false if the memory was given by the user
+		 * \return True if the region was added, false if the size is too small or there is no more space in the region table
+		 * \remarks Mutex should be locked by the caller
+		 */
+		bool addRegion(Block *first_block, size_t size_in_blocks, bool mapped = false) noexcept;
+
+		/**
+		 * \brief Add one more huge page aligned region to the allocator
+		 * \param first_block Pointer to the first block of the region
+		 * \param size_in_blocks Number of blocks in the region
+		 * \return True if the region was added, false if the size is too small or there is no more space in the region table
+		 * \remarks Mutex should be locked by the caller
+		 */
+		bool addHugeRegion(Block *first_block, size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Add one more region to the allocator, with the metadata kept separately from the pool
+		 * \param metadata Pointer to the blocks where the bitmaps and the owner table are kept
+		 * \param memory Pointer to the first block of the pool
+		 * \param size_in_blocks Number of blocks in the pool
+		 * \param pool Pool whose free lists hold the blocks of the region
+		 * \param mapped True if the allocator mapped the pool itself, false if the memory was given by the user
+		 * \return True if the region was added, false if the size is too small or there is no more space in the region table
+		 * \remarks Mutex should be locked by the caller
+		 */
+		bool addRegion(Block *metadata, Block *memory, size_t size_in_blocks, BuddyPool pool, bool mapped) noexcept;
+
+		/**
+		 * \brief Map a new region from the operating system, big enough for the block of the given size
+		 * \param power 2^power is size in blocks
+		 * \param pool Pool which the region is added to
+		 * \return True if the region was added, false otherwise
+		 * \remarks Mutex should be locked by the caller
+		 */
+		bool grow(size_t power, BuddyPool pool) noexcept;
+
+		/**
+		 * \brief Map a new huge page region from the operating system, with the metadata mapped separately
+		 * \param size_in_blocks Number of blocks in the pool of the region, multiple of the huge page size
+		 * \return True if the region was added, false otherwise
+		 * \remarks Mutex should be locked by the caller
+		 */
+		bool mapHugeRegion(size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Insert a free block into the list of buddies, and into the purge list if it is big enough
+		 * \param pool Pool whose free list holds the block
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \param state Purge state of the block
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void insertFree(BuddyPool pool, Block *block, size_t power, PurgeState state) noexcept;
+
+		/**
+		 * \brief Remove a specific free block from the list of buddies, and from the purge list
+		 * \param pool Pool whose free list holds the block
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void removeFree(BuddyPool pool, Block *block, size_t power) noexcept;
+
+		/**
+		 * \brief Put a free block into the list of buddies, in the place its policy gives it
+		 * \param pool Pool whose free list holds the block
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void linkFree(BuddyPool pool, Block *block, size_t power) noexcept;
+
+		/**
+		 * \brief Take a specific free block out of the list of buddies
+		 * \param pool Pool whose free list holds the block
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void unlinkFree(BuddyPool pool, Block *block, size_t power) noexcept;
+
+		/**
+		 * \brief Get the free block that the policy allocates next
+		 * \param pool Pool whose free list holds the block
+		 * \param power 2^power is size in blocks
+		 * \param long_lived True if the block is kept for long, which the hybrid policy places at the lowest address
+		 * \return Pointer to the block, or nullptr if there are no free blocks of that size
+		 * \remarks Mutex should be locked by the caller
 		 */
-		void initializeBitmaps(Block *first_block, size_t size_in_blocks) noexcept;
+		Block *firstFree(BuddyPool pool, size_t power, bool long_lived = false) const noexcept;
+
+		/**
+		 * \brief Take a free block out of the lists, splitting a bigger one if needed
+		 * \param power 2^power is size in blocks
+		 * \param pool Pool from which the block is taken
+		 * \param zeroed Set to true if the block is known to be filled with zeros, false otherwise
+		 * \param long_lived True if the block is kept for long, which the hybrid policy places at the lowest address
+		 * \return Pointer to the block marked as allocated, or nullptr if there is not enough memory
+		 * \remarks Mutex should be locked by the caller
+		 */
+		Block *takeFree(size_t power, BuddyPool pool, bool &zeroed, bool long_lived = false) noexcept;
+
+		/**
+		 * \brief Return the allocated block to the lists, merging it with its free buddies
+		 * \param region Region of the block
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void giveFree(buddy_region_s *region, Block *block, size_t power) noexcept;
+
+		/**
+		 * \brief Get the root of the free list of the pool and size
+		 * \param pool Pool whose free list is returned, the reserve included
+		 * \param power 2^power is size in blocks
+		 * \return Reference to the head of the list, or the root of the tree
+		 * \remarks Mutex should be locked by the caller, and the reserve must exist for \c RESERVE_POOL
+		 */
+		Block *&freeRoot(BuddyPool pool, size_t power) noexcept;
+
+		/**
+		 * \brief Get the root of the free list of the pool and size
+		 * \param pool Pool whose free list is returned, the reserve included
+		 * \param power 2^power is size in blocks
+		 * \return Head of the list, or the root of the tree
+		 * \remarks Mutex should be locked by the caller, and the reserve must exist for \c RESERVE_POOL
+		 */
+		Block *freeRoot(BuddyPool pool, size_t power) const noexcept;
+
+		/**
+		 * \brief Get the policy of the free list of the pool and size
+		 * \param pool Pool of the free list
+		 * \param power 2^power is size in blocks
+		 * \return Policy set for the size, the reserve is always sorted by address
+		 */
+		FreeListPolicy policyOf(BuddyPool pool, size_t power) const noexcept;
+
+		/**
+		 * \brief Get the pool whose free lists hold the block when it is free
+		 * \param region Region of the block
+		 * \param block Pointer to the block
+		 * \return \c RESERVE_POOL if the block is in the reserve, the pool of the region otherwise
+		 */
+		BuddyPool poolOf(const buddy_region_s *region, const Block *block) const noexcept;
+
+		/**
+		 * \brief Take a free block for a movable allocation, from the reserve if it lends, from the normal pool otherwise
+		 * \param power 2^power is size in blocks
+		 * \param zeroed Set to true if the block is known to be filled with zeros, false otherwise
+		 * \return Pointer to the block marked as allocated, or nullptr if there is not enough memory
+		 * \remarks Mutex should be locked by the caller
+		 */
+		Block *borrowFree(size_t power, bool &zeroed) noexcept;
+
+		/**
+		 * \brief Take a block from the reserve for an allocation the normal pool could not serve
+		 * \param power 2^power is size in blocks
+		 * \param zeroed Set to true if the block is known to be filled with zeros, false otherwise
+		 * \return Pointer to the block marked as allocated, or nullptr if there is no reserve, the size may not take it back,
+		 * or the borrowed blocks could not be moved out
+		 * \remarks No lock of the allocator may be held by the caller, the slabs are moved with the locks of the slab header and their caches
+		 *
+		 * A free block of the reserve is taken if there is one. Otherwise the part of the size with the fewest borrowed blocks
+		 * is emptied, while the reserve lends nothing, so the moved objects land in the normal pool.
+		 * One part is emptied at a time, the allocations made meanwhile only take the free blocks
+		 */
+		Block *reclaim(size_t power, bool &zeroed) noexcept;
+
+		/**
+		 * \brief Get the lists of the processor the calling thread is running on
+		 * \return Pointer to the lists, or nullptr if the processors keep no blocks, or there is no memory for the lists
+		 *
+		 * The lists are allocated on their first use, so the memory grows with the number of processors
+		 */
+		cpu_pages_s *cpuPages() noexcept;
+
+		/**
+		 * \brief Allocate a block from the list of the processor, refilling it with a batch if it is empty
+		 * \param power 2^power is size in blocks, less than \c CPU_PAGE_POWERS
+		 * \return Pointer to the block, or nullptr if the processors keep no blocks or there is not enough memory
+		 */
+		Block *allocateCached(size_t power) noexcept;
+
+		/**
+		 * \brief Keep the freed block in the list of the processor, returning a batch if the list is full
+		 * \param block Pointer to the block, from the normal pool
+		 * \param power 2^power is size in blocks, less than \c CPU_PAGE_POWERS
+		 * \return True if the block is kept, false if the processors keep no blocks of that size
+		 */
+		bool deallocateCached(Block *block, size_t power) noexcept;
+
+		/**
+		 * \brief Return the blocks kept by all processors to the lists
+		 * \return Number of returned blocks
+		 * \remarks Mutex must not be locked by the caller
+		 */
+		size_t drainCached() noexcept;
+
+		/**
+		 * \brief Lock the lists of all processors and the mutex, so no block changes its state
+		 */
+		void lockAll() noexcept;
+
+		/**
+		 * \brief Unlock everything locked by \c lockAll
+		 */
+		void unlockAll() noexcept;
+
+		/**
+		 * \brief Initialize the mutex again, when the header is mapped in a new process
+		 *
+		 * Lists of the processors are unlocked in a detached pool, and are kept with their blocks
+		 */
+		void reattach() noexcept;
+
+		/**
+		 * \brief Count the free blocks of one size
+		 * \param pool Pool whose free list holds the blocks
+		 * \param power 2^power is size in blocks
+		 * \return Number of free blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		size_t countFree(BuddyPool pool, size_t power) const noexcept;
+
+		/**
+		 * \brief Remove the block from the purge list, if it is there
+		 * \param block Pointer to the block
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void dequeuePurge(Block *block) noexcept;
+
+		/**
+		 * \brief Purge the blocks whose decay interval has passed
+		 * \param force True if all the blocks in the purge list should be purged
+		 * \return Number of purged blocks
+		 * \remarks Mutex should be locked by the caller
+		 */
+		size_t purgeExpired(bool force) noexcept;
+
+		/**
+		 * \brief Update the time when the oldest block in the purge list is due
+		 * \remarks Mutex should be locked by the caller
+		 */
+		void updatePurgeDue() noexcept;
+
+		/**
+		 * \brief Calculate the page aligned part of the block that can be purged
+		 * \param block Pointer to the block
+		 * \param power 2^power is size in blocks
+		 * \param begin Set to the start of the range
+		 * \param end Set to the end of the range
+		 *
+		 * The first block is never purged, because it holds the information about the free block
+		 */
+		static void purgeRange(Block *block, size_t power, byte *&begin, byte *&end) noexcept;
+
+		/**
+		 * \brief Get the current time used for the purge decay
+		 * \return Time in milliseconds
+		 */
+		static long long now() noexcept;
 
 		/**
 		 * \brief Calculate the number of bitmaps needed for the given number of blocks
@@ -224,53 +858,43 @@ namespace os2bn140314d {
 		static size_t numOfBitmaps(size_t size_in_blocks) noexcept;
 
 		/**
-		 * \brief Calculate the index of bitmap where the information about the block is stored
-		 * \param block Pointer to the block
-		 * \throw invalid_argument Thrown when buddy is not responsible for the given block
+		 * \brief Find the region responsible for the memory
+		 * \param memory Pointer to the memory
+		 * \return Pointer to the region, or nullptr if no region is responsible for the memory
 		 */
-		size_t indexOfBitmap(Block *block) const throw (std::invalid_argument);
+		buddy_region_s *regionOf(const void *memory) noexcept;
 
 		/**
-		 * \brief Calculate the index of block inside the bitmap
+		 * \brief Calculate the index of bitmap where the information about the block is stored
 		 * \param block Pointer to the block
-		 * \throw invalid_argument Thrown when buddy is not responsible for the given block
+		 * \return Index of the bitmap, or \c NULL_INDEX if buddy is not responsible for the given block
 		 */
-		size_t indexInBitmap(Block *block) const throw (std::invalid_argument);
+		size_t indexOfBitmap(Block *block) noexcept;
 
 		/**
-		 * \brief Get the left buddy of the block.
+		 * \brief Calculate the index of block inside the bitmap
 		 * \param block Pointer to the block
-		 * \param power Block size
-		 * \return If the block itself is the left buddy, the block, left buddy otherwise
-		 * \throw invalid_argument Thrown when buddy is not responsible for the given block
+		 * \return Index inside the bitmap, or \c NULL_INDEX if buddy is not responsible for the given block
 		 */
-		Block *leftBuddy(Block *block, size_t power) const throw (std::invalid_argument);
-
-		/**
-		* \brief Get the right buddy of the block.
-		* \param block Pointer to the block
-		* \param power Block size
-		* \return If the block itself is the right buddy, the block, right buddy otherwise
-		* \throw invalid_argument Thrown when buddy is not responsible for the given block
-		*/
-		Block *rightBuddy(Block *block, size_t power) const throw (std::invalid_argument);
+		size_t indexInBitmap(Block *block) noexcept;
 
 		/**
 		 * \brief Check if the block is free
 		 * \param block Pointer to the block
-		 * \return True if block is free, false otherwise
-		 * \throw invalid_argument Thrown when buddy is not responsible for the given block
+		 * \return True if block is free, false otherwise, or if buddy is not responsible for the given block
 		 */
-		bool isFree(Block *block) const throw (std::invalid_argument);
+		bool isFree(Block *block) noexcept;
 
 		/**
 		 * \brief Check if buddy is responsible for the block
 		 * \param block Pointer to the block
 		 * \return True if the block is in range, false otherwise
 		 */
-		bool isInRange(Block *block) const noexcept;
+		bool isInRange(Block *block) noexcept;
 	};
 
+	static_assert(buddy_header_s::MAX_REGIONS <= sizeof(size_t) * BITS_IN_BYTE, "Each region must have its bit in the mask of the mapped regions");
+
 	#pragma endregion 
 }
 
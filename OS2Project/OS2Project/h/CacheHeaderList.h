@@ -6,8 +6,6 @@
 #ifndef _cacheheaderlist_h_
 #define _cacheheaderlist_h_
 
-#include <stdexcept> // underflow_error
-
 namespace os2bn140314d {
 
 	struct cache_header_s;
@@ -31,9 +29,9 @@ namespace os2bn140314d {
 
 		/**
 		 * \brief Remove first element from the list
-		 * \return Pointer to the first element
+		 * \return Pointer to the first element, or nullptr if the list is empty
 		 */
-		cache_header_s *remove() throw (std::underflow_error);
+		cache_header_s *remove() noexcept;
 
 		/**
 		 * \brief Checks if list is empty
@@ -41,6 +39,14 @@ namespace os2bn140314d {
 		 */
 		bool isEmpty() const noexcept;
 
+		/**
+		 * \brief Get the first element of the list
+		 * \return Pointer to the first element, or nullptr if the list is empty
+		 *
+		 * The rest of the list is reached through the \c next_ field of the elements
+		 */
+		cache_header_s *first() const noexcept;
+
 	private:
 		cache_header_s *first_ = nullptr;
 	};
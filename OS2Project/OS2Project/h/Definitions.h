@@ -17,16 +17,38 @@ namespace os2bn140314d {
 
 	const size_t ENTRIES_IN_BITMAP = BLOCK_SIZE * BITS_IN_BYTE;
 
+	const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	const size_t BLOCKS_IN_HUGE_PAGE = HUGE_PAGE_SIZE / BLOCK_SIZE;
+
+	const size_t ENTRIES_IN_OWNER_TABLE = BLOCK_SIZE / sizeof(void *);
+
 	const size_t MAX_NAME_LENGTH = 256;
 
 	const size_t NULL_INDEX = ~static_cast<size_t>(0);
 
 	union Block;
 
+	/**
+	 * \brief State of a free block in regard to returning its memory to the operating system
+	 */
+	enum PurgeState : unsigned char {
+		RESIDENT = 0,	/**< Memory of the block is resident */
+		PENDING = 1,	/**< Block is waiting in the purge list for its decay interval to pass */
+		PURGED = 2,		/**< Memory of the block was returned, and it reads as zeros */
+		DISCARDED = 3	/**< Memory of the block was returned lazily, its contents are undefined */
+	};
+
 	struct BlockInfo {
 		Block *next;
 		Block *prev;
+		Block *left;
+		Block *right;
 		size_t index;
+
+		Block *purge_next;
+		Block *purge_prev;
+		long long freed_at;
+		PurgeState purge_state;
 	};
 
 	union Block {
@@ -38,7 +60,8 @@ namespace os2bn140314d {
 		OK = 0,
 		NO_MORE_SPACE = 1,
 		DESTROYING_NON_EMPTY_CACHE = 2,
-		DEALLOCATING_WRONG_OBJECT = 4
+		DEALLOCATING_WRONG_OBJECT = 4,
+		DEALLOCATING_FREE_OBJECT = 8
 	};
 	
 	inline AllocatorError operator|(const AllocatorError &lhs, const AllocatorError &rhs) {
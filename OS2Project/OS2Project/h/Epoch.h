@@ -0,0 +1,239 @@
+/**
+* \file Epoch.h
+* \brief File providing the epoch based reclamation of the deferred objects
+*/
+
+#ifndef _epoch_h_
+#define _epoch_h_
+
+#include <atomic> // atomic
+#include "Definitions.h" // BLOCK_SIZE
+
+namespace os2bn140314d {
+
+	struct cache_header_s;
+
+	/**
+	 * \brief Struct representing one object waiting to be returned to its cache
+	 */
+	struct deferred_object_s {
+		cache_header_s *cache_;					/**< Cache of the object */
+		void *object_;							/**< Pointer to the object */
+	};
+
+	/**
+	 * \brief Struct representing one block of the deferred objects
+	 */
+	struct deferred_batch_s {
+		static const size_t CAPACITY = (BLOCK_SIZE - 2 * sizeof(size_t)) / sizeof(deferred_object_s);
+
+		deferred_batch_s *next_;				/**< Pointer to the next batch of the same epoch */
+		size_t count_;							/**< Number of objects in the batch */
+		deferred_object_s objects_[CAPACITY];	/**< Deferred objects */
+	};
+
+	static_assert(sizeof(deferred_batch_s) <= BLOCK_SIZE, "Deferred batch must fit in one block");
+
+	/**
+	 * \brief Struct representing the objects deferred by one thread during one epoch
+	 */
+	struct epoch_bag_s {
+		size_t epoch_;							/**< Epoch in which the objects were deferred */
+		deferred_batch_s *batches_;				/**< List of the batches, the first one is being filled */
+	};
+
+	/**
+	 * \brief Struct representing one thread taking part in the reclamation
+	 *
+	 * The state read by the threads advancing the epoch is apart from the deferred objects,
+	 * which are only locked by the owner and by \c Epoch::barrier
+	 */
+	struct alignas(CACHE_L1_LINE_SIZE) epoch_record_s {
+		static const size_t ACTIVE = 1;			/**< Flag of the state, set while the thread is in a critical section */
+		static const size_t EPOCHS = 3;			/**< Number of bags, one for each epoch that may still be read */
+
+		#pragma region Fields
+
+		std::atomic<size_t> state_;				/**< Epoch observed by the thread shifted by one, with the \c ACTIVE flag */
+		size_t nesting_;						/**< Depth of the nested critical sections of the thread */
+		epoch_record_s *next_;					/**< Pointer to the next record, never changed once the record is published */
+		std::atomic<bool> used_;				/**< True if a thread owns the record */
+
+		alignas(CACHE_L1_LINE_SIZE) std::atomic<bool> locked_;	/**< Lock held while the bags are changed */
+		epoch_bag_s bags_[EPOCHS];				/**< Deferred objects, indexed by their epoch modulo \c EPOCHS */
+
+		#pragma endregion
+
+		#pragma region Methods
+
+		/**
+		 * \brief Initialize the record owned by the calling thread
+		 */
+		void initialize() noexcept;
+
+		/**
+		 * \brief Lock the bags
+		 *
+		 * The lock is only contended while a barrier collects the objects of the thread
+		 */
+		void lock() noexcept;
+
+		/**
+		 * \brief Unlock the bags
+		 */
+		void unlock() noexcept;
+
+		/**
+		 * \brief Take the batches of all bags whose grace period has passed
+		 * \param epoch Current global epoch
+		 * \param taken List where the batches are moved
+		 * \remarks Bags must be locked
+		 */
+		void collect(size_t epoch, deferred_batch_s *&taken) noexcept;
+
+		#pragma endregion
+	};
+
+	/**
+	 * \brief Utility class reclaiming the deferred objects once no reader can hold them
+	 *
+	 * Readers announce the global epoch when they enter the outermost critical section, and clear it
+	 * when they leave. The epoch advances only when every reader in a critical section has announced
+	 * the current one, so an object deferred in some epoch can not be reached by any reader
+	 * once the epoch is two greater. Deferred objects are kept per thread in blocks, one list of blocks
+	 * for each epoch, and whole lists are returned to their slabs with the batch deallocation.
+	 * Records of the exited threads keep their objects, they are taken over by the next thread
+	 * that registers, or released by a barrier.
+	 */
+	class Epoch final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Enter the critical section of the calling thread
+		 *
+		 * Critical sections can be nested, only the outermost one announces the epoch
+		 */
+		static void enter() noexcept {
+			auto record = local();
+
+			if (record->nesting_++ == 0) {
+				record->state_.store((global_.load(std::memory_order_relaxed) << 1) | epoch_record_s::ACTIVE, std::memory_order_relaxed);
+
+				// Announcement must be visible before the reader loads any protected pointer
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+
+		/**
+		 * \brief Leave the critical section of the calling thread
+		 * \remarks Thread must be in a critical section
+		 */
+		static void leave() noexcept {
+			auto record = record_;
+
+			if (--record->nesting_ == 0) {
+				record->state_.store(0, std::memory_order_release);
+			}
+		}
+
+		/**
+		 * \brief Return the object to its cache once no reader can hold it
+		 * \param cache Pointer to the cache
+		 * \param object Pointer to the object
+		 *
+		 * Every \c ADVANCE_INTERVAL objects, and when a block of them fills up, the thread tries to advance
+		 * the epoch, and releases the objects whose grace period has passed. If no block for the object can be allocated,
+		 * a thread outside of a critical section waits for the grace period and frees the object,
+		 * while inside of one the object stays allocated and the error bit of the cache is set
+		 */
+		static void defer(cache_header_s *cache, void *object) noexcept;
+
+		/**
+		 * \brief Wait for the grace period and release the objects deferred by all threads
+		 * \return Number of released objects, or -1 if the calling thread is in a critical section
+		 */
+		static long long barrier() noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Get the record of the calling thread
+		 * \return Pointer to the record
+		 */
+		static epoch_record_s *local() noexcept {
+			return record_ != nullptr ? record_ : acquire();
+		}
+
+		/**
+		 * \brief Take a free record, or allocate a new one, for the calling thread
+		 * \return Pointer to the record
+		 *
+		 * Readers can not be protected without a record, so the program is aborted if there is no memory for it
+		 */
+		static epoch_record_s *acquire() noexcept;
+
+		/**
+		 * \brief Advance the global epoch if every reader in a critical section has announced it
+		 * \return True if the epoch was advanced, by this thread or another one, false otherwise
+		 */
+		static bool advance() noexcept;
+
+		/**
+		 * \brief Wait until the global epoch is at least the given one
+		 * \param epoch Epoch to wait for
+		 * \remarks Calling thread must not be in a critical section
+		 */
+		static void waitFor(size_t epoch) noexcept;
+
+		/**
+		 * \brief Add the object to the bag
+		 * \param bag Reference to the bag
+		 * \param cache Pointer to the cache
+		 * \param object Pointer to the object
+		 * \return True if the object was added, false if there is no memory for another batch
+		 * \remarks Bags must be locked
+		 */
+		static bool push(epoch_bag_s &bag, cache_header_s *cache, void *object) noexcept;
+
+		/**
+		 * \brief Return the objects of the batches to their caches, and deallocate the batches
+		 * \param batches List of the batches
+		 * \return Number of released objects
+		 *
+		 * Consecutive objects of the same cache are returned with one batch deallocation
+		 */
+		static size_t release(deferred_batch_s *batches) noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		static const size_t ADVANCE_INTERVAL = 32;			/**< Number of objects deferred by a thread between two attempts to advance the epoch */
+		static const size_t RELEASE_RUN = 64;				/**< Maximum number of objects returned with one batch deallocation */
+
+		static thread_local epoch_record_s *record_;		/**< Record of the calling thread, or nullptr before its first use */
+
+		static std::atomic<size_t> global_;					/**< Global epoch */
+		static std::atomic<epoch_record_s *> records_;		/**< List of all records */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		Epoch() = delete;
+		Epoch(const Epoch &) = delete;
+		void operator=(const Epoch &) = delete;
+
+		#pragma endregion
+
+		friend struct epoch_owner_s;
+	};
+}
+
+#endif
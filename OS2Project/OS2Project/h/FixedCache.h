@@ -0,0 +1,266 @@
+/**
+* \file FixedCache.h
+* \brief File providing the typed object caches whose layout is known at compile time
+*/
+
+#ifndef _fixedcache_h_
+#define _fixedcache_h_
+
+#include <memory> // unique_ptr
+#include <new> // placement new
+#include <utility> // forward
+#include "SlabStructs.h" // cache_header_s, slab_s
+#include "SlabUtility.h" // Slab
+#include "GuardedPool.h" // GuardedPool
+#include "HeapProfiler.h" // HeapProfiler
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct computing the slab layout of the typed cache, the same way \c cache_header_s::initilaze does
+	 * \tparam T Type of the objects
+	 * \tparam Align Alignment of the objects, at most one cache line
+	 */
+	template <typename T, size_t Align>
+	struct fixed_layout_s {
+		#pragma region Helpers
+
+		/**
+		 * \brief Round the size up to the multiple of the alignment
+		 */
+		static constexpr size_t roundUp(size_t size, size_t alignment) noexcept {
+			return (size + alignment - 1) / alignment * alignment;
+		}
+
+		/**
+		 * \brief Get the smallest power of two that is not less than the size
+		 */
+		static constexpr size_t powerOfTwo(size_t size, size_t power = 1) noexcept {
+			return power >= size ? power : powerOfTwo(size, power << 1);
+		}
+
+		/**
+		 * \brief Get the greater of the two sizes
+		 */
+		static constexpr size_t greater(size_t lhs, size_t rhs) noexcept {
+			return lhs > rhs ? lhs : rhs;
+		}
+
+		#pragma endregion
+
+		#pragma region Layout
+
+		static constexpr size_t ALIGNMENT = greater(Align, alignof(T));											/**< Alignment of the objects */
+		static constexpr unsigned FLAGS = ALIGNMENT > sizeof(size_t) ? KMEM_CACHE_HWALIGN : 0;					/**< Flags of the cache, the slab already aligns to the index size */
+		static constexpr size_t OBJECT_SIZE = roundUp(sizeof(T), FLAGS != 0 ? CACHE_L1_LINE_SIZE : ALIGNMENT);	/**< Distance between two objects */
+		static constexpr size_t PADDING = FLAGS != 0 ? CACHE_L1_LINE_SIZE : 0;									/**< Space reserved for aligning the first object */
+		static constexpr size_t INDEX_SIZE = sizeof(size_t);													/**< Size of one element indexing the slab */
+		static constexpr size_t SLAB_SIZE = greater(BLOCK_SIZE, powerOfTwo(OBJECT_SIZE + PADDING + INDEX_SIZE + sizeof(slab_s)));	/**< Size of one slab in bytes */
+		static constexpr size_t AVAILABLE = SLAB_SIZE - sizeof(slab_s) - PADDING;								/**< Space for the objects and the index */
+		static constexpr size_t OBJECTS_IN_SLAB = AVAILABLE / (OBJECT_SIZE + INDEX_SIZE) < slab_s::FREELIST_END
+			? AVAILABLE / (OBJECT_SIZE + INDEX_SIZE) : slab_s::FREELIST_END;									/**< Number of objects in one slab */
+		static constexpr size_t UNUSED_SPACE = AVAILABLE % (OBJECT_SIZE + INDEX_SIZE);							/**< Space left for coloring the slabs */
+		static constexpr size_t COLORS = UNUSED_SPACE / CACHE_L1_LINE_SIZE + 1;									/**< Number of different offsets of the first object */
+
+		#pragma endregion
+
+		static_assert((Align & (Align - 1)) == 0 && ALIGNMENT <= CACHE_L1_LINE_SIZE, "Alignment must be a power of two, at most one cache line");
+		static_assert(OBJECTS_IN_SLAB > 0, "At least one object must fit in the slab");
+	};
+
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::ALIGNMENT;
+	template <typename T, size_t Align> constexpr unsigned fixed_layout_s<T, Align>::FLAGS;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::OBJECT_SIZE;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::PADDING;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::INDEX_SIZE;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::SLAB_SIZE;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::AVAILABLE;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::OBJECTS_IN_SLAB;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::UNUSED_SPACE;
+	template <typename T, size_t Align> constexpr size_t fixed_layout_s<T, Align>::COLORS;
+
+	/**
+	 * \brief Cache of the objects of one type, kept in the slabs of an ordinary cache
+	 * \tparam T Type of the objects
+	 * \tparam Align Alignment of the objects, at most one cache line
+	 *
+	 * Objects are constructed with the arguments of \c allocate and destroyed when their pointer releases them,
+	 * both calls are inlined. The pointer remembers the slab of its object, so freeing it needs no lookup,
+	 * and the index of the object is found by dividing with the constant object size.
+	 * Unlike the constructor of an ordinary cache, the constructor of \c T runs on every allocation.
+	 */
+	template <typename T, size_t Align = alignof(T)>
+	class FixedCache final {
+	public:
+
+		typedef fixed_layout_s<T, Align> Layout;
+
+		/**
+		 * \brief Deleter of the owning pointers, returning the object straight to its slab
+		 */
+		class Deleter {
+		public:
+
+			/**
+			 * \brief Create the deleter of the empty pointer
+			 */
+			Deleter() noexcept : cache_(nullptr), slab_(nullptr) {}
+
+			/**
+			 * \brief Destroy the object and return it to its slab
+			 * \param object Pointer to the object
+			 */
+			void operator()(T *object) const noexcept {
+				object->~T();
+				FixedCache::release(cache_, slab_, object);
+			}
+
+		private:
+
+			Deleter(cache_header_s *cache, slab_s *slab) noexcept : cache_(cache), slab_(slab) {}
+
+			cache_header_s *cache_;		/**< Cache of the object */
+			slab_s *slab_;				/**< Slab of the object, or nullptr if the object is served from the guarded pool */
+
+			friend class FixedCache;
+		};
+
+		/**
+		 * \brief Pointer owning one object of the cache
+		 */
+		typedef std::unique_ptr<T, Deleter> Pointer;
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Create the cache
+		 * \param name Name of the cache
+		 * \remarks If there is no space for the cache, \c valid returns false and every allocation fails
+		 */
+		explicit FixedCache(const char name[]) noexcept
+			: cache_(Slab::create(name, Layout::OBJECT_SIZE, nullptr, nullptr, Layout::FLAGS)) {}
+
+		/**
+		 * \brief Destroy the cache
+		 * \remarks All the pointers of the cache must be released before
+		 */
+		~FixedCache() {
+			if (cache_ != nullptr) {
+				Slab::destroy(cache_);
+			}
+		}
+
+		/**
+		 * \brief Check if the cache was created
+		 * \return True if the cache can allocate, false otherwise
+		 */
+		bool valid() const noexcept {
+			return cache_ != nullptr;
+		}
+
+		/**
+		 * \brief Allocate one object and construct it
+		 * \param args Arguments forwarded to the constructor of \c T
+		 * \return Pointer owning the object, or the empty one if there is no more space
+		 * \remarks If the constructor throws, the memory is returned before the exception is passed on
+		 */
+		template <typename... Args>
+		Pointer allocate(Args &&...args) {
+			if (cache_ == nullptr) {
+				return Pointer();
+			}
+
+			slab_s *slab = nullptr;
+			void *memory = nullptr;
+
+			// Guarded pool serves only the objects that need no more than its alignment
+			if (Layout::ALIGNMENT <= GuardedPool::OBJECT_ALIGNMENT && GuardedPool::sample()) {
+				memory = GuardedPool::allocate(Layout::OBJECT_SIZE, cache_);
+			}
+
+			if (memory == nullptr) {
+				memory = cache_->allocate(slab);
+			}
+
+			if (memory == nullptr) {
+				return Pointer();
+			}
+
+			if (HeapProfiler::sample(Layout::OBJECT_SIZE)) {
+				HeapProfiler::record(memory, Layout::OBJECT_SIZE);
+			}
+
+			T *object;
+
+			try {
+				object = new (memory) T(std::forward<Args>(args)...);
+			}
+			catch (...) {
+				release(cache_, slab, memory);
+				throw;
+			}
+
+			return Pointer(object, Deleter(cache_, slab));
+		}
+
+		/**
+		 * \brief Shrink the cache
+		 * \return Number of deallocated blocks
+		 */
+		int shrink() noexcept {
+			return cache_ == nullptr ? 0 : Slab::shrink(cache_);
+		}
+
+		/**
+		 * \brief Get the cache for the functions of the C interface
+		 * \return Pointer to the cache
+		 */
+		kmem_cache_t *cache() const noexcept {
+			return reinterpret_cast<kmem_cache_t *>(cache_);
+		}
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Return the memory of the object to its slab
+		 * \param cache Pointer to the cache
+		 * \param slab Pointer to the slab of the object, or nullptr if it is served from the guarded pool
+		 * \param memory Pointer to the memory of the object, which is already destroyed
+		 */
+		static void release(cache_header_s *cache, slab_s *slab, void *memory) noexcept {
+			HeapProfiler::remove(memory);
+
+			if (slab == nullptr) {
+				GuardedPool::deallocate(memory, cache);
+				return;
+			}
+
+			// Constant divisor becomes a shift or a multiplication
+			auto index = static_cast<size_t>(static_cast<byte *>(memory) - slab->objects_start_) / Layout::OBJECT_SIZE;
+
+			cache->deallocateAt(slab, index);
+		}
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		cache_header_s *cache_;		/**< Cache holding the objects */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		FixedCache(const FixedCache &) = delete;
+		void operator=(const FixedCache &) = delete;
+
+		#pragma endregion
+
+	};
+}
+
+#endif
@@ -0,0 +1,216 @@
+/**
+* \file Group.h
+* \brief File providing the accounting groups limiting the memory of their allocations
+*/
+
+#ifndef _group_h_
+#define _group_h_
+
+#include <atomic> // atomic
+#include <mutex> // mutex
+#include "Definitions.h" // kmem_group_t
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct representing one accounting group
+	 */
+	struct group_header_s {
+		std::atomic<size_t> usage_;				/**< Bytes charged to the group, including the ones the threads charged ahead */
+		size_t limit_;							/**< Most bytes charged at once, 0 if there is no limit */
+		size_t batch_;							/**< Bytes a thread charges ahead at once */
+		std::atomic<size_t> generation_;		/**< Generation of the group, changed when it is destroyed */
+
+		int(*reclaim_)(kmem_group_t *, size_t, void *);	/**< Function freeing the objects of the group, or nullptr to fail at the limit */
+		void *reclaim_context_;					/**< Pointer passed to the reclaim function */
+
+		std::mutex mutex_;						/**< Mutex serializing the returned charges with the destruction */
+
+		static std::atomic<size_t> next_generation_;	/**< Generation given to the next created or destroyed group */
+	};
+
+	/**
+	 * \brief Struct representing the bytes one thread charged ahead to one group
+	 */
+	struct group_stock_s {
+		group_header_s *group_;					/**< Pointer to the group, or nullptr if the entry is not used */
+		size_t generation_;						/**< Generation of the group when the bytes were charged */
+		size_t bytes_;							/**< Bytes charged and not used yet */
+	};
+
+	/**
+	 * \brief Struct representing the table of the charged bytes of one thread
+	 *
+	 * The table is direct mapped, a group whose entry is taken by another group returns those bytes first
+	 */
+	struct thread_stocks_s {
+		static const size_t NUMBER_OF_ENTRIES = 8;
+
+		#pragma region Fields
+
+		group_stock_s entries_[NUMBER_OF_ENTRIES];	/**< Charged bytes of the thread */
+
+		#pragma endregion
+
+		#pragma region Methods
+
+		/**
+		 * \brief Return the bytes of all entries to their groups
+		 *
+		 * The thread that initialized the allocator keeps them, as it keeps its slabs
+		 */
+		~thread_stocks_s();
+
+		/**
+		 * \brief Get the table of the calling thread
+		 * \return Reference to the table
+		 */
+		static thread_stocks_s &local() noexcept;
+
+		/**
+		 * \brief Get the entry where the charged bytes of the group are kept
+		 * \param group Pointer to the group
+		 * \return Reference to the entry
+		 */
+		group_stock_s &entryFor(const group_header_s *group) noexcept {
+			auto index = reinterpret_cast<size_t>(group) / sizeof(group_header_s) % NUMBER_OF_ENTRIES;
+			return entries_[index];
+		}
+
+		/**
+		 * \brief Return the bytes of the entry to its group, and clear the entry
+		 * \param entry Reference to the entry
+		 *
+		 * Nothing is returned if the group was destroyed after the bytes were charged
+		 */
+		static void release(group_stock_s &entry) noexcept;
+
+		#pragma endregion
+	};
+
+	/**
+	 * \brief Utility class charging the allocations to the accounting groups
+	 *
+	 * A thread charges the bytes of a group one batch ahead, and the allocations and deallocations
+	 * only change the bytes the thread holds. The limit of the group is checked when the batch is used up,
+	 * and the bytes over two batches are returned once they are freed. The usage of a group can thus
+	 * exceed its live objects by two batches for each thread, so the batch is a small part of the limit.
+	 */
+	class Group final {
+	public:
+
+		#pragma region Public interface
+
+		static const size_t MAX_BATCH = 64 * 1024;		/**< Most bytes a thread charges ahead */
+		static const size_t BATCH_DIVISOR = 64;			/**< Part of the limit a thread charges ahead */
+
+		/**
+		 * \brief Create the group
+		 * \param limit Most bytes charged to the group at once, 0 if there is no limit
+		 * \return Pointer to the group, or nullptr if there is no more space
+		 */
+		static group_header_s *create(size_t limit) noexcept;
+
+		/**
+		 * \brief Set the function freeing the objects of the group when it reaches its limit
+		 * \param group Pointer to the group
+		 * \param reclaim Function getting the group, the bytes missing and the context, returning nonzero if it freed anything
+		 * \param context Pointer passed to the function
+		 */
+		static void setReclaim(group_header_s *group, int(*reclaim)(kmem_group_t *, size_t, void *), void *context) noexcept;
+
+		/**
+		 * \brief Get the bytes charged to the group
+		 * \param group Pointer to the group
+		 * \return Number of the bytes, including the ones the threads charged ahead
+		 */
+		static size_t usage(const group_header_s *group) noexcept;
+
+		/**
+		 * \brief Destroy the group
+		 * \param group Pointer to the group
+		 * \remarks Objects charged to the group must be freed before
+		 */
+		static void destroy(group_header_s *group) noexcept;
+
+		/**
+		 * \brief Charge the bytes to the group
+		 * \param group Pointer to the group
+		 * \param size Number of the bytes
+		 * \return True if the bytes are charged, false if the group is at its limit
+		 *
+		 * Unless the bytes the thread charged ahead run out, only the entry of the thread is changed
+		 */
+		static bool charge(group_header_s *group, size_t size) noexcept {
+			auto &entry = thread_stocks_s::local().entryFor(group);
+
+			if (entry.group_ == group && entry.generation_ == group->generation_.load(std::memory_order_acquire) && entry.bytes_ >= size) {
+				entry.bytes_ -= size;
+				return true;
+			}
+
+			return chargeBatch(group, entry, size);
+		}
+
+		/**
+		 * \brief Return the charged bytes to the group
+		 * \param group Pointer to the group
+		 * \param size Number of the bytes
+		 *
+		 * The bytes are kept by the thread, up to two batches
+		 */
+		static void uncharge(group_header_s *group, size_t size) noexcept {
+			auto &entry = thread_stocks_s::local().entryFor(group);
+
+			if (entry.group_ == group && entry.generation_ == group->generation_.load(std::memory_order_acquire)) {
+				entry.bytes_ += size;
+
+				if (entry.bytes_ > 2 * group->batch_) {
+					group->usage_.fetch_sub(entry.bytes_ - group->batch_, std::memory_order_relaxed);
+					entry.bytes_ = group->batch_;
+				}
+
+				return;
+			}
+
+			group->usage_.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Charge the next batch to the group, and take the bytes from it
+		 * \param group Pointer to the group
+		 * \param entry Entry of the calling thread for the group
+		 * \param size Number of the bytes
+		 * \return True if the bytes are charged, false if the group is at its limit even after its reclaim
+		 *
+		 * Near the limit only the missing bytes are charged
+		 */
+		static bool chargeBatch(group_header_s *group, group_stock_s &entry, size_t size) noexcept;
+
+		/**
+		 * \brief Add the bytes to the usage of the group, unless it would exceed the limit
+		 * \param group Pointer to the group
+		 * \param bytes Number of the bytes
+		 * \return True if the bytes were added, false otherwise
+		 */
+		static bool reserve(group_header_s *group, size_t bytes) noexcept;
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		Group() = delete;
+		Group(const Group &) = delete;
+		void operator=(const Group &) = delete;
+
+		#pragma endregion
+	};
+}
+
+#endif
@@ -0,0 +1,199 @@
+/**
+* \file GuardedPool.h
+* \brief File providing the sampled guarded allocations used for detecting memory errors
+*/
+
+#ifndef _guardedpool_h_
+#define _guardedpool_h_
+
+#include <atomic> // atomic
+#include <mutex> // mutex
+#include "Definitions.h" // byte
+#include "StackTrace.h" // stack_trace_s
+
+namespace os2bn140314d {
+
+	struct cache_header_s;
+
+	/**
+	 * \brief State of one slot of the guarded pool
+	 */
+	enum GuardedSlotState : unsigned char {
+		SLOT_UNUSED = 0,		/**< Slot was never used */
+		SLOT_ALLOCATED = 1,		/**< Slot holds an allocated object */
+		SLOT_FREED = 2			/**< Object of the slot was freed, and its page is protected */
+	};
+
+	/**
+	 * \brief Struct representing one slot of the guarded pool
+	 */
+	struct guarded_slot_s {
+		byte *object_;					/**< Pointer to the object */
+		size_t size_;					/**< Size of the object in bytes */
+		cache_header_s *cache_;			/**< Cache of the object, or nullptr for the small memory buffers */
+		GuardedSlotState state_;		/**< State of the slot */
+		stack_trace_s allocation_;		/**< Stack trace of the allocation */
+		stack_trace_s deallocation_;	/**< Stack trace of the deallocation */
+	};
+
+	/**
+	 * \brief Utility class serving a sample of the allocations from pages surrounded by guard pages
+	 *
+	 * The pool is a run of pages where each slot page lies between two protected guard pages.
+	 * Objects in even slots end at the guard page after them, and objects in odd slots start
+	 * at the guard page before them, so both overflows and underflows fault.
+	 * Freed slots are protected and reused in the order they were freed.
+	 * A fault in the pool is reported with the allocation and deallocation stack traces.
+	 */
+	class GuardedPool final {
+	public:
+
+		#pragma region Public interface
+
+		static const size_t OBJECT_ALIGNMENT = 8;		/**< Alignment of the guarded objects */
+		static const size_t DISABLED_RECHECK = 1 << 16;	/**< Number of allocations after which a disabled thread checks the sample rate again */
+
+		/**
+		 * \brief Set the sampling of the guarded allocations
+		 * \param sample_rate Average number of allocations between two guarded ones, 0 to disable sampling
+		 * \param number_of_slots Number of slots in the pool, used only when the pool is mapped by the first call
+		 * \return True if the sampling is set, false if the pool could not be mapped
+		 */
+		static bool configure(size_t sample_rate, size_t number_of_slots) noexcept;
+
+		/**
+		 * \brief Decide if the current allocation should be guarded
+		 * \return True if the allocation should be served from the pool, false otherwise
+		 *
+		 * Unless the countdown of the thread runs out, this only decrements it
+		 */
+		static bool sample() noexcept {
+			if (countdown_-- != 0) {
+				return false;
+			}
+
+			return resample();
+		}
+
+		/**
+		 * \brief Allocate one guarded object
+		 * \param size Size of the object in bytes
+		 * \param cache Cache of the object, or nullptr for the small memory buffers
+		 * \return Pointer to the object, or nullptr if it can not be guarded and should be allocated normally
+		 */
+		static void *allocate(size_t size, cache_header_s *cache) noexcept;
+
+		/**
+		 * \brief Check if the memory belongs to the pool
+		 * \param memory Pointer to the memory
+		 * \return True if the memory is in the pool, false otherwise
+		 */
+		static bool contains(const void *memory) noexcept;
+
+		/**
+		 * \brief Get the size of one guarded object
+		 * \param object Pointer to the object
+		 * \return Size of the object in bytes, as it was allocated
+		 */
+		static size_t objectSize(const void *object) noexcept;
+
+		/**
+		 * \brief Deallocate one guarded object
+		 * \param object Pointer to the object
+		 * \param cache Cache the object is returned to, or nullptr for the small memory buffers
+		 * \return True if the object was deallocated, false if it belongs to another cache
+		 *
+		 * Double and invalid deallocations are reported, and the program is aborted
+		 */
+		static bool deallocate(void *object, const cache_header_s *cache) noexcept;
+
+		/**
+		 * \brief Report a fault, called by the fault handler
+		 * \param address Faulting address
+		 * \return True if the fault was in the pool and it was reported, false otherwise
+		 */
+		static bool handleFault(const void *address) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Restart the countdown of the thread
+		 * \return True if the current allocation should be guarded, false otherwise
+		 */
+		static bool resample() noexcept;
+
+		/**
+		 * \brief Get the page of the slot
+		 * \param index Index of the slot
+		 * \return Pointer to the page
+		 */
+		static byte *slotPage(size_t index) noexcept;
+
+		/**
+		 * \brief Get the slot whose page holds the memory
+		 * \param memory Pointer to the memory in the pool
+		 * \return Pointer to the slot, or nullptr if the memory is in a guard page
+		 */
+		static guarded_slot_s *slotOf(const void *memory) noexcept;
+
+		/**
+		 * \brief Find the slot whose object was most likely accessed through the faulting address
+		 * \param address Faulting address in the pool
+		 * \param error Set to the description of the error
+		 * \return Pointer to the slot, or nullptr if no slot can be blamed
+		 */
+		static const guarded_slot_s *diagnose(const void *address, const char *&error) noexcept;
+
+		/**
+		 * \brief Report the error with the stack traces of the slot
+		 * \param error Description of the error
+		 * \param address Accessed address
+		 * \param slot Slot of the object, or nullptr if unknown
+		 */
+		static void report(const char *error, const void *address, const guarded_slot_s *slot) noexcept;
+
+		/**
+		 * \brief Install the handler reporting the faults in the pool
+		 */
+		static void installHandler() noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		static thread_local size_t countdown_;			/**< Allocations of the thread left until the next guarded one */
+		static thread_local size_t random_;				/**< State of the random generator of the thread */
+
+		static std::atomic<size_t> sample_rate_;		/**< Average number of allocations between two guarded ones */
+		static std::atomic<byte *> pool_;				/**< Start of the pool, or nullptr if it is not mapped */
+
+		static size_t pool_size_;						/**< Size of the pool in bytes */
+		static size_t page_size_;						/**< Size of one page */
+		static size_t number_of_slots_;					/**< Number of slots */
+
+		static guarded_slot_s *slots_;					/**< Metadata of the slots */
+		static size_t *free_slots_;						/**< Queue of the slots ready for use */
+		static size_t free_head_;						/**< Position of the first slot in the queue */
+		static size_t free_count_;						/**< Number of slots in the queue */
+
+		static std::mutex mutex_;						/**< Mutex protecting the slots */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		GuardedPool() = delete;
+		GuardedPool(const GuardedPool &) = delete;
+		void operator=(const GuardedPool &) = delete;
+
+		#pragma endregion
+
+		friend class AllocatorUtility;
+	};
+}
+
+#endif
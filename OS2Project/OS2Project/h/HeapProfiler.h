@@ -0,0 +1,179 @@
+/**
+* \file HeapProfiler.h
+* \brief File providing the sampling heap profiler
+*/
+
+#ifndef _heapprofiler_h_
+#define _heapprofiler_h_
+
+#include <atomic> // atomic
+#include <mutex> // mutex
+#include <ostream> // ostream
+#include "Definitions.h" // byte
+#include "StackTrace.h" // stack_trace_s
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct representing one call site of the sampled allocations
+	 */
+	struct heap_stack_s {
+		stack_trace_s trace_;					/**< Stack trace of the allocations */
+		size_t hash_;							/**< Hash of the trace, 0 if the entry is not used */
+		size_t allocations_;					/**< Number of sampled allocations since profiling started */
+		size_t allocated_bytes_;				/**< Bytes of the sampled allocations since profiling started */
+		std::atomic<size_t> live_objects_;		/**< Number of sampled objects that are not freed */
+		std::atomic<size_t> live_bytes_;		/**< Bytes of the sampled objects that are not freed */
+	};
+
+	/**
+	 * \brief Struct representing one sampled object that is not freed
+	 */
+	struct heap_sample_s {
+		std::atomic<const void *> object_;		/**< Pointer to the object, nullptr if the entry was never used, or \c TOMBSTONE if it is freed */
+		size_t size_;							/**< Size of the object in bytes */
+		size_t stack_;							/**< Index of the call site */
+	};
+
+	/**
+	 * \brief Utility class sampling the allocations once per the given number of bytes on average
+	 *
+	 * Each thread counts down the bytes until its next sample, the gaps are drawn from the exponential
+	 * distribution, so every byte is equally likely to be sampled. Sampled objects are kept in an
+	 * open addressing table, which the deallocations search without locking, and only while
+	 * sampled objects are live. Profiles are written in the legacy heap format read by pprof,
+	 * with both the live and the cumulative values of each call site.
+	 */
+	class HeapProfiler final {
+	public:
+
+		#pragma region Public interface
+
+		static const size_t MAX_SAMPLES = 1 << 15;			/**< Maximum number of live sampled objects */
+		static const size_t MAX_STACKS = 1 << 12;			/**< Maximum number of call sites */
+		static const size_t MAX_PROBES = 16;				/**< Number of entries searched for one object */
+		static const long long DISABLED_RECHECK = 1 << 24;	/**< Number of bytes after which a disabled thread checks the sample rate again */
+
+		/**
+		 * \brief Set the sampling of the heap profiler
+		 * \param sample_bytes Average number of bytes allocated between two samples, 0 to disable sampling
+		 * \return True if the sampling is set, false if the tables could not be mapped
+		 */
+		static bool configure(size_t sample_bytes) noexcept;
+
+		/**
+		 * \brief Decide if the current allocation should be sampled
+		 * \param size Size of the allocation in bytes
+		 * \return True if the allocation should be recorded, false otherwise
+		 *
+		 * Unless the countdown of the thread runs out, this only subtracts the size from it
+		 */
+		static bool sample(size_t size) noexcept {
+			bytes_until_sample_ -= static_cast<long long>(size);
+			if (bytes_until_sample_ > 0) {
+				return false;
+			}
+
+			return resample();
+		}
+
+		/**
+		 * \brief Record the sampled allocation with the stack trace of the calling thread
+		 * \param object Pointer to the allocated object
+		 * \param size Size of the object in bytes
+		 *
+		 * The sample is dropped if the tables are full
+		 */
+		static void record(const void *object, size_t size) noexcept;
+
+		/**
+		 * \brief Stop tracking the object if it was sampled
+		 * \param object Pointer to the object being deallocated
+		 *
+		 * Without live samples this is one load, otherwise a few entries are searched without locking
+		 */
+		static void remove(const void *object) noexcept {
+			if (live_.load(std::memory_order_acquire) != 0) {
+				removeSample(object);
+			}
+		}
+
+		/**
+		 * \brief Write the profile of the sampled allocations
+		 * \param os Output stream
+		 *
+		 * Each call site has its live objects and bytes, followed by the cumulative ones in brackets
+		 */
+		static void dump(std::ostream &os) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Restart the countdown of the thread
+		 * \return True if the current allocation should be sampled, false otherwise
+		 */
+		static bool resample() noexcept;
+
+		/**
+		 * \brief Search the live samples for the object and remove it
+		 * \param object Pointer to the object being deallocated
+		 */
+		static void removeSample(const void *object) noexcept;
+
+		/**
+		 * \brief Get the first entry searched for the object
+		 * \param object Pointer to the object
+		 * \return Index of the entry
+		 */
+		static size_t sampleIndex(const void *object) noexcept;
+
+		/**
+		 * \brief Find the call site with the trace, or add it
+		 * \param trace Captured stack trace
+		 * \return Index of the call site, or \c MAX_STACKS if there is no space
+		 * \remarks Mutex must be locked
+		 */
+		static size_t stackIndex(const stack_trace_s &trace) noexcept;
+
+		/**
+		 * \brief Write the mapped libraries, used by pprof to symbolize the addresses
+		 * \param os Output stream
+		 */
+		static void writeMappings(std::ostream &os) noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		static const void *const TOMBSTONE;					/**< Marks the entry of a freed sample */
+
+		static thread_local long long bytes_until_sample_;	/**< Bytes the thread allocates until the next sample */
+		static thread_local size_t random_;					/**< State of the random generator of the thread */
+
+		static std::atomic<size_t> sample_bytes_;			/**< Average number of bytes between two samples */
+		static std::atomic<size_t> live_;					/**< Number of live sampled objects */
+
+		static heap_sample_s *samples_;						/**< Table of the live sampled objects */
+		static heap_stack_s *stacks_;						/**< Table of the call sites */
+
+		static std::mutex mutex_;							/**< Mutex protecting the insertions and the call sites */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		HeapProfiler() = delete;
+		HeapProfiler(const HeapProfiler &) = delete;
+		void operator=(const HeapProfiler &) = delete;
+
+		#pragma endregion
+
+		friend class AllocatorUtility;
+	};
+}
+
+#endif
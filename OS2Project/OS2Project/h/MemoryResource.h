@@ -0,0 +1,266 @@
+/**
+* \file MemoryResource.h
+* \brief File providing the adapters for the allocators and memory resources of the standard library
+*/
+
+#ifndef _memoryresource_h_
+#define _memoryresource_h_
+
+#include <cstddef> // size_t
+#include <new> // bad_alloc
+#include "Definitions.h" // BLOCK_SIZE
+
+// Memory resources need the C++17 library, the allocator adapter works with any standard
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+#define KMEM_MEMORY_RESOURCE 1
+#endif
+#endif
+
+#ifdef KMEM_MEMORY_RESOURCE
+#include <atomic> // atomic
+#include <mutex> // mutex
+#include <memory_resource> // memory_resource
+#endif
+
+namespace os2bn140314d {
+
+	struct cache_header_s;
+
+	/**
+	 * \brief Utility class serving the allocations whose size is passed again when they are freed
+	 *
+	 * Sizes with a small memory buffer cache are served by it, bigger ones by the buddy allocator.
+	 * Since the size is known when the memory is freed, the buffer cache or the number of blocks
+	 * is computed from it, and the slab of the memory is not looked up.
+	 */
+	class SizedAllocator final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Allocate the memory
+		 * \param size Size of the memory in bytes
+		 * \param alignment Alignment of the memory, at most one cache line
+		 * \return Pointer to the memory, or nullptr if there is not enough memory, or the alignment can not be met
+		 *
+		 * Memory from the buddy allocator is aligned as much as the region it comes from,
+		 * so the regions should start at cache line boundaries for the big aligned requests
+		 */
+		static void *allocate(size_t size, size_t alignment) noexcept;
+
+		/**
+		 * \brief Deallocate the memory
+		 * \param memory Pointer to the memory obtained by \c allocate
+		 * \param size Size passed to \c allocate
+		 * \param alignment Alignment passed to \c allocate
+		 */
+		static void deallocate(void *memory, size_t size, size_t alignment) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Get the number of blocks for the memory that no buffer cache serves
+		 * \param size Size of the memory in bytes
+		 * \return Number of blocks
+		 */
+		static size_t blocksFor(size_t size) noexcept;
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		SizedAllocator() = delete;
+		SizedAllocator(const SizedAllocator &) = delete;
+		void operator=(const SizedAllocator &) = delete;
+
+		#pragma endregion
+
+	};
+
+	/**
+	 * \brief Allocator of the standard containers taking the memory from the allocator
+	 * \tparam T Type of the elements
+	 *
+	 * All instances are interchangeable, the memory allocated by one can be freed by any other
+	 */
+	template <typename T>
+	class Allocator {
+	public:
+
+		typedef T value_type;
+
+		/**
+		 * \brief Get the allocator of another type
+		 */
+		template <typename U>
+		struct rebind {
+			typedef Allocator<U> other;
+		};
+
+		Allocator() noexcept {}
+
+		template <typename U>
+		Allocator(const Allocator<U> &) noexcept {}
+
+		/**
+		 * \brief Allocate the memory for the elements
+		 * \param count Number of elements
+		 * \return Pointer to the memory
+		 * \remarks Throws \c std::bad_alloc if there is not enough memory
+		 */
+		T *allocate(size_t count) {
+			if (count > static_cast<size_t>(-1) / sizeof(T)) {
+				throw std::bad_alloc();
+			}
+
+			auto ret = SizedAllocator::allocate(count * sizeof(T), alignof(T));
+
+			if (ret == nullptr) {
+				throw std::bad_alloc();
+			}
+
+			return static_cast<T *>(ret);
+		}
+
+		/**
+		 * \brief Deallocate the memory of the elements
+		 * \param memory Pointer to the memory obtained by \c allocate
+		 * \param count Number of elements passed to \c allocate
+		 */
+		void deallocate(T *memory, size_t count) noexcept {
+			SizedAllocator::deallocate(memory, count * sizeof(T), alignof(T));
+		}
+	};
+
+	template <typename T, typename U>
+	bool operator==(const Allocator<T> &, const Allocator<U> &) noexcept {
+		return true;
+	}
+
+	template <typename T, typename U>
+	bool operator!=(const Allocator<T> &, const Allocator<U> &) noexcept {
+		return false;
+	}
+
+#ifdef KMEM_MEMORY_RESOURCE
+
+	/**
+	 * \brief Memory resource taking the memory from the small memory buffers and the buddy allocator
+	 */
+	class BufferResource final : public std::pmr::memory_resource {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Get the resource shared by the whole program
+		 * \return Pointer to the resource
+		 */
+		static BufferResource *instance() noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Memory resource
+
+		void *do_allocate(size_t bytes, size_t alignment) override;
+
+		void do_deallocate(void *memory, size_t bytes, size_t alignment) override;
+
+		bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+		#pragma endregion
+
+	};
+
+	/**
+	 * \brief Memory resource keeping a dedicated cache for each small size it is asked for
+	 *
+	 * Containers allocating their nodes one by one get the nodes from a cache of exactly their size,
+	 * created on the first request. Bigger or more aligned requests are passed to the upstream resource.
+	 * Caches are destroyed with the resource, so all memory must be returned before.
+	 *
+	 * The size and the alignment given to deallocation pick the cache, so the cache of a node is never looked up.
+	 * A node of the slab the thread is allocating from is also freed without looking up its slab. Other nodes
+	 * still find their slab in the owner table of the buddy allocator: slabs are aligned only within their region,
+	 * whose start may have any alignment, so the slab can not be computed from the address of the node.
+	 */
+	class CachePoolResource final : public std::pmr::memory_resource {
+	public:
+
+		static const size_t GRANULE = 8;								/**< Difference between the sizes of two neighbouring caches */
+		static const size_t MAX_POOLED_SIZE = 1024;						/**< Biggest size served by the caches */
+		static const size_t NUMBER_OF_POOLS = MAX_POOLED_SIZE / GRANULE;
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Create the resource
+		 * \param upstream Resource serving the requests that no cache serves
+		 */
+		explicit CachePoolResource(std::pmr::memory_resource *upstream = BufferResource::instance()) noexcept;
+
+		/**
+		 * \brief Destroy the caches of the resource
+		 */
+		~CachePoolResource();
+
+		/**
+		 * \brief Get the upstream resource
+		 * \return Pointer to the resource
+		 */
+		std::pmr::memory_resource *upstream_resource() const noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Memory resource
+
+		void *do_allocate(size_t bytes, size_t alignment) override;
+
+		void do_deallocate(void *memory, size_t bytes, size_t alignment) override;
+
+		bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+		#pragma endregion
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Get the cache serving the pool, creating it on the first use
+		 * \param pool Index of the pool
+		 * \return Pointer to the cache, or nullptr if it could not be created
+		 */
+		cache_header_s *cacheFor(size_t pool) noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		std::atomic<cache_header_s *> caches_[NUMBER_OF_POOLS];		/**< Cache of each pool, or nullptr before its first use */
+		std::pmr::memory_resource *upstream_;						/**< Resource serving the other requests */
+		std::mutex mutex_;											/**< Mutex serializing the creation of the caches */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		CachePoolResource(const CachePoolResource &) = delete;
+		void operator=(const CachePoolResource &) = delete;
+
+		#pragma endregion
+
+	};
+
+#endif
+}
+
+#endif
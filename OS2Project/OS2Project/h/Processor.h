@@ -0,0 +1,51 @@
+/**
+* \file Processor.h
+* \brief File providing the functions for querying the processors of the system
+*/
+
+#ifndef _processor_h_
+#define _processor_h_
+
+#include <cstddef> // size_t
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Utility class wrapping the operating system processor queries
+	 */
+	class Processor final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Get the number of processors in the system
+		 * \return Number of processors, at least 1
+		 */
+		static size_t count() noexcept;
+
+		/**
+		 * \brief Get the index of the processor the calling thread is running on
+		 * \return Index of the processor, or 0 if it can not be determined
+		 *
+		 * The thread may be moved to another processor right after the call,
+		 * so the index should only be used as a hint
+		 */
+		static size_t current() noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Delete constructors
+
+		Processor() = delete;
+		Processor(const Processor &) = delete;
+		void operator=(const Processor &) = delete;
+
+		#pragma endregion
+
+	};
+}
+
+#endif
@@ -7,6 +7,7 @@
 #define _slab_h_
 
 typedef struct kmem_cache_s kmem_cache_t;
+typedef struct kmem_group_s kmem_group_t;
 
 const size_t BLOCK_SIZE = 4096;
 const size_t CACHE_L1_LINE_SIZE = 64;
@@ -18,6 +19,220 @@ const size_t CACHE_L1_LINE_SIZE = 64;
  */
 void kmem_init(void *space, int block_num);
 
+/**
+ * \brief Default start of the range reserved for the persistent pools, far from the addresses the system picks for its mappings
+ */
+#define KMEM_PERSISTENT_ADDRESS ((void *)(size_t)(sizeof(void *) == 8 ? 0x600000000000ULL : 0x60000000ULL))
+
+/**
+ * \brief Reserve the address range the persistent pools are mapped at, so nothing else in the process can take it
+ * \param address Start of the range, aligned to the allocation granularity of the system, or null for \c KMEM_PERSISTENT_ADDRESS
+ * \param block_num Size of the range in blocks, the size of the biggest pool the process creates or attaches
+ * \return 1 if the range was reserved, 0 if a part of it is taken, or a range is already reserved
+ *
+ * A persistent pool is always mapped at the start of the range, so the pointers in it, both in the metadata and in the data
+ * of the users, are valid in every process that reserves the same range, whatever the rest of its layout is.
+ * It should be called first in main, before the libraries and threads of the process map memory.
+ * Without it, \c kmem_init_persistent and \c kmem_attach reserve \c KMEM_PERSISTENT_ADDRESS for the size of their pool,
+ * and fail if that range is already taken
+ */
+int kmem_reserve_persistent(void *address, int block_num);
+
+/**
+ * \brief Initialize the allocator in a file, whose pool outlives the process
+ * \param path Path of the file, created or truncated
+ * \param block_num Size of the file in blocks, the first one describes the pool
+ * \return 1 if the allocator was initialized, 0 if the size is too small, does not fit in the reserved range, or the file could not be mapped
+ *
+ * The buddy and slab metadata live in the file together with the objects. The file is mapped at the start of the range
+ * reserved by \c kmem_reserve_persistent, and a later process maps it there again with \c kmem_attach, so no pointer in the pool has to change.
+ * Regions added later, objects of the guarded pool and purging are not supported in such a pool
+ */
+int kmem_init_persistent(const char *path, int block_num);
+
+/**
+ * \brief Map the persistent pool of the file, and use it as the allocator
+ * \param path Path of the file
+ * \return 1 if the pool was attached, 0 otherwise
+ *
+ * The pool must have been detached by \c kmem_detach, by a build with the same layout of the metadata,
+ * and created in a range reserved at the same address as the range of this process. Caches are found again by
+ * \c kmem_cache_open, which also sets their functions, and the data by \c kmem_root.
+ * The allocator must not have been initialized in this process
+ */
+int kmem_attach(const char *path);
+
+/**
+ * \brief Write the persistent pool to its file, and unmap it
+ * \return 1 if the pool was detached, 0 if the allocator is not persistent, holds memory outside of the file,
+ * or the calling thread is in an epoch critical section
+ *
+ * Deferred objects are freed first, and the calling thread returns its slabs. Other threads
+ * using the allocator must have exited. Until the pool is attached, the allocator can not be used
+ */
+int kmem_detach();
+
+/**
+ * \brief Set the object through which the data of the persistent pool is found after it is attached
+ * \param root Pointer to the object in the pool, or null
+ */
+void kmem_set_root(void *root);
+
+/**
+ * \brief Get the object set by \c kmem_set_root
+ * \return Pointer to the object, or null if there is none or the allocator is not persistent
+ */
+void *kmem_root();
+
+/**
+ * \brief Give one more memory region to the allocator
+ * \param space Pointer to the memory which the allocator can use
+ * \param block_num Size of the memory in blocks
+ *
+ * The region is used in addition to the memory passed to \c kmem_init,
+ * and it must stay valid as long as the allocator is used
+ */
+void kmem_add_region(void *space, int block_num);
+
+/**
+ * \brief Set the automatic growth of the allocator
+ * \param block_num Minimal size in blocks of each region mapped from the operating system
+ * when the allocator runs out of memory, 0 to disable growing
+ */
+void kmem_set_auto_grow(int block_num);
+
+/**
+ * \brief Give one more huge page aligned region to the allocator
+ * \param space Pointer to the memory which the allocator can use, or null if the region should be mapped from the system
+ * \param block_num Size of the memory in blocks
+ *
+ * The usable part of the region starts at a huge page aligned address,
+ * and it is used for the slabs of the caches created with \c KMEM_CACHE_HUGEPAGE
+ */
+void kmem_add_huge_region(void *space, int block_num);
+
+/**
+ * \brief Set how the huge page regions mapped by the allocator are backed
+ * \param explicit_pages Nonzero if explicit huge pages should be requested, 0 if transparent huge pages should be advised
+ */
+void kmem_set_hugepage_backing(int explicit_pages);
+
+/**
+ * \brief Set the policy for returning idle memory to the operating system
+ * \param order Free blocks of 2^order blocks and greater are purged, negative to disable purging
+ * \param decay_milliseconds Time a free block must stay idle before it is purged
+ * \param lazy Nonzero if the pages may be reclaimed lazily by the system
+ * \remarks Ignored by the persistent pool, whose purged pages would keep their contents
+ */
+void kmem_set_purge_policy(int order, int decay_milliseconds, int lazy);
+
+/**
+ * \brief Purge all the free blocks waiting for their decay interval
+ * \return Number of purged blocks, 0 for the persistent pool
+ */
+int kmem_purge();
+
+/**
+ * \brief Set the number of the small free blocks each processor keeps
+ * \param high Number of blocks of each order from 0 to 3 a processor keeps at most, 0 if the processors should keep none
+ * \param batch Number of blocks of each order moved between a processor and the shared free lists at once
+ * \return 1 if the numbers were set, 0 if the batch is not between 1 and \c high
+ *
+ * Blocks of the orders 0 to 3 are allocated from the list of the current processor, and freed to it,
+ * without locking the buddy allocator. An empty list takes a batch of blocks, and a list that reaches
+ * the high watermark returns a batch, each under one lock. Kept blocks do not merge with their buddies,
+ * they are returned when an allocation would fail, and by \c kmem_purge. Orders whose free lists are
+ * not \c KMEM_FREELIST_LIFO are not kept by the processors. By default each processor keeps
+ * at most 64 blocks of each order and moves 16 at once, with both numbers shifted right by the order
+ */
+int kmem_set_cpu_pages(int high, int batch);
+
+/**
+ * \brief Set aside a contiguous block of memory for the big allocations, lent to the movable caches meanwhile
+ * \param order Size of the reserve is 2^order blocks
+ * \param min_order Buddy allocations of 2^min_order blocks and more may take the reserve back
+ * \return 1 if the reserve was made, 0 if there already is one, \c min_order is greater than \c order, or there is no free block that big
+ *
+ * Only the slabs of the caches made with \c kmem_cache_create_movable are placed in the reserve.
+ * When a big enough \c Buddy::allocate of the user finds no free block elsewhere, the objects in a part of the reserve
+ * are moved by the callbacks of their caches, and the allocation takes that part.
+ * The part fails to empty if a callback refuses to move an object, or another thread is allocating from one of its slabs.
+ * Memory the allocator takes for itself, such as the slabs, never takes the reserve back
+ */
+int kmem_reserve_contiguous(int order, int min_order);
+
+/**
+ * \brief Policy for \c kmem_set_freelist_policy, the free block freed last is allocated first
+ */
+#define KMEM_FREELIST_LIFO (0)
+
+/**
+ * \brief Policy for \c kmem_set_freelist_policy, the free block with the lowest address is allocated first
+ *
+ * Long lived allocations gather at the start of the regions, so the free blocks at the end can merge into bigger ones
+ */
+#define KMEM_FREELIST_ADDRESS (1)
+
+/**
+ * \brief Policy for \c kmem_set_freelist_policy, the slabs of the caches take the free block with the lowest address,
+ * the other allocations the block freed last
+ *
+ * Long lived slabs gather at the start of the regions, while the short lived allocations reuse the memory that is still in the processor cache.
+ * The first use of the policy takes one block for its lists
+ */
+#define KMEM_FREELIST_HYBRID (2)
+
+/**
+ * \brief Set the order in which the free blocks of one size are allocated
+ * \param order Size of the blocks is 2^order blocks, negative to set the policy of all sizes
+ * \param policy One of the \c KMEM_FREELIST policies
+ * \return 1 if the policy was set, 0 if the order or the policy is not valid, or there is no block for the lists of the hybrid policy
+ *
+ * All sizes use \c KMEM_FREELIST_LIFO by default
+ */
+int kmem_set_freelist_policy(int order, int policy);
+
+/**
+ * \brief Get the share of the free memory that can not serve an allocation of the given order
+ * \param order Size of the allocation is 2^order blocks
+ * \return Number from 0, if all the free memory is in blocks of that order or greater, to 1, if none of it is
+ */
+double kmem_fragmentation(int order);
+
+/**
+ * \brief Set the sampling of the guarded allocations used for detecting memory errors
+ * \param sample_rate Average number of allocations between two guarded ones, 0 to disable sampling
+ * \param slots Number of guarded objects that can be live at once, used only by the first call that enables sampling
+ * \return Nonzero if the sampling is set, 0 if the guarded pool could not be mapped, or the allocator is persistent
+ *
+ * A guarded object is placed against a protected page, and its page is protected when it is freed.
+ * Overflows, underflows and uses after free of guarded objects are reported with the allocation
+ * and free stacks, and double frees abort the program.
+ * Guarded objects live outside of the persistent pool, so sampling is skipped while the allocator is persistent.
+ */
+int kmem_set_guarded_sampling(int sample_rate, int slots);
+
+/**
+ * \brief Set the sampling of the heap profiler
+ * \param sample_bytes Average number of bytes allocated between two samples, 0 to disable sampling
+ * \return Nonzero if the sampling is set, 0 if the profiler tables could not be mapped
+ *
+ * Allocations made by \c kmem_cache_alloc, \c kmalloc and the buddy allocator are sampled,
+ * and the sampled objects are tracked with their stack traces until they are freed
+ */
+int kmem_set_heap_sampling(size_t sample_bytes);
+
+/**
+ * \brief Write the heap profile of the sampled allocations
+ * \param path Path of the profile file
+ * \return Nonzero if the profile was written, 0 otherwise
+ *
+ * The profile is in the legacy heap format read by pprof, each call site has the sampled objects
+ * that are still live, followed by all sampled objects since profiling started, which pprof shows
+ * with -inuse_space and -alloc_space
+ */
+int kmem_heap_profile(const char *path);
+
 /**
  * \brief Allocate cache
  * \param name Name of the cache
@@ -31,6 +246,78 @@ void kmem_init(void *space, int block_num);
  */
 kmem_cache_t *kmem_cache_create(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *));
 
+/**
+ * \brief Flag for \c kmem_cache_create_flags, slabs of the cache are taken from the huge page regions
+ */
+#define KMEM_CACHE_HUGEPAGE (0x1)
+
+/**
+ * \brief Flag for \c kmem_cache_create_flags, each slab keeps a bitmap of its allocated objects
+ *
+ * Freeing an object that is already free sets the error bit instead of corrupting the cache,
+ * the live objects can be visited with \c kmem_cache_walk, and destroying a non empty cache prints the leaked objects
+ */
+#define KMEM_CACHE_TRACK (0x2)
+
+/**
+ * \brief Flag for \c kmem_cache_create_flags, objects of the cache start at cache line boundaries
+ *
+ * The object size is rounded up to whole cache lines, so objects used by different threads do not share lines
+ */
+#define KMEM_CACHE_HWALIGN (0x4)
+
+/**
+ * \brief Allocate cache with additional options
+ * \param name Name of the cache
+ * \param size Size of the object in cache
+ * \param ctor Constructor
+ * \param dtor Destructor
+ * \param flags Combination of the \c KMEM_CACHE flags
+ * \return Cache object
+ */
+kmem_cache_t *kmem_cache_create_flags(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *), unsigned flags);
+
+/**
+ * \brief Allocate cache whose objects can be moved by \c kmem_cache_defragment
+ * \param name Name of the cache
+ * \param size Size of the object in cache
+ * \param ctor Constructor
+ * \param dtor Destructor
+ * \param migrate Function moving the object from the first pointer to the second one
+ * \return Cache object
+ *
+ * The callback gets an allocated object, and a new object of the same cache. It copies the contents,
+ * updates every reference to the object, and returns nonzero, after which the old object is freed
+ * as by \c kmem_cache_free. If it returns 0, the object stays and the new one is returned to the cache.
+ * The callback runs without the cache locked, so it must serialize with the users of the object itself.
+ * The cache tracks its objects as with \c KMEM_CACHE_TRACK, and its slabs borrow the reserve made by \c kmem_reserve_contiguous
+ */
+kmem_cache_t *kmem_cache_create_movable(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *), int(*migrate)(void *from, void *to));
+
+/**
+ * \brief Find the cache of an attached persistent pool by its name
+ * \param name Name of the cache
+ * \param ctor Constructor
+ * \param dtor Destructor
+ * \return Cache object, or null if there is no cache with the name
+ *
+ * The code of the new process may be mapped elsewhere, so the functions of the caches are cleared
+ * when the pool is attached. A cache is opened, with the same functions, before it is used
+ */
+kmem_cache_t *kmem_cache_open(const char *name, void(*ctor)(void *), void(*dtor)(void *));
+
+/**
+ * \brief Find the movable cache of an attached persistent pool by its name
+ * \param name Name of the cache
+ * \param ctor Constructor
+ * \param dtor Destructor
+ * \param migrate Function moving the object from the first pointer to the second one
+ * \return Cache object, or null if there is no cache with the name
+ *
+ * Same as \c kmem_cache_open, the objects can be moved again once the function is set
+ */
+kmem_cache_t *kmem_cache_open_movable(const char *name, void(*ctor)(void *), void(*dtor)(void *), int(*migrate)(void *from, void *to));
+
 /**
  * \brief Shrink cache
  * \param cachep Pointer to the cache
@@ -38,6 +325,29 @@ kmem_cache_t *kmem_cache_create(const char *name, size_t size, void(*ctor)(void
  */
 int kmem_cache_shrink(kmem_cache_t *cachep);
 
+/**
+ * \brief Move the objects out of the sparsest slabs of the cache, and deallocate the emptied slabs
+ * \param cachep Pointer to the cache created with \c kmem_cache_create_movable
+ * \return Number of deallocated blocks, or -1 if the objects of the cache can not be moved
+ *
+ * If there is not even one block for sorting the slabs, nothing is moved, and \c kmem_cache_error reports
+ * that there was no more space. Objects are moved only into the slabs that already have free space, so the cache never grows.
+ * The emptied slabs are returned to the buddy allocator, down to the minimal number of empty slabs,
+ * where they can merge into bigger blocks
+ */
+int kmem_cache_defragment(kmem_cache_t *cachep);
+
+/**
+ * \brief Set the number of the empty slabs the cache keeps
+ * \param cachep Pointer to the cache
+ * \param min_empty Number of empty slabs that \c kmem_cache_shrink keeps
+ * \param max_empty Number of empty slabs kept when more become empty, negative if there is no limit
+ *
+ * A slab that becomes empty while the cache already keeps \c max_empty of them
+ * is returned to the buddy allocator immediately. By default there is no limit, and shrinking keeps none.
+ */
+void kmem_cache_set_empty_limits(kmem_cache_t *cachep, int min_empty, int max_empty);
+
 /**
  * \brief Allocate one object from cache
  * \param cachep Pointer to the cache
@@ -45,6 +355,18 @@ int kmem_cache_shrink(kmem_cache_t *cachep);
  */
 void *kmem_cache_alloc(kmem_cache_t *cachep);
 
+/**
+ * \brief Allocate one object from cache, waiting for memory if there is none
+ * \param cachep Pointer to the cache
+ * \param timeout Longest time to wait in milliseconds, 0 to not wait, negative to wait without a limit
+ * \return Allocated object, or nullptr if the timeout expired
+ *
+ * The thread sleeps until an object of the cache is freed, or the buddy allocator gets back a block
+ * big enough for a slab, as when another cache is shrunk. Objects freed to a slab that another thread
+ * is allocating from reach the waiter only once that thread moves on from the slab
+ */
+void *kmem_cache_alloc_wait(kmem_cache_t *cachep, int timeout);
+
 /**
  * \brief Deallocate one object from cache
  * \param cachep Pointer to the cache
@@ -52,6 +374,53 @@ void *kmem_cache_alloc(kmem_cache_t *cachep);
  */
 void kmem_cache_free(kmem_cache_t *cachep, void *objp);
 
+/**
+ * \brief Deallocate one object from cache once no reader can hold it
+ * \param cachep Pointer to the cache
+ * \param objp Pointer to the object, already unreachable for the readers that enter after the call
+ *
+ * The object is returned to the cache after every thread that was in a critical section
+ * entered with \c kmem_epoch_enter at the time of the call has left it. Deferred objects are kept
+ * per thread and returned to their slabs in batches, so they stay allocated for some time after
+ * the grace period. If there is no memory to keep the object, and the calling thread is in a critical section,
+ * the object is not freed and the error bit is set
+ */
+void kmem_cache_free_deferred(kmem_cache_t *cachep, void *objp);
+
+/**
+ * \brief Enter the critical section in which the objects freed with \c kmem_cache_free_deferred stay valid
+ *
+ * Critical sections can be nested, and they should be short, since no deferred object
+ * is returned while any of them lasts
+ */
+void kmem_epoch_enter();
+
+/**
+ * \brief Leave the critical section entered with \c kmem_epoch_enter
+ */
+void kmem_epoch_leave();
+
+/**
+ * \brief Wait for the grace period and return the objects deferred by all threads to their caches
+ * \return Number of returned objects, or -1 if the calling thread is in a critical section
+ *
+ * A cache whose objects were freed with \c kmem_cache_free_deferred should be destroyed only after the barrier
+ */
+int kmem_epoch_barrier();
+
+/**
+ * \brief Visit every allocated object of the cache
+ * \param cachep Pointer to the cache created with \c KMEM_CACHE_TRACK
+ * \param callback Function called with each object and the context
+ * \param ctx Pointer passed to the callback
+ * \return Number of visited objects, or -1 if the cache does not track its objects
+ *
+ * The cache is locked during the walk, so the callback must not allocate from the cache or free to it.
+ * Objects allocated or freed by other threads during the walk may or may not be visited,
+ * and objects served from the guarded pool are not visited
+ */
+int kmem_cache_walk(kmem_cache_t *cachep, void(*callback)(void *objp, void *ctx), void *ctx);
+
 /**
  * \brief Allocate one small memory buffer
  * \param size Size of the buffer
@@ -59,6 +428,17 @@ void kmem_cache_free(kmem_cache_t *cachep, void *objp);
  */
 void *kmalloc(size_t size);
 
+/**
+ * \brief Allocate one small memory buffer, waiting for memory if there is none
+ * \param size Size of the buffer
+ * \param timeout Longest time to wait in milliseconds, 0 to not wait, negative to wait without a limit
+ * \return Pointer to the allocated buffer, or nullptr if there is no buffer cache for the size, or the timeout expired
+ *
+ * Waits as \c kmem_cache_alloc_wait on the buffer cache of the size. Buffers kept by the processor caches
+ * of other processors are not waited for, they return to the buffer cache in batches
+ */
+void *kmalloc_wait(size_t size, int timeout);
+
 /**
  * \brief Deallocate one small memory buffer
  * \param objp Pointer to a buffer obtained by \c kmalloc
@@ -84,4 +464,75 @@ void kmem_cache_info(kmem_cache_t *cachep);
  */
 int kmem_cache_error(kmem_cache_t *cachep);
 
+/**
+ * \brief Create an accounting group, limiting the memory of the allocations charged to it
+ * \param limit Most bytes charged to the group at once, 0 if there is no limit
+ * \return Group object, or null if there is no more space
+ *
+ * Each thread charges the group a batch of bytes ahead, 1/64 of the limit and at most 64 KiB,
+ * and the limit is checked only when the batch is used up. The usage may thus exceed
+ * the live objects by two batches for each thread that allocates from the group
+ */
+kmem_group_t *kmem_group_create(size_t limit);
+
+/**
+ * \brief Set the function called when an allocation would exceed the limit of the group
+ * \param groupp Pointer to the group
+ * \param reclaim Function getting the group, the missing bytes and the context, or null to fail such allocations at once
+ * \param ctx Pointer passed to the function
+ *
+ * The function frees objects charged to the group, and returns nonzero if it freed any,
+ * after which the allocation is tried once more. It is called by the allocating thread,
+ * possibly by several threads at once
+ */
+void kmem_group_set_reclaim(kmem_group_t *groupp, int(*reclaim)(kmem_group_t *groupp, size_t bytes, void *ctx), void *ctx);
+
+/**
+ * \brief Get the bytes charged to the group
+ * \param groupp Pointer to the group
+ * \return Number of the bytes, including the batches the threads charged ahead
+ */
+size_t kmem_group_usage(kmem_group_t *groupp);
+
+/**
+ * \brief Destroy the group
+ * \param groupp Pointer to the group
+ *
+ * Objects charged to the group must be freed before
+ */
+void kmem_group_destroy(kmem_group_t *groupp);
+
+/**
+ * \brief Allocate one object from cache, and charge its size to the group
+ * \param cachep Pointer to the cache
+ * \param groupp Pointer to the group
+ * \return Allocated object, or null if the group is at its limit or there is no more space
+ */
+void *kmem_cache_alloc_group(kmem_cache_t *cachep, kmem_group_t *groupp);
+
+/**
+ * \brief Deallocate one object from cache, and return its charge to the group
+ * \param cachep Pointer to the cache
+ * \param groupp Pointer to the group the object was charged to
+ * \param objp Pointer to the object
+ */
+void kmem_cache_free_group(kmem_cache_t *cachep, kmem_group_t *groupp, void *objp);
+
+/**
+ * \brief Allocate one small memory buffer, and charge it to the group
+ * \param size Size of the buffer
+ * \param groupp Pointer to the group
+ * \return Pointer to the allocated buffer, or null if the group is at its limit or there is no more space
+ *
+ * The size is charged rounded up to the buffer that holds it
+ */
+void *kmalloc_group(size_t size, kmem_group_t *groupp);
+
+/**
+ * \brief Deallocate one small memory buffer, and return its charge to the group
+ * \param groupp Pointer to the group the buffer was charged to
+ * \param objp Pointer to a buffer obtained by \c kmalloc_group
+ */
+void kfree_group(kmem_group_t *groupp, const void *objp);
+
 #endif
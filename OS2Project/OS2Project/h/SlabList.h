@@ -6,8 +6,6 @@
 #ifndef _slablist_h_
 #define _slablist_h_
 
-#include <stdexcept> // underflow_error
-
 namespace os2bn140314d {
 
 	struct slab_s;
@@ -31,9 +29,9 @@ namespace os2bn140314d {
 
 		/**
 		 * \brief Get the first element from the list
-		 * \throw underflow_error Thrown when the list is empty
+		 * \return Pointer to the first slab, or nullptr if the list is empty
 		 */
-		slab_s *first() const throw(std::underflow_error);
+		slab_s *first() const noexcept;
 
 		/**
 		 * \brief Check if list is empty
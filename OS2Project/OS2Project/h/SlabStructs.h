@@ -7,26 +7,58 @@
 #define _slabstructs_h_
 
 #include <mutex> // mutex
+#include <atomic> // atomic
+#include <thread> // thread::id
+#include <cstdint> // uint64_t
 #include "Definitions.h" // MAX_NAME_LENGTH
 #include "SlabList.h" // SlabList
 #include "CacheHeaderList.h" // CacheHeaderList
-#include "CacheBlockList.h" // CacheBlockList
 
 namespace os2bn140314d {
 	struct cache_header_s;
 
+	/**
+	 * \brief List of the cache where the slab is kept
+	 */
+	enum SlabState : unsigned char {
+		SLAB_EMPTY = 0,		/**< Slab has no allocated objects */
+		SLAB_PARTIAL = 1,	/**< Slab has both allocated and free objects */
+		SLAB_FULL = 2,		/**< Slab has no free objects */
+		SLAB_ACTIVE = 3		/**< Slab is owned by a thread, which allocates from it without locking */
+	};
+
 	/**
 	 * \brief Struct representing one slab
+	 *
+	 * The thread that froze the slab allocates from the local free list, and returns its objects there, without atomics.
+	 * Other threads push the objects onto the remote free list, whose first index, length and the frozen flag
+	 * are packed into one word. The owner takes the whole remote list with one exchange when the local list runs dry.
 	 */
 	struct slab_s {
+		#pragma region Constants
+
+		static const size_t FREELIST_END = 0xFFFF;			/**< Index marking the end of the free list, also the maximum number of objects */
+		static const unsigned COUNT_SHIFT = 16;				/**< Position of the length of the list in the remote free list word */
+		static const uint64_t FROZEN_BIT = 1ull << 32;		/**< Flag of the remote free list word, set while a thread owns the slab */
+		static const size_t BITS_IN_WORD = 64;				/**< Number of objects tracked by one word of the allocation bitmap */
+		static const size_t PARTIAL_BUCKETS = 4;			/**< Number of lists the partially full slabs are split into by their fullness */
+
+		#pragma endregion
+
 		#pragma region Fields
 
 		slab_s *next_;							/**< Pointer to the next slab */
 		slab_s *prev_;							/**< Pointer to the previous slab*/
 
 		size_t *index_array_;					/**< Pointer to the array indexing the slab */
-		size_t free_index_;						/**< Index of first free object */
-		size_t number_of_allocated_objects_;	/**< Number of allocated objects */
+		size_t local_free_;						/**< Index of the first object in the local free list */
+		std::atomic<size_t> used_;				/**< Number of objects not in the local free list, written only by the owner or under the cache mutex */
+		std::atomic<const void *> owner_;		/**< Table of the thread that owns the slab, or nullptr */
+		std::atomic<uint64_t> remote_free_;		/**< Packed first index and length of the remote free list, and the frozen flag */
+		std::atomic<size_t> pending_;			/**< Number of deallocations that will move the slab to another list */
+		std::atomic<uint64_t> *allocated_;		/**< Bitmap with the set bit for each allocated object, or nullptr if the cache is not tracked */
+		SlabState state_;						/**< List where the slab is kept */
+		size_t bucket_;							/**< Partial list where the slab is kept, if it is partially full */
 
 		byte *objects_start_;					/**< Pointer to the start of the object array */
 
@@ -34,6 +66,47 @@ namespace os2bn140314d {
 
 		#pragma endregion 
 
+		#pragma region Helpers
+
+		/**
+		 * \brief Get the first index from the remote free list word
+		 * \param word Remote free list word
+		 * \return Index of the first object, or \c FREELIST_END if the list is empty
+		 */
+		static size_t headOf(uint64_t word) noexcept;
+
+		/**
+		 * \brief Get the length of the list from the remote free list word
+		 * \param word Remote free list word
+		 * \return Number of objects in the remote free list
+		 */
+		static size_t countOf(uint64_t word) noexcept;
+
+		/**
+		 * \brief Check the frozen flag of the remote free list word
+		 * \param word Remote free list word
+		 * \return True if a thread owns the slab, false otherwise
+		 */
+		static bool frozenOf(uint64_t word) noexcept;
+
+		/**
+		 * \brief Make the remote free list word
+		 * \param head Index of the first object
+		 * \param count Number of objects in the list
+		 * \param frozen True if a thread owns the slab, false otherwise
+		 * \return Remote free list word
+		 */
+		static uint64_t pack(size_t head, size_t count, bool frozen) noexcept;
+
+		/**
+		 * \brief Get the position of the lowest set bit
+		 * \param word Word with at least one bit set
+		 * \return Position of the bit
+		 */
+		static size_t lowestBit(uint64_t word) noexcept;
+
+		#pragma endregion
+
 		#pragma region Methods
 
 		/**
@@ -53,21 +126,25 @@ namespace os2bn140314d {
 		 */
 		void initializeObjectArray() noexcept;
 
+		/**
+		 * \brief Clear the allocation bitmap, if the cache is tracked
+		 */
+		void initializeBitmap() noexcept;
+
 		/**
 		 * \brief Get the object at the specific index
 		 * \param index Index of the object
 		 * \return Pointer to the object
-		 * \throw out_of_range Thrown when index is out of range
+		 * \remarks Index must be in range
 		 */
-		byte *objectAt(size_t index) const throw (std::out_of_range);
+		byte *objectAt(size_t index) const noexcept;
 
 		/**
 		 * \brief Get the index of the specific object
 		 * \param object Pointer to the object
-		 * \return Index of the object
-		 * \throw invalid_argument Thrown when pointer is out of range, or it does not point to an object
+		 * \return Index of the object, or \c NULL_INDEX if the pointer is out of range, or it does not point to an object
 		 */
-		size_t indexOf(void *object) const throw(std::invalid_argument);
+		size_t indexOf(void *object) const noexcept;
 
 		/**
 		 * \brief Checks if object is in slab range
@@ -83,6 +160,33 @@ namespace os2bn140314d {
 		 */
 		bool contains(void *object) const noexcept;
 
+		/**
+		 * \brief Get the number of allocated objects
+		 * \return Number of allocated objects
+		 */
+		size_t allocatedObjects() const noexcept;
+
+		/**
+		 * \brief Get the list where the slab belongs if no thread owns it
+		 * \param word Remote free list word
+		 * \return State matching the number of allocated objects
+		 */
+		SlabState stateFor(uint64_t word) const noexcept;
+
+		/**
+		 * \brief Get the partial list where the slab belongs if no thread owns it
+		 * \param word Remote free list word
+		 * \return Bucket matching the number of allocated objects
+		 */
+		size_t bucketFor(uint64_t word) const noexcept;
+
+		/**
+		 * \brief Get the partial list for the number of allocated objects
+		 * \param allocated Number of allocated objects, greater than 0 and less than the number of objects in the slab
+		 * \return Bucket, the fuller slabs have the greater ones
+		 */
+		size_t bucketOf(size_t allocated) const noexcept;
+
 		/**
 		 * \brief Checks if slab is empty
 		 * \return True if slab is empty, false otherwise
@@ -95,56 +199,155 @@ namespace os2bn140314d {
 		 */
 		bool isFull() const noexcept;
 
+		/**
+		 * \brief Mark the slab as owned by the thread
+		 * \param owner Table of the thread
+		 * \remarks Cache mutex must be locked
+		 */
+		void freeze(const void *owner) noexcept;
+
+		/**
+		 * \brief Mark the slab as not owned by any thread
+		 * \return Remote free list word at the moment of unfreezing
+		 * \remarks Cache mutex must be locked
+		 */
+		uint64_t unfreeze() noexcept;
+
+		/**
+		 * \brief Move the remote free list into the empty local free list
+		 * \return True if any object was collected, false otherwise
+		 * \remarks Only the thread that froze the slab may collect
+		 */
+		bool collect() noexcept;
+
 		/**
 		 * \brief Allocate one object from slab
-		 * \throw bad_alloc Thrown if there are no free objects in slab
+		 * \return Pointer to the object, or nullptr if there are no free objects in slab
+		 * \remarks Only the thread that froze the slab may allocate from it
+		 */
+		void *allocate() noexcept;
+
+		/**
+		 * \brief Check the bit of the object in the allocation bitmap
+		 * \param index Index of the object
+		 * \return True if the object is allocated, or the cache is not tracked, false otherwise
 		 */
-		void *allocate() throw(std::bad_alloc);
+		bool isAllocated(size_t index) const noexcept;
+
+		/**
+		 * \brief Clear the bit of the object in the allocation bitmap
+		 * \param index Index of the object
+		 * \return True if the object was allocated, or the cache is not tracked, false if it is already free
+		 */
+		bool markFree(size_t index) noexcept;
+
+		/**
+		 * \brief Visit every allocated object of the slab
+		 * \param callback Function called with each object and the context
+		 * \param context Pointer passed to the callback
+		 * \return Number of visited objects
+		 *
+		 * The bitmap is scanned a word at a time, skipping the words without allocated objects
+		 */
+		size_t walk(void(*callback)(void *, void *), void *context) const;
 
 		/**
 		 * \brief Deallocate one object from slab
 		 * \param object Pointer to the object
-		 * \throw invalid_argument Thrown when pointer does not point to an object in slab
+		 * \return True if the slab should be moved to another list, false otherwise
+		 * \remarks Object must be in the slab, as checked by \c contains
+		 *
+		 * The owner returns the object to the local free list, other threads to the remote one.
+		 * If true is returned, \c pending_ is incremented, and the caller must decrement it after moving the slab
+		 */
+		bool deallocate(void *object) noexcept;
+
+		/**
+		 * \brief Return the object at the index to the free list, without calling the destructor and constructor
+		 * \param index Index of the object
+		 * \return True if the slab should be moved to another list, false otherwise
+		 * \remarks Index must be in range, the pending count is handled as in \c deallocate
 		 */
-		void deallocate(void *object) throw(std::invalid_argument);
+		bool release(size_t index) noexcept;
 
 		#pragma endregion 
 	};
 
-	struct cache_block_header_s;
+	/**
+	 * \brief Struct representing one interned cache name, shared by all the caches with that name
+	 *
+	 * The string is kept right after the struct, in a small memory buffer
+	 */
+	struct cache_name_s {
+		cache_name_s *next_;					/**< Pointer to the next name in the same bucket */
+		size_t hash_;							/**< Hash of the string */
+		size_t references_;						/**< Number of caches with the name */
 
-	struct cache_header_s {
-		#pragma region Fields
+		/**
+		 * \brief Get the string of the name
+		 * \return Pointer to the null terminated string
+		 */
+		char *string() noexcept;
+	};
 
-		SlabList full_;							/**< List of full slabs */
-		SlabList partial_;						/**< List of partially full slabs */
-		SlabList empty_;						/**< List of empty slabs */
+	/**
+	 * \brief Struct representing one slab considered by the defragmentation
+	 */
+	struct defrag_candidate_s {
+		slab_s *slab_;							/**< Pointer to the partially full slab */
+		size_t allocated_;						/**< Number of objects allocated when the slab was taken */
+	};
+
+	/**
+	 * \brief Header of one cache
+	 *
+	 * Fields are split by the way they are used. The fields read on every allocation are only written
+	 * when the cache is created, the mutex is alone in its cache line, and the lists and counters
+	 * changed under the mutex follow it in their own lines. Waiting for the mutex, or refilling the
+	 * lists, does not invalidate the lines other threads read on their fast paths.
+	 */
+	struct alignas(CACHE_L1_LINE_SIZE) cache_header_s {
+		#pragma region Fields
 
 		size_t object_size_;					/**< Size of one object in cache */
 
 		size_t number_of_blocks_in_slab_;		/**< Number of memory blocks in one slab */
 		size_t num_of_objects_;					/**< Number of objects that can fit in one slab */
 
-		size_t next_color_;						/**< The color of the slab that will be allocated next */
 		size_t unused_memory_size_;				/**< Size of unused memory in each slab */
+		size_t bitmap_words_;					/**< Number of words in the allocation bitmap of each slab, 0 if the cache is not tracked */
 
-		char name_[MAX_NAME_LENGTH];			/**< Human readable name of the cache */
-
-		std::mutex mutex_;						/**< Mutex used for synhronization in the cache */
+		std::atomic<size_t> generation_;		/**< Unique id of this instance of the cache, used to invalidate the active slabs of the threads */
 
 		void(*constructor_)(void *);			/**< Constructor of the cache objects */
 		void(*destructor_)(void *);				/**< Destructor of the cache objects */
-		
-		size_t number_of_slabs_;				/**< Number of slabs in cache */
-		size_t number_of_allocated_objects_;	/**< Number of allocated objects in cache */
+		int(*migrate_)(void *, void *);			/**< Function moving an object to another one of the cache, or nullptr if the objects can not be moved */
+
+		unsigned flags_;						/**< Combination of the \c KMEM_CACHE flags */
 
-		cache_block_header_s *block_;				/**< Pointer to the block where this header is kept */
+		const char *name_;						/**< Human readable name of the cache */
+		cache_name_s *interned_name_;			/**< Interned name the string belongs to, or nullptr for the caches of the allocator */
 
 		cache_header_s *next_;					/**< Pointer to the next cache header in list */
 		cache_header_s *prev_;					/**< Pointer to the previous cache header in list */
 
 		AllocatorError error_;					/**< Error info about the cache */
 
+		alignas(CACHE_L1_LINE_SIZE) std::mutex mutex_;	/**< Mutex used for synhronization in the cache */
+
+		alignas(CACHE_L1_LINE_SIZE) SlabList full_;	/**< List of full slabs */
+		SlabList partial_[slab_s::PARTIAL_BUCKETS];	/**< Lists of partially full slabs, from the nearly empty to the nearly full */
+		SlabList empty_;						/**< List of empty slabs */
+		SlabList active_;						/**< List of slabs owned by the threads */
+
+		size_t next_color_;						/**< The color of the slab that will be allocated next */
+		size_t number_of_slabs_;				/**< Number of slabs in cache */
+		size_t empty_slabs_;					/**< Number of slabs in the empty list */
+		size_t min_empty_;						/**< Number of empty slabs that shrinking keeps */
+		size_t max_empty_;						/**< Number of empty slabs kept when more become empty, \c NULL_INDEX if there is no limit */
+
+		static std::atomic<size_t> next_generation_;	/**< Generation given to the next initialized cache */
+
 		#pragma endregion 
 
 		#pragma region Helpers
@@ -153,30 +356,34 @@ namespace os2bn140314d {
 		 * \brief Calculate the size of the slab
 		 * \param object_size Size of one object
 		 * \param index_size Size of one element indexing the slab
-		 * \return Size of the slab in bytes
-		 * \throw overflow_error Thrown when size is bigger then the maximum allocation size
+		 * \return Size of the slab in bytes, or 0 if it is bigger than the maximum allocation size
 		 */
-		static size_t slabSize(size_t object_size, size_t index_size) throw(std::overflow_error);
+		static size_t slabSize(size_t object_size, size_t index_size) noexcept;
 
 		/**
 		 * \brief Calculate the number of objects that can fit in one slab
 		 * \param slab_size Size of the slab available for the objects and index
 		 * \param object_size Size of one object
 		 * \param index_size Size of one element indexing the slabd
-		 * \return Number of objects
-		 * \throw invalid_argument Thrown when one of the parameters is 0
+		 * \return Number of objects, or 0 if one of the parameters is 0
 		 */
-		static size_t numOfObjects(size_t slab_size, size_t object_size, size_t index_size) throw(std::invalid_argument);
+		static size_t numOfObjects(size_t slab_size, size_t object_size, size_t index_size) noexcept;
 
 		/**
 		* \brief Calculate the size of the unused space in one slab
 		* \param slab_size Size of the slab available for the objects and index
 		* \param object_size Size of one object
 		* \param index_size Size of one element indexing the slabd
-		* \return Size of the unused space in bytes
-		* \throw invalid_argument Thrown when one of the parameters is 0
+		* \return Size of the unused space in bytes, or 0 if one of the parameters is 0
 		*/
-		static size_t unusedSpace(size_t slab_size, size_t object_size, size_t index_size) throw(std::invalid_argument);
+		static size_t unusedSpace(size_t slab_size, size_t object_size, size_t index_size) noexcept;
+
+		/**
+		 * \brief Calculate the number of words in the allocation bitmap
+		 * \param num_of_objects Number of objects in one slab
+		 * \return Number of words
+		 */
+		static size_t bitmapWords(size_t num_of_objects) noexcept;
 
 		#pragma endregion 
 
@@ -188,40 +395,225 @@ namespace os2bn140314d {
 		 * \param object_size Size of the object
 		 * \param constructor Constructor
 		 * \param destructor Destructor
-		 * \param block Pointer to the block where the header is located
+		 * \param flags Combination of the \c KMEM_CACHE flags
+		 * \return True if the cache was initialized, false if the object size is 0 or too big
 		 */
-		void initilaze(
+		bool initilaze(
 			const char name[],
 			size_t object_size,
 			void(*constructor)(void *),
 			void(*destructor)(void *),
-			cache_block_header_s *block) noexcept;
+			unsigned flags) noexcept;
 
 		/**
-		 * \brief Copies at most \c MAX_NAME_LENGTH characters into the name string
-		 * \param name Name of the cache
+		 * \brief Allocate the memory for one slab
+		 * \return Pointer to the memory, or nullptr if there is not enough memory
+		 */
+		void *allocateSlabMemory() noexcept;
+
+		/**
+		 * \brief Get the list holding the slabs in the specific state
+		 * \param state State of the slabs
+		 * \param bucket Partial list, used only for the partially full slabs
+		 * \return Reference to the list
+		 */
+		SlabList &list(SlabState state, size_t bucket) noexcept;
+
+		/**
+		 * \brief Insert the slab into the list matching its state
+		 * \param slab Pointer to the slab
+		 * \remarks Mutex must be locked
 		 */
-		void copyName(const char name[]) noexcept;
+		void insert(slab_s *slab) noexcept;
+
+		/**
+		 * \brief Remove the slab from the list matching its state
+		 * \param slab Pointer to the slab
+		 * \remarks Mutex must be locked
+		 */
+		void remove(slab_s *slab) noexcept;
+
+		/**
+		 * \brief Get all the lists that may hold the allocated objects
+		 * \param lists Array where the pointers to the lists are written
+		 */
+		void usedLists(const SlabList *lists[slab_s::PARTIAL_BUCKETS + 2]) const noexcept;
+
+		/**
+		 * \brief Take a slab with free objects and make it owned by the calling thread
+		 * \return Pointer to the frozen slab, or nullptr if there are no free objects and a new slab can not be allocated
+		 *
+		 * The fullest slabs are taken first, so the nearly empty ones can drain and be shrunk
+		 * \remarks Mutex must be locked
+		 */
+		slab_s *activate() noexcept;
+
+		/**
+		 * \brief Return the slab owned by a thread to the list matching its state
+		 * \param slab Pointer to the active slab
+		 * \remarks Mutex must be locked
+		 */
+		void deactivate(slab_s *slab) noexcept;
+
+		/**
+		 * \brief Move the slab to the list matching its state, if no thread owns it
+		 * \param slab Pointer to the slab
+		 * \remarks Mutex must be locked
+		 */
+		void relist(slab_s *slab) noexcept;
+
+		/**
+		 * \brief Count the allocated objects in all slabs of the cache
+		 * \return Number of allocated objects
+		 * \remarks Mutex must be locked
+		 */
+		size_t allocatedObjects() const noexcept;
+
+		/**
+		 * \brief Visit every allocated object of the cache
+		 * \param callback Function called with each object and the context
+		 * \param context Pointer passed to the callback
+		 * \return Number of visited objects, or -1 if the cache does not track its objects
+		 * \remarks Mutex must be locked
+		 */
+		long long walk(void(*callback)(void *, void *), void *context) const;
+
+		/**
+		 * \brief Print the objects that are still allocated
+		 * \param os Output stream
+		 * \remarks Mutex must be locked, and the cache must track its objects
+		 */
+		void printLeaks(std::ostream &os) const;
 
 		/**
 		 * \brief Allocate one object from cache
 		 * \remarks If the allocation is not successfull, error bit is set
+		 *
+		 * The object is taken from the active slab of the calling thread without locking,
+		 * the mutex is locked only when the thread needs another slab
 		 */
 		void *allocate() noexcept;
 
+		/**
+		 * \brief Allocate one object from cache, and get its slab
+		 * \param slab Set to the slab holding the object, if it is allocated
+		 * \return Pointer to the object, or nullptr if there is no more space
+		 *
+		 * The slab is the active one of the calling thread, so no lookup is needed
+		 */
+		void *allocate(slab_s *&slab) noexcept;
+
+		/**
+		 * \brief Allocate several objects from cache
+		 * \param objects Array where the pointers to the objects are written
+		 * \param count Number of objects to allocate
+		 * \return Number of allocated objects, less than \c count if there is no more space
+		 * \remarks If not all objects are allocated, error bit is set
+		 */
+		size_t allocateBatch(void *objects[], size_t count) noexcept;
+
 		/**
 		 * \brief Deallocate one object from cache
 		 * \param object Pointer to the object
-		 * \remarks If the pointer is not valid, error bit is set
+		 * \remarks If the pointer is not valid, or the object is already free in a tracked cache, error bit is set
+		 *
+		 * The object is returned to its slab without locking,
+		 * the mutex is locked only when the slab has to be moved to another list.
+		 * Objects of the active slab of the calling thread are freed without looking up their slab
 		 */
 		void deallocate(void *object) noexcept;
 
 		/**
-		 * \brief Deallocate all empty slabs
+		 * \brief Deallocate the object whose slab and index are known
+		 * \param slab Pointer to the slab holding the object
+		 * \param index Index of the object in the slab
+		 * \remarks If the object is already free in a tracked cache, error bit is set
+		 *
+		 * The destructor and constructor of the cache are not called, the caller handles the object itself
+		 */
+		void deallocateAt(slab_s *slab, size_t index) noexcept;
+
+		/**
+		 * \brief Deallocate several objects from cache
+		 * \param objects Array of pointers to the objects
+		 * \param count Number of objects
+		 * \remarks If any pointer is not valid, error bit is set
+		 *
+		 * The mutex is locked at most once for all the slabs that have to be moved to another list
+		 */
+		void deallocateBatch(void *const objects[], size_t count) noexcept;
+
+		/**
+		 * \brief Wake the allocations waiting for the objects of the cache
+		 * \remarks Mutex must be locked, or the lock of the processor cache the objects are returned to
+		 *
+		 * Allocations of the cache wait on the queue of its slab size
+		 */
+		void wakeWaiters() const noexcept;
+
+		/**
+		 * \brief Prepare the cache, when its header is mapped in a new process
+		 * \param name Name of the cache of the allocator, or nullptr to keep the interned name of the users
+		 *
+		 * Mutex is initialized again, the active slabs are returned, and the functions are cleared
+		 */
+		void reattach(const char name[]) noexcept;
+
+		/**
+		 * \brief Return the slabs owned by the threads and invalidate their entries
+		 * \remarks Mutex must be locked
+		 */
+		void deactivateAll() noexcept;
+
+		/**
+		 * \brief Set the number of the empty slabs the cache keeps
+		 * \param min_empty Number of empty slabs that shrinking keeps
+		 * \param max_empty Number of empty slabs kept when more become empty, \c NULL_INDEX if there is no limit
+		 */
+		void setEmptyLimits(size_t min_empty, size_t max_empty) noexcept;
+
+		/**
+		 * \brief Take the empty slabs over the limit out of the cache
+		 * \param released List where the slabs are moved
+		 * \param retained Number of empty slabs to keep
+		 * \remarks Mutex must be locked, the slabs are returned with \c releaseSlabs after it is unlocked
+		 *
+		 * Slabs that are about to be moved by a deallocation are kept
+		 */
+		void trimEmpty(SlabList &released, size_t retained) noexcept;
+
+		/**
+		 * \brief Return the slabs taken out of the cache to the buddy allocator
+		 * \param released List of the slabs
+		 * \return Number of blocks deallocated
+		 */
+		int releaseSlabs(SlabList &released) noexcept;
+
+		/**
+		 * \brief Return all slabs of the cache, if it has no allocated objects
+		 * \return True if the slabs were returned, false otherwise
+		 * \remarks If the cache is not empty, error bit is set, and the objects are reported if the cache tracks them
+		 */
+		bool destroy() noexcept;
+
+		/**
+		 * \brief Deallocate the empty slabs, except for the minimal number of them
 		 * \return Number of blocks deallocated
 		 */
 		int shrink() noexcept;
 
+		/**
+		 * \brief Move the objects out of the sparsest partially full slabs, and deallocate the emptied slabs
+		 * \return Number of blocks deallocated, or -1 if the objects of the cache can not be moved
+		 * \remarks If there is no block for sorting the slabs, error bit is set and 0 is returned
+		 *
+		 * The partially full slabs are sorted by their number of objects. The sparsest ones are emptied
+		 * only as long as the fullest ones have the space for their objects, so no slab is added.
+		 * Both are frozen by the cache itself for the duration of the pass, so no thread allocates from them,
+		 * while the frees of the other threads go to their remote lists as usual
+		 */
+		int defragment() noexcept;
+
 		/**
 		 * \brief Print info about the cache
 		 * \param os Output stream
@@ -236,85 +628,195 @@ namespace os2bn140314d {
 		int printErrorInfo(std::ostream &os) noexcept;
 
 		#pragma endregion 
+
+		#pragma region Defragmentation
+
+		static const size_t MAX_DEFRAG_CANDIDATES = BLOCK_SIZE / sizeof(defrag_candidate_s);	/**< Number of slabs one defragmentation pass considers */
+
+		/**
+		 * \brief Move the allocated objects of the slab into the target slabs
+		 * \param slab Pointer to the slab being emptied, frozen by the cache
+		 * \param targets Array of the target slabs, frozen by the cache
+		 * \param count Number of the target slabs
+		 * \param next Index of the target slab with free objects, advanced as the targets fill up
+		 *
+		 * The moved object is freed as by \c deallocate, so the destructor and constructor run on its old place.
+		 * The object the callback refuses to move stays, and its target is returned untouched
+		 */
+		void migrateSlab(slab_s *slab, const defrag_candidate_s targets[], size_t count, size_t &next) noexcept;
+
+		/**
+		 * \brief Move the objects out of the slabs in the memory range, and deallocate those slabs
+		 * \param begin Pointer to the start of the range
+		 * \param end Pointer past the end of the range
+		 * \return True if no slab of the cache is left in the range, false otherwise
+		 * \remarks If there is no block for the list of the slabs to empty, error bit is set
+		 *
+		 * The objects are moved to the slabs the calling thread allocates from, as by \c allocate.
+		 * The slab of the calling thread is returned first, the slabs the other threads own at the moment stay.
+		 * Empty slabs in the range are deallocated even if the cache would keep them
+		 */
+		bool evacuate(const void *begin, const void *end) noexcept;
+
+		/**
+		 * \brief Move the allocated objects of the slab into the newly allocated ones
+		 * \param slab Pointer to the slab being emptied, frozen by the cache
+		 * \return True if all objects were moved, false if the callback refused one, or there was no space
+		 */
+		bool evacuateSlab(slab_s *slab) noexcept;
+
+		#pragma endregion
 	};
 
-	struct cache_block_header_s {
+	/**
+	 * \brief Struct representing the slab owned by a thread in one cache
+	 */
+	struct active_slab_s {
+		cache_header_s *cache_;		/**< Pointer to the cache, or nullptr if the entry is not used */
+		size_t generation_;			/**< Generation of the cache when the slab was taken */
+		slab_s *slab_;				/**< Pointer to the active slab */
+	};
+
+	/**
+	 * \brief Struct representing the table of the active slabs of one thread
+	 *
+	 * The table is direct mapped, a cache whose entry is taken by another cache returns that slab first
+	 */
+	struct thread_slabs_s {
+		static const size_t NUMBER_OF_ENTRIES = 16;
+
 		#pragma region Fields
-		
-		cache_block_header_s *next_;
-		cache_block_header_s *prev_;
 
-		CacheHeaderList used_;
-		CacheHeaderList unused_;
+		active_slab_s entries_[NUMBER_OF_ENTRIES];	/**< Active slabs of the thread */
 
-		#pragma endregion 
+		static std::thread::id initializing_thread_;	/**< Thread that initialized the allocator */
+
+		#pragma endregion
 
 		#pragma region Methods
 
 		/**
-		 * \brief Initialize the block header
+		 * \brief Return all active slabs of the thread to their caches
+		 *
+		 * The thread that initialized the allocator keeps its slabs,
+		 * since the memory of the allocator may already be released when it exits
 		 */
-		void initialize() noexcept;
+		~thread_slabs_s();
 
 		/**
-		 * \brief Checks if the block can allocate more cache headers
-		 * \return True if additional headers can be allocated, false otherwise
+		 * \brief Get the table of the calling thread
+		 * \return Reference to the table
 		 */
-		bool hasMoreSpace() const noexcept;
+		static thread_slabs_s &local() noexcept;
 
 		/**
-		 * \brief Checks if the block has any allocated cache headers
-		 * \return True if there are no allocated cache headers, false otherwise
+		 * \brief Get the entry where the active slab of the cache is kept
+		 * \param cache Pointer to the cache
+		 * \return Reference to the entry
 		 */
-		bool isEmpty() const noexcept;
+		active_slab_s &entryFor(const cache_header_s *cache) noexcept;
 
 		/**
-		 * \brief Allocate one more cache header
-		 * \param name Human readable name of the cache
-		 * \param object_size Size of the cache object
-		 * \param constructor Constructor
-    	 * \param destructor Destructor
-    	 * \throw overflow_error If there is no more space for the header
+		 * \brief Return the slab of the entry to its cache, and clear the entry
+		 * \param entry Reference to the entry
+		 *
+		 * Nothing is returned if the cache was destroyed after the slab was taken
 		 */
-		cache_header_s *create(
-			const char name[],
-			size_t object_size,
-			void(*constructor)(void *),
-			void(*destructor)(void *)) throw(std::overflow_error);
+		static void release(active_slab_s &entry) noexcept;
+
+		#pragma endregion
+	};
 
+	/**
+	 * \brief Struct representing the objects of one small memory buffer cache kept by one processor
+	 */
+	struct cpu_buffer_cache_s {
+		static const size_t CAPACITY = 32;		/**< Maximum number of objects kept */
+		static const size_t BATCH = 16;			/**< Number of objects moved to or from the cache at once */
+
+		#pragma region Fields
+
+		std::atomic<bool> locked_;				/**< Lock held while the objects are changed */
+		size_t count_;							/**< Number of objects kept */
+		void *objects_[CAPACITY];				/**< Kept objects, the last one is used first */
+
+		#pragma endregion
+
+		#pragma region Methods
 
 		/**
-		 * \brief Check if block contains the header
-		 * \param header Pointer to the cache header
-		 * \return True if the block contains the header, false otherwise
+		 * \brief Initialize the cache
 		 */
-		bool contains(cache_header_s *header) const noexcept;
+		void initialize() noexcept;
 
 		/**
-		 * \brief Destroy the cache
-		 * \param header Pointer to the cache header
-		 * \return True if the destruction was successfull, false otherwise
-		 * \remarks If the cache is not empty, it will not be destroyed, and error bit will be set
+		 * \brief Lock the cache
+		 *
+		 * The lock is only contended when the thread is moved to another processor
+		 * in the middle of the operation, so spinning is cheaper than a mutex
 		 */
-		bool destroy(cache_header_s *header) noexcept;
+		void lock() noexcept;
 
-		#pragma endregion 
+		/**
+		 * \brief Unlock the cache
+		 */
+		void unlock() noexcept;
+
+		#pragma endregion
 	};
 
-	struct slab_header_s {
+	/**
+	 * \brief Header needed by the slab allocator
+	 *
+	 * The buffer caches looked up by every \c kmalloc share no cache line with the mutex
+	 */
+	struct alignas(CACHE_L1_LINE_SIZE) slab_header_s {
 		static const size_t BUFFER_SIZES_LOWER_BOUND = 5;
 		static const size_t BUFFER_SIZES_UPPER_BOUND = 17;
+		static const size_t NUMBER_OF_BUFFER_SIZES = BUFFER_SIZES_UPPER_BOUND - BUFFER_SIZES_LOWER_BOUND;
 
-		#pragma region Fields
+		/**
+		 * \brief Small memory buffer caches of one processor, kept in one block
+		 */
+		struct cpu_buffers_s {
+			cpu_buffer_cache_s caches_[NUMBER_OF_BUFFER_SIZES];
+		};
 
-		CacheBlockList headers_;	/**< List of header blocks */
+		static const size_t MAX_CPUS = BLOCK_SIZE / sizeof(std::atomic<cpu_buffers_s *>);
+		static const size_t NAME_BUCKETS = 32;
 
-		std::mutex mutex_;			/**< Mutex used for mutual exclusion */
+		#pragma region Fields
 
 		/**
 		 * \brief List of pointers to the small memory buffer cache headers
 		 */
-		cache_header_s *buffers_[BUFFER_SIZES_UPPER_BOUND - BUFFER_SIZES_LOWER_BOUND];
+		cache_header_s *buffers_[NUMBER_OF_BUFFER_SIZES];
+
+		/**
+		 * \brief Block with the pointers to the buffer caches of each processor, allocated on the first use
+		 */
+		std::atomic<std::atomic<cpu_buffers_s *> *> cpus_;
+
+		size_t number_of_cpus_;		/**< Number of processors with their own buffer caches */
+
+		cache_header_s *groups_;	/**< Cache of the accounting group headers */
+
+		/**
+		 * \brief Mutex used for mutual exclusion, kept apart from the buffer caches read by every \c kmalloc
+		 */
+		alignas(CACHE_L1_LINE_SIZE) std::mutex mutex_;
+
+		CacheHeaderList caches_;	/**< List of the caches created by the users */
+
+		/**
+		 * \brief Hash table of the interned cache names
+		 */
+		cache_name_s *names_[NAME_BUCKETS];
+
+		/**
+		 * \brief Cache of the cache headers, the only header that is not allocated from it
+		 */
+		cache_header_s cache_cache_;
 
 		#pragma endregion 
 
@@ -331,6 +833,7 @@ namespace os2bn140314d {
 		* \param object_size Size of the object in cache
 		* \param constructor Constructor
 		* \param destructor Destructor
+		* \param flags Combination of the \c KMEM_CACHE flags
 		* \return Cache object
 		*
 		* If there is no need for a constructor or destructor,
@@ -340,7 +843,8 @@ namespace os2bn140314d {
 			const char name[],
 			size_t object_size,
 			void(*constructor)(void *),
-			void(*destructor)(void *)) noexcept;
+			void(*destructor)(void *),
+			unsigned flags) noexcept;
 
 		/**
 		 * \brief Deallocate one cache
@@ -349,8 +853,129 @@ namespace os2bn140314d {
 		 */
 		bool destroy(cache_header_s *header) noexcept;
 
+		/**
+		 * \brief Allocate the cache header from the cache of the cache headers
+		 * \param name Name of the cache, which must outlive it
+		 * \param object_size Size of the object in cache
+		 * \param constructor Constructor
+		 * \param destructor Destructor
+		 * \param flags Combination of the \c KMEM_CACHE flags
+		 * \return Cache object, or nullptr if there is no more space, or the object size is 0 or too big
+		 */
+		cache_header_s *allocateCache(
+			const char name[],
+			size_t object_size,
+			void(*constructor)(void *),
+			void(*destructor)(void *),
+			unsigned flags) noexcept;
+
+		/**
+		 * \brief Allocate the interned name that is not yet in the table
+		 * \param name Name of the cache
+		 * \param hash Hash of the name
+		 * \return Pointer to the name with no references, or nullptr if there is no more space
+		 *
+		 * The name is allocated before locking, since the buffer allocation may lock the mutex
+		 */
+		cache_name_s *allocateName(const char name[], size_t hash) noexcept;
+
+		/**
+		 * \brief Find the interned name, or insert the allocated one, and add a reference to it
+		 * \param name Name of the cache
+		 * \param hash Hash of the name
+		 * \param allocated Name allocated by \c allocateName, or nullptr if only the interned names should be searched
+		 * \return Pointer to the interned name, or nullptr if it is not found and no name was allocated
+		 * \remarks Mutex must be locked. If the name was already interned, the allocated one is not used
+		 */
+		cache_name_s *internName(const char name[], size_t hash, cache_name_s *allocated) noexcept;
+
+		/**
+		 * \brief Remove a reference to the interned name
+		 * \param name Pointer to the interned name
+		 * \return True if the name was removed from the table, and it should be deallocated after unlocking
+		 * \remarks Mutex must be locked
+		 */
+		bool releaseName(cache_name_s *name) noexcept;
+
+		/**
+		 * \brief Deallocate the name that is not in the table
+		 * \param name Pointer to the name
+		 */
+		void deallocateName(cache_name_s *name) noexcept;
+
+		/**
+		 * \brief Hash the name of the cache
+		 * \param name Name of the cache
+		 * \return Hash of at most \c MAX_NAME_LENGTH - 1 characters
+		 */
+		static size_t hashName(const char name[]) noexcept;
+
+		/**
+		 * \brief Get the buffer caches of the processor the calling thread is running on
+		 * \return Pointer to the caches, or nullptr if there is no space for them
+		 */
+		cpu_buffers_s *cpuBuffers() noexcept;
+
+		/**
+		 * \brief Allocate one small memory buffer through the cache of the current processor
+		 * \param power Size of the buffer as a power of two
+		 * \return Pointer to the buffer, or nullptr if there is no more space
+		 *
+		 * The processor cache is refilled with a batch of objects from the buffer cache when it is empty
+		 */
+		void *bufferAllocate(size_t power) noexcept;
+
+		/**
+		 * \brief Deallocate one small memory buffer through the cache of the current processor
+		 * \param cache Pointer to the buffer cache holding the buffer
+		 * \param buffer Pointer to the buffer
+		 *
+		 * A batch of objects is returned to the buffer cache when the processor cache is full
+		 */
+		void bufferDeallocate(cache_header_s *cache, void *buffer) noexcept;
+
+		/**
+		 * \brief Move the objects of the movable caches out of the memory range
+		 * \param begin Pointer to the start of the range
+		 * \param end Pointer past the end of the range
+		 * \return True if no slab of a movable cache is left in the range, false otherwise
+		 *
+		 * The header is locked for the whole pass, so no cache is destroyed while its slabs are moved
+		 */
+		bool evacuate(const void *begin, const void *end) noexcept;
+
+		/**
+		 * \brief Lock the header, the processor caches and all the caches
+		 *
+		 * Locks are taken in the order the allocation paths nest them,
+		 * so no structure of the slab allocator is changed until \c unlockAll
+		 */
+		void lockAll() noexcept;
+
+		/**
+		 * \brief Unlock everything locked by \c lockAll
+		 */
+		void unlockAll() noexcept;
+
+		/**
+		 * \brief Prepare the header and all the caches, when the header is mapped in a new process
+		 *
+		 * Mutexes are initialized again, the slabs of the threads of the old process are returned,
+		 * and the functions of the caches and the groups are cleared, since the code may be mapped elsewhere
+		 */
+		void reattach() noexcept;
+
+		/**
+		 * \brief Find the cache created by the users with the given name
+		 * \param name Name of the cache
+		 * \return Pointer to the first such cache, or nullptr if there is none
+		 */
+		cache_header_s *find(const char name[]) noexcept;
+
 		#pragma endregion 
 	};
+
+	static_assert(sizeof(slab_header_s::cpu_buffers_s) <= BLOCK_SIZE, "Buffer caches of one processor must fit in one block");
 }
 
 #endif
@@ -7,6 +7,7 @@
 #define _slabutility_h_
 
 #include "SlabStructs.h"
+#include "Group.h"
 
 namespace os2bn140314d {
 
@@ -23,6 +24,7 @@ namespace os2bn140314d {
 		* \param object_size Size of the object in cache
 		* \param constructor Constructor
 		* \param destructor Destructor
+		* \param flags Combination of the \c KMEM_CACHE flags
 		* \return Cache object
 		*
 		* If there is no need for a constructor or destructor,
@@ -32,7 +34,40 @@ namespace os2bn140314d {
 			const char name[],
 			size_t object_size,
 			void(*constructor)(void *),
-			void(*destructor)(void *)) noexcept;
+			void(*destructor)(void *),
+			unsigned flags) noexcept;
+
+		/**
+		* \brief Allocate cache whose objects can be moved
+		* \param name Name of the cache
+		* \param object_size Size of the object in cache
+		* \param constructor Constructor
+		* \param destructor Destructor
+		* \param migrate Function moving the object from the first pointer to the second one, returning 0 if it must stay
+		* \return Cache object
+		*
+		* The cache tracks its objects, so the defragmentation can find them
+		*/
+		static cache_header_s *createMovable(
+			const char name[],
+			size_t object_size,
+			void(*constructor)(void *),
+			void(*destructor)(void *),
+			int(*migrate)(void *, void *)) noexcept;
+
+		/**
+		* \brief Find the cache of an attached persistent pool, and set its functions
+		* \param name Name of the cache
+		* \param constructor Constructor
+		* \param destructor Destructor
+		* \param migrate Function moving the objects, or nullptr if the cache is not movable
+		* \return Cache object, or nullptr if there is no cache with the name
+		*/
+		static cache_header_s *open(
+			const char name[],
+			void(*constructor)(void *),
+			void(*destructor)(void *),
+			int(*migrate)(void *, void *)) noexcept;
 
 		/**
 		* \brief Shrink cache
@@ -41,6 +76,21 @@ namespace os2bn140314d {
 		*/
 		static int shrink(cache_header_s *cache) noexcept;
 
+		/**
+		* \brief Move the objects out of the sparsest slabs of the cache, and deallocate the emptied slabs
+		* \param cache Pointer to the cache
+		* \return Number of deallocated blocks, or -1 if the objects of the cache can not be moved
+		*/
+		static int defragment(cache_header_s *cache) noexcept;
+
+		/**
+		* \brief Set the number of the empty slabs the cache keeps
+		* \param cache Pointer to the cache
+		* \param min_empty Number of empty slabs that shrinking keeps
+		* \param max_empty Number of empty slabs kept when more become empty, \c NULL_INDEX if there is no limit
+		*/
+		static void setEmptyLimits(cache_header_s *cache, size_t min_empty, size_t max_empty) noexcept;
+
 		/**
 		* \brief Allocate one object from cache
 		* \param cache Pointer to the cache
@@ -48,6 +98,14 @@ namespace os2bn140314d {
 		*/
 		static void *allocate(cache_header_s *cache) noexcept;
 
+		/**
+		* \brief Allocate one object from cache, waiting for memory if there is none
+		* \param cache Pointer to the cache
+		* \param timeout_milliseconds Longest time to wait, 0 to not wait, negative to wait without a limit
+		* \return Allocated object, or nullptr if the timeout expired
+		*/
+		static void *allocateWait(cache_header_s *cache, long long timeout_milliseconds) noexcept;
+
 		/**
 		* \brief Deallocate one object from cache
 		* \param cache Pointer to the cache
@@ -55,6 +113,31 @@ namespace os2bn140314d {
 		*/
 		static void deallocate(cache_header_s *cache, void *object) noexcept;
 
+		/**
+		* \brief Allocate one object from cache, and charge it to the group
+		* \param cache Pointer to the cache
+		* \param group Pointer to the group
+		* \return Allocated object, or nullptr if the group is at its limit or there is no more space
+		*/
+		static void *allocateCharged(cache_header_s *cache, group_header_s *group) noexcept;
+
+		/**
+		* \brief Deallocate one object from cache, and return its charge to the group
+		* \param cache Pointer to the cache
+		* \param group Pointer to the group the object was charged to
+		* \param object Pointer to the object
+		*/
+		static void deallocateCharged(cache_header_s *cache, group_header_s *group, void *object) noexcept;
+
+		/**
+		* \brief Visit every allocated object of the cache
+		* \param cache Pointer to the cache
+		* \param callback Function called with each object and the context
+		* \param context Pointer passed to the callback
+		* \return Number of visited objects, or -1 if the cache does not track its objects
+		*/
+		static long long walk(cache_header_s *cache, void(*callback)(void *, void *), void *context);
+
 		/**
 		* \brief Allocate one small memory buffer
 		* \param size Size of the buffer
@@ -62,12 +145,64 @@ namespace os2bn140314d {
 		*/
 		static void *bufferAllocate(size_t size) noexcept;
 
+		/**
+		* \brief Allocate one small memory buffer with the given alignment
+		* \param size Size of the buffer
+		* \param alignment Alignment of the buffer, at most one cache line
+		* \return Pointer to the allocated buffer, or nullptr if there is no buffer cache for the size and alignment, or no more space
+		*/
+		static void *bufferAllocate(size_t size, size_t alignment) noexcept;
+
+		/**
+		* \brief Allocate one small memory buffer, waiting for memory if there is none
+		* \param size Size of the buffer
+		* \param timeout_milliseconds Longest time to wait, 0 to not wait, negative to wait without a limit
+		* \return Pointer to the allocated buffer, or nullptr if there is no buffer cache for the size, or the timeout expired
+		*/
+		static void *bufferAllocateWait(size_t size, long long timeout_milliseconds) noexcept;
+
+		/**
+		* \brief Allocate one small memory buffer, and charge it to the group
+		* \param size Size of the buffer
+		* \param group Pointer to the group
+		* \return Pointer to the allocated buffer, or nullptr if the group is at its limit, there is no buffer cache for the size, or no more space
+		*
+		* The whole buffer the size is rounded up to is charged
+		*/
+		static void *bufferAllocateCharged(size_t size, group_header_s *group) noexcept;
+
 		/**
 		* \brief Deallocate one small memory buffer
 		* \param buffer Pointer to a buffer obtained by \c bufferAllocate
 		*/
 		static void bufferDeallocate(const void *buffer) noexcept;
 
+		/**
+		* \brief Deallocate one small memory buffer, and return its charge to the group
+		* \param buffer Pointer to a buffer obtained by \c bufferAllocateCharged
+		* \param group Pointer to the group the buffer was charged to
+		*/
+		static void bufferDeallocateCharged(const void *buffer, group_header_s *group) noexcept;
+
+		/**
+		* \brief Deallocate one small memory buffer whose size is known
+		* \param buffer Pointer to a buffer obtained by \c bufferAllocate
+		* \param size Size passed to \c bufferAllocate
+		* \param alignment Alignment passed to \c bufferAllocate
+		*
+		* The buffer cache is chosen by the size, without looking up the slab of the buffer
+		*/
+		static void bufferDeallocate(const void *buffer, size_t size, size_t alignment) noexcept;
+
+		/**
+		* \brief Get the buffer cache serving the size and alignment
+		* \param size Size of the buffer
+		* \param alignment Alignment of the buffer
+		* \return Size of the buffer cache as a power of two, not less than \c BUFFER_SIZES_LOWER_BOUND,
+		* or \c NULL_INDEX if the alignment is greater than one cache line
+		*/
+		static size_t bufferPower(size_t size, size_t alignment) noexcept;
+
 		/**
 		* \brief Deallocate cache
 		* \param cache Pointer to the cache
@@ -0,0 +1,74 @@
+/**
+* \file StackTrace.h
+* \brief File providing the functions for capturing and printing stack traces
+*/
+
+#ifndef _stacktrace_h_
+#define _stacktrace_h_
+
+#include <cstddef> // size_t
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct representing one captured stack trace
+	 */
+	struct stack_trace_s {
+		static const size_t MAX_FRAMES = 16;
+
+		void *frames_[MAX_FRAMES];	/**< Return addresses, the innermost first */
+		size_t size_;				/**< Number of captured frames */
+	};
+
+	/**
+	 * \brief Utility class for capturing stack traces and reporting errors
+	 *
+	 * The output functions write straight to the standard error,
+	 * so they can be used from a signal handler
+	 */
+	class StackTrace final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Capture the stack trace of the calling thread
+		 * \param trace Struct where the trace is stored
+		 */
+		static void capture(stack_trace_s &trace) noexcept;
+
+		/**
+		 * \brief Print the stack trace to the standard error
+		 * \param trace Captured stack trace
+		 */
+		static void print(const stack_trace_s &trace) noexcept;
+
+		/**
+		 * \brief Write the string to the standard error
+		 * \param string Null terminated string
+		 */
+		static void write(const char *string) noexcept;
+
+		/**
+		 * \brief Write the number to the standard error
+		 * \param number Number to write
+		 * \param hex True if the number should be written in hexadecimal, false for decimal
+		 */
+		static void writeNumber(size_t number, bool hex) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Delete constructors
+
+		StackTrace() = delete;
+		StackTrace(const StackTrace &) = delete;
+		void operator=(const StackTrace &) = delete;
+
+		#pragma endregion
+
+	};
+}
+
+#endif
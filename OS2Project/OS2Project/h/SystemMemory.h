@@ -0,0 +1,129 @@
+/**
+* \file SystemMemory.h
+* \brief File providing the functions for obtaining memory from the operating system
+*/
+
+#ifndef _systemmemory_h_
+#define _systemmemory_h_
+
+#include "Definitions.h" // Block
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Utility class wrapping the operating system memory mapping calls
+	 */
+	class SystemMemory final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Map fresh memory from the operating system
+		 * \param size_in_blocks Size of the memory in blocks
+		 * \return Pointer to the mapped memory, or nullptr if the mapping failed
+		 */
+		static void *allocate(size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Return the memory obtained by \c allocate to the operating system
+		 * \param memory Pointer to the mapped memory
+		 * \param size_in_blocks Size of the memory in blocks
+		 */
+		static void deallocate(void *memory, size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Map fresh huge page aligned memory from the operating system
+		 * \param size_in_blocks Size of the memory in blocks, multiple of the huge page size
+		 * \param explicit_pages True if explicit huge pages should be requested, false if transparent huge pages should be advised
+		 * \return Pointer to the mapped memory, or nullptr if the mapping failed
+		 *
+		 * If explicit huge pages are not available, the memory is mapped with normal pages, and huge pages are advised
+		 */
+		static void *allocateHuge(size_t size_in_blocks, bool explicit_pages) noexcept;
+
+		/**
+		 * \brief Advise the operating system to back the memory with transparent huge pages
+		 * \param memory Pointer to the memory, aligned to the huge page size
+		 * \param size Size of the memory in bytes
+		 */
+		static void adviseHuge(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Return the physical pages of the memory to the operating system, keeping the address range usable
+		 * \param memory Pointer to the memory, aligned to the page size
+		 * \param size Size of the memory in bytes, multiple of the page size
+		 * \param lazy True if the pages may be reclaimed lazily, false if they should be dropped immediately
+		 * \return True if the pages were dropped immediately, false otherwise
+		 * \remarks Only private anonymous memory reads as zeros once its pages are dropped
+		 */
+		static bool purge(void *memory, size_t size, bool lazy) noexcept;
+
+		/**
+		 * \brief Change the access to the memory
+		 * \param memory Pointer to the memory, aligned to the page size
+		 * \param size Size of the memory in bytes, multiple of the page size
+		 * \param accessible True if the memory should be readable and writable, false if every access should fault
+		 * \return True if the protection was changed, false otherwise
+		 */
+		static bool protect(void *memory, size_t size, bool accessible) noexcept;
+
+		/**
+		 * \brief Reserve the address range without making it accessible, so nothing else is mapped there
+		 * \param address Start of the range, aligned to the page size
+		 * \param size_in_blocks Size of the range in blocks
+		 * \param replace True if the range is mapped by \c mapFile, and the mapping is turned back into the reservation, false if the range must be free
+		 * \return Pointer to the range, always equal to the address, or nullptr if a part of the range is taken
+		 */
+		static void *reserve(void *address, size_t size_in_blocks, bool replace) noexcept;
+
+		/**
+		 * \brief Map the file shared, so the changes of the memory reach the file
+		 * \param path Path of the file
+		 * \param size_in_blocks Size the file is created or truncated to, or 0 to map the existing file whole
+		 * \param reserved Start of the range obtained by \c reserve that the file is mapped over, or nullptr if any address will do
+		 * \param reserved_blocks Size of the reserved range in blocks, a bigger file is refused
+		 * \param mapped_blocks Set to the size of the mapping in blocks
+		 * \return Pointer to the mapped memory, or nullptr if the file could not be opened, or does not fit in the range
+		 * \remarks On Windows the whole reservation is released for the mapping, the range past the file is free again
+		 */
+		static void *mapFile(const char *path, size_t size_in_blocks, void *reserved, size_t reserved_blocks, size_t &mapped_blocks) noexcept;
+
+		/**
+		 * \brief Write the changed memory of the mapping to its file
+		 * \param memory Pointer to the memory, aligned to the page size
+		 * \param size Size of the memory in bytes
+		 * \return True if the memory was written, false otherwise
+		 */
+		static bool flushFile(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Unmap the memory obtained by \c mapFile
+		 * \param memory Pointer to the mapped memory
+		 * \param size_in_blocks Size of the mapping in blocks
+		 */
+		static void unmapFile(void *memory, size_t size_in_blocks) noexcept;
+
+		/**
+		 * \brief Get the size of one page of the operating system
+		 * \return Size of the page in bytes
+		 */
+		static size_t pageSize() noexcept;
+
+		#pragma endregion
+
+	private:
+		static const size_t HUGE_ALLOCATION_ATTEMPTS = 8;	/**< Times an aligned range is looked for on Windows, where it may be taken before it is allocated */
+
+		#pragma region Delete constructors
+
+		SystemMemory() = delete;
+		SystemMemory(const SystemMemory &) = delete;
+		void operator=(const SystemMemory &) = delete;
+
+		#pragma endregion
+
+	};
+}
+
+#endif
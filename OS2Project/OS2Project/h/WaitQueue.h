@@ -0,0 +1,125 @@
+/**
+* \file WaitQueue.h
+* \brief File providing the queues of the allocations waiting for memory
+*/
+
+#ifndef _waitqueue_h_
+#define _waitqueue_h_
+
+#include <atomic> // atomic
+#include <condition_variable> // condition_variable
+#include <cstdint> // uint64_t
+#include <mutex> // mutex
+#include "Definitions.h" // POWERS_OF_TWO
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct representing the threads waiting for the blocks of one size
+	 */
+	struct wait_queue_s {
+		std::mutex mutex_;						/**< Mutex protecting the counters */
+		std::condition_variable condition_;		/**< Condition the waiting threads sleep on */
+		size_t waiters_;						/**< Number of the waiting threads */
+		size_t wakeups_;						/**< Number of the wakeups, a waiter sleeps until it changes */
+	};
+
+	/**
+	 * \brief Utility class parking the failed allocations until memory of their size is deallocated
+	 *
+	 * There is one queue for each size of the buddy blocks. Buddy allocations wait on the queue of their size,
+	 * and cache allocations on the queue of the size of their slabs. A deallocated buddy block wakes the queues
+	 * of its size and the smaller ones, and an object returned to a cache the queue of the slab size, so
+	 * the threads waiting for the big blocks sleep through the small deallocations.
+	 *
+	 * A waiter is announced before it tries to allocate again, and a deallocation checks the waiters
+	 * under the same lock that the allocation takes, so a wakeup between the two is not lost.
+	 * Without waiters, a deallocation only loads one mask.
+	 */
+	class WaitQueue final {
+	public:
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Allocate, and if there is no memory, wait until the deallocations make room or the timeout expires
+		 * \param power Size of the blocks the allocation needs, 2^power blocks
+		 * \param attempt Function trying the allocation, returning nullptr if there is no memory
+		 * \param context Pointer passed to the function
+		 * \param timeout_milliseconds Longest time to wait, 0 to try only once, negative to wait without a limit
+		 * \return Pointer returned by the function, or nullptr if the timeout expired
+		 */
+		static void *wait(size_t power, void *(*attempt)(void *), void *context, long long timeout_milliseconds) noexcept;
+
+		/**
+		 * \brief Wake the allocations waiting for the blocks of the given size
+		 * \param power Size of the blocks, 2^power blocks
+		 * \remarks Lock taken by the allocations of that size must be held
+		 */
+		static void wake(size_t power) noexcept {
+			auto waiting = waiting_.load(std::memory_order_relaxed) & (static_cast<uint64_t>(1) << power);
+
+			if (waiting != 0) {
+				wakeQueues(waiting);
+			}
+		}
+
+		/**
+		 * \brief Wake the allocations waiting for the blocks of the given size or smaller
+		 * \param power Size of the deallocated block, 2^power blocks
+		 * \remarks Lock taken by the allocations of those sizes must be held
+		 */
+		static void wakeUpTo(size_t power) noexcept {
+			auto mask = power + 1 < POWERS_OF_TWO ? (static_cast<uint64_t>(1) << (power + 1)) - 1 : ~static_cast<uint64_t>(0);
+			auto waiting = waiting_.load(std::memory_order_relaxed) & mask;
+
+			if (waiting != 0) {
+				wakeQueues(waiting);
+			}
+		}
+
+		/**
+		 * \brief Check if any allocation waits for the blocks bigger than the given size
+		 * \param power Size of the blocks, 2^power blocks
+		 * \return True if there are waiters for the bigger blocks, false otherwise
+		 * \remarks Lock taken by the allocations of those sizes must be held
+		 */
+		static bool waitingAbove(size_t power) noexcept {
+			return (waiting_.load(std::memory_order_relaxed) >> power >> 1) != 0;
+		}
+
+		#pragma endregion
+
+	private:
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Wake every thread waiting on the queues
+		 * \param waiting Mask of the sizes whose queues are woken
+		 */
+		static void wakeQueues(uint64_t waiting) noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		static std::atomic<uint64_t> waiting_;			/**< Mask of the sizes that have waiting threads */
+
+		static wait_queue_s queues_[POWERS_OF_TWO];		/**< Queue for each size */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		WaitQueue() = delete;
+		WaitQueue(const WaitQueue &) = delete;
+		void operator=(const WaitQueue &) = delete;
+
+		#pragma endregion
+
+		friend class AllocatorUtility;
+	};
+}
+
+#endif
@@ -0,0 +1,950 @@
+/**
+* \file MallocShim.cpp
+* \brief Replacement of the heap functions of the C and C++ libraries, loaded with \c LD_PRELOAD
+*
+* Linux only. The shim is built into one shared library together with all the sources of the allocator,
+* listed in \c SOURCES, and \c size_t is declared up front for the public interface:
+*
+*     g++ -std=c++17 -O2 -fPIC -shared -fvisibility=hidden -fno-semantic-interposition -ftls-model=initial-exec
+*         -pthread -include cstddef -Ih preload/MallocShim.cpp $SOURCES -ldl -o libkmem.so
+*     LD_PRELOAD=./libkmem.so program
+*
+* Only the heap functions are exported, so the calls inside of the allocator are bound directly
+* instead of going through the procedure linkage table.
+*
+* The pool is mapped on the first call. Its size in blocks is read from \c KMEM_PRELOAD_BLOCKS,
+* and the size of the regions mapped when the pool runs out from \c KMEM_PRELOAD_GROW_BLOCKS.
+*/
+
+#ifndef __linux__
+#error The malloc shim is only supported on Linux
+#endif
+
+#include <atomic> // atomic
+#include <cerrno> // errno
+#include <cstddef> // max_align_t
+#include <cstdlib> // getenv, strtoull
+#include <cstring> // memcpy, memset
+#include <new> // bad_alloc, new_handler
+#include <thread> // yield
+#include <malloc.h> // memalign, malloc_usable_size
+#include <dlfcn.h> // dlsym
+#include <pthread.h> // pthread_atfork
+#include "Slab.h" // kmem_init
+#include "AllocatorUtility.h" // AllocatorUtility
+#include "SlabUtility.h" // Slab
+#include "SystemMemory.h" // SystemMemory
+#include "HeapProfiler.h" // HeapProfiler
+
+#define KMEM_EXPORT __attribute__((visibility("default")))
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Header of one chunk of the bootstrap arena
+	 */
+	struct bootstrap_chunk_s {
+		size_t size_;			/**< Usable size of the chunk in bytes */
+		size_t bin_;			/**< Bin the chunk is returned to, or \c NULL_INDEX if it is never reused */
+	};
+
+	/**
+	 * \brief Header placed right before the memory aligned to more than one block
+	 */
+	struct aligned_chunk_s {
+		void *start_;			/**< Start of the blocks taken from the buddy allocator */
+		size_t blocks_;			/**< Number of blocks passed to the buddy allocator */
+	};
+
+	/**
+	 * \brief Utility class routing the heap functions of the process to the allocator
+	 *
+	 * Sizes with a small memory buffer cache are served by it, bigger ones by the buddy allocator.
+	 * The block of a big allocation is marked in the owner table with the address of a marker
+	 * for its power of two, so freeing finds its size without a header, and slab objects are
+	 * recognized by their slab being the owner.
+	 *
+	 * Calls made while the thread is already inside of the allocator, like the registration
+	 * of the thread local destructors, and calls made while another thread maps the pool,
+	 * are served from a static bootstrap arena. Its chunks are recycled through bins of
+	 * powers of two, and freeing them never reaches the allocator.
+	 */
+	class MallocShim final {
+	public:
+
+		static const size_t MIN_ALIGNMENT = alignof(std::max_align_t);	/**< Alignment of every allocation, as the C library guarantees */
+		static const size_t DEFAULT_BLOCKS = 16384;					/**< Size of the pool in blocks, if the environment does not set it */
+
+		#pragma region Public interface
+
+		/**
+		 * \brief Allocate the memory
+		 * \param size Size of the memory in bytes
+		 * \param alignment Alignment of the memory, a power of two
+		 * \param zero True if the memory must be filled with zeros
+		 * \return Pointer to the memory, or nullptr with \c errno set if there is not enough memory
+		 */
+		static void *allocate(size_t size, size_t alignment, bool zero) noexcept;
+
+		/**
+		 * \brief Allocate the memory of the C++ objects
+		 * \param size Size of the memory in bytes
+		 * \param alignment Alignment of the memory, a power of two
+		 * \param nothrow True if nullptr should be returned on failure, false if \c std::bad_alloc should be thrown
+		 * \return Pointer to the memory
+		 *
+		 * The new handler is called for as long as it is set and the memory can not be allocated
+		 */
+		static void *allocateObject(size_t size, size_t alignment, bool nothrow);
+
+		/**
+		 * \brief Deallocate the memory
+		 * \param memory Pointer to the memory, nullptr is ignored
+		 */
+		static void deallocate(void *memory) noexcept;
+
+		/**
+		 * \brief Deallocate the memory whose size is known
+		 * \param memory Pointer to the memory, nullptr is ignored
+		 * \param size Size passed to \c allocate
+		 * \param alignment Alignment passed to \c allocate
+		 *
+		 * The size picks the buffer cache, so the slab of the memory is not looked up
+		 */
+		static void deallocate(void *memory, size_t size, size_t alignment) noexcept;
+
+		/**
+		 * \brief Change the size of the memory
+		 * \param memory Pointer to the memory, or nullptr to allocate new memory
+		 * \param size New size in bytes, 0 to deallocate the memory
+		 * \return Pointer to the memory holding the old contents, or nullptr if there is not enough memory,
+		 * in which case the old memory is kept
+		 */
+		static void *reallocate(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Get the number of bytes that can be used in the memory
+		 * \param memory Pointer to the memory
+		 * \return Usable size in bytes, or 0 if the memory was not allocated by the shim
+		 */
+		static size_t usableSize(const void *memory) noexcept;
+
+		#pragma endregion
+
+	private:
+
+		/**
+		 * \brief State of the pool of the process
+		 */
+		enum ShimState : int {
+			UNINITIALIZED = 0,	/**< No call has been made yet */
+			INITIALIZING = 1,	/**< Pool is being mapped by one thread */
+			READY = 2,			/**< Allocator can be used */
+			FAILED = 3			/**< Pool could not be mapped, only the bootstrap arena serves the calls */
+		};
+
+		static const size_t BOOTSTRAP_SIZE = 1 << 20;				/**< Size of the bootstrap arena in bytes */
+		static const size_t BOOTSTRAP_BINS = 13;					/**< Number of bins, bin i keeps the chunks of 16 << i bytes */
+
+		#pragma region Helpers
+
+		/**
+		 * \brief Mark the calling thread as inside of the allocator, mapping the pool on the first call
+		 * \return True if the allocator can be used, false if the call must be served from the bootstrap arena
+		 */
+		static bool enter() noexcept {
+			if (inside_) {
+				return false;
+			}
+
+			inside_ = true;
+
+			if (state_.load(std::memory_order_acquire) == READY || initialize()) {
+				return true;
+			}
+
+			inside_ = false;
+
+			return false;
+		}
+
+		/**
+		 * \brief Mark the calling thread as outside of the allocator
+		 */
+		static void leave() noexcept {
+			inside_ = false;
+		}
+
+		/**
+		 * \brief Map the pool and initialize the allocator, if no other thread has started it
+		 * \return True if the allocator is ready, false otherwise
+		 */
+		static bool initialize() noexcept;
+
+		/**
+		 * \brief Read the size in blocks from the environment
+		 * \param name Name of the variable
+		 * \param fallback Size used if the variable is not set or not valid
+		 * \return Size in blocks
+		 */
+		static size_t environment(const char name[], size_t fallback) noexcept;
+
+		/**
+		 * \brief Allocate the memory that no buffer cache serves from the buddy allocator
+		 * \param size Size of the memory in bytes
+		 * \param alignment Alignment of the memory, a power of two
+		 * \param zero True if the memory must be filled with zeros
+		 * \return Pointer to the memory, or nullptr if there is not enough memory
+		 */
+		static void *allocateLarge(size_t size, size_t alignment, bool zero) noexcept;
+
+		/**
+		 * \brief Deallocate the memory served by the buddy allocator
+		 * \param memory Pointer to the memory
+		 * \param owner Marker found in the owner table
+		 */
+		static void deallocateLarge(void *memory, const void *owner) noexcept;
+
+		/**
+		 * \brief Check if the memory was allocated by the C library rather than by the shim
+		 * \param memory Pointer to the memory
+		 * \return True if neither the bootstrap arena nor the allocator holds the memory, false otherwise
+		 *
+		 * The dynamic loader allocates from its own heap before the shim is bound, and may free or reallocate that memory later
+		 */
+		static bool isForeign(const void *memory) noexcept;
+
+		/**
+		 * \brief Free the memory of the C library with its own \c free
+		 * \param memory Pointer to the memory
+		 */
+		static void foreignDeallocate(void *memory) noexcept;
+
+		/**
+		 * \brief Change the size of the memory of the C library with its own \c realloc
+		 * \param memory Pointer to the memory
+		 * \param size New size in bytes
+		 * \return Pointer to the memory, or nullptr if there is not enough memory, or no library defines the function
+		 */
+		static void *foreignReallocate(void *memory, size_t size) noexcept;
+
+		/**
+		 * \brief Check if the owner is one of the markers of the big allocations
+		 * \param owner Owner of the memory
+		 * \return True if it is a marker, false otherwise
+		 */
+		static bool isLarge(const void *owner) noexcept;
+
+		/**
+		 * \brief Allocate the zeroed memory from the bootstrap arena
+		 * \param size Size of the memory in bytes
+		 * \param alignment Alignment of the memory, a power of two
+		 * \return Pointer to the memory, or nullptr with \c errno set if the arena is exhausted
+		 */
+		static void *bootstrapAllocate(size_t size, size_t alignment) noexcept;
+
+		/**
+		 * \brief Return the chunk to its bin
+		 * \param memory Pointer to the memory of the chunk
+		 */
+		static void bootstrapDeallocate(void *memory) noexcept;
+
+		/**
+		 * \brief Check if the memory belongs to the bootstrap arena
+		 * \param memory Pointer to the memory
+		 * \return True if the memory is in the arena, false otherwise
+		 */
+		static bool inBootstrap(const void *memory) noexcept;
+
+		/**
+		 * \brief Lock the bootstrap arena
+		 */
+		static void bootstrapLock() noexcept;
+
+		/**
+		 * \brief Unlock the bootstrap arena
+		 */
+		static void bootstrapUnlock() noexcept;
+
+		/**
+		 * \brief Lock the allocator and the bootstrap arena before the process forks
+		 */
+		static void prepareFork() noexcept;
+
+		/**
+		 * \brief Unlock the allocator and the bootstrap arena in the parent
+		 */
+		static void parentFork() noexcept;
+
+		/**
+		 * \brief Unlock the allocator and the bootstrap arena in the child
+		 */
+		static void childFork() noexcept;
+
+		#pragma endregion
+
+		#pragma region Fields
+
+		static thread_local bool inside_ __attribute__((tls_model("initial-exec")));	/**< True while the thread is inside of the allocator */
+
+		static std::atomic<int> state_;								/**< State of the pool */
+
+		alignas(CACHE_L1_LINE_SIZE) static byte bootstrap_[BOOTSTRAP_SIZE];	/**< Memory of the bootstrap arena */
+		static size_t bootstrap_used_;								/**< Number of bytes of the arena taken by the chunks */
+		static bootstrap_chunk_s *bins_[BOOTSTRAP_BINS];			/**< Lists of the free chunks, linked through their memory */
+		static std::atomic<bool> bootstrap_locked_;					/**< Lock held while the arena is changed */
+
+		static byte large_marks_[POWERS_OF_TWO];					/**< Owners of the big allocations, one for each power of two */
+		static byte aligned_mark_;									/**< Owner of the allocations aligned to more than one block */
+
+		#pragma endregion
+
+		#pragma region Delete constructors
+
+		MallocShim() = delete;
+		MallocShim(const MallocShim &) = delete;
+		void operator=(const MallocShim &) = delete;
+
+		#pragma endregion
+
+	};
+
+	#pragma region MallocShim implementation
+
+	// Every field is initialized statically, the shim may be called before any constructor of the library runs
+	thread_local bool MallocShim::inside_ = false;
+
+	std::atomic<int> MallocShim::state_(UNINITIALIZED);
+
+	alignas(CACHE_L1_LINE_SIZE) byte MallocShim::bootstrap_[BOOTSTRAP_SIZE];
+	size_t MallocShim::bootstrap_used_ = 0;
+	bootstrap_chunk_s *MallocShim::bins_[BOOTSTRAP_BINS];
+	std::atomic<bool> MallocShim::bootstrap_locked_(false);
+
+	byte MallocShim::large_marks_[POWERS_OF_TWO];
+	byte MallocShim::aligned_mark_;
+
+	void *MallocShim::allocate(size_t size, size_t alignment, bool zero) noexcept {
+		if (alignment < MIN_ALIGNMENT) {
+			alignment = MIN_ALIGNMENT;
+		}
+
+		// Every allocation returns a unique pointer, even for no bytes
+		if (size == 0) {
+			size = 1;
+		}
+
+		if (!enter()) {
+			return bootstrapAllocate(size, alignment);
+		}
+
+		void *ret;
+
+		// Alignment of the C library is above the index size, so the guarded pool never serves the shim
+		if (Slab::bufferPower(size, alignment) < slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			ret = Slab::bufferAllocate(size, alignment);
+
+			if (zero && ret != nullptr) {
+				std::memset(ret, 0, size);
+			}
+		}
+		else {
+			ret = allocateLarge(size, alignment, zero);
+		}
+
+		leave();
+
+		if (ret == nullptr) {
+			errno = ENOMEM;
+		}
+
+		return ret;
+	}
+
+	void *MallocShim::allocateObject(size_t size, size_t alignment, bool nothrow) {
+		while (true) {
+			auto ret = allocate(size, alignment, false);
+
+			if (ret != nullptr) {
+				return ret;
+			}
+
+			auto handler = std::get_new_handler();
+
+			if (handler != nullptr) {
+				handler();
+				continue;
+			}
+
+			if (nothrow) {
+				return nullptr;
+			}
+
+			throw std::bad_alloc();
+		}
+	}
+
+	void MallocShim::deallocate(void *memory) noexcept {
+		if (memory == nullptr) {
+			return;
+		}
+
+		if (inBootstrap(memory)) {
+			bootstrapDeallocate(memory);
+			return;
+		}
+
+		if (isForeign(memory)) {
+			foreignDeallocate(memory);
+			return;
+		}
+
+		// Memory freed from inside of the allocator is not from the pool, it is left alone
+		if (!enter()) {
+			return;
+		}
+
+		auto owner = Buddy::owner(memory);
+
+		if (isLarge(owner)) {
+			deallocateLarge(memory, owner);
+		}
+		else {
+			kfree(memory);
+		}
+
+		leave();
+	}
+
+	void MallocShim::deallocate(void *memory, size_t size, size_t alignment) noexcept {
+		if (alignment < MIN_ALIGNMENT) {
+			alignment = MIN_ALIGNMENT;
+		}
+
+		if (size == 0) {
+			size = 1;
+		}
+
+		if (memory == nullptr || inBootstrap(memory) || Slab::bufferPower(size, alignment) >= slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			deallocate(memory);
+			return;
+		}
+
+		if (!enter()) {
+			return;
+		}
+
+		Slab::bufferDeallocate(memory, size, alignment);
+
+		leave();
+	}
+
+	void *MallocShim::reallocate(void *memory, size_t size) noexcept {
+		if (memory == nullptr) {
+			return allocate(size, MIN_ALIGNMENT, false);
+		}
+
+		// Size of the memory of the C library is not known here, so only its own realloc keeps the contents
+		if (isForeign(memory)) {
+			return foreignReallocate(memory, size);
+		}
+
+		if (size == 0) {
+			deallocate(memory);
+			return nullptr;
+		}
+
+		auto old_size = usableSize(memory);
+
+		// Memory is kept while it is at most half empty, so small changes do not copy
+		if (size <= old_size && size > old_size / 2) {
+			return memory;
+		}
+
+		auto ret = allocate(size, MIN_ALIGNMENT, false);
+
+		if (ret == nullptr) {
+			return nullptr;
+		}
+
+		std::memcpy(ret, memory, old_size < size ? old_size : size);
+		deallocate(memory);
+
+		return ret;
+	}
+
+	size_t MallocShim::usableSize(const void *memory) noexcept {
+		if (memory == nullptr) {
+			return 0;
+		}
+
+		if (inBootstrap(memory)) {
+			return (static_cast<const bootstrap_chunk_s *>(memory) - 1)->size_;
+		}
+
+		if (state_.load(std::memory_order_acquire) != READY) {
+			return 0;
+		}
+
+		auto owner = Buddy::owner(memory);
+
+		if (owner == &aligned_mark_) {
+			auto chunk = static_cast<const aligned_chunk_s *>(memory) - 1;
+			auto end = static_cast<const byte *>(chunk->start_) + Buddy::greaterOrEqualPowerOfTwo(chunk->blocks_) * BLOCK_SIZE;
+
+			return static_cast<size_t>(end - static_cast<const byte *>(memory));
+		}
+
+		if (isLarge(owner)) {
+			return Buddy::powerToSize(static_cast<const byte *>(owner) - large_marks_) * BLOCK_SIZE;
+		}
+
+		if (owner == nullptr) {
+			return 0;
+		}
+
+		return static_cast<const slab_s *>(owner)->header_->object_size_;
+	}
+
+	bool MallocShim::initialize() noexcept {
+		auto expected = static_cast<int>(UNINITIALIZED);
+
+		// Calls of the other threads are served from the bootstrap arena until the pool is ready
+		if (!state_.compare_exchange_strong(expected, INITIALIZING, std::memory_order_acq_rel)) {
+			return expected == READY;
+		}
+
+		auto blocks = environment("KMEM_PRELOAD_BLOCKS", DEFAULT_BLOCKS);
+		auto grow_blocks = environment("KMEM_PRELOAD_GROW_BLOCKS", blocks);
+
+		auto memory = SystemMemory::allocate(blocks);
+
+		if (memory == nullptr) {
+			state_.store(FAILED, std::memory_order_release);
+			return false;
+		}
+
+		// Exceptions of the public interface are allocated from the bootstrap arena
+		try {
+			kmem_init(memory, static_cast<int>(blocks));
+		}
+		catch (...) {
+			SystemMemory::deallocate(memory, blocks);
+			state_.store(FAILED, std::memory_order_release);
+			return false;
+		}
+
+		kmem_set_auto_grow(static_cast<int>(grow_blocks));
+
+		pthread_atfork(prepareFork, parentFork, childFork);
+
+		state_.store(READY, std::memory_order_release);
+
+		return true;
+	}
+
+	size_t MallocShim::environment(const char name[], size_t fallback) noexcept {
+		auto value = std::getenv(name);
+
+		if (value == nullptr) {
+			return fallback;
+		}
+
+		char *end;
+		auto ret = std::strtoull(value, &end, 10);
+
+		// The public interface takes the sizes as int
+		if (end == value || ret < AllocatorUtility::MIN_SIZE_IN_BLOCKS || ret > static_cast<unsigned long long>(INT32_MAX)) {
+			return fallback;
+		}
+
+		return static_cast<size_t>(ret);
+	}
+
+	void *MallocShim::allocateLarge(size_t size, size_t alignment, bool zero) noexcept {
+		// Blocks are aligned to the block size, the stronger alignments need the slack before the memory
+		auto slack = alignment > BLOCK_SIZE ? alignment : 0;
+
+		if (size > NULL_INDEX - slack - BLOCK_SIZE) {
+			return nullptr;
+		}
+
+		auto blocks = (size + slack + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+		bool zeroed;
+		auto memory = Buddy::allocate(blocks, zeroed);
+
+		if (memory == nullptr) {
+			return nullptr;
+		}
+
+		auto ret = memory;
+		const void *owner = &large_marks_[Buddy::sizeToPower(Buddy::greaterOrEqualPowerOfTwo(blocks))];
+
+		// The header fits into the slack, since the block start is at least one block below the aligned address
+		if (slack != 0) {
+			auto address = reinterpret_cast<size_t>(memory) + sizeof(aligned_chunk_s);
+			ret = reinterpret_cast<void *>((address + alignment - 1) & ~(alignment - 1));
+
+			auto chunk = static_cast<aligned_chunk_s *>(ret) - 1;
+			chunk->start_ = memory;
+			chunk->blocks_ = blocks;
+
+			owner = &aligned_mark_;
+		}
+
+		if (zero && !zeroed) {
+			std::memset(ret, 0, size);
+		}
+
+		Buddy::setOwner(ret, 1, owner);
+
+		if (HeapProfiler::sample(size)) {
+			HeapProfiler::record(ret, size);
+		}
+
+		return ret;
+	}
+
+	void MallocShim::deallocateLarge(void *memory, const void *owner) noexcept {
+		HeapProfiler::remove(memory);
+
+		Buddy::setOwner(memory, 1, nullptr);
+
+		if (owner == &aligned_mark_) {
+			auto chunk = static_cast<aligned_chunk_s *>(memory) - 1;
+			Buddy::deallocate(chunk->start_, chunk->blocks_);
+			return;
+		}
+
+		Buddy::deallocatePowerOfTwo(memory, static_cast<const byte *>(owner) - large_marks_);
+	}
+
+	bool MallocShim::isForeign(const void *memory) noexcept {
+		if (inBootstrap(memory)) {
+			return false;
+		}
+
+		// Before the pool is ready every allocation of the shim comes from the bootstrap arena
+		return state_.load(std::memory_order_acquire) != READY || Buddy::owner(memory) == nullptr;
+	}
+
+	void MallocShim::foreignDeallocate(void *memory) noexcept {
+		static auto next = reinterpret_cast<void(*)(void *)>(dlsym(RTLD_NEXT, "free"));
+
+		if (next != nullptr) {
+			next(memory);
+		}
+	}
+
+	void *MallocShim::foreignReallocate(void *memory, size_t size) noexcept {
+		static auto next = reinterpret_cast<void *(*)(void *, size_t)>(dlsym(RTLD_NEXT, "realloc"));
+
+		if (next == nullptr) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		return next(memory, size);
+	}
+
+	bool MallocShim::isLarge(const void *owner) noexcept {
+		return owner == &aligned_mark_ || (owner >= large_marks_ && owner < large_marks_ + POWERS_OF_TWO);
+	}
+
+	void *MallocShim::bootstrapAllocate(size_t size, size_t alignment) noexcept {
+		auto bin = NULL_INDEX;
+
+		// Only the chunks with the default alignment are recycled, the others are rare
+		if (alignment <= MIN_ALIGNMENT) {
+			for (size_t i = 0; i < BOOTSTRAP_BINS; i++) {
+				if (size <= (static_cast<size_t>(16) << i)) {
+					bin = i;
+					break;
+				}
+			}
+		}
+
+		auto capacity = bin != NULL_INDEX ? static_cast<size_t>(16) << bin : size;
+		void *ret = nullptr;
+
+		bootstrapLock();
+
+		if (bin != NULL_INDEX && bins_[bin] != nullptr) {
+			ret = bins_[bin];
+			bins_[bin] = *static_cast<bootstrap_chunk_s **>(ret);
+
+			std::memset(ret, 0, capacity);
+		}
+		else if (capacity <= BOOTSTRAP_SIZE) {
+			auto start = (bootstrap_used_ + sizeof(bootstrap_chunk_s) + alignment - 1) & ~(alignment - 1);
+
+			// Untouched part of the arena is still zeroed
+			if (start <= BOOTSTRAP_SIZE - capacity) {
+				ret = bootstrap_ + start;
+				bootstrap_used_ = start + capacity;
+
+				auto chunk = static_cast<bootstrap_chunk_s *>(ret) - 1;
+				chunk->size_ = capacity;
+				chunk->bin_ = bin;
+			}
+		}
+
+		bootstrapUnlock();
+
+		if (ret == nullptr) {
+			errno = ENOMEM;
+		}
+
+		return ret;
+	}
+
+	void MallocShim::bootstrapDeallocate(void *memory) noexcept {
+		auto chunk = static_cast<bootstrap_chunk_s *>(memory) - 1;
+
+		if (chunk->bin_ == NULL_INDEX) {
+			return;
+		}
+
+		bootstrapLock();
+
+		*static_cast<bootstrap_chunk_s **>(memory) = bins_[chunk->bin_];
+		bins_[chunk->bin_] = static_cast<bootstrap_chunk_s *>(memory);
+
+		bootstrapUnlock();
+	}
+
+	bool MallocShim::inBootstrap(const void *memory) noexcept {
+		return memory >= bootstrap_ && memory < bootstrap_ + BOOTSTRAP_SIZE;
+	}
+
+	void MallocShim::bootstrapLock() noexcept {
+		while (bootstrap_locked_.exchange(true, std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void MallocShim::bootstrapUnlock() noexcept {
+		bootstrap_locked_.store(false, std::memory_order_release);
+	}
+
+	void MallocShim::prepareFork() noexcept {
+		bootstrapLock();
+		AllocatorUtility::prepareFork();
+	}
+
+	void MallocShim::parentFork() noexcept {
+		AllocatorUtility::finishFork(false);
+		bootstrapUnlock();
+	}
+
+	void MallocShim::childFork() noexcept {
+		AllocatorUtility::finishFork(true);
+		bootstrapUnlock();
+	}
+
+	#pragma endregion
+}
+
+using os2bn140314d::MallocShim;
+
+#pragma region C interface
+
+extern "C" {
+
+	KMEM_EXPORT void *malloc(size_t size) noexcept {
+		return MallocShim::allocate(size, MallocShim::MIN_ALIGNMENT, false);
+	}
+
+	KMEM_EXPORT void free(void *memory) noexcept {
+		MallocShim::deallocate(memory);
+	}
+
+	KMEM_EXPORT void *calloc(size_t count, size_t size) noexcept {
+		if (size != 0 && count > static_cast<size_t>(-1) / size) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		return MallocShim::allocate(count * size, MallocShim::MIN_ALIGNMENT, true);
+	}
+
+	KMEM_EXPORT void *realloc(void *memory, size_t size) noexcept {
+		return MallocShim::reallocate(memory, size);
+	}
+
+	KMEM_EXPORT void *reallocarray(void *memory, size_t count, size_t size) noexcept {
+		if (size != 0 && count > static_cast<size_t>(-1) / size) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		return MallocShim::reallocate(memory, count * size);
+	}
+
+	KMEM_EXPORT int posix_memalign(void **memory, size_t alignment, size_t size) noexcept {
+		if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+			return EINVAL;
+		}
+
+		auto ret = MallocShim::allocate(size, alignment, false);
+
+		if (ret == nullptr) {
+			return ENOMEM;
+		}
+
+		*memory = ret;
+
+		return 0;
+	}
+
+	KMEM_EXPORT void *aligned_alloc(size_t alignment, size_t size) noexcept {
+		if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+			errno = EINVAL;
+			return nullptr;
+		}
+
+		return MallocShim::allocate(size, alignment, false);
+	}
+
+	KMEM_EXPORT void *memalign(size_t alignment, size_t size) noexcept {
+		// Like the C library, alignments that are not powers of two are rounded up
+		auto power = os2bn140314d::Buddy::greaterOrEqualPowerOfTwo(alignment);
+
+		if (power == 0) {
+			errno = EINVAL;
+			return nullptr;
+		}
+
+		return MallocShim::allocate(size, power, false);
+	}
+
+	KMEM_EXPORT void *valloc(size_t size) noexcept {
+		return MallocShim::allocate(size, os2bn140314d::SystemMemory::pageSize(), false);
+	}
+
+	KMEM_EXPORT void *pvalloc(size_t size) noexcept {
+		auto page = os2bn140314d::SystemMemory::pageSize();
+
+		if (size > static_cast<size_t>(-1) - page) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		return MallocShim::allocate((size + page - 1) / page * page, page, false);
+	}
+
+	KMEM_EXPORT size_t malloc_usable_size(void *memory) noexcept {
+		return MallocShim::usableSize(memory);
+	}
+}
+
+#pragma endregion
+
+#pragma region C++ interface
+
+KMEM_EXPORT void *operator new(size_t size) {
+	return MallocShim::allocateObject(size, MallocShim::MIN_ALIGNMENT, false);
+}
+
+KMEM_EXPORT void *operator new[](size_t size) {
+	return MallocShim::allocateObject(size, MallocShim::MIN_ALIGNMENT, false);
+}
+
+KMEM_EXPORT void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return MallocShim::allocateObject(size, MallocShim::MIN_ALIGNMENT, true);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+KMEM_EXPORT void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return MallocShim::allocateObject(size, MallocShim::MIN_ALIGNMENT, true);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+KMEM_EXPORT void operator delete(void *memory) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete[](void *memory) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete(void *memory, const std::nothrow_t &) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete(void *memory, size_t size) noexcept {
+	MallocShim::deallocate(memory, size, MallocShim::MIN_ALIGNMENT);
+}
+
+KMEM_EXPORT void operator delete[](void *memory, size_t size) noexcept {
+	MallocShim::deallocate(memory, size, MallocShim::MIN_ALIGNMENT);
+}
+
+#ifdef __cpp_aligned_new
+
+KMEM_EXPORT void *operator new(size_t size, std::align_val_t alignment) {
+	return MallocShim::allocateObject(size, static_cast<size_t>(alignment), false);
+}
+
+KMEM_EXPORT void *operator new[](size_t size, std::align_val_t alignment) {
+	return MallocShim::allocateObject(size, static_cast<size_t>(alignment), false);
+}
+
+KMEM_EXPORT void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	try {
+		return MallocShim::allocateObject(size, static_cast<size_t>(alignment), true);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+KMEM_EXPORT void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+	try {
+		return MallocShim::allocateObject(size, static_cast<size_t>(alignment), true);
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
+
+KMEM_EXPORT void operator delete(void *memory, std::align_val_t) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete[](void *memory, std::align_val_t) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept {
+	MallocShim::deallocate(memory);
+}
+
+KMEM_EXPORT void operator delete(void *memory, size_t size, std::align_val_t alignment) noexcept {
+	MallocShim::deallocate(memory, size, static_cast<size_t>(alignment));
+}
+
+KMEM_EXPORT void operator delete[](void *memory, size_t size, std::align_val_t alignment) noexcept {
+	MallocShim::deallocate(memory, size, static_cast<size_t>(alignment));
+}
+
+#endif
+
+#pragma endregion
@@ -4,20 +4,35 @@
 */
 
 #include "AllocatorUtility.h"
+#include "Epoch.h" // Epoch
+#include "Group.h" // thread_stocks_s
+#include "GuardedPool.h" // GuardedPool
+#include "HeapProfiler.h" // HeapProfiler
+#include "SystemMemory.h" // SystemMemory
+#include "WaitQueue.h" // WaitQueue
+#include <string> // to_string
 
 namespace os2bn140314d {
 
 	#pragma region header_s implementation
 
-	void header_s::initialize(Block *first_pool_block, size_t size_in_blocks) throw (std::invalid_argument) {
-		if (size_in_blocks == 0) {
-			throw std::invalid_argument("Size of the memory must be greater than 0");
+	bool header_s::initialize(Block *first_pool_block, size_t size_in_blocks) noexcept {
+		if (size_in_blocks == 0 || !buddy_header_.initialize(first_pool_block, size_in_blocks)) {
+			return false;
 		}
 
-		buddy_header_.initialize(first_pool_block, size_in_blocks);
 		slab_header_.initialize();
 
 		new (&write_mutex_) std::mutex;
+
+		return true;
+	}
+
+	void header_s::reattach() noexcept {
+		buddy_header_.reattach();
+		slab_header_.reattach();
+
+		new (&write_mutex_) std::mutex;
 	}
 
 	#pragma endregion
@@ -25,19 +40,52 @@ namespace os2bn140314d {
 	#pragma region AllocatorUtility implementation
 
 	void *AllocatorUtility::memory_start_ = nullptr;
+	header_s *AllocatorUtility::header_ = nullptr;
+	persistent_pool_s *AllocatorUtility::pool_ = nullptr;
+	void *AllocatorUtility::reserved_ = nullptr;
+	size_t AllocatorUtility::reserved_blocks_ = 0;
 
-	void AllocatorUtility::initialize(void * memory_start, int size_in_blocks) throw (std::invalid_argument) {
-		if (size_in_blocks < MIN_SIZE_IN_BLOCKS) {
-			throw std::invalid_argument("Size of the allocated space must be at least " + MIN_SIZE_IN_BLOCKS);
+	void AllocatorUtility::initialize(void * memory_start, int size_in_blocks) {
+		if (size_in_blocks < 0 || static_cast<size_t>(size_in_blocks) < MIN_SIZE_IN_BLOCKS) {
+			throw std::invalid_argument("Size of the allocated space must be at least " + std::to_string(MIN_SIZE_IN_BLOCKS) + " blocks");
 		}
 
 		memory_start_ = memory_start;
-		
-		auto &header = *static_cast<Header *>(memory_start);
+
+		// Memory given by the user may be aligned to less than a cache line
+		auto address = reinterpret_cast<size_t>(memory_start);
+		header_ = reinterpret_cast<header_s *>((address + CACHE_L1_LINE_SIZE - 1) & ~(CACHE_L1_LINE_SIZE - 1));
 
 		auto first_pool_block = static_cast<Block *>(memory_start) + 1;
 
-		header.header_.initialize(first_pool_block, size_in_blocks - 1);
+		// Internal paths report errors by their results, they are turned into exceptions only here
+		if (!header_->initialize(first_pool_block, size_in_blocks - 1)) {
+			throw std::invalid_argument("Too few blocks for the buddy allocator");
+		}
+	}
+
+	void AllocatorUtility::addRegion(void *memory_start, int size_in_blocks) {
+		if (size_in_blocks <= 0) {
+			throw std::invalid_argument("Size of the region must be greater than 0");
+		}
+
+		if (!Buddy::addRegion(memory_start, size_in_blocks)) {
+			throw std::invalid_argument("Region is too small, or there is no more space in the region table");
+		}
+	}
+
+	void AllocatorUtility::addHugeRegion(void *memory_start, int size_in_blocks) {
+		if (size_in_blocks <= 0) {
+			throw std::invalid_argument("Size of the region must be greater than 0");
+		}
+
+		if (!Buddy::addHugeRegion(memory_start, size_in_blocks)) {
+			throw std::invalid_argument("Huge page region could not be added");
+		}
+	}
+
+	void AllocatorUtility::setAutoGrow(int size_in_blocks) noexcept {
+		Buddy::setAutoGrow(size_in_blocks > 0 ? size_in_blocks : 0);
 	}
 
 	void *AllocatorUtility::memoryStart() noexcept {
@@ -45,6 +93,13 @@ namespace os2bn140314d {
 	}
 
 	const Block *AllocatorUtility::blockStart(const void * memory) noexcept {
+		auto region = buddyHeader().regionOf(memory);
+
+		if (region != nullptr) {
+			return region->blockStart(memory);
+		}
+
+		// Memory outside of all regions, like the header block, is aligned to the start of the allocator
 		auto start = reinterpret_cast<const byte *>(memory_start_);
 		auto pointer = reinterpret_cast<const byte *>(memory);
 
@@ -63,9 +118,49 @@ namespace os2bn140314d {
 		header.write_mutex_.unlock();
 	}
 
+	void AllocatorUtility::prepareFork() noexcept {
+		auto &header = AllocatorUtility::header();
+
+		GuardedPool::mutex_.lock();
+		HeapProfiler::mutex_.lock();
+
+		header.slab_header_.lockAll();
+		header.buddy_header_.lockAll();
+
+		// Deallocations wake the queues while holding the other locks, so they are taken last
+		for (auto &queue : WaitQueue::queues_) {
+			queue.mutex_.lock();
+		}
+	}
+
+	void AllocatorUtility::finishFork(bool child) noexcept {
+		auto &header = AllocatorUtility::header();
+
+		for (auto &queue : WaitQueue::queues_) {
+			queue.mutex_.unlock();
+		}
+
+		header.buddy_header_.unlockAll();
+		header.slab_header_.unlockAll();
+
+		HeapProfiler::mutex_.unlock();
+		GuardedPool::mutex_.unlock();
+
+		if (child) {
+			new (&header.write_mutex_) std::mutex;
+
+			// Waiting threads of the parent do not exist in the child
+			for (auto &queue : WaitQueue::queues_) {
+				new (&queue.condition_) std::condition_variable;
+				queue.waiters_ = 0;
+			}
+
+			WaitQueue::waiting_.store(0, std::memory_order_relaxed);
+		}
+	}
+
 	header_s &AllocatorUtility::header() noexcept {
-		auto &header = *static_cast<Header *>(memory_start_);
-		return header.header_;
+		return *header_;
 	}
 
 	buddy_header_s & AllocatorUtility::buddyHeader() noexcept {
@@ -78,5 +173,198 @@ namespace os2bn140314d {
 		return header.slab_header_;
 	}
 
+	bool AllocatorUtility::reservePersistent(void *address, int size_in_blocks) noexcept {
+		// Pools already mapped in the range would be left behind by a new one
+		if (reserved_ != nullptr || size_in_blocks <= 0) {
+			return false;
+		}
+
+		if (address == nullptr) {
+			address = KMEM_PERSISTENT_ADDRESS;
+		}
+
+		reserved_ = SystemMemory::reserve(address, static_cast<size_t>(size_in_blocks), false);
+		reserved_blocks_ = reserved_ != nullptr ? static_cast<size_t>(size_in_blocks) : 0;
+
+		return reserved_ != nullptr;
+	}
+
+	bool AllocatorUtility::reserveFor(size_t size_in_blocks) noexcept {
+		if (reserved_ == nullptr) {
+			reserved_ = SystemMemory::reserve(KMEM_PERSISTENT_ADDRESS, size_in_blocks, false);
+			reserved_blocks_ = reserved_ != nullptr ? size_in_blocks : 0;
+		}
+
+		return reserved_ != nullptr && size_in_blocks <= reserved_blocks_;
+	}
+
+	bool AllocatorUtility::initializePersistent(const char *path, int size_in_blocks) noexcept {
+		// First block describes the pool, the allocator starts after it
+		if (size_in_blocks < 0 || static_cast<size_t>(size_in_blocks) < MIN_SIZE_IN_BLOCKS + 1) {
+			return false;
+		}
+
+		// Pool is placed at the start of the reserved range, which every process reserves at the same address
+		if (pool_ != nullptr || !reserveFor(static_cast<size_t>(size_in_blocks))) {
+			return false;
+		}
+
+		size_t mapped_blocks;
+		auto memory = static_cast<Block *>(SystemMemory::mapFile(path, static_cast<size_t>(size_in_blocks), reserved_, reserved_blocks_, mapped_blocks));
+
+		if (memory == nullptr) {
+			return false;
+		}
+
+		try {
+			initialize(memory + 1, size_in_blocks - 1);
+		}
+		catch (...) {
+			SystemMemory::reserve(memory, mapped_blocks, true);
+			return false;
+		}
+
+		pool_ = reinterpret_cast<persistent_pool_s *>(memory);
+
+		pool_->magic_ = persistent_pool_s::MAGIC;
+		pool_->header_size_ = sizeof(header_s);
+		pool_->cache_size_ = sizeof(cache_header_s);
+		pool_->slab_size_ = sizeof(slab_s);
+		pool_->address_ = memory;
+		pool_->size_in_blocks_ = mapped_blocks;
+		pool_->root_ = nullptr;
+		pool_->clean_ = false;
+
+		return true;
+	}
+
+	bool AllocatorUtility::attach(const char *path) noexcept {
+		// Pool can not replace the allocator this process already uses
+		if (header_ != nullptr) {
+			return false;
+		}
+
+		// Description is read first, from a mapping at any address
+		size_t mapped_blocks;
+		auto memory = SystemMemory::mapFile(path, 0, nullptr, 0, mapped_blocks);
+
+		if (memory == nullptr) {
+			return false;
+		}
+
+		auto description = *static_cast<persistent_pool_s *>(memory);
+		SystemMemory::unmapFile(memory, mapped_blocks);
+
+		if (description.magic_ != persistent_pool_s::MAGIC ||
+			description.header_size_ != sizeof(header_s) ||
+			description.cache_size_ != sizeof(cache_header_s) ||
+			description.slab_size_ != sizeof(slab_s) ||
+			description.size_in_blocks_ != mapped_blocks ||
+			!description.clean_)
+		{
+			return false;
+		}
+
+		// Pointers of the pool are valid only at the start of a range reserved at the same address
+		if (!reserveFor(description.size_in_blocks_) || description.address_ != reserved_) {
+			return false;
+		}
+
+		memory = SystemMemory::mapFile(path, 0, reserved_, reserved_blocks_, mapped_blocks);
+
+		if (memory == nullptr) {
+			return false;
+		}
+
+		// File may have changed since the description was read
+		if (mapped_blocks != description.size_in_blocks_) {
+			SystemMemory::reserve(memory, mapped_blocks, true);
+			return false;
+		}
+
+		pool_ = static_cast<persistent_pool_s *>(memory);
+
+		// Pool that is not detached again is refused by the next attach
+		pool_->clean_ = false;
+		SystemMemory::flushFile(pool_, BLOCK_SIZE);
+
+		memory_start_ = static_cast<Block *>(memory) + 1;
+
+		auto address = reinterpret_cast<size_t>(memory_start_);
+		header_ = reinterpret_cast<header_s *>((address + CACHE_L1_LINE_SIZE - 1) & ~(CACHE_L1_LINE_SIZE - 1));
+
+		header_->reattach();
+
+		return true;
+	}
+
+	bool AllocatorUtility::detach() noexcept {
+		if (pool_ == nullptr) {
+			return false;
+		}
+
+		auto &header = AllocatorUtility::header();
+
+		// Regions outside of the file are lost with the process, and the metadata would point to them
+		if (header.buddy_header_.number_of_regions_.load() != 1) {
+			return false;
+		}
+
+		// Deferred objects are kept by the records outside of the pool
+		if (Epoch::barrier() < 0) {
+			return false;
+		}
+
+		for (auto &entry : thread_slabs_s::local().entries_) {
+			if (entry.cache_ != nullptr) {
+				thread_slabs_s::release(entry);
+			}
+		}
+
+		for (auto &entry : thread_stocks_s::local().entries_) {
+			if (entry.group_ != nullptr) {
+				thread_stocks_s::release(entry);
+			}
+		}
+
+		auto pool = pool_;
+		auto size_in_blocks = pool->size_in_blocks_;
+
+		if (!SystemMemory::flushFile(pool, size_in_blocks * BLOCK_SIZE)) {
+			return false;
+		}
+
+		// Pool is marked clean only once the rest of it is written
+		pool->clean_ = true;
+		SystemMemory::flushFile(pool, BLOCK_SIZE);
+
+		pool_ = nullptr;
+		header_ = nullptr;
+		memory_start_ = nullptr;
+
+		// Range stays reserved, so the pool can be attached there again
+		SystemMemory::reserve(pool, size_in_blocks, true);
+
+		return true;
+	}
+
+	bool AllocatorUtility::isPersistent() noexcept {
+		return pool_ != nullptr;
+	}
+
+	bool AllocatorUtility::setRoot(void *root) noexcept {
+		if (pool_ == nullptr) {
+			return false;
+		}
+
+		pool_->root_ = root;
+
+		return true;
+	}
+
+	void *AllocatorUtility::root() noexcept {
+		return pool_ != nullptr ? pool_->root_ : nullptr;
+	}
+
 	#pragma endregion 
 }
@@ -7,9 +7,9 @@
 
 namespace os2bn140314d {
 
-	void BlockList::insert(Block *&head, Block *new_block) throw(std::invalid_argument) {
+	void BlockList::insert(Block *&head, Block *new_block) noexcept {
 		if (new_block == nullptr) {
-			throw std::invalid_argument("Block which should be inserted is nullptr");
+			return;
 		}
 
 		// Inserting to the beginning of the list
@@ -23,9 +23,9 @@ namespace os2bn140314d {
 		head = new_block;
 	}
 
-	Block *BlockList::remove(Block *&head) throw(std::underflow_error) {
+	Block *BlockList::remove(Block *&head) noexcept {
 		if (head == nullptr) {
-			throw std::underflow_error("List of blocks is empty");
+			return nullptr;
 		}
 
 		auto old_head = head;
@@ -39,14 +39,20 @@ namespace os2bn140314d {
 		return old_head;
 	}
 
-	void BlockList::remove(Block *&head, Block *block) throw(std::invalid_argument) {
+	bool BlockList::remove(Block *&head, Block *block) noexcept {
 		if (block == nullptr) {
-			throw std::invalid_argument("Nullptr passed for block");
+			return false;
 		}
 
-		auto right = block->info.next;
 		auto left = block->info.prev;
 
+		// Only the head has no previous block
+		if (left == nullptr && head != block) {
+			return false;
+		}
+
+		auto right = block->info.next;
+
 		if (right != nullptr) {
 			right->info.prev = left;
 		}
@@ -54,11 +60,10 @@ namespace os2bn140314d {
 		if (left != nullptr) {
 			left->info.next = right;
 		}
-		else if (head == block) {
-			head = right;
-		}
 		else {
-			throw std::invalid_argument("Invalid list passed");
+			head = right;
 		}
+
+		return true;
 	}
 }
@@ -0,0 +1,132 @@
+/**
+* \file BlockTree.cpp
+* \brief Implementation of the functions manipulating the address ordered trees of free blocks
+*/
+
+#include "BlockTree.h"
+
+namespace os2bn140314d {
+
+	void BlockTree::insert(Block *&root, Block *new_block) noexcept {
+		if (new_block == nullptr) {
+			return;
+		}
+
+		auto link = &root;
+		auto new_priority = priority(new_block);
+
+		// Descend while the blocks have the higher priority, the new block takes the place of the next one
+		while (*link != nullptr && priority(*link) > new_priority) {
+			link = before(new_block, *link) ? &(*link)->info.left : &(*link)->info.right;
+		}
+
+		split(*link, new_block, new_block->info.left, new_block->info.right);
+		*link = new_block;
+	}
+
+	Block *BlockTree::remove(Block *&root) noexcept {
+		if (root == nullptr) {
+			return nullptr;
+		}
+
+		auto link = &root;
+
+		while ((*link)->info.left != nullptr) {
+			link = &(*link)->info.left;
+		}
+
+		// The lowest block has no left child
+		auto ret = *link;
+		*link = ret->info.right;
+
+		return ret;
+	}
+
+	bool BlockTree::remove(Block *&root, Block *block) noexcept {
+		if (block == nullptr) {
+			return false;
+		}
+
+		auto link = &root;
+
+		while (*link != nullptr && *link != block) {
+			link = before(block, *link) ? &(*link)->info.left : &(*link)->info.right;
+		}
+
+		if (*link == nullptr) {
+			return false;
+		}
+
+		*link = merge(block->info.left, block->info.right);
+
+		return true;
+	}
+
+	Block *BlockTree::first(Block *root) noexcept {
+		if (root == nullptr) {
+			return nullptr;
+		}
+
+		while (root->info.left != nullptr) {
+			root = root->info.left;
+		}
+
+		return root;
+	}
+
+	size_t BlockTree::count(const Block *root) noexcept {
+		size_t ret = 0;
+
+		// Recursion goes only to the left, as deep as the tree, the right spine is walked in the loop
+		while (root != nullptr) {
+			ret += 1 + count(root->info.left);
+			root = root->info.right;
+		}
+
+		return ret;
+	}
+
+	bool BlockTree::before(const Block *lhs, const Block *rhs) noexcept {
+		return reinterpret_cast<uintptr_t>(lhs) < reinterpret_cast<uintptr_t>(rhs);
+	}
+
+	uint64_t BlockTree::priority(const Block *block) noexcept {
+		// Multiplicative hash of the block number spreads the neighbouring blocks apart
+		auto number = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(block) / BLOCK_SIZE);
+		return number * 0x9E3779B97F4A7C15ull;
+	}
+
+	void BlockTree::split(Block *root, const Block *key, Block *&left, Block *&right) noexcept {
+		if (root == nullptr) {
+			left = right = nullptr;
+			return;
+		}
+
+		if (before(root, key)) {
+			split(root->info.right, key, root->info.right, right);
+			left = root;
+		}
+		else {
+			split(root->info.left, key, left, root->info.left);
+			right = root;
+		}
+	}
+
+	Block *BlockTree::merge(Block *left, Block *right) noexcept {
+		if (left == nullptr) {
+			return right;
+		}
+
+		if (right == nullptr) {
+			return left;
+		}
+
+		if (priority(left) > priority(right)) {
+			left->info.right = merge(left->info.right, right);
+			return left;
+		}
+
+		right->info.left = merge(left, right->info.left);
+		return right;
+	}
+}
@@ -6,165 +6,215 @@
 #include "Buddy.h"
 #include "AllocatorUtility.h"
 #include "BlockList.h"
+#include "BlockTree.h"
+#include "SystemMemory.h"
+#include "HeapProfiler.h"
+#include "Processor.h"
+#include "WaitQueue.h"
+#include <chrono> // steady_clock
+#include <cstring> // memset
+#include <thread> // yield
 
 namespace os2bn140314d {
 	
 	#pragma region Buddy implementation
 
-	void *Buddy::allocate(size_t size) throw (std::bad_alloc, std::invalid_argument) {
+	void *Buddy::allocate(size_t size) noexcept {
 		if (size == 0) {
-			throw std::invalid_argument("Size must be greater than 0");
+			return nullptr;
 		}
 
-		try {
-			auto power = greaterOrEqualPowerOfTwo(size);
-			auto index = sizeToPower(power);
+		auto power = greaterOrEqualPowerOfTwo(size);
 
-			return allocatePowerOfTwo(index);
+		if (power == 0) {
+			return nullptr;
 		}
-		catch (std::bad_alloc &) {
-			throw;
+
+		auto ret = allocatePowerOfTwo(sizeToPower(power));
+
+		if (ret != nullptr && HeapProfiler::sample(size * BLOCK_SIZE)) {
+			HeapProfiler::record(ret, size * BLOCK_SIZE);
 		}
-		catch (std::exception &) {
-			throw std::bad_alloc();
+
+		return ret;
+	}
+
+	void *Buddy::allocatePowerOfTwo(size_t power) noexcept {
+		bool zeroed;
+		auto ret = allocatePowerOfTwo(power, zeroed);
+
+		// Big allocations take a part of the reserve back, only here, where the caller holds no lock of the allocator
+		if (ret == nullptr && power < POWERS_OF_TWO) {
+			ret = AllocatorUtility::buddyHeader().reclaim(power, zeroed);
 		}
+
+		return ret;
 	}
 
-	void *Buddy::allocatePowerOfTwo(size_t power) throw (std::bad_alloc) {
-		auto &header = AllocatorUtility::buddyHeader();
+	void *Buddy::allocate(size_t size, bool &zeroed, BuddyPool pool, bool long_lived) noexcept {
+		if (size == 0) {
+			return nullptr;
+		}
 
-		header.mutex_.lock();
+		auto power = greaterOrEqualPowerOfTwo(size);
+
+		if (power == 0) {
+			return nullptr;
+		}
 
-		auto pointer = header.pointers_[power];
+		return allocatePowerOfTwo(sizeToPower(power), zeroed, pool, long_lived);
+	}
 
-		Block *ret;
+	void *Buddy::allocatePowerOfTwo(size_t power, bool &zeroed, BuddyPool pool, bool long_lived) noexcept {
+		if (power >= POWERS_OF_TWO) {
+			return nullptr;
+		}
 
-		// There exists no block with the given size
-		// Should check if there is a greater block, split it, and return the smaller block
-		if (pointer == nullptr) {
-			auto bigger_power = power;
+		auto &header = AllocatorUtility::buddyHeader();
 
-			// Find the size of the greater block
-			while (bigger_power < POWERS_OF_TWO && header.pointers_[bigger_power] == nullptr) {
-				bigger_power++;
-			}
+		// Small blocks of the normal pool come from the list of the processor, without the mutex
+		if (power < buddy_header_s::CPU_PAGE_POWERS && pool == NORMAL_POOL) {
+			auto ret = header.allocateCached(power);
 
-			// The greater block does not exist
-			// Error - no more available memory
-			if (bigger_power == POWERS_OF_TWO) {
-				header.mutex_.unlock();
-				throw std::bad_alloc();
+			if (ret != nullptr) {
+				zeroed = false;
+				return ret;
 			}
+		}
+
+		header.mutex_.lock();
+		auto ret = pool == RESERVE_POOL ? header.borrowFree(power, zeroed) : header.takeFree(power, pool, zeroed, long_lived);
 
-			ret = BlockList::remove(header.pointers_[bigger_power]);
+		// Allocations check the purge list as well, a pool that only allocates after a spike still returns its idle blocks
+		header.purgeExpired(false);
 
-			// Split the block in half until the wanted size
-			// Insert the right halves back into the lists
-			while (bigger_power != power) {
-				bigger_power--;
-				
-				auto second_pointer = ret + powerToSize(bigger_power);
-				second_pointer->info.index = bigger_power;
-				BlockList::insert(header.pointers_[bigger_power], second_pointer);
-			}
+		header.mutex_.unlock();
+
+		// Blocks kept by the processors may be enough, once they are returned and merged
+		if (ret == nullptr && header.drainCached() != 0) {
+			header.mutex_.lock();
+			ret = pool == RESERVE_POOL ? header.borrowFree(power, zeroed) : header.takeFree(power, pool, zeroed, long_lived);
+			header.mutex_.unlock();
 		}
-		else {
-			ret = BlockList::remove(header.pointers_[power]);
+
+		return ret;
+	}
+
+	bool Buddy::deallocate(void *memory, size_t size) noexcept {
+		auto power = greaterOrEqualPowerOfTwo(size);
+
+		// Nothing is deallocated for the sizes that could not have been allocated
+		if (size == 0 || power == 0) {
+			return false;
 		}
 
-		// Mark memory as allocated
-		auto index_of_bitmap = header.indexOfBitmap(ret);
-		auto index_in_bitmap = header.indexInBitmap(ret);
+		return deallocatePowerOfTwo(memory, sizeToPower(power));
+	}
+
+	bool Buddy::deallocatePowerOfTwo(void * memory, size_t power) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		auto block = reinterpret_cast<Block *>(memory);
 
-		auto num_of_entries = powerToSize(power);
+		auto region = header.regionOf(block);
 
-		if (index_in_bitmap + num_of_entries > ENTRIES_IN_BITMAP) {
-			header.bitmaps_[index_of_bitmap].allocate(index_in_bitmap, ENTRIES_IN_BITMAP - index_in_bitmap);
-			header.bitmaps_[index_of_bitmap + 1].allocate(0, num_of_entries - ENTRIES_IN_BITMAP + index_in_bitmap);
+		if (region == nullptr || power >= POWERS_OF_TWO) {
+			return false;
 		}
-		else {
-			header.bitmaps_[index_of_bitmap].allocate(index_in_bitmap, num_of_entries);
+
+		HeapProfiler::remove(memory);
+
+		// Blocks of the reserve go straight back to it, the processors would lend them to any allocation
+		if (power < buddy_header_s::CPU_PAGE_POWERS && header.poolOf(region, block) == NORMAL_POOL && header.deallocateCached(block, power)) {
+			return true;
 		}
 
+		header.mutex_.lock();
+
+		header.giveFree(region, block, power);
+
+		// Check the oldest blocks in the purge list while the lock is already held
+		header.purgeExpired(false);
+
+		header.mutex_.unlock();
+
+		return true;
+	}
+
+	bool Buddy::addRegion(void *memory, size_t size) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.mutex_.lock();
+		auto ret = header.addRegion(static_cast<Block *>(memory), size);
 		header.mutex_.unlock();
 
 		return ret;
 	}
 
-	void Buddy::deallocate(void *memory, size_t size) throw (std::invalid_argument) {
-		if (size == 0) {
-			// This is not an exception - nothing is deallocated
-			return;
+	bool Buddy::addHugeRegion(void *memory, size_t size) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.mutex_.lock();
+
+		// Map the region, rounded up to whole huge pages
+		if (memory == nullptr) {
+			auto size_in_huge_pages = (size + BLOCKS_IN_HUGE_PAGE - 1) / BLOCKS_IN_HUGE_PAGE;
+			auto mapped = header.mapHugeRegion(size_in_huge_pages * BLOCKS_IN_HUGE_PAGE);
+
+			header.mutex_.unlock();
+
+			return mapped;
 		}
 
-		auto power = greaterOrEqualPowerOfTwo(size);
-		auto index = sizeToPower(power);
+		auto ret = header.addHugeRegion(static_cast<Block *>(memory), size);
+
+		header.mutex_.unlock();
 
-		deallocatePowerOfTwo(memory, index);
+		return ret;
 	}
 
-	void Buddy::deallocatePowerOfTwo(void * memory, size_t power) throw (std::invalid_argument) {
+	void Buddy::setHugePageBacking(bool explicit_pages) noexcept {
 		auto &header = AllocatorUtility::buddyHeader();
 
-		auto block = reinterpret_cast<Block *>(memory);
+		header.mutex_.lock();
+		header.explicit_huge_pages_ = explicit_pages;
+		header.mutex_.unlock();
+	}
 
-		if (block < header.memory_ || block >= header.memory_ + header.number_of_blocks_) {
-			throw std::invalid_argument("Memory address not a part of the buddy allocator");
-		}
+	void Buddy::setAutoGrow(size_t size) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
 
 		header.mutex_.lock();
+		header.auto_grow_blocks_ = size;
+		header.mutex_.unlock();
+	}
 
-		// Mark memory as deallocated
-		auto index_of_bitmap = header.indexOfBitmap(block);
-		auto index_in_bitmap = header.indexInBitmap(block);
-		
-		auto num_of_entries = powerToSize(power);
+	void Buddy::setOwner(void *memory, size_t size, const void *owner) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
 
-		if (index_in_bitmap + num_of_entries > ENTRIES_IN_BITMAP) {
-			header.bitmaps_[index_of_bitmap].deallocate(index_in_bitmap, ENTRIES_IN_BITMAP - index_in_bitmap);
-			header.bitmaps_[index_of_bitmap + 1].deallocate(0, num_of_entries - ENTRIES_IN_BITMAP + index_in_bitmap);
-		}
-		else {
-			header.bitmaps_[index_of_bitmap].deallocate(index_in_bitmap, num_of_entries);
-		}
+		auto region = header.regionOf(memory);
 
-		auto current_power = power;
-		auto current_block = block;
+		if (region == nullptr) {
+			return;
+		}
 
-		// Insert the block back into the list
-		// If the block could merge with its buddy, merge them
-		// Repeat as long as there are merges, and buddies exist
-		while (true) {
-			current_block->info.index = current_power;
+		auto block = static_cast<Block *>(memory);
 
-			BlockList::insert(header.pointers_[current_power], current_block);
+		for (size_t i = 0; i < size; i++) {
+			region->owner(block + i) = owner;
+		}
+	}
 
-			auto left = header.leftBuddy(current_block, current_power);
-			auto right = header.rightBuddy(current_block, current_power);
+	const void *Buddy::owner(const void *memory) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
 
-			// Checks:
-			//   1) Both blocks in range
-			//   2) Both blocks free
-			//   3) Both blocks the same size
-			if (header.isInRange(left) &&
-				header.isInRange(right) &&
-				header.isFree(left) && 
-				header.isFree(right) && 
-				left->info.index == current_power && 
-				right->info.index == current_power)
-			{
-				BlockList::remove(header.pointers_[current_power], left);
-				BlockList::remove(header.pointers_[current_power], right);
+		auto region = header.regionOf(memory);
 
-				current_power++;
-				current_block = left;
-			}
-			else {
-				break;
-			}
+		if (region == nullptr) {
+			return nullptr;
 		}
 
-		header.mutex_.unlock();
+		return region->owner(memory);
 	}
 
 	bool Buddy::isPowerOfTwo(size_t number) noexcept {
@@ -181,9 +231,9 @@ namespace os2bn140314d {
 		return (number & mask) != 0;
 	}
 
-	size_t Buddy::greaterOrEqualPowerOfTwo(size_t number) throw (std::overflow_error) {
+	size_t Buddy::greaterOrEqualPowerOfTwo(size_t number) noexcept {
 		if (isSignedNegative(number)) {
-			throw std::overflow_error("Greater power of two is out of size_t range");
+			return 0;
 		}
 
 		size_t ret = 1;
@@ -203,9 +253,9 @@ namespace os2bn140314d {
 		return ret;
 	}
 
-	size_t Buddy::sizeToPower(size_t number) throw (std::invalid_argument) {
-		if (!isPowerOfTwo(number)) {
-			throw std::invalid_argument("Number is not a power of two");
+	size_t Buddy::sizeToPower(size_t number) noexcept {
+		if (number == 0 || !isPowerOfTwo(number)) {
+			return NULL_INDEX;
 		}
 
 		size_t ret = 0;
@@ -218,16 +268,258 @@ namespace os2bn140314d {
 		return ret;
 	}
 
-	size_t Buddy::powerToSize(size_t power) throw (std::out_of_range) {
-		if (power > sizeof(size_t) * BITS_IN_BYTE) {
-			throw std::out_of_range("Power of two index out of range");
+	size_t Buddy::powerToSize(size_t power) noexcept {
+		if (power >= sizeof(size_t) * BITS_IN_BYTE) {
+			return 0;
+		}
+
+		return static_cast<size_t>(1) << power;
+	}
+
+	void Buddy::setPurgePolicy(size_t power, long long decay_milliseconds, bool lazy) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.mutex_.lock();
+
+		header.purge_power_ = power;
+		header.purge_decay_ = decay_milliseconds;
+		header.purge_lazy_ = lazy;
+
+		// Blocks which are too small for the new policy should not wait to be purged
+		auto block = header.purge_first_;
+
+		while (block != nullptr) {
+			auto next = block->info.purge_next;
+
+			if (block->info.index < power) {
+				header.dequeuePurge(block);
+			}
+
+			block = next;
+		}
+
+		// Decay interval of the waiting blocks may have changed
+		header.updatePurgeDue();
+
+		header.mutex_.unlock();
+	}
+
+	size_t Buddy::purgeIdle() noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		if (buddy_header_s::now() < header.purge_due_.load(std::memory_order_relaxed)) {
+			return 0;
+		}
+
+		header.mutex_.lock();
+		auto ret = header.purgeExpired(false);
+		header.mutex_.unlock();
+
+		return ret;
+	}
+
+	size_t Buddy::purge() noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		// Blocks kept by the processors are returned first, so they can merge and be purged
+		header.drainCached();
+
+		header.mutex_.lock();
+		auto ret = header.purgeExpired(true);
+		header.mutex_.unlock();
+
+		return ret;
+	}
+
+	bool Buddy::setFreeListPolicy(size_t power, FreeListPolicy policy) noexcept {
+		if (power >= POWERS_OF_TWO || policy >= NUMBER_OF_POLICIES) {
+			return false;
+		}
+
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.mutex_.lock();
+
+		// Lists of the hybrid policy are taken on its first use, the header has no space for them
+		if (policy == HYBRID_POLICY && header.recent_ == nullptr) {
+			bool zeroed;
+			auto recent = reinterpret_cast<buddy_recent_s *>(header.takeFree(0, NORMAL_POOL, zeroed, true));
+
+			if (recent == nullptr) {
+				header.mutex_.unlock();
+				return false;
+			}
+
+			for (auto &lists : recent->lists_) {
+				for (auto &list : lists) {
+					list = nullptr;
+				}
+			}
+
+			header.recent_ = recent;
+		}
+
+		auto old_policy = header.policies_[power];
+
+		for (size_t pool = 0; pool < NUMBER_OF_POOLS; pool++) {
+			auto buddy_pool = static_cast<BuddyPool>(pool);
+			Block *blocks = nullptr;
+
+			// Free blocks keep their purge state, only their place in the lists changes
+			header.policies_[power] = old_policy;
+
+			for (auto block = header.firstFree(buddy_pool, power); block != nullptr; block = header.firstFree(buddy_pool, power)) {
+				header.unlinkFree(buddy_pool, block, power);
+				BlockList::insert(blocks, block);
+			}
+
+			header.policies_[power] = policy;
+
+			for (auto block = BlockList::remove(blocks); block != nullptr; block = BlockList::remove(blocks)) {
+				header.linkFree(buddy_pool, block, power);
+			}
+		}
+
+		// Lists of the processors hand out the blocks freed last, which would defeat sorting by address
+		if (power < buddy_header_s::CPU_PAGE_POWERS) {
+			auto bit = static_cast<size_t>(1) << power;
+
+			if (policy == LIFO_POLICY) {
+				header.cpu_powers_.fetch_or(bit, std::memory_order_relaxed);
+			}
+			else {
+				header.cpu_powers_.fetch_and(~bit, std::memory_order_relaxed);
+			}
+		}
+
+		header.mutex_.unlock();
+
+		// Kept blocks are returned to the lists in the new order
+		header.drainCached();
+
+		return true;
+	}
+
+	bool Buddy::setCpuPages(size_t high, size_t batch) noexcept {
+		if (high != 0 && (batch == 0 || batch > high)) {
+			return false;
+		}
+
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.cpu_high_.store(high, std::memory_order_relaxed);
+		header.cpu_batch_.store(batch, std::memory_order_relaxed);
+
+		// Blocks kept under the old numbers are returned, the lists refill under the new ones
+		header.drainCached();
+
+		return true;
+	}
+
+	bool Buddy::reserveContiguous(size_t power, size_t min_power) noexcept {
+		if (power >= POWERS_OF_TWO || min_power > power) {
+			return false;
+		}
+
+		auto &header = AllocatorUtility::buddyHeader();
+
+		header.mutex_.lock();
+
+		if (header.reserve_.load(std::memory_order_relaxed) != nullptr) {
+			header.mutex_.unlock();
+			return false;
+		}
+
+		bool zeroed;
+		auto reserve = reinterpret_cast<buddy_reserve_s *>(header.takeFree(0, NORMAL_POOL, zeroed, true));
+		auto memory = reserve == nullptr ? nullptr : header.takeFree(power, NORMAL_POOL, zeroed);
+
+		if (memory == nullptr) {
+			if (reserve != nullptr) {
+				auto block = reinterpret_cast<Block *>(reserve);
+				header.giveFree(header.regionOf(block), block, 0);
+			}
+
+			header.mutex_.unlock();
+			return false;
+		}
+
+		reserve->memory_ = memory;
+		reserve->power_ = power;
+		reserve->min_power_ = min_power;
+		reserve->reclaiming_ = false;
+
+		for (auto &pointer : reserve->pointers_) {
+			pointer = nullptr;
+		}
+
+		header.reserve_.store(reserve, std::memory_order_release);
+
+		// Freed block lands in the lists of the reserve, where it can not merge with the blocks outside
+		header.giveFree(header.regionOf(memory), memory, power);
+
+		header.mutex_.unlock();
+
+		return true;
+	}
+
+	double Buddy::fragmentation(size_t power) noexcept {
+		auto &header = AllocatorUtility::buddyHeader();
+
+		size_t free_blocks = 0;
+		size_t usable_blocks = 0;
+
+		header.mutex_.lock();
+
+		// Lists are walked under the lock, the metric is meant for the statistics rather than for the fast paths
+		for (size_t pool = 0; pool < NUMBER_OF_POOLS; pool++) {
+			for (size_t i = 0; i < POWERS_OF_TWO; i++) {
+				auto blocks = header.countFree(static_cast<BuddyPool>(pool), i) << i;
+
+				free_blocks += blocks;
+				usable_blocks += i >= power ? blocks : 0;
+			}
+		}
+
+		header.mutex_.unlock();
+
+		if (free_blocks == 0) {
+			return 0;
 		}
 
-		return 1 << power;
+		return static_cast<double>(free_blocks - usable_blocks) / free_blocks;
 	}
 
 	#pragma endregion 
 
+	#pragma region cpu_page_list_s implementation
+
+	void cpu_page_list_s::initialize() noexcept {
+		new (&locked_) std::atomic<bool>(false);
+		count_ = 0;
+		blocks_ = nullptr;
+	}
+
+	void cpu_page_list_s::lock() noexcept {
+		while (locked_.exchange(true, std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void cpu_page_list_s::unlock() noexcept {
+		locked_.store(false, std::memory_order_release);
+	}
+
+	#pragma endregion
+
+	#pragma region buddy_reserve_s implementation
+
+	bool buddy_reserve_s::contains(const void *block) const noexcept {
+		return block >= memory_ && block < memory_ + Buddy::powerToSize(power_);
+	}
+
+	#pragma endregion
+
 	#pragma region BitMapBlock implementation
 
 	void BitMapBlock::initialize() noexcept {
@@ -236,37 +528,29 @@ namespace os2bn140314d {
 		}
 	}
 
-	void BitMapBlock::allocate(size_t index, size_t size_in_blocks) throw(std::out_of_range) {
+	void BitMapBlock::allocate(size_t index, size_t size_in_blocks) noexcept {
 		insertValues(index, size_in_blocks, true);
 	}
 
-	void BitMapBlock::deallocate(size_t index, size_t size_in_blocks) throw(std::out_of_range) {
+	void BitMapBlock::deallocate(size_t index, size_t size_in_blocks) noexcept {
 		insertValues(index, size_in_blocks, false);
 	}
 
-	bool BitMapBlock::isFree(size_t index) const throw(std::out_of_range) {
+	bool BitMapBlock::isFree(size_t index) const noexcept {
 		auto i = indexOfByte(index);
 		auto m = mask(index);
 		return (bytes[i] & m) == 0;
 	}
 
-	size_t BitMapBlock::indexOfByte(size_t index) throw(std::out_of_range) {
-		if (index > ENTRIES_IN_BITMAP) {
-			throw std::out_of_range("Bitmap entry index out of range");
-		}
-
+	size_t BitMapBlock::indexOfByte(size_t index) noexcept {
 		return index / BITS_IN_BYTE;
 	}
 
-	unsigned char BitMapBlock::mask(size_t index) throw(std::out_of_range) {
-		if (index > ENTRIES_IN_BITMAP) {
-			throw std::out_of_range("Bitmap entry index out of range");
-		}
-
+	unsigned char BitMapBlock::mask(size_t index) noexcept {
 		return 1 << index % BITS_IN_BYTE;
 	}
 
-	void BitMapBlock::insertValue(size_t index, bool value) throw(std::out_of_range) {
+	void BitMapBlock::insertValue(size_t index, bool value) noexcept {
 		auto i = indexOfByte(index);
 		auto m = mask(index);
 
@@ -278,7 +562,7 @@ namespace os2bn140314d {
 		}
 	}
 
-	void BitMapBlock::insertValues(size_t index, size_t size_in_blocks, bool value) throw(std::out_of_range) {
+	void BitMapBlock::insertValues(size_t index, size_t size_in_blocks, bool value) noexcept {
 		for (auto i = index; i < index + size_in_blocks; i++) {
 			insertValue(i, value);
 		}
@@ -286,91 +570,107 @@ namespace os2bn140314d {
 
 	#pragma endregion
 
-	#pragma region buddy_header_s implementation
+	#pragma region buddy_region_s implementation
 
-	void buddy_header_s::initialize(Block *first_block, size_t size_in_blocks) throw (std::invalid_argument) {
-		if (size_in_blocks < 2) {
-			throw std::invalid_argument("Too few blocks for the buddy allocator");
+	bool buddy_region_s::initialize(Block *metadata, Block *memory, size_t size_in_blocks, BuddyPool pool, buddy_header_s &header) noexcept {
+		if (size_in_blocks == 0) {
+			return false;
 		}
 
-		new (&mutex_) std::mutex();
+		pool_ = pool;
 
-		initializePointers();
-		initializeBitmaps(first_block, size_in_blocks);
+		number_of_bitmaps_ = buddy_header_s::numOfBitmaps(size_in_blocks);
+		bitmaps_ = reinterpret_cast<BitMapBlock *>(metadata);
+
+		for (size_t i = 0; i < number_of_bitmaps_; i++) {
+			bitmaps_[i].initialize();
+		}
+
+		// Owner table is kept right after the bitmaps
+		owners_ = reinterpret_cast<const void **>(metadata + number_of_bitmaps_);
 
-		auto remaining_size = size_in_blocks - number_of_bitmaps_;
-		auto *remaining_blocks = first_block + number_of_bitmaps_;
+		for (size_t i = 0; i < size_in_blocks; i++) {
+			owners_[i] = nullptr;
+		}
+
+		memory_ = memory;
+		number_of_blocks_ = size_in_blocks;
 
-		memory_ = remaining_blocks;
-		number_of_blocks_ = remaining_size;
+		auto remaining_size = size_in_blocks;
+		auto *remaining_blocks = memory;
 
 		while (remaining_size > 0) {
 			auto power = Buddy::smallerOrEqualPowerOfTwo(remaining_size);
 			auto index = Buddy::sizeToPower(power);
 
 			remaining_blocks->info.index = index;
-			BlockList::insert(pointers_[index], remaining_blocks);
+			remaining_blocks->info.purge_state = RESIDENT;
+			header.linkFree(pool, remaining_blocks, index);
 
 			remaining_blocks += power;
 			remaining_size -= power;
 		}
+
+		return true;
 	}
 
-	void buddy_header_s::initializePointers() noexcept {
-		for (auto &pointer : pointers_) {
-			pointer = nullptr;
+	size_t buddy_region_s::numOfMetadataBlocks(size_t size_in_blocks) noexcept {
+		auto number_of_owner_blocks = size_in_blocks / ENTRIES_IN_OWNER_TABLE;
+
+		if (size_in_blocks % ENTRIES_IN_OWNER_TABLE != 0) {
+			number_of_owner_blocks++;
 		}
-	}
 
-	void buddy_header_s::initializeBitmaps(Block * first_block, size_t size_in_blocks) noexcept {
-		number_of_bitmaps_ = numOfBitmaps(size_in_blocks);
+		return buddy_header_s::numOfBitmaps(size_in_blocks) + number_of_owner_blocks;
+	}
 
-		bitmaps_ = reinterpret_cast<BitMapBlock *>(first_block);
+	size_t buddy_region_s::regionSizeFor(size_t power) noexcept {
+		auto needed = Buddy::powerToSize(power);
+		auto ret = needed + 1;
 
-		for (size_t i = 0; i < number_of_bitmaps_; i++) {
-			bitmaps_[i].initialize();
+		// Metadata grows with the size of the region, so repeat until the size is stable
+		while (ret - numOfMetadataBlocks(ret) < needed) {
+			ret = needed + numOfMetadataBlocks(ret);
 		}
+
+		return ret;
 	}
 
-	size_t buddy_header_s::numOfBitmaps(size_t size_in_blocks) noexcept {
-		auto ret = size_in_blocks / ENTRIES_IN_BITMAP;
+	void buddy_region_s::mark(Block *block, size_t size_in_blocks, bool value) noexcept {
+		auto index_of_bitmap = indexOfBitmap(block);
+		auto index_in_bitmap = indexInBitmap(block);
 
-		if (size_in_blocks % ENTRIES_IN_BITMAP == 0) {
-			return ret;
-		}
-		else {
-			return ret + 1;
-		}
-	}
+		// Blocks can span over more than one bitmap
+		while (size_in_blocks > 0) {
+			auto count = ENTRIES_IN_BITMAP - index_in_bitmap;
+
+			if (count > size_in_blocks) {
+				count = size_in_blocks;
+			}
+
+			bitmaps_[index_of_bitmap].insertValues(index_in_bitmap, count, value);
 
-	size_t buddy_header_s::indexOfBitmap(Block *block) const throw(std::invalid_argument) {
-		if (!isInRange(block)) {
-			throw std::invalid_argument("Block not inside allocated space");
+			size_in_blocks -= count;
+			index_of_bitmap++;
+			index_in_bitmap = 0;
 		}
+	}
 
+	size_t buddy_region_s::indexOfBitmap(const Block *block) const noexcept {
 		auto dist = block - memory_;
 		return dist / ENTRIES_IN_BITMAP;
 	}
 
-	size_t buddy_header_s::indexInBitmap(Block *block) const throw(std::invalid_argument) {
-		if (!isInRange(block)) {
-			throw std::invalid_argument("Block not inside allocated space");
-		}
-
+	size_t buddy_region_s::indexInBitmap(const Block *block) const noexcept {
 		auto dist = block - memory_;
 		return dist % ENTRIES_IN_BITMAP;
 	}
 
-	Block *buddy_header_s::leftBuddy(Block *block, size_t power) const throw(std::invalid_argument) {
+	Block *buddy_region_s::leftBuddy(Block *block, size_t power) const noexcept {
 		auto size = Buddy::powerToSize(power);
-
-		if (!isInRange(block)) {
-			throw std::invalid_argument("Block not in buddy address space");
-		}
-
 		auto diff = block - memory_;
 
-		if (diff % size == 0) {
+		if (diff % (2 * size) == 0) {
 			return block;
 		}
 		else {
@@ -378,16 +678,11 @@ namespace os2bn140314d {
 		}
 	}
 
-	Block * buddy_header_s::rightBuddy(Block * block, size_t power) const throw(std::invalid_argument) {
+	Block *buddy_region_s::rightBuddy(Block *block, size_t power) const noexcept {
 		auto size = Buddy::powerToSize(power);
-
-		if (!isInRange(block)) {
-			throw std::invalid_argument("Block not in buddy address space");
-		}
-
 		auto diff = block - memory_;
 
-		if (diff % size == 0) {
+		if (diff % (2 * size) == 0) {
 			return block + size;
 		}
 		else {
@@ -395,16 +690,892 @@ namespace os2bn140314d {
 		}
 	}
 
-	bool buddy_header_s::isFree(Block *block) const throw(std::invalid_argument) {
+	bool buddy_region_s::isFree(const Block *block) const noexcept {
 		auto index_of_bitmap = indexOfBitmap(block);
 		auto index_in_bitmap = indexInBitmap(block);
 
 		return bitmaps_[index_of_bitmap].isFree(index_in_bitmap);
 	}
 
-	bool buddy_header_s::isInRange(Block *block) const noexcept {
+	bool buddy_region_s::isInRange(const void *block) const noexcept {
 		return block >= memory_ && block < memory_ + number_of_blocks_;
 	}
 
+	const Block *buddy_region_s::blockStart(const void *memory) const noexcept {
+		auto diff = static_cast<const byte *>(memory) - reinterpret_cast<const byte *>(memory_);
+		return memory_ + diff / BLOCK_SIZE;
+	}
+
+	const void *&buddy_region_s::owner(const void *memory) const noexcept {
+		return owners_[blockStart(memory) - memory_];
+	}
+
+	#pragma endregion
+
+	#pragma region buddy_header_s implementation
+
+	bool buddy_header_s::initialize(Block *first_block, size_t size_in_blocks) noexcept {
+		if (size_in_blocks < 2) {
+			return false;
+		}
+
+		new (&mutex_) std::mutex();
+		new (&number_of_regions_) std::atomic<size_t>(0);
+
+		new (&cpus_) std::atomic<std::atomic<cpu_pages_s *> *>(nullptr);
+		new (&cpu_high_) std::atomic<size_t>(DEFAULT_CPU_HIGH);
+		new (&cpu_batch_) std::atomic<size_t>(DEFAULT_CPU_BATCH);
+		new (&cpu_powers_) std::atomic<size_t>((static_cast<size_t>(1) << CPU_PAGE_POWERS) - 1);
+
+		new (&reserve_) std::atomic<buddy_reserve_s *>(nullptr);
+
+		number_of_cpus_ = Processor::count();
+		if (number_of_cpus_ > MAX_CPUS) {
+			number_of_cpus_ = MAX_CPUS;
+		}
+
+		auto_grow_blocks_ = 0;
+		explicit_huge_pages_ = false;
+		mapped_regions_ = 0;
+
+		purge_power_ = POWERS_OF_TWO;
+		purge_decay_ = 0;
+		purge_lazy_ = false;
+		purge_first_ = nullptr;
+		purge_last_ = nullptr;
+		new (&purge_due_) std::atomic<long long>(NO_PURGE_DUE);
+
+		initializePointers();
+
+		return addRegion(first_block, size_in_blocks);
+	}
+
+	void buddy_header_s::initializePointers() noexcept {
+		for (size_t pool = 0; pool < NUMBER_OF_POOLS; pool++) {
+			for (auto &pointer : pointers_[pool]) {
+				pointer = nullptr;
+			}
+		}
+
+		recent_ = nullptr;
+
+		for (auto &policy : policies_) {
+			policy = LIFO_POLICY;
+		}
+	}
+
+	bool buddy_header_s::addRegion(Block *first_block, size_t size_in_blocks, bool mapped) noexcept {
+		// Metadata is kept in the first blocks of the region
+		auto number_of_metadata_blocks = buddy_region_s::numOfMetadataBlocks(size_in_blocks);
+
+		if (size_in_blocks <= number_of_metadata_blocks) {
+			return false;
+		}
+
+		return addRegion(first_block, first_block + number_of_metadata_blocks, size_in_blocks - number_of_metadata_blocks, NORMAL_POOL, mapped);
+	}
+
+	bool buddy_header_s::addHugeRegion(Block *first_block, size_t size_in_blocks) noexcept {
+		auto address = reinterpret_cast<size_t>(first_block);
+		auto aligned = reinterpret_cast<Block *>((address + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+
+		// Whole blocks before the aligned start can hold the metadata
+		// Part of the last block is lost if the start is not aligned to blocks
+		auto slack = static_cast<size_t>(reinterpret_cast<byte *>(aligned) - reinterpret_cast<byte *>(first_block));
+		auto blocks_before = slack / BLOCK_SIZE;
+		auto lost_blocks = (slack + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+		if (size_in_blocks <= lost_blocks) {
+			return false;
+		}
+
+		auto size = size_in_blocks - lost_blocks;
+		auto number_of_metadata_blocks = buddy_region_s::numOfMetadataBlocks(size);
+
+		// Keep the metadata in the blocks before the aligned start if it fits there, otherwise after the pool
+		auto metadata = first_block;
+
+		if (blocks_before < number_of_metadata_blocks) {
+			if (size <= number_of_metadata_blocks) {
+				return false;
+			}
+
+			size -= number_of_metadata_blocks;
+			metadata = aligned + size;
+		}
+
+		if (!addRegion(metadata, aligned, size, HUGE_POOL, false)) {
+			return false;
+		}
+
+		SystemMemory::adviseHuge(aligned, size / BLOCKS_IN_HUGE_PAGE * HUGE_PAGE_SIZE);
+
+		return true;
+	}
+
+	bool buddy_header_s::addRegion(Block *metadata, Block *memory, size_t size_in_blocks, BuddyPool pool, bool mapped) noexcept {
+		auto index = number_of_regions_.load();
+
+		if (index == MAX_REGIONS || !regions_[index].initialize(metadata, memory, size_in_blocks, pool, *this)) {
+			return false;
+		}
+
+		auto bit = static_cast<size_t>(1) << index;
+		mapped_regions_ = mapped ? mapped_regions_ | bit : mapped_regions_ & ~bit;
+
+		// Publish the region only after it is fully initialized
+		// Lookups are done without the lock
+		number_of_regions_.store(index + 1);
+
+		return true;
+	}
+
+	bool buddy_header_s::grow(size_t power, BuddyPool pool) noexcept {
+		if (auto_grow_blocks_ == 0 || number_of_regions_.load() == MAX_REGIONS) {
+			return false;
+		}
+
+		if (pool == HUGE_POOL) {
+			auto size_in_blocks = Buddy::powerToSize(power);
+
+			if (size_in_blocks < auto_grow_blocks_) {
+				size_in_blocks = auto_grow_blocks_;
+			}
+
+			auto size_in_huge_pages = (size_in_blocks + BLOCKS_IN_HUGE_PAGE - 1) / BLOCKS_IN_HUGE_PAGE;
+
+			return mapHugeRegion(size_in_huge_pages * BLOCKS_IN_HUGE_PAGE);
+		}
+
+		auto size_in_blocks = buddy_region_s::regionSizeFor(power);
+
+		if (size_in_blocks < auto_grow_blocks_) {
+			size_in_blocks = auto_grow_blocks_;
+		}
+
+		auto memory = SystemMemory::allocate(size_in_blocks);
+
+		if (memory == nullptr) {
+			return false;
+		}
+
+		if (!addRegion(static_cast<Block *>(memory), size_in_blocks, true)) {
+			SystemMemory::deallocate(memory, size_in_blocks);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool buddy_header_s::mapHugeRegion(size_t size_in_blocks) noexcept {
+		if (number_of_regions_.load() == MAX_REGIONS) {
+			return false;
+		}
+
+		auto number_of_metadata_blocks = buddy_region_s::numOfMetadataBlocks(size_in_blocks);
+
+		auto memory = SystemMemory::allocateHuge(size_in_blocks, explicit_huge_pages_);
+		auto metadata = SystemMemory::allocate(number_of_metadata_blocks);
+
+		if (memory == nullptr || metadata == nullptr) {
+			SystemMemory::deallocate(metadata, number_of_metadata_blocks);
+			return false;
+		}
+
+		if (!addRegion(static_cast<Block *>(metadata), static_cast<Block *>(memory), size_in_blocks, HUGE_POOL, true)) {
+			SystemMemory::deallocate(metadata, number_of_metadata_blocks);
+			return false;
+		}
+
+		return true;
+	}
+
+	Block *buddy_header_s::takeFree(size_t power, BuddyPool pool, bool &zeroed, bool long_lived) noexcept {
+		// Find the size of the smallest block that is big enough
+		// If there is no such block, try to map one more region and search again
+		auto bigger_power = power;
+
+		while (true) {
+			while (bigger_power < POWERS_OF_TWO && freeRoot(pool, bigger_power) == nullptr) {
+				bigger_power++;
+			}
+
+			if (bigger_power != POWERS_OF_TWO) {
+				break;
+			}
+
+			// The greater block does not exist, and the allocator can not grow
+			// Error - no more available memory
+			// Reserve never grows, it is a part of the normal pool
+			if (pool == RESERVE_POOL || !grow(power, pool)) {
+				return nullptr;
+			}
+
+			bigger_power = power;
+		}
+
+		auto ret = firstFree(pool, bigger_power, long_lived);
+		auto state = ret->info.purge_state;
+
+		removeFree(pool, ret, bigger_power);
+
+		// Halves of a purged block are purged as well, except for the first block
+		// which gets the information about the free block written into it
+		auto halves_state = state == PURGED || state == DISCARDED ? state : RESIDENT;
+
+		// If the block is greater than needed, split it in half until the wanted size
+		// Insert the right halves back into the lists
+		while (bigger_power != power) {
+			bigger_power--;
+
+			auto second_pointer = ret + Buddy::powerToSize(bigger_power);
+			insertFree(pool, second_pointer, bigger_power, halves_state);
+		}
+
+		// Mark memory as allocated
+		regionOf(ret)->mark(ret, Buddy::powerToSize(power), true);
+
+		// Zero the parts of a purged block which were not returned to the system
+		// The rest of the block already reads as zeros
+		zeroed = state == PURGED;
+
+		if (zeroed) {
+			byte *begin;
+			byte *end;
+			purgeRange(ret, power, begin, end);
+
+			auto start = reinterpret_cast<byte *>(ret);
+			auto finish = reinterpret_cast<byte *>(ret + Buddy::powerToSize(power));
+
+			if (begin >= end) {
+				begin = end = finish;
+			}
+
+			std::memset(start, 0, begin - start);
+			std::memset(end, 0, finish - end);
+		}
+
+		return ret;
+	}
+
+	void buddy_header_s::giveFree(buddy_region_s *region, Block *block, size_t power) noexcept {
+		// Mark memory as deallocated
+		region->mark(block, Buddy::powerToSize(power), false);
+
+		auto pool = poolOf(region, block);
+		auto current_power = power;
+		auto current_block = block;
+
+		// If the block could merge with its buddy, merge them
+		// Repeat as long as there are merges, and buddies exist
+		// Buddies are always searched for inside the same region
+		while (true) {
+			auto left = region->leftBuddy(current_block, current_power);
+			auto right = region->rightBuddy(current_block, current_power);
+
+			auto buddy = left == current_block ? right : left;
+
+			// Checks:
+			//   1) Buddy in range
+			//   2) Buddy free
+			//   3) Buddy the same size
+			//   4) Buddy on the same side of the reserve boundary
+			if (region->isInRange(buddy) &&
+				region->isFree(buddy) &&
+				buddy->info.index == current_power &&
+				poolOf(region, buddy) == pool)
+			{
+				removeFree(pool, buddy, current_power);
+
+				current_power++;
+				current_block = left;
+			}
+			else {
+				break;
+			}
+		}
+
+		// Insert the block back into the list
+		// Big enough blocks also wait in the purge list until they have been idle long enough
+		insertFree(pool, current_block, current_power, RESIDENT);
+
+		// Merged block can be split for any smaller size, the bigger ones still do not fit
+		WaitQueue::wakeUpTo(current_power);
+	}
+
+	buddy_header_s::cpu_pages_s *buddy_header_s::cpuPages() noexcept {
+		if (cpu_high_.load(std::memory_order_relaxed) == 0) {
+			return nullptr;
+		}
+
+		auto cpus = cpus_.load(std::memory_order_acquire);
+		auto index = Processor::current() % number_of_cpus_;
+
+		if (cpus != nullptr) {
+			auto ret = cpus[index].load(std::memory_order_acquire);
+			if (ret != nullptr) {
+				return ret;
+			}
+		}
+
+		// Table and the lists of each processor are taken straight from the free lists,
+		// a block from the list of the processor would need the lists first
+		mutex_.lock();
+
+		bool zeroed;
+
+		cpus = cpus_.load(std::memory_order_relaxed);
+		if (cpus == nullptr) {
+			cpus = reinterpret_cast<std::atomic<cpu_pages_s *> *>(takeFree(0, NORMAL_POOL, zeroed, true));
+
+			if (cpus == nullptr) {
+				mutex_.unlock();
+				return nullptr;
+			}
+
+			for (size_t i = 0; i < number_of_cpus_; i++) {
+				new (cpus + i) std::atomic<cpu_pages_s *>(nullptr);
+			}
+
+			cpus_.store(cpus, std::memory_order_release);
+		}
+
+		auto ret = cpus[index].load(std::memory_order_relaxed);
+		if (ret == nullptr) {
+			ret = reinterpret_cast<cpu_pages_s *>(takeFree(0, NORMAL_POOL, zeroed, true));
+
+			if (ret == nullptr) {
+				mutex_.unlock();
+				return nullptr;
+			}
+
+			for (auto &list : ret->lists_) {
+				list.initialize();
+			}
+
+			cpus[index].store(ret, std::memory_order_release);
+		}
+
+		mutex_.unlock();
+
+		return ret;
+	}
+
+	Block *buddy_header_s::allocateCached(size_t power) noexcept {
+		if ((cpu_powers_.load(std::memory_order_relaxed) & (static_cast<size_t>(1) << power)) == 0 ||
+			(cpu_high_.load(std::memory_order_relaxed) >> power) == 0)
+		{
+			return nullptr;
+		}
+
+		auto cpu = cpuPages();
+
+		if (cpu == nullptr) {
+			return nullptr;
+		}
+
+		auto &list = cpu->lists_[power];
+
+		list.lock();
+
+		// Empty list takes a batch from the free lists under one lock
+		if (list.count_ == 0) {
+			auto batch = cpu_batch_.load(std::memory_order_relaxed) >> power;
+			batch = batch == 0 ? 1 : batch;
+
+			mutex_.lock();
+
+			for (size_t i = 0; i < batch; i++) {
+				bool zeroed;
+				auto block = takeFree(power, NORMAL_POOL, zeroed);
+
+				if (block == nullptr) {
+					break;
+				}
+
+				BlockList::insert(list.blocks_, block);
+				list.count_++;
+			}
+
+			mutex_.unlock();
+		}
+
+		auto ret = BlockList::remove(list.blocks_);
+
+		if (ret != nullptr) {
+			list.count_--;
+		}
+
+		list.unlock();
+
+		return ret;
+	}
+
+	bool buddy_header_s::deallocateCached(Block *block, size_t power) noexcept {
+		auto high = cpu_high_.load(std::memory_order_relaxed) >> power;
+
+		if ((cpu_powers_.load(std::memory_order_relaxed) & (static_cast<size_t>(1) << power)) == 0 || high == 0) {
+			return false;
+		}
+
+		auto cpu = cpuPages();
+
+		if (cpu == nullptr) {
+			return false;
+		}
+
+		auto &list = cpu->lists_[power];
+
+		list.lock();
+
+		// While bigger allocations wait, the block is merged at once rather than kept by the processor
+		if (WaitQueue::waitingAbove(power)) {
+			list.unlock();
+			return false;
+		}
+
+		// Full list returns a batch of the blocks to the free lists under one lock
+		// The blocks freed last are kept, their memory is likely still in the processor cache
+		if (list.count_ >= high) {
+			auto batch = cpu_batch_.load(std::memory_order_relaxed) >> power;
+			batch = batch == 0 ? 1 : batch;
+
+			auto kept = list.count_ > batch ? list.count_ - batch : 0;
+			auto link = &list.blocks_;
+
+			for (size_t i = 0; i < kept; i++) {
+				link = &(*link)->info.next;
+			}
+
+			auto returned = *link;
+			*link = nullptr;
+
+			mutex_.lock();
+
+			while (returned != nullptr) {
+				auto next = returned->info.next;
+
+				giveFree(regionOf(returned), returned, power);
+				list.count_--;
+
+				returned = next;
+			}
+
+			purgeExpired(false);
+
+			mutex_.unlock();
+		}
+
+		BlockList::insert(list.blocks_, block);
+		list.count_++;
+
+		WaitQueue::wake(power);
+
+		list.unlock();
+
+		return true;
+	}
+
+	size_t buddy_header_s::drainCached() noexcept {
+		size_t ret = 0;
+
+		auto cpus = cpus_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; cpus != nullptr && i < number_of_cpus_; i++) {
+			auto cpu = cpus[i].load(std::memory_order_acquire);
+
+			for (size_t power = 0; cpu != nullptr && power < CPU_PAGE_POWERS; power++) {
+				auto &list = cpu->lists_[power];
+
+				list.lock();
+
+				auto blocks = list.blocks_;
+				list.blocks_ = nullptr;
+				list.count_ = 0;
+
+				mutex_.lock();
+
+				while (blocks != nullptr) {
+					auto next = blocks->info.next;
+
+					giveFree(regionOf(blocks), blocks, power);
+					ret += Buddy::powerToSize(power);
+
+					blocks = next;
+				}
+
+				mutex_.unlock();
+
+				list.unlock();
+			}
+		}
+
+		return ret;
+	}
+
+	void buddy_header_s::lockAll() noexcept {
+		// Lists of the processors are locked before the mutex, as when they are refilled
+		auto cpus = cpus_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; cpus != nullptr && i < number_of_cpus_; i++) {
+			auto cpu = cpus[i].load(std::memory_order_acquire);
+
+			for (size_t power = 0; cpu != nullptr && power < CPU_PAGE_POWERS; power++) {
+				cpu->lists_[power].lock();
+			}
+		}
+
+		mutex_.lock();
+	}
+
+	void buddy_header_s::unlockAll() noexcept {
+		mutex_.unlock();
+
+		auto cpus = cpus_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; cpus != nullptr && i < number_of_cpus_; i++) {
+			auto cpu = cpus[i].load(std::memory_order_acquire);
+
+			for (size_t power = 0; cpu != nullptr && power < CPU_PAGE_POWERS; power++) {
+				cpu->lists_[power].unlock();
+			}
+		}
+	}
+
+	void buddy_header_s::reattach() noexcept {
+		new (&mutex_) std::mutex;
+	}
+
+	void buddy_header_s::insertFree(BuddyPool pool, Block *block, size_t power, PurgeState state) noexcept {
+		block->info.index = power;
+		block->info.purge_state = state;
+
+		linkFree(pool, block, power);
+
+		if (state != RESIDENT || power < purge_power_) {
+			return;
+		}
+
+		// Insert to the end of the purge list, so the list stays sorted by the time of freeing
+		block->info.purge_state = PENDING;
+		block->info.freed_at = now();
+		block->info.purge_next = nullptr;
+		block->info.purge_prev = purge_last_;
+
+		if (purge_last_ != nullptr) {
+			purge_last_->info.purge_next = block;
+		}
+		else {
+			purge_first_ = block;
+			updatePurgeDue();
+		}
+
+		purge_last_ = block;
+	}
+
+	void buddy_header_s::removeFree(BuddyPool pool, Block *block, size_t power) noexcept {
+		unlinkFree(pool, block, power);
+		dequeuePurge(block);
+	}
+
+	void buddy_header_s::linkFree(BuddyPool pool, Block *block, size_t power) noexcept {
+		switch (policyOf(pool, power)) {
+		case LIFO_POLICY:
+			BlockList::insert(freeRoot(pool, power), block);
+			break;
+		case HYBRID_POLICY:
+			BlockList::insert(recent_->lists_[pool][power], block);
+			BlockTree::insert(freeRoot(pool, power), block);
+			break;
+		default:
+			BlockTree::insert(freeRoot(pool, power), block);
+			break;
+		}
+	}
+
+	void buddy_header_s::unlinkFree(BuddyPool pool, Block *block, size_t power) noexcept {
+		auto policy = policyOf(pool, power);
+
+		if (policy == LIFO_POLICY) {
+			BlockList::remove(freeRoot(pool, power), block);
+		}
+		else {
+			BlockTree::remove(freeRoot(pool, power), block);
+		}
+
+		if (policy == HYBRID_POLICY) {
+			BlockList::remove(recent_->lists_[pool][power], block);
+		}
+	}
+
+	Block *buddy_header_s::firstFree(BuddyPool pool, size_t power, bool long_lived) const noexcept {
+		switch (policyOf(pool, power)) {
+		case LIFO_POLICY:
+			return freeRoot(pool, power);
+		case HYBRID_POLICY:
+			// Long lived blocks gather at the start of the regions, the others reuse the memory freed last
+			return long_lived ? BlockTree::first(freeRoot(pool, power)) : recent_->lists_[pool][power];
+		default:
+			return BlockTree::first(freeRoot(pool, power));
+		}
+	}
+
+	size_t buddy_header_s::countFree(BuddyPool pool, size_t power) const noexcept {
+		if (policyOf(pool, power) != LIFO_POLICY) {
+			return BlockTree::count(freeRoot(pool, power));
+		}
+
+		size_t ret = 0;
+
+		for (auto block = freeRoot(pool, power); block != nullptr; block = block->info.next) {
+			ret++;
+		}
+
+		return ret;
+	}
+
+	Block *&buddy_header_s::freeRoot(BuddyPool pool, size_t power) noexcept {
+		if (pool == RESERVE_POOL) {
+			return reserve_.load(std::memory_order_relaxed)->pointers_[power];
+		}
+
+		return pointers_[pool][power];
+	}
+
+	Block *buddy_header_s::freeRoot(BuddyPool pool, size_t power) const noexcept {
+		if (pool == RESERVE_POOL) {
+			return reserve_.load(std::memory_order_relaxed)->pointers_[power];
+		}
+
+		return pointers_[pool][power];
+	}
+
+	FreeListPolicy buddy_header_s::policyOf(BuddyPool pool, size_t power) const noexcept {
+		// Borrowed blocks gather at the start of the reserve, so its end stays contiguous
+		return pool == RESERVE_POOL ? ADDRESS_POLICY : policies_[power];
+	}
+
+	BuddyPool buddy_header_s::poolOf(const buddy_region_s *region, const Block *block) const noexcept {
+		auto reserve = reserve_.load(std::memory_order_acquire);
+
+		if (reserve != nullptr && reserve->contains(block)) {
+			return RESERVE_POOL;
+		}
+
+		return region->pool_;
+	}
+
+	Block *buddy_header_s::borrowFree(size_t power, bool &zeroed) noexcept {
+		auto reserve = reserve_.load(std::memory_order_relaxed);
+
+		if (reserve != nullptr && !reserve->reclaiming_) {
+			auto ret = takeFree(power, RESERVE_POOL, zeroed);
+
+			if (ret != nullptr) {
+				return ret;
+			}
+		}
+
+		// Only the slabs of the movable caches borrow the reserve
+		return takeFree(power, NORMAL_POOL, zeroed, true);
+	}
+
+	Block *buddy_header_s::reclaim(size_t power, bool &zeroed) noexcept {
+		auto reserve = reserve_.load(std::memory_order_acquire);
+
+		if (reserve == nullptr || power < reserve->min_power_ || power > reserve->power_) {
+			return nullptr;
+		}
+
+		mutex_.lock();
+
+		auto ret = takeFree(power, RESERVE_POOL, zeroed);
+
+		if (ret != nullptr || reserve->reclaiming_) {
+			mutex_.unlock();
+			return ret;
+		}
+
+		// Part of the reserve with the fewest borrowed blocks is the cheapest to empty
+		// Borrowed blocks belong to the slabs, so the parts with the allocated blocks without an owner can not be emptied
+		auto region = regionOf(reserve->memory_);
+		auto size = Buddy::powerToSize(power);
+		auto end = reserve->memory_ + Buddy::powerToSize(reserve->power_);
+
+		Block *cheapest = nullptr;
+		auto fewest = size + 1;
+
+		for (auto part = reserve->memory_; part < end; part += size) {
+			size_t borrowed = 0;
+
+			for (size_t i = 0; i < size && borrowed < fewest; i++) {
+				if (region->isFree(part + i)) {
+					continue;
+				}
+
+				borrowed += region->owner(part + i) != nullptr ? 1 : fewest;
+			}
+
+			if (borrowed < fewest) {
+				cheapest = part;
+				fewest = borrowed;
+			}
+		}
+
+		if (cheapest == nullptr) {
+			mutex_.unlock();
+			return nullptr;
+		}
+
+		// Nothing is lent while the objects move, so they land in the normal pool
+		reserve->reclaiming_ = true;
+
+		mutex_.unlock();
+
+		AllocatorUtility::slabHeader().evacuate(cheapest, cheapest + size);
+
+		mutex_.lock();
+
+		ret = takeFree(power, RESERVE_POOL, zeroed);
+		reserve->reclaiming_ = false;
+
+		mutex_.unlock();
+
+		return ret;
+	}
+
+	void buddy_header_s::dequeuePurge(Block *block) noexcept {
+		if (block->info.purge_state != PENDING) {
+			return;
+		}
+
+		auto left = block->info.purge_prev;
+		auto right = block->info.purge_next;
+
+		if (left != nullptr) {
+			left->info.purge_next = right;
+		}
+		else {
+			purge_first_ = right;
+			updatePurgeDue();
+		}
+
+		if (right != nullptr) {
+			right->info.purge_prev = left;
+		}
+		else {
+			purge_last_ = left;
+		}
+
+		block->info.purge_state = RESIDENT;
+	}
+
+	size_t buddy_header_s::purgeExpired(bool force) noexcept {
+		if (purge_first_ == nullptr) {
+			return 0;
+		}
+
+		auto current_time = now();
+		size_t ret = 0;
+
+		// The list is sorted by the time of freeing, so stop at the first block that is not old enough
+		while (purge_first_ != nullptr && (force || current_time - purge_first_->info.freed_at >= purge_decay_)) {
+			auto block = purge_first_;
+			dequeuePurge(block);
+
+			byte *begin;
+			byte *end;
+			purgeRange(block, block->info.index, begin, end);
+
+			if (begin < end) {
+				// Dropped pages of the memory given by the user may be shared or backed by a file, and keep their contents
+				auto region = static_cast<size_t>(regionOf(block) - regions_);
+				auto zeroed = SystemMemory::purge(begin, end - begin, purge_lazy_) && (mapped_regions_ >> region & 1) != 0;
+				block->info.purge_state = zeroed ? PURGED : DISCARDED;
+				ret++;
+			}
+		}
+
+		return ret;
+	}
+
+	void buddy_header_s::updatePurgeDue() noexcept {
+		auto due = purge_first_ != nullptr ? purge_first_->info.freed_at + purge_decay_ : NO_PURGE_DUE;
+		purge_due_.store(due, std::memory_order_relaxed);
+	}
+
+	void buddy_header_s::purgeRange(Block *block, size_t power, byte *&begin, byte *&end) noexcept {
+		auto page_size = SystemMemory::pageSize();
+
+		auto first = reinterpret_cast<size_t>(block + 1);
+		auto last = reinterpret_cast<size_t>(block + Buddy::powerToSize(power));
+
+		// Round the start up, and the end down to the page boundary
+		begin = reinterpret_cast<byte *>((first + page_size - 1) / page_size * page_size);
+		end = reinterpret_cast<byte *>(last / page_size * page_size);
+	}
+
+	long long buddy_header_s::now() noexcept {
+		auto time = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(time).count();
+	}
+
+	size_t buddy_header_s::numOfBitmaps(size_t size_in_blocks) noexcept {
+		auto ret = size_in_blocks / ENTRIES_IN_BITMAP;
+
+		if (size_in_blocks % ENTRIES_IN_BITMAP == 0) {
+			return ret;
+		}
+		else {
+			return ret + 1;
+		}
+	}
+
+	buddy_region_s *buddy_header_s::regionOf(const void *memory) noexcept {
+		auto number_of_regions = number_of_regions_.load();
+
+		for (size_t i = 0; i < number_of_regions; i++) {
+			if (regions_[i].isInRange(memory)) {
+				return &regions_[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	size_t buddy_header_s::indexOfBitmap(Block *block) noexcept {
+		auto region = regionOf(block);
+
+		if (region == nullptr) {
+			return NULL_INDEX;
+		}
+
+		return region->indexOfBitmap(block);
+	}
+
+	size_t buddy_header_s::indexInBitmap(Block *block) noexcept {
+		auto region = regionOf(block);
+
+		if (region == nullptr) {
+			return NULL_INDEX;
+		}
+
+		return region->indexInBitmap(block);
+	}
+
+	bool buddy_header_s::isFree(Block *block) noexcept {
+		auto region = regionOf(block);
+
+		if (region == nullptr) {
+			return false;
+		}
+
+		return region->isFree(block);
+	}
+
+	bool buddy_header_s::isInRange(Block *block) noexcept {
+		return regionOf(block) != nullptr;
+	}
+
 	#pragma endregion  
 }
@@ -30,13 +30,13 @@ namespace os2bn140314d {
 		}
 
 		if (right != nullptr) {
-			right->next_ = left;
+			right->prev_ = left;
 		}
 	}
 
-	cache_header_s *CacheHeaderList::remove() throw(std::underflow_error) {
+	cache_header_s *CacheHeaderList::remove() noexcept {
 		if (first_ == nullptr) {
-			throw std::underflow_error("List is empty");
+			return nullptr;
 		}
 
 		auto ret = first_;
@@ -52,4 +52,8 @@ namespace os2bn140314d {
 	bool CacheHeaderList::isEmpty() const noexcept {
 		return first_ == nullptr;
 	}
+
+	cache_header_s *CacheHeaderList::first() const noexcept {
+		return first_;
+	}
 }
\ No newline at end of file
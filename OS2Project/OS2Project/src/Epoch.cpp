@@ -0,0 +1,313 @@
+/**
+* \file Epoch.cpp
+* \brief Implementation of the epoch based reclamation of the deferred objects
+*/
+
+#include "Epoch.h"
+#include "Buddy.h"
+#include "SlabUtility.h"
+#include "GuardedPool.h"
+#include "HeapProfiler.h"
+#include "SystemMemory.h"
+#include <cstdlib> // abort
+#include <iostream> // cerr
+#include <thread> // yield
+
+namespace os2bn140314d {
+
+	/**
+	 * \brief Struct giving up the record of the thread when it exits
+	 */
+	struct epoch_owner_s {
+		epoch_record_s *record_;				/**< Record of the thread, or nullptr */
+
+		/**
+		 * \brief Clear the announced epoch and free the record, keeping its deferred objects
+		 */
+		~epoch_owner_s();
+	};
+
+	epoch_owner_s::~epoch_owner_s() {
+		if (record_ == nullptr) {
+			return;
+		}
+
+		record_->nesting_ = 0;
+		record_->state_.store(0, std::memory_order_release);
+
+		Epoch::record_ = nullptr;
+
+		record_->used_.store(false, std::memory_order_release);
+	}
+
+	#pragma region epoch_record_s implementation
+
+	void epoch_record_s::initialize() noexcept {
+		new (&state_) std::atomic<size_t>(0);
+		nesting_ = 0;
+		next_ = nullptr;
+		new (&used_) std::atomic<bool>(true);
+
+		new (&locked_) std::atomic<bool>(false);
+
+		for (auto &bag : bags_) {
+			bag.epoch_ = 0;
+			bag.batches_ = nullptr;
+		}
+	}
+
+	void epoch_record_s::lock() noexcept {
+		while (locked_.exchange(true, std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void epoch_record_s::unlock() noexcept {
+		locked_.store(false, std::memory_order_release);
+	}
+
+	void epoch_record_s::collect(size_t epoch, deferred_batch_s *&taken) noexcept {
+		for (auto &bag : bags_) {
+			if (bag.batches_ == nullptr || bag.epoch_ + 2 > epoch) {
+				continue;
+			}
+
+			auto last = bag.batches_;
+			while (last->next_ != nullptr) {
+				last = last->next_;
+			}
+
+			last->next_ = taken;
+			taken = bag.batches_;
+			bag.batches_ = nullptr;
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Epoch implementation
+
+	thread_local epoch_record_s *Epoch::record_ = nullptr;
+
+	std::atomic<size_t> Epoch::global_(0);
+	std::atomic<epoch_record_s *> Epoch::records_(nullptr);
+
+	void Epoch::defer(cache_header_s *cache, void *object) noexcept {
+		auto record = local();
+
+		// The second attempt follows an advance, which may free the batches of the older epochs
+		for (auto attempt = 0; attempt < 2; attempt++) {
+			deferred_batch_s *taken = nullptr;
+
+			record->lock();
+
+			auto epoch = global_.load(std::memory_order_seq_cst);
+
+			// Bag with the index of the current epoch is either of this epoch, or three behind, and collected
+			record->collect(epoch, taken);
+
+			auto &bag = record->bags_[epoch % epoch_record_s::EPOCHS];
+			bag.epoch_ = epoch;
+
+			auto pushed = push(bag, cache, object);
+			auto count = pushed ? bag.batches_->count_ : 0;
+			auto due = count % ADVANCE_INTERVAL == 0 || count == deferred_batch_s::CAPACITY;
+
+			record->unlock();
+
+			release(taken);
+
+			if (pushed && due && advance()) {
+				taken = nullptr;
+
+				record->lock();
+				record->collect(global_.load(std::memory_order_acquire), taken);
+				record->unlock();
+
+				release(taken);
+			}
+
+			if (pushed) {
+				return;
+			}
+
+			advance();
+		}
+
+		// Readers of the calling thread would never let the grace period pass
+		if (record->nesting_ != 0) {
+			cache->mutex_.lock();
+			cache->error_ |= NO_MORE_SPACE;
+			cache->mutex_.unlock();
+
+			return;
+		}
+
+		waitFor(global_.load(std::memory_order_seq_cst) + 2);
+
+		Slab::deallocate(cache, object);
+	}
+
+	long long Epoch::barrier() noexcept {
+		auto record = local();
+
+		if (record->nesting_ != 0) {
+			return -1;
+		}
+
+		// Every object deferred before the call has an epoch not greater than the current one
+		waitFor(global_.load(std::memory_order_seq_cst) + 2);
+
+		auto epoch = global_.load(std::memory_order_acquire);
+		long long ret = 0;
+
+		for (auto current = records_.load(std::memory_order_acquire); current != nullptr; current = current->next_) {
+			deferred_batch_s *taken = nullptr;
+
+			current->lock();
+			current->collect(epoch, taken);
+			current->unlock();
+
+			ret += release(taken);
+		}
+
+		return ret;
+	}
+
+	epoch_record_s *Epoch::acquire() noexcept {
+		epoch_record_s *ret = nullptr;
+
+		// Records of the exited threads are reused, together with the objects they deferred
+		for (auto current = records_.load(std::memory_order_acquire); current != nullptr && ret == nullptr; current = current->next_) {
+			auto used = false;
+
+			if (!current->used_.load(std::memory_order_relaxed) && current->used_.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+				ret = current;
+			}
+		}
+
+		if (ret == nullptr) {
+			auto blocks = (sizeof(epoch_record_s) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			ret = static_cast<epoch_record_s *>(SystemMemory::allocate(blocks));
+
+			if (ret == nullptr) {
+				std::cerr << "Epoch record of the thread could not be allocated" << std::endl;
+				std::abort();
+			}
+
+			ret->initialize();
+
+			auto head = records_.load(std::memory_order_relaxed);
+			do {
+				ret->next_ = head;
+			} while (!records_.compare_exchange_weak(head, ret, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		static thread_local epoch_owner_s owner = { nullptr };
+		owner.record_ = ret;
+
+		record_ = ret;
+
+		return ret;
+	}
+
+	bool Epoch::advance() noexcept {
+		auto epoch = global_.load(std::memory_order_seq_cst);
+
+		// Pairs with the fence of the readers, either the reader sees the unlinked object, or this thread sees the reader
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		for (auto current = records_.load(std::memory_order_acquire); current != nullptr; current = current->next_) {
+			// Acquire pairs with leaving the critical section, the reads of the reader happen before the objects are freed
+			auto state = current->state_.load(std::memory_order_acquire);
+
+			if ((state & epoch_record_s::ACTIVE) != 0 && (state >> 1) != epoch) {
+				return false;
+			}
+		}
+
+		// Failure means that another thread advanced the epoch
+		global_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+
+		return true;
+	}
+
+	void Epoch::waitFor(size_t epoch) noexcept {
+		while (global_.load(std::memory_order_acquire) < epoch) {
+			if (!advance()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	bool Epoch::push(epoch_bag_s &bag, cache_header_s *cache, void *object) noexcept {
+		auto batch = bag.batches_;
+
+		if (batch == nullptr || batch->count_ == deferred_batch_s::CAPACITY) {
+			bool zeroed;
+			auto fresh = static_cast<deferred_batch_s *>(Buddy::allocatePowerOfTwo(0, zeroed));
+
+			if (fresh == nullptr) {
+				return false;
+			}
+
+			fresh->next_ = batch;
+			fresh->count_ = 0;
+
+			bag.batches_ = batch = fresh;
+		}
+
+		batch->objects_[batch->count_].cache_ = cache;
+		batch->objects_[batch->count_].object_ = object;
+		batch->count_++;
+
+		return true;
+	}
+
+	size_t Epoch::release(deferred_batch_s *batches) noexcept {
+		void *run[RELEASE_RUN];
+		size_t length = 0;
+		cache_header_s *cache = nullptr;
+
+		size_t ret = 0;
+
+		while (batches != nullptr) {
+			auto batch = batches;
+			batches = batch->next_;
+
+			for (size_t i = 0; i < batch->count_; i++) {
+				auto &deferred = batch->objects_[i];
+
+				// Guarded objects are not in any slab, they take the usual path
+				if (GuardedPool::contains(deferred.object_)) {
+					Slab::deallocate(deferred.cache_, deferred.object_);
+					continue;
+				}
+
+				if (deferred.cache_ != cache || length == RELEASE_RUN) {
+					if (length != 0) {
+						cache->deallocateBatch(run, length);
+					}
+
+					cache = deferred.cache_;
+					length = 0;
+				}
+
+				HeapProfiler::remove(deferred.object_);
+				run[length++] = deferred.object_;
+			}
+
+			ret += batch->count_;
+
+			Buddy::deallocatePowerOfTwo(batch, 0);
+		}
+
+		if (length != 0) {
+			cache->deallocateBatch(run, length);
+		}
+
+		return ret;
+	}
+
+	#pragma endregion
+}
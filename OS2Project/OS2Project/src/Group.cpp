@@ -0,0 +1,164 @@
+/**
+* \file Group.cpp
+* \brief Implementation of the accounting groups
+*/
+
+#include "Group.h"
+#include "AllocatorUtility.h"
+#include "SlabStructs.h"
+#include <new> // placement new
+#include <thread> // this_thread
+
+namespace os2bn140314d {
+
+	#pragma region thread_stocks_s implementation
+
+	thread_stocks_s::~thread_stocks_s() {
+		if (std::this_thread::get_id() == thread_slabs_s::initializing_thread_) {
+			return;
+		}
+
+		for (auto &entry : entries_) {
+			if (entry.group_ != nullptr) {
+				release(entry);
+			}
+		}
+	}
+
+	thread_stocks_s &thread_stocks_s::local() noexcept {
+		static thread_local thread_stocks_s stocks;
+		return stocks;
+	}
+
+	void thread_stocks_s::release(group_stock_s &entry) noexcept {
+		auto group = entry.group_;
+
+		// Generation is checked again under the lock, the group may be destroyed in the meantime
+		if (group->generation_.load(std::memory_order_acquire) == entry.generation_ && entry.bytes_ != 0) {
+			group->mutex_.lock();
+
+			if (group->generation_.load(std::memory_order_relaxed) == entry.generation_) {
+				group->usage_.fetch_sub(entry.bytes_, std::memory_order_relaxed);
+			}
+
+			group->mutex_.unlock();
+		}
+
+		entry.group_ = nullptr;
+		entry.bytes_ = 0;
+	}
+
+	#pragma endregion
+
+	#pragma region Group implementation
+
+	std::atomic<size_t> group_header_s::next_generation_(1);
+
+	group_header_s *Group::create(size_t limit) noexcept {
+		auto &header = AllocatorUtility::slabHeader();
+		auto ret = static_cast<group_header_s *>(header.groups_->allocate());
+
+		if (ret == nullptr) {
+			return nullptr;
+		}
+
+		new (&ret->usage_) std::atomic<size_t>(0);
+		ret->limit_ = limit;
+		ret->batch_ = limit == 0 || limit / BATCH_DIVISOR > MAX_BATCH ? MAX_BATCH : limit / BATCH_DIVISOR;
+		new (&ret->generation_) std::atomic<size_t>(group_header_s::next_generation_++);
+
+		ret->reclaim_ = nullptr;
+		ret->reclaim_context_ = nullptr;
+
+		new (&ret->mutex_) std::mutex;
+
+		return ret;
+	}
+
+	void Group::setReclaim(group_header_s *group, int(*reclaim)(kmem_group_t *, size_t, void *), void *context) noexcept {
+		group->mutex_.lock();
+
+		group->reclaim_ = reclaim;
+		group->reclaim_context_ = context;
+
+		group->mutex_.unlock();
+	}
+
+	size_t Group::usage(const group_header_s *group) noexcept {
+		return group->usage_.load(std::memory_order_relaxed);
+	}
+
+	void Group::destroy(group_header_s *group) noexcept {
+		auto &header = AllocatorUtility::slabHeader();
+
+		// Entries of the threads that charged the group do not match the new generation
+		group->mutex_.lock();
+		group->generation_.store(group_header_s::next_generation_++, std::memory_order_release);
+		group->mutex_.unlock();
+
+		header.groups_->deallocate(group);
+	}
+
+	bool Group::chargeBatch(group_header_s *group, group_stock_s &entry, size_t size) noexcept {
+		for (auto reclaimed = false; ; reclaimed = true) {
+			// Entry taken by another group, or by the destroyed instance of this one, returns those bytes first
+			auto generation = group->generation_.load(std::memory_order_acquire);
+
+			if (entry.group_ != group || entry.generation_ != generation) {
+				if (entry.group_ != nullptr) {
+					thread_stocks_s::release(entry);
+				}
+
+				entry.group_ = group;
+				entry.generation_ = generation;
+			}
+
+			// Objects freed by the reclaim may have returned their bytes to this thread
+			if (entry.bytes_ >= size) {
+				entry.bytes_ -= size;
+				return true;
+			}
+
+			auto missing = size - entry.bytes_;
+
+			// Near the limit the batch may not fit, while the missing bytes alone still do
+			if (reserve(group, missing + group->batch_)) {
+				entry.bytes_ = group->batch_;
+				return true;
+			}
+
+			if (reserve(group, missing)) {
+				entry.bytes_ = 0;
+				return true;
+			}
+
+			if (reclaimed) {
+				return false;
+			}
+
+			group->mutex_.lock();
+			auto reclaim = group->reclaim_;
+			auto context = group->reclaim_context_;
+			group->mutex_.unlock();
+
+			// Without the reclaim function, or if it frees nothing, the allocation fails at once
+			if (reclaim == nullptr || reclaim(reinterpret_cast<kmem_group_t *>(group), missing, context) == 0) {
+				return false;
+			}
+		}
+	}
+
+	bool Group::reserve(group_header_s *group, size_t bytes) noexcept {
+		auto usage = group->usage_.load(std::memory_order_relaxed);
+
+		do {
+			if (group->limit_ != 0 && (bytes > group->limit_ || usage > group->limit_ - bytes)) {
+				return false;
+			}
+		} while (!group->usage_.compare_exchange_weak(usage, usage + bytes, std::memory_order_relaxed));
+
+		return true;
+	}
+
+	#pragma endregion
+}
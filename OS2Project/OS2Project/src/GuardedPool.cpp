@@ -0,0 +1,386 @@
+/**
+* \file GuardedPool.cpp
+* \brief Implementation of the sampled guarded allocations used for detecting memory errors
+*/
+
+#include "GuardedPool.h"
+#include "AllocatorUtility.h"
+#include "SystemMemory.h"
+#include "SlabStructs.h"
+#include <cstdlib> // abort
+#include <chrono> // steady_clock
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <signal.h>
+#endif
+
+namespace os2bn140314d {
+
+	#pragma region Fault handler
+
+#ifdef _WIN32
+	static LONG CALLBACK guardedPoolHandler(PEXCEPTION_POINTERS exception) {
+		auto record = exception->ExceptionRecord;
+
+		if (record->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && record->NumberParameters >= 2) {
+			GuardedPool::handleFault(reinterpret_cast<const void *>(record->ExceptionInformation[1]));
+		}
+
+		// The fault is reported, the process is terminated as it would be without the handler
+		return EXCEPTION_CONTINUE_SEARCH;
+	}
+#else
+	static struct sigaction previous_action;
+
+	static void guardedPoolHandler(int signal, siginfo_t *info, void *context) {
+		if (GuardedPool::handleFault(info->si_addr)
+			|| previous_action.sa_handler == SIG_DFL
+			|| previous_action.sa_handler == SIG_IGN)
+		{
+			// Returning repeats the faulting access, which is now handled by the previous handler
+			sigaction(SIGSEGV, &previous_action, nullptr);
+			return;
+		}
+
+		if (previous_action.sa_flags & SA_SIGINFO) {
+			previous_action.sa_sigaction(signal, info, context);
+		}
+		else {
+			previous_action.sa_handler(signal);
+		}
+	}
+#endif
+
+	#pragma endregion
+
+	#pragma region GuardedPool implementation
+
+	thread_local size_t GuardedPool::countdown_ = 0;
+	thread_local size_t GuardedPool::random_ = 0;
+
+	std::atomic<size_t> GuardedPool::sample_rate_(0);
+	std::atomic<byte *> GuardedPool::pool_(nullptr);
+
+	size_t GuardedPool::pool_size_ = 0;
+	size_t GuardedPool::page_size_ = 0;
+	size_t GuardedPool::number_of_slots_ = 0;
+
+	guarded_slot_s *GuardedPool::slots_ = nullptr;
+	size_t *GuardedPool::free_slots_ = nullptr;
+	size_t GuardedPool::free_head_ = 0;
+	size_t GuardedPool::free_count_ = 0;
+
+	std::mutex GuardedPool::mutex_;
+
+	bool GuardedPool::configure(size_t sample_rate, size_t number_of_slots) noexcept {
+		mutex_.lock();
+
+		if (sample_rate != 0 && pool_.load(std::memory_order_relaxed) == nullptr) {
+			if (number_of_slots == 0) {
+				mutex_.unlock();
+				return false;
+			}
+
+			page_size_ = SystemMemory::pageSize();
+
+			// Guard page before each slot, and one after the last
+			auto pool_size = (2 * number_of_slots + 1) * page_size_;
+			auto pool_blocks = (pool_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+			auto metadata_size = number_of_slots * (sizeof(guarded_slot_s) + sizeof(size_t));
+			auto metadata_blocks = (metadata_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+			auto pool = static_cast<byte *>(SystemMemory::allocate(pool_blocks));
+			auto metadata = static_cast<byte *>(SystemMemory::allocate(metadata_blocks));
+
+			if (pool == nullptr || metadata == nullptr || !SystemMemory::protect(pool, pool_size, false)) {
+				SystemMemory::deallocate(pool, pool_blocks);
+				SystemMemory::deallocate(metadata, metadata_blocks);
+
+				mutex_.unlock();
+				return false;
+			}
+
+			// Mapped memory is zeroed, so all slots are unused
+			slots_ = reinterpret_cast<guarded_slot_s *>(metadata);
+			free_slots_ = reinterpret_cast<size_t *>(metadata + number_of_slots * sizeof(guarded_slot_s));
+
+			for (size_t i = 0; i < number_of_slots; i++) {
+				free_slots_[i] = i;
+			}
+
+			free_head_ = 0;
+			free_count_ = number_of_slots;
+			number_of_slots_ = number_of_slots;
+			pool_size_ = pool_size;
+
+			// The first capture may allocate while loading the unwinder, do it outside of the fault handler
+			stack_trace_s trace;
+			StackTrace::capture(trace);
+
+			installHandler();
+
+			pool_.store(pool, std::memory_order_release);
+		}
+
+		sample_rate_.store(sample_rate, std::memory_order_relaxed);
+
+		mutex_.unlock();
+
+		return true;
+	}
+
+	bool GuardedPool::resample() noexcept {
+		auto sample_rate = sample_rate_.load(std::memory_order_relaxed);
+
+		// Objects of the persistent pool must stay in its file, the guarded pool is mapped apart
+		if (sample_rate == 0 || AllocatorUtility::isPersistent()) {
+			countdown_ = DISABLED_RECHECK;
+			return false;
+		}
+
+		// Seed the generator of the thread with its own address and the time
+		if (random_ == 0) {
+			random_ = (reinterpret_cast<size_t>(&random_)
+				^ static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count()))
+				| 1;
+		}
+
+		// Xorshift, the countdown is uniform in [0, 2 * rate - 1), so one in rate allocations is guarded on average
+		random_ ^= random_ << 13;
+		random_ ^= random_ >> 7;
+		random_ ^= random_ << 17;
+
+		countdown_ = random_ % (2 * sample_rate - 1);
+
+		return true;
+	}
+
+	void *GuardedPool::allocate(size_t size, cache_header_s *cache) noexcept {
+		if (pool_.load(std::memory_order_acquire) == nullptr) {
+			return nullptr;
+		}
+
+		if (size == 0) {
+			size = 1;
+		}
+
+		auto rounded = (size + OBJECT_ALIGNMENT - 1) / OBJECT_ALIGNMENT * OBJECT_ALIGNMENT;
+
+		// Objects bigger than a page are not guarded
+		if (rounded > page_size_) {
+			return nullptr;
+		}
+
+		mutex_.lock();
+
+		// All slots are in use, serve the allocation normally
+		if (free_count_ == 0) {
+			mutex_.unlock();
+			return nullptr;
+		}
+
+		auto index = free_slots_[free_head_];
+		auto page = slotPage(index);
+
+		if (!SystemMemory::protect(page, page_size_, true)) {
+			mutex_.unlock();
+			return nullptr;
+		}
+
+		free_head_ = (free_head_ + 1) % number_of_slots_;
+		free_count_--;
+
+		auto &slot = slots_[index];
+
+		slot.object_ = index % 2 == 0 ? page + page_size_ - rounded : page;
+		slot.size_ = size;
+		slot.cache_ = cache;
+		slot.state_ = SLOT_ALLOCATED;
+		slot.deallocation_.size_ = 0;
+		StackTrace::capture(slot.allocation_);
+
+		mutex_.unlock();
+
+		if (cache != nullptr && cache->constructor_ != nullptr) {
+			cache->constructor_(slot.object_);
+		}
+
+		return slot.object_;
+	}
+
+	bool GuardedPool::contains(const void *memory) noexcept {
+		auto pool = pool_.load(std::memory_order_relaxed);
+		return pool != nullptr && memory >= pool && memory < pool + pool_size_;
+	}
+
+	size_t GuardedPool::objectSize(const void *object) noexcept {
+		auto slot = slotOf(object);
+		return slot != nullptr ? slot->size_ : 0;
+	}
+
+	bool GuardedPool::deallocate(void *object, const cache_header_s *cache) noexcept {
+		auto slot = slotOf(object);
+
+		if (slot == nullptr) {
+			report("Invalid free of a guard page", object, nullptr);
+			std::abort();
+		}
+
+		mutex_.lock();
+
+		if (slot->state_ == SLOT_FREED && slot->object_ == object) {
+			mutex_.unlock();
+			report("Double free", object, slot);
+			std::abort();
+		}
+
+		if (slot->state_ != SLOT_ALLOCATED || slot->object_ != object) {
+			mutex_.unlock();
+			report("Invalid free", object, slot);
+			std::abort();
+		}
+
+		if (slot->cache_ != cache) {
+			mutex_.unlock();
+			return false;
+		}
+
+		// Mark the slot freed first, so a concurrent double free is caught
+		slot->state_ = SLOT_FREED;
+		StackTrace::capture(slot->deallocation_);
+
+		mutex_.unlock();
+
+		if (slot->cache_ != nullptr && slot->cache_->destructor_ != nullptr) {
+			slot->cache_->destructor_(object);
+		}
+
+		auto index = static_cast<size_t>(slot - slots_);
+
+		SystemMemory::protect(slotPage(index), page_size_, false);
+
+		// Freed slot goes to the back of the queue, so it stays protected as long as possible
+		mutex_.lock();
+
+		free_slots_[(free_head_ + free_count_) % number_of_slots_] = index;
+		free_count_++;
+
+		mutex_.unlock();
+
+		return true;
+	}
+
+	bool GuardedPool::handleFault(const void *address) noexcept {
+		if (!contains(address)) {
+			return false;
+		}
+
+		const char *error;
+		auto slot = diagnose(address, error);
+
+		report(error, address, slot);
+
+		return true;
+	}
+
+	byte *GuardedPool::slotPage(size_t index) noexcept {
+		return pool_.load(std::memory_order_relaxed) + (2 * index + 1) * page_size_;
+	}
+
+	guarded_slot_s *GuardedPool::slotOf(const void *memory) noexcept {
+		auto offset = static_cast<const byte *>(memory) - pool_.load(std::memory_order_relaxed);
+		auto page = static_cast<size_t>(offset) / page_size_;
+
+		// Even pages are the guard pages
+		if (page % 2 == 0) {
+			return nullptr;
+		}
+
+		return slots_ + (page - 1) / 2;
+	}
+
+	const guarded_slot_s *GuardedPool::diagnose(const void *address, const char *&error) noexcept {
+		auto slot = slotOf(address);
+
+		if (slot != nullptr) {
+			error = slot->state_ == SLOT_FREED ? "Use after free" : "Access to an unused guarded slot";
+			return slot;
+		}
+
+		// Address is in a guard page, blame the closest object next to it
+		auto pointer = static_cast<const byte *>(address);
+		auto guard = static_cast<size_t>(pointer - pool_.load(std::memory_order_relaxed)) / page_size_ / 2;
+
+		const guarded_slot_s *before = guard > 0 && slots_[guard - 1].state_ != SLOT_UNUSED ? slots_ + guard - 1 : nullptr;
+		const guarded_slot_s *after = guard < number_of_slots_ && slots_[guard].state_ != SLOT_UNUSED ? slots_ + guard : nullptr;
+
+		if (before != nullptr && after != nullptr) {
+			auto overflow = static_cast<size_t>(pointer - (before->object_ + before->size_));
+			auto underflow = static_cast<size_t>(after->object_ - pointer);
+
+			if (overflow <= underflow) {
+				after = nullptr;
+			}
+			else {
+				before = nullptr;
+			}
+		}
+
+		if (before != nullptr) {
+			error = "Buffer overflow";
+			return before;
+		}
+
+		if (after != nullptr) {
+			error = "Buffer underflow";
+			return after;
+		}
+
+		error = "Access to a guard page";
+		return nullptr;
+	}
+
+	void GuardedPool::report(const char *error, const void *address, const guarded_slot_s *slot) noexcept {
+		StackTrace::write("*** Guarded allocation error: ");
+		StackTrace::write(error);
+		StackTrace::write(" at address ");
+		StackTrace::writeNumber(reinterpret_cast<size_t>(address), true);
+		StackTrace::write("\n");
+
+		if (slot == nullptr) {
+			return;
+		}
+
+		if (slot->state_ != SLOT_UNUSED) {
+			StackTrace::write("Object ");
+			StackTrace::writeNumber(reinterpret_cast<size_t>(slot->object_), true);
+			StackTrace::write(" of ");
+			StackTrace::writeNumber(slot->size_, false);
+			StackTrace::write(" bytes was allocated at:\n");
+			StackTrace::print(slot->allocation_);
+		}
+
+		if (slot->state_ == SLOT_FREED) {
+			StackTrace::write("and freed at:\n");
+			StackTrace::print(slot->deallocation_);
+		}
+	}
+
+	void GuardedPool::installHandler() noexcept {
+#ifdef _WIN32
+		AddVectoredExceptionHandler(1, guardedPoolHandler);
+#else
+		struct sigaction action = {};
+		action.sa_sigaction = guardedPoolHandler;
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigemptyset(&action.sa_mask);
+
+		sigaction(SIGSEGV, &action, &previous_action);
+#endif
+	}
+
+	#pragma endregion
+}
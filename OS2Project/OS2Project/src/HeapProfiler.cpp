@@ -0,0 +1,284 @@
+/**
+* \file HeapProfiler.cpp
+* \brief Implementation of the sampling heap profiler
+*/
+
+#include "HeapProfiler.h"
+#include "SystemMemory.h"
+#include <cmath> // log
+#include <cstdint> // uint64_t
+#include <chrono> // steady_clock
+#include <fstream> // ifstream
+
+namespace os2bn140314d {
+
+	#pragma region HeapProfiler implementation
+
+	const void *const HeapProfiler::TOMBSTONE = reinterpret_cast<const void *>(1);
+
+	thread_local long long HeapProfiler::bytes_until_sample_ = 0;
+	thread_local size_t HeapProfiler::random_ = 0;
+
+	std::atomic<size_t> HeapProfiler::sample_bytes_(0);
+	std::atomic<size_t> HeapProfiler::live_(0);
+
+	heap_sample_s *HeapProfiler::samples_ = nullptr;
+	heap_stack_s *HeapProfiler::stacks_ = nullptr;
+
+	std::mutex HeapProfiler::mutex_;
+
+	bool HeapProfiler::configure(size_t sample_bytes) noexcept {
+		mutex_.lock();
+
+		if (sample_bytes != 0 && samples_ == nullptr) {
+			auto samples_blocks = (MAX_SAMPLES * sizeof(heap_sample_s) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+			auto stacks_blocks = (MAX_STACKS * sizeof(heap_stack_s) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+			auto samples = static_cast<heap_sample_s *>(SystemMemory::allocate(samples_blocks));
+			auto stacks = static_cast<heap_stack_s *>(SystemMemory::allocate(stacks_blocks));
+
+			if (samples == nullptr || stacks == nullptr) {
+				SystemMemory::deallocate(samples, samples_blocks);
+				SystemMemory::deallocate(stacks, stacks_blocks);
+
+				mutex_.unlock();
+				return false;
+			}
+
+			for (size_t i = 0; i < MAX_SAMPLES; i++) {
+				new (&samples[i].object_) std::atomic<const void *>(nullptr);
+			}
+
+			for (size_t i = 0; i < MAX_STACKS; i++) {
+				stacks[i].hash_ = 0;
+				new (&stacks[i].live_objects_) std::atomic<size_t>(0);
+				new (&stacks[i].live_bytes_) std::atomic<size_t>(0);
+			}
+
+			samples_ = samples;
+			stacks_ = stacks;
+
+			// The first capture may allocate while loading the unwinder, do it before any sample
+			stack_trace_s trace;
+			StackTrace::capture(trace);
+		}
+
+		sample_bytes_.store(sample_bytes, std::memory_order_relaxed);
+
+		mutex_.unlock();
+
+		return true;
+	}
+
+	void HeapProfiler::record(const void *object, size_t size) noexcept {
+		if (object == nullptr) {
+			return;
+		}
+
+		// Unwinding is the expensive part, it is done before locking
+		stack_trace_s trace;
+		StackTrace::capture(trace);
+
+		mutex_.lock();
+
+		if (samples_ == nullptr) {
+			mutex_.unlock();
+			return;
+		}
+
+		auto stack = stackIndex(trace);
+		if (stack == MAX_STACKS) {
+			mutex_.unlock();
+			return;
+		}
+
+		auto start = sampleIndex(object);
+
+		for (size_t i = 0; i < MAX_PROBES; i++) {
+			auto &sample = samples_[(start + i) % MAX_SAMPLES];
+			auto key = sample.object_.load(std::memory_order_relaxed);
+
+			if (key != nullptr && key != TOMBSTONE) {
+				continue;
+			}
+
+			// Fields are written before the object is published to the deallocating threads
+			sample.size_ = size;
+			sample.stack_ = stack;
+			sample.object_.store(object, std::memory_order_release);
+
+			auto &site = stacks_[stack];
+			site.allocations_++;
+			site.allocated_bytes_ += size;
+			site.live_objects_.fetch_add(1, std::memory_order_relaxed);
+			site.live_bytes_.fetch_add(size, std::memory_order_relaxed);
+
+			live_.fetch_add(1, std::memory_order_release);
+
+			break;
+		}
+
+		// If all the searched entries are taken, the sample is dropped
+
+		mutex_.unlock();
+	}
+
+	void HeapProfiler::dump(std::ostream &os) noexcept {
+		mutex_.lock();
+
+		size_t live_objects = 0, live_bytes = 0, allocations = 0, allocated_bytes = 0;
+
+		for (size_t i = 0; stacks_ != nullptr && i < MAX_STACKS; i++) {
+			if (stacks_[i].hash_ != 0) {
+				live_objects += stacks_[i].live_objects_.load(std::memory_order_relaxed);
+				live_bytes += stacks_[i].live_bytes_.load(std::memory_order_relaxed);
+				allocations += stacks_[i].allocations_;
+				allocated_bytes += stacks_[i].allocated_bytes_;
+			}
+		}
+
+		// The values are the sampled ones, pprof scales them by the sampling period
+		os << "heap profile: " << live_objects << ": " << live_bytes
+			<< " [" << allocations << ": " << allocated_bytes << "] @ heap_v2/"
+			<< sample_bytes_.load(std::memory_order_relaxed) << "\n";
+
+		for (size_t i = 0; stacks_ != nullptr && i < MAX_STACKS; i++) {
+			auto &site = stacks_[i];
+
+			if (site.hash_ == 0) {
+				continue;
+			}
+
+			os << site.live_objects_.load(std::memory_order_relaxed) << ": " << site.live_bytes_.load(std::memory_order_relaxed)
+				<< " [" << site.allocations_ << ": " << site.allocated_bytes_ << "] @";
+
+			for (size_t j = 0; j < site.trace_.size_; j++) {
+				os << " 0x" << std::hex << reinterpret_cast<size_t>(site.trace_.frames_[j]) << std::dec;
+			}
+
+			os << "\n";
+		}
+
+		writeMappings(os);
+
+		mutex_.unlock();
+	}
+
+	bool HeapProfiler::resample() noexcept {
+		auto sample_bytes = sample_bytes_.load(std::memory_order_relaxed);
+
+		if (sample_bytes == 0) {
+			bytes_until_sample_ = DISABLED_RECHECK;
+			return false;
+		}
+
+		// The first countdown of the thread does not end with a sample
+		auto first = random_ == 0;
+
+		if (first) {
+			random_ = (reinterpret_cast<size_t>(&random_)
+				^ static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count()))
+				| 1;
+		}
+
+		random_ ^= random_ << 13;
+		random_ ^= random_ >> 7;
+		random_ ^= random_ << 17;
+
+		// Exponential gap with the mean of the sampling period, uniform is taken from (0, 1]
+		auto uniform = (static_cast<double>(random_ % (1ull << 53)) + 1) / static_cast<double>(1ull << 53);
+		auto gap = static_cast<long long>(-std::log(uniform) * static_cast<double>(sample_bytes));
+
+		bytes_until_sample_ = gap < 1 ? 1 : gap;
+
+		return !first;
+	}
+
+	void HeapProfiler::removeSample(const void *object) noexcept {
+		auto start = sampleIndex(object);
+
+		for (size_t i = 0; i < MAX_PROBES; i++) {
+			auto &sample = samples_[(start + i) % MAX_SAMPLES];
+			auto key = sample.object_.load(std::memory_order_acquire);
+
+			// Entries are never emptied, so the object is not further in the table
+			if (key == nullptr) {
+				return;
+			}
+
+			if (key != object) {
+				continue;
+			}
+
+			// Fields can not change until the entry is marked freed
+			auto size = sample.size_;
+			auto stack = sample.stack_;
+
+			if (sample.object_.compare_exchange_strong(key, TOMBSTONE, std::memory_order_acq_rel)) {
+				stacks_[stack].live_objects_.fetch_sub(1, std::memory_order_relaxed);
+				stacks_[stack].live_bytes_.fetch_sub(size, std::memory_order_relaxed);
+				live_.fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			return;
+		}
+	}
+
+	size_t HeapProfiler::sampleIndex(const void *object) noexcept {
+		auto address = static_cast<uint64_t>(reinterpret_cast<size_t>(object));
+		return static_cast<size_t>((address * 0x9E3779B97F4A7C15ull) >> 40) % MAX_SAMPLES;
+	}
+
+	size_t HeapProfiler::stackIndex(const stack_trace_s &trace) noexcept {
+		// FNV-1a over the frames, 0 marks the unused entries
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (size_t i = 0; i < trace.size_; i++) {
+			hash = (hash ^ reinterpret_cast<size_t>(trace.frames_[i])) * 0x100000001b3ull;
+		}
+
+		auto key = static_cast<size_t>(hash) | 1;
+
+		for (size_t i = 0; i < MAX_STACKS; i++) {
+			auto &site = stacks_[(key + i) % MAX_STACKS];
+
+			if (site.hash_ == 0) {
+				site.trace_ = trace;
+				site.hash_ = key;
+				site.allocations_ = 0;
+				site.allocated_bytes_ = 0;
+
+				return (key + i) % MAX_STACKS;
+			}
+
+			if (site.hash_ != key || site.trace_.size_ != trace.size_) {
+				continue;
+			}
+
+			auto same = true;
+			for (size_t j = 0; j < trace.size_ && same; j++) {
+				same = site.trace_.frames_[j] == trace.frames_[j];
+			}
+
+			if (same) {
+				return (key + i) % MAX_STACKS;
+			}
+		}
+
+		return MAX_STACKS;
+	}
+
+	void HeapProfiler::writeMappings(std::ostream &os) noexcept {
+#ifdef _WIN32
+		// Windows has no maps file, pprof has to be given the binary to symbolize the addresses
+		(void)os;
+#else
+		std::ifstream maps("/proc/self/maps");
+
+		if (maps) {
+			os << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+		}
+#endif
+	}
+
+	#pragma endregion
+}
@@ -0,0 +1,169 @@
+/**
+* \file MemoryResource.cpp
+* \brief Implementation of the adapters for the allocators and memory resources of the standard library
+*/
+
+#include "MemoryResource.h"
+#include "Buddy.h"
+#include "SlabUtility.h"
+#include <cstdio> // snprintf
+
+namespace os2bn140314d {
+
+	#pragma region SizedAllocator implementation
+
+	void *SizedAllocator::allocate(size_t size, size_t alignment) noexcept {
+		auto power = Slab::bufferPower(size, alignment);
+
+		if (power == NULL_INDEX) {
+			return nullptr;
+		}
+
+		if (power < slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			return Slab::bufferAllocate(size, alignment);
+		}
+
+		auto blocks = blocksFor(size);
+		auto ret = Buddy::allocate(blocks);
+
+		// Blocks are aligned only as much as their region
+		if (ret != nullptr && reinterpret_cast<size_t>(ret) % alignment != 0) {
+			Buddy::deallocate(ret, blocks);
+			return nullptr;
+		}
+
+		return ret;
+	}
+
+	void SizedAllocator::deallocate(void *memory, size_t size, size_t alignment) noexcept {
+		auto power = Slab::bufferPower(size, alignment);
+
+		if (memory == nullptr || power == NULL_INDEX) {
+			return;
+		}
+
+		if (power < slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			Slab::bufferDeallocate(memory, size, alignment);
+			return;
+		}
+
+		Buddy::deallocate(memory, blocksFor(size));
+	}
+
+	size_t SizedAllocator::blocksFor(size_t size) noexcept {
+		return size / BLOCK_SIZE + (size % BLOCK_SIZE != 0 ? 1 : 0);
+	}
+
+	#pragma endregion
+
+#ifdef KMEM_MEMORY_RESOURCE
+
+	#pragma region BufferResource implementation
+
+	BufferResource *BufferResource::instance() noexcept {
+		static BufferResource resource;
+		return &resource;
+	}
+
+	void *BufferResource::do_allocate(size_t bytes, size_t alignment) {
+		auto ret = SizedAllocator::allocate(bytes, alignment);
+
+		if (ret == nullptr) {
+			throw std::bad_alloc();
+		}
+
+		return ret;
+	}
+
+	void BufferResource::do_deallocate(void *memory, size_t bytes, size_t alignment) {
+		SizedAllocator::deallocate(memory, bytes, alignment);
+	}
+
+	bool BufferResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+		return dynamic_cast<const BufferResource *>(&other) != nullptr;
+	}
+
+	#pragma endregion
+
+	#pragma region CachePoolResource implementation
+
+	CachePoolResource::CachePoolResource(std::pmr::memory_resource *upstream) noexcept : upstream_(upstream) {
+		for (auto &cache : caches_) {
+			new (&cache) std::atomic<cache_header_s *>(nullptr);
+		}
+	}
+
+	CachePoolResource::~CachePoolResource() {
+		for (auto &cache : caches_) {
+			auto header = cache.load(std::memory_order_relaxed);
+
+			if (header != nullptr) {
+				Slab::destroy(header);
+			}
+		}
+	}
+
+	std::pmr::memory_resource *CachePoolResource::upstream_resource() const noexcept {
+		return upstream_;
+	}
+
+	void *CachePoolResource::do_allocate(size_t bytes, size_t alignment) {
+		if (bytes > MAX_POOLED_SIZE || alignment > GRANULE) {
+			return upstream_->allocate(bytes, alignment);
+		}
+
+		// Pool of a size must never change, so a cache that can not be created fails the request
+		auto cache = cacheFor(bytes == 0 ? 0 : (bytes - 1) / GRANULE);
+		auto ret = cache == nullptr ? nullptr : Slab::allocate(cache);
+
+		if (ret == nullptr) {
+			throw std::bad_alloc();
+		}
+
+		return ret;
+	}
+
+	void CachePoolResource::do_deallocate(void *memory, size_t bytes, size_t alignment) {
+		if (bytes > MAX_POOLED_SIZE || alignment > GRANULE) {
+			upstream_->deallocate(memory, bytes, alignment);
+			return;
+		}
+
+		// Size picks the cache, and nodes of the active slab of the thread skip the slab lookup
+		auto cache = caches_[bytes == 0 ? 0 : (bytes - 1) / GRANULE].load(std::memory_order_acquire);
+		Slab::deallocate(cache, memory);
+	}
+
+	bool CachePoolResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+		return this == &other;
+	}
+
+	cache_header_s *CachePoolResource::cacheFor(size_t pool) noexcept {
+		auto ret = caches_[pool].load(std::memory_order_acquire);
+
+		if (ret != nullptr) {
+			return ret;
+		}
+
+		mutex_.lock();
+
+		ret = caches_[pool].load(std::memory_order_relaxed);
+
+		if (ret == nullptr) {
+			// Name is interned by the cache, the buffer only has to live during the call
+			char name[32];
+			std::snprintf(name, sizeof(name), "Pool %u", static_cast<unsigned>((pool + 1) * GRANULE));
+
+			ret = Slab::create(name, (pool + 1) * GRANULE, nullptr, nullptr, 0);
+			caches_[pool].store(ret, std::memory_order_release);
+		}
+
+		mutex_.unlock();
+
+		return ret;
+	}
+
+	#pragma endregion
+
+#endif
+}
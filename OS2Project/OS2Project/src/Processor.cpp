@@ -0,0 +1,30 @@
+/**
+* \file Processor.cpp
+* \brief Implementation of the functions for querying the processors of the system
+*/
+
+#include "Processor.h"
+#include <thread> // hardware_concurrency
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sched.h>
+#endif
+
+namespace os2bn140314d {
+
+	size_t Processor::count() noexcept {
+		auto ret = std::thread::hardware_concurrency();
+		return ret == 0 ? 1 : ret;
+	}
+
+	size_t Processor::current() noexcept {
+#ifdef _WIN32
+		return GetCurrentProcessorNumber();
+#else
+		auto ret = sched_getcpu();
+		return ret < 0 ? 0 : static_cast<size_t>(ret);
+#endif
+	}
+}
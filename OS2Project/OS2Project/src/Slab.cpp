@@ -6,7 +6,12 @@
 #include "Slab.h"
 #include "AllocatorUtility.h"
 #include "SlabUtility.h"
+#include "GuardedPool.h"
+#include "HeapProfiler.h"
+#include "Epoch.h"
+#include "Group.h"
 #include <iostream>
+#include <fstream>
 
 using namespace os2bn140314d;
 
@@ -14,8 +19,159 @@ void kmem_init(void *space, int block_num) {
 	AllocatorUtility::initialize(space, block_num);
 }
 
+int kmem_reserve_persistent(void *address, int block_num) {
+	return AllocatorUtility::reservePersistent(address, block_num) ? 1 : 0;
+}
+
+int kmem_init_persistent(const char *path, int block_num) {
+	return AllocatorUtility::initializePersistent(path, block_num) ? 1 : 0;
+}
+
+int kmem_attach(const char *path) {
+	return AllocatorUtility::attach(path) ? 1 : 0;
+}
+
+int kmem_detach() {
+	return AllocatorUtility::detach() ? 1 : 0;
+}
+
+void kmem_set_root(void *root) {
+	AllocatorUtility::setRoot(root);
+}
+
+void *kmem_root() {
+	return AllocatorUtility::root();
+}
+
+void kmem_add_region(void *space, int block_num) {
+	AllocatorUtility::addRegion(space, block_num);
+}
+
+void kmem_set_auto_grow(int block_num) {
+	AllocatorUtility::setAutoGrow(block_num);
+}
+
+void kmem_add_huge_region(void *space, int block_num) {
+	AllocatorUtility::addHugeRegion(space, block_num);
+}
+
+void kmem_set_hugepage_backing(int explicit_pages) {
+	Buddy::setHugePageBacking(explicit_pages != 0);
+}
+
+void kmem_set_purge_policy(int order, int decay_milliseconds, int lazy) {
+	// Dropped pages of a file mapping read its contents again, not zeros
+	if (AllocatorUtility::isPersistent()) {
+		return;
+	}
+
+	auto power = order < 0 || order > static_cast<int>(POWERS_OF_TWO) ? POWERS_OF_TWO : static_cast<size_t>(order);
+	Buddy::setPurgePolicy(power, decay_milliseconds, lazy != 0);
+}
+
+int kmem_set_guarded_sampling(int sample_rate, int slots) {
+	if (sample_rate < 0 || slots < 0) {
+		return 0;
+	}
+
+	// Guarded objects would live outside of the file, and be lost when the pool is detached
+	if (AllocatorUtility::isPersistent() && sample_rate != 0) {
+		return 0;
+	}
+
+	return GuardedPool::configure(sample_rate, slots) ? 1 : 0;
+}
+
+int kmem_set_heap_sampling(size_t sample_bytes) {
+	return HeapProfiler::configure(sample_bytes) ? 1 : 0;
+}
+
+int kmem_heap_profile(const char *path) {
+	std::ofstream file(path);
+
+	if (!file) {
+		return 0;
+	}
+
+	HeapProfiler::dump(file);
+
+	return file ? 1 : 0;
+}
+
+int kmem_purge() {
+	if (AllocatorUtility::isPersistent()) {
+		return 0;
+	}
+
+	return static_cast<int>(Buddy::purge());
+}
+
+int kmem_set_cpu_pages(int high, int batch) {
+	if (high < 0 || batch < 0) {
+		return 0;
+	}
+
+	return Buddy::setCpuPages(static_cast<size_t>(high), static_cast<size_t>(batch)) ? 1 : 0;
+}
+
+int kmem_reserve_contiguous(int order, int min_order) {
+	if (order < 0 || min_order < 0) {
+		return 0;
+	}
+
+	return Buddy::reserveContiguous(static_cast<size_t>(order), static_cast<size_t>(min_order)) ? 1 : 0;
+}
+
+int kmem_set_freelist_policy(int order, int policy) {
+	if (order >= static_cast<int>(POWERS_OF_TWO) || policy < 0 || policy >= static_cast<int>(NUMBER_OF_POLICIES)) {
+		return 0;
+	}
+
+	auto free_list_policy = static_cast<FreeListPolicy>(policy);
+
+	if (order >= 0) {
+		return Buddy::setFreeListPolicy(static_cast<size_t>(order), free_list_policy) ? 1 : 0;
+	}
+
+	for (size_t power = 0; power < POWERS_OF_TWO; power++) {
+		if (!Buddy::setFreeListPolicy(power, free_list_policy)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+double kmem_fragmentation(int order) {
+	if (order < 0 || order >= static_cast<int>(POWERS_OF_TWO)) {
+		return 0;
+	}
+
+	return Buddy::fragmentation(static_cast<size_t>(order));
+}
+
 kmem_cache_t *kmem_cache_create(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *)) {
-	auto ret = Slab::create(name, size, ctor, dtor);
+	auto ret = Slab::create(name, size, ctor, dtor, 0);
+	return reinterpret_cast<kmem_cache_t *>(ret);
+}
+
+kmem_cache_t *kmem_cache_create_flags(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *), unsigned flags) {
+	auto ret = Slab::create(name, size, ctor, dtor, flags);
+	return reinterpret_cast<kmem_cache_t *>(ret);
+}
+
+kmem_cache_t *kmem_cache_create_movable(const char *name, size_t size, void(*ctor)(void *), void(*dtor)(void *), int(*migrate)(void *from, void *to)) {
+	auto ret = Slab::createMovable(name, size, ctor, dtor, migrate);
+	return reinterpret_cast<kmem_cache_t *>(ret);
+}
+
+kmem_cache_t *kmem_cache_open(const char *name, void(*ctor)(void *), void(*dtor)(void *)) {
+	auto ret = Slab::open(name, ctor, dtor, nullptr);
+	return reinterpret_cast<kmem_cache_t *>(ret);
+}
+
+kmem_cache_t *kmem_cache_open_movable(const char *name, void(*ctor)(void *), void(*dtor)(void *), int(*migrate)(void *from, void *to)) {
+	auto ret = Slab::open(name, ctor, dtor, migrate);
 	return reinterpret_cast<kmem_cache_t *>(ret);
 }
 
@@ -23,16 +179,55 @@ int kmem_cache_shrink(kmem_cache_t *cachep) {
 	return Slab::shrink(reinterpret_cast<cache_header_s *>(cachep));
 }
 
+int kmem_cache_defragment(kmem_cache_t *cachep) {
+	return Slab::defragment(reinterpret_cast<cache_header_s *>(cachep));
+}
+
+void kmem_cache_set_empty_limits(kmem_cache_t *cachep, int min_empty, int max_empty) {
+	auto min = min_empty < 0 ? 0 : static_cast<size_t>(min_empty);
+	auto max = max_empty < 0 ? NULL_INDEX : static_cast<size_t>(max_empty);
+
+	Slab::setEmptyLimits(reinterpret_cast<cache_header_s *>(cachep), min, max);
+}
+
 void *kmem_cache_alloc(kmem_cache_t *cachep) {
 	return Slab::allocate(reinterpret_cast<cache_header_s *>(cachep));
 }
 
+void *kmem_cache_alloc_wait(kmem_cache_t *cachep, int timeout) {
+	return Slab::allocateWait(reinterpret_cast<cache_header_s *>(cachep), timeout);
+}
+
 void kmem_cache_free(kmem_cache_t *cachep, void *objp) {
 	Slab::deallocate(reinterpret_cast<cache_header_s *>(cachep), objp);
 }
 
+void kmem_cache_free_deferred(kmem_cache_t *cachep, void *objp) {
+	Epoch::defer(reinterpret_cast<cache_header_s *>(cachep), objp);
+}
+
+void kmem_epoch_enter() {
+	Epoch::enter();
+}
+
+void kmem_epoch_leave() {
+	Epoch::leave();
+}
+
+int kmem_epoch_barrier() {
+	return static_cast<int>(Epoch::barrier());
+}
+
+int kmem_cache_walk(kmem_cache_t *cachep, void(*callback)(void *objp, void *ctx), void *ctx) {
+	return static_cast<int>(Slab::walk(reinterpret_cast<cache_header_s *>(cachep), callback, ctx));
+}
+
 void *kmalloc(size_t size) {
-	return Slab::bufferAllocate(Buddy::sizeToPower(Buddy::greaterOrEqualPowerOfTwo(size)));
+	return Slab::bufferAllocate(size);
+}
+
+void *kmalloc_wait(size_t size, int timeout) {
+	return Slab::bufferAllocateWait(size, timeout);
 }
 
 void kfree(const void *objp) {
@@ -50,3 +245,35 @@ void kmem_cache_info(kmem_cache_t *cachep) {
 int kmem_cache_error(kmem_cache_t *cachep) {
 	return Slab::printErrors(reinterpret_cast<cache_header_s *>(cachep), std::cerr);
 }
+
+kmem_group_t *kmem_group_create(size_t limit) {
+	return reinterpret_cast<kmem_group_t *>(Group::create(limit));
+}
+
+void kmem_group_set_reclaim(kmem_group_t *groupp, int(*reclaim)(kmem_group_t *groupp, size_t bytes, void *ctx), void *ctx) {
+	Group::setReclaim(reinterpret_cast<group_header_s *>(groupp), reclaim, ctx);
+}
+
+size_t kmem_group_usage(kmem_group_t *groupp) {
+	return Group::usage(reinterpret_cast<group_header_s *>(groupp));
+}
+
+void kmem_group_destroy(kmem_group_t *groupp) {
+	Group::destroy(reinterpret_cast<group_header_s *>(groupp));
+}
+
+void *kmem_cache_alloc_group(kmem_cache_t *cachep, kmem_group_t *groupp) {
+	return Slab::allocateCharged(reinterpret_cast<cache_header_s *>(cachep), reinterpret_cast<group_header_s *>(groupp));
+}
+
+void kmem_cache_free_group(kmem_cache_t *cachep, kmem_group_t *groupp, void *objp) {
+	Slab::deallocateCharged(reinterpret_cast<cache_header_s *>(cachep), reinterpret_cast<group_header_s *>(groupp), objp);
+}
+
+void *kmalloc_group(size_t size, kmem_group_t *groupp) {
+	return Slab::bufferAllocateCharged(size, reinterpret_cast<group_header_s *>(groupp));
+}
+
+void kfree_group(kmem_group_t *groupp, const void *objp) {
+	Slab::bufferDeallocateCharged(objp, reinterpret_cast<group_header_s *>(groupp));
+}
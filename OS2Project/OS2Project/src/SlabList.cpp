@@ -39,11 +39,7 @@ namespace os2bn140314d {
 		}
 	}
 
-	slab_s *SlabList::first() const throw(std::underflow_error) {
-		if (first_ == nullptr) {
-			throw std::underflow_error("List is empty");
-		}
-
+	slab_s *SlabList::first() const noexcept {
 		return first_;
 	}
 
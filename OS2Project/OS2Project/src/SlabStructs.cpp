@@ -8,11 +8,48 @@
 #include <ostream>
 #include <iostream>
 #include "AllocatorUtility.h"
+#include "Processor.h"
+#include "WaitQueue.h"
+#include "Group.h"
+#include <cstring> // strncmp, strcmp
+#include <algorithm> // sort, copy
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace os2bn140314d {
 
 	#pragma region slab_s implementation
 
+	size_t slab_s::headOf(uint64_t word) noexcept {
+		return static_cast<size_t>(word & FREELIST_END);
+	}
+
+	size_t slab_s::countOf(uint64_t word) noexcept {
+		return static_cast<size_t>((word >> COUNT_SHIFT) & FREELIST_END);
+	}
+
+	bool slab_s::frozenOf(uint64_t word) noexcept {
+		return (word & FROZEN_BIT) != 0;
+	}
+
+	uint64_t slab_s::pack(size_t head, size_t count, bool frozen) noexcept {
+		return static_cast<uint64_t>(head) 
+			| static_cast<uint64_t>(count) << COUNT_SHIFT 
+			| (frozen ? FROZEN_BIT : 0);
+	}
+
+	size_t slab_s::lowestBit(uint64_t word) noexcept {
+#ifdef _MSC_VER
+		unsigned long ret;
+		_BitScanForward64(&ret, word);
+		return ret;
+#else
+		return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+	}
+
 	void slab_s::initialize(size_t color_offset, cache_header_s *header) noexcept {
 		header_ = header;
 
@@ -21,30 +58,48 @@ namespace os2bn140314d {
 		// Index array is starting after the slab_s structure, inside the block
 		auto index_array_start = start + sizeof(slab_s);
 
-		// Object array is starting after the index array
+		// Allocation bitmap of the tracked caches is starting after the index array
+		auto bitmap_start = index_array_start + header_->num_of_objects_ * sizeof(size_t);
+
+		// Object array is starting after the bitmap
+		auto object_array_start = bitmap_start + header_->bitmap_words_ * sizeof(uint64_t);
+
+		if (header_->flags_ & KMEM_CACHE_HWALIGN) {
+			auto address = reinterpret_cast<size_t>(object_array_start);
+			object_array_start += (CACHE_L1_LINE_SIZE - address % CACHE_L1_LINE_SIZE) % CACHE_L1_LINE_SIZE;
+		}
+
 		// Array start should be offset by color
-		auto object_array_start = index_array_start + header_->num_of_objects_ * sizeof(size_t) + color_offset;
+		object_array_start += color_offset;
 
 		index_array_ = reinterpret_cast<size_t *>(index_array_start);
+		allocated_ = header_->bitmap_words_ == 0 ? nullptr : reinterpret_cast<std::atomic<uint64_t> *>(bitmap_start);
 		objects_start_ = object_array_start;
 
+		new (&pending_) std::atomic<size_t>(0);
+		state_ = SLAB_EMPTY;
+		bucket_ = 0;
+
 		initializeIndexArray();
+		initializeBitmap();
 		initializeObjectArray();
 	}
 
 	void slab_s::initializeIndexArray() noexcept {
-		free_index_ = 0;
-		
 		for (size_t i = 1; i < header_->num_of_objects_; i++) {
 			index_array_[i - 1] = i;
 		}
 
-		index_array_[header_->num_of_objects_ - 1] = NULL_INDEX;
+		index_array_[header_->num_of_objects_ - 1] = FREELIST_END;
+
+		local_free_ = 0;
+
+		new (&used_) std::atomic<size_t>(0);
+		new (&owner_) std::atomic<const void *>(nullptr);
+		new (&remote_free_) std::atomic<uint64_t>(pack(FREELIST_END, 0, false));
 	}
 
 	void slab_s::initializeObjectArray() noexcept {
-		number_of_allocated_objects_ = 0;
-
 		if (header_->constructor_ == nullptr) {
 			return;
 		}
@@ -55,17 +110,19 @@ namespace os2bn140314d {
 		}
 	}
 
-	byte *slab_s::objectAt(size_t index) const throw(std::out_of_range) {
-		if (index >= header_->num_of_objects_) {
-			throw std::out_of_range("Object index in slab out of range");
+	void slab_s::initializeBitmap() noexcept {
+		for (size_t i = 0; i < header_->bitmap_words_; i++) {
+			new (allocated_ + i) std::atomic<uint64_t>(0);
 		}
+	}
 
+	byte *slab_s::objectAt(size_t index) const noexcept {
 		return objects_start_ + index * header_->object_size_;
 	}
 
-	size_t slab_s::indexOf(void *object) const throw(std::invalid_argument) {
+	size_t slab_s::indexOf(void *object) const noexcept {
 		if (!objectInRange(object)) {
-			throw std::invalid_argument("Object not in slab");
+			return NULL_INDEX;
 		}
 
 		auto pointer = reinterpret_cast<byte *>(object);
@@ -73,7 +130,7 @@ namespace os2bn140314d {
 		auto diff = pointer - objects_start_;
 
 		if (diff % header_->object_size_ != 0) {
-			throw std::invalid_argument("Invalid pointer to object");
+			return NULL_INDEX;
 		}
 
 		return diff / header_->object_size_;
@@ -96,53 +153,204 @@ namespace os2bn140314d {
 		return diff % header_->object_size_ == 0;
 	}
 
+	size_t slab_s::allocatedObjects() const noexcept {
+		auto word = remote_free_.load(std::memory_order_acquire);
+		return used_.load(std::memory_order_relaxed) - countOf(word);
+	}
+
+	SlabState slab_s::stateFor(uint64_t word) const noexcept {
+		auto inuse = used_.load(std::memory_order_relaxed) - countOf(word);
+
+		if (inuse == 0) {
+			return SLAB_EMPTY;
+		}
+
+		return inuse == header_->num_of_objects_ ? SLAB_FULL : SLAB_PARTIAL;
+	}
+
+	size_t slab_s::bucketFor(uint64_t word) const noexcept {
+		return bucketOf(used_.load(std::memory_order_relaxed) - countOf(word));
+	}
+
+	size_t slab_s::bucketOf(size_t allocated) const noexcept {
+		return allocated * PARTIAL_BUCKETS / header_->num_of_objects_;
+	}
+
 	bool slab_s::isEmpty() const noexcept {
-		return number_of_allocated_objects_ == 0;
+		return allocatedObjects() == 0;
 	}
 
 	bool slab_s::isFull() const noexcept {
-		return number_of_allocated_objects_ == header_->num_of_objects_;
+		return allocatedObjects() == header_->num_of_objects_;
+	}
+
+	void slab_s::freeze(const void *owner) noexcept {
+		owner_.store(owner, std::memory_order_relaxed);
+
+		auto word = remote_free_.load(std::memory_order_relaxed);
+		while (!remote_free_.compare_exchange_weak(
+			word, word | FROZEN_BIT,
+			std::memory_order_acq_rel, std::memory_order_relaxed));
+	}
+
+	uint64_t slab_s::unfreeze() noexcept {
+		owner_.store(nullptr, std::memory_order_relaxed);
+
+		auto word = remote_free_.load(std::memory_order_relaxed);
+		while (!remote_free_.compare_exchange_weak(
+			word, word & ~FROZEN_BIT,
+			std::memory_order_acq_rel, std::memory_order_relaxed));
+
+		return word & ~FROZEN_BIT;
+	}
+
+	bool slab_s::collect() noexcept {
+		// Take the whole list at once, the slab stays frozen
+		auto word = remote_free_.exchange(pack(FREELIST_END, 0, true), std::memory_order_acquire);
+
+		if (headOf(word) == FREELIST_END) {
+			return false;
+		}
+
+		local_free_ = headOf(word);
+		used_.store(used_.load(std::memory_order_relaxed) - countOf(word), std::memory_order_relaxed);
+
+		return true;
 	}
 
-	void *slab_s::allocate() throw(std::bad_alloc) {
-		if (free_index_ == NULL_INDEX) {
-			throw std::bad_alloc();
+	void *slab_s::allocate() noexcept {
+		if (local_free_ == FREELIST_END && !collect()) {
+			return nullptr;
 		}
 
 		// There is no special need to mark the object allocated
 		// Just say that the first free object is the next one in the list
-		auto ret = objectAt(free_index_);
-		free_index_ = index_array_[free_index_];
+		auto index = local_free_;
+		local_free_ = index_array_[index];
+
+		used_.store(used_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		// Other threads clear the bits of their frees in the same words, so the bits are set atomically
+		if (allocated_ != nullptr) {
+			allocated_[index / BITS_IN_WORD].fetch_or(1ull << (index % BITS_IN_WORD), std::memory_order_relaxed);
+		}
+
+		return objects_start_ + index * header_->object_size_;
+	}
+
+	bool slab_s::isAllocated(size_t index) const noexcept {
+		return allocated_ == nullptr 
+			|| (allocated_[index / BITS_IN_WORD].load(std::memory_order_relaxed) & 1ull << (index % BITS_IN_WORD)) != 0;
+	}
+
+	bool slab_s::markFree(size_t index) noexcept {
+		if (allocated_ == nullptr) {
+			return true;
+		}
+
+		// Of two frees of the same object only one sees the bit set
+		auto bit = 1ull << (index % BITS_IN_WORD);
+		return (allocated_[index / BITS_IN_WORD].fetch_and(~bit, std::memory_order_relaxed) & bit) != 0;
+	}
+
+	size_t slab_s::walk(void(*callback)(void *, void *), void *context) const {
+		size_t ret = 0;
+
+		for (size_t i = 0; i < header_->bitmap_words_; i++) {
+			auto word = allocated_[i].load(std::memory_order_relaxed);
+
+			while (word != 0) {
+				auto index = i * BITS_IN_WORD + lowestBit(word);
+				word &= word - 1;
 
-		number_of_allocated_objects_++;
+				callback(objects_start_ + index * header_->object_size_, context);
+				ret++;
+			}
+		}
 
 		return ret;
 	}
 
-	void slab_s::deallocate(void *object) throw(std::invalid_argument) {
+	bool slab_s::deallocate(void *object) noexcept {
 		auto index = indexOf(object);
 
 		if (header_->destructor_ != nullptr) {
-			header_->destructor_(object);			
+			header_->destructor_(object);
 		}
 
 		if (header_->constructor_ != nullptr) {
 			header_->constructor_(object);
 		}
 
-		// Insert free object to the beginning of the list
-		index_array_[index] = free_index_;
-		free_index_ = index;
+		return release(index);
+	}
+
+	bool slab_s::release(size_t index) noexcept {
+		// Owner inserts free object to the beginning of the local list
+		if (owner_.load(std::memory_order_relaxed) == &thread_slabs_s::local()) {
+			index_array_[index] = local_free_;
+			local_free_ = index;
+
+			used_.store(used_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+
+			return false;
+		}
+
+		auto word = remote_free_.load(std::memory_order_relaxed);
+		auto moves = false;
+
+		// Other threads insert it to the beginning of the remote list
+		// Slab that no thread owns changes its list when it stops being full, when it becomes empty,
+		// or when it drops to the partial list of the emptier slabs
+		// The pending count is raised before the swap, so the slab can not be released before it is moved
+		while (true) {
+			auto count = countOf(word);
+			auto frozen = frozenOf(word);
+
+			auto will_move = false;
+			if (!frozen) {
+				auto inuse = used_.load(std::memory_order_relaxed) - count;
+				will_move = inuse == header_->num_of_objects_ || inuse == 1 || bucketOf(inuse) != bucketOf(inuse - 1);
+			}
+
+			if (will_move != moves) {
+				will_move ? pending_++ : pending_--;
+				moves = will_move;
+			}
+
+			index_array_[index] = headOf(word);
 
-		number_of_allocated_objects_--;
+			if (remote_free_.compare_exchange_weak(
+				word, pack(index, count + 1, frozen),
+				std::memory_order_release, std::memory_order_relaxed))
+			{
+				return moves;
+			}
+		}
 	}
 
 	#pragma endregion 
 
+	#pragma region cache_name_s implementation
+
+	char *cache_name_s::string() noexcept {
+		return reinterpret_cast<char *>(this + 1);
+	}
+
+	#pragma endregion
+
 	#pragma region cache_header_s implementation
 
-	size_t cache_header_s::slabSize(size_t object_size, size_t index_size) throw(std::overflow_error) {
-		auto ret = Buddy::greaterOrEqualPowerOfTwo(object_size + index_size + sizeof(cache_header_s));
+	std::atomic<size_t> cache_header_s::next_generation_(1);
+
+	size_t cache_header_s::slabSize(size_t object_size, size_t index_size) noexcept {
+		auto ret = Buddy::greaterOrEqualPowerOfTwo(object_size + index_size + sizeof(slab_s));
+
+		// Sizes that wrap around, or have no power of two, can not be allocated
+		if (ret == 0 || object_size > ret) {
+			return 0;
+		}
+
 		if (ret < BLOCK_SIZE) {
 			ret = BLOCK_SIZE;
 		}
@@ -150,420 +358,1456 @@ namespace os2bn140314d {
 		return ret;
 	}
 
-	size_t cache_header_s::numOfObjects(size_t slab_size, size_t object_size, size_t index_size) throw(std::invalid_argument) {
+	size_t cache_header_s::numOfObjects(size_t slab_size, size_t object_size, size_t index_size) noexcept {
 		if (slab_size == 0 || object_size == 0 || index_size == 0) {
-			throw std::invalid_argument("Size can not be 0");
+			return 0;
 		}
 
 		return slab_size / (object_size + index_size);
 	}
 
-	size_t cache_header_s::unusedSpace(size_t slab_size, size_t object_size, size_t index_size) throw(std::invalid_argument) {
+	size_t cache_header_s::unusedSpace(size_t slab_size, size_t object_size, size_t index_size) noexcept {
 		if (slab_size == 0 || object_size == 0 || index_size == 0) {
-			throw std::invalid_argument("Size can not be 0");
+			return 0;
 		}
 
 		return slab_size % (object_size + index_size);
 	}
 
-	void cache_header_s::initilaze(
+	size_t cache_header_s::bitmapWords(size_t num_of_objects) noexcept {
+		return (num_of_objects + slab_s::BITS_IN_WORD - 1) / slab_s::BITS_IN_WORD;
+	}
+
+	bool cache_header_s::initilaze(
 		const char name[], 
 		size_t object_size,
 		void(*constructor)(void *), 
 		void(*destructor)(void *), 
-		cache_block_header_s * block) noexcept 
+		unsigned flags) noexcept 
 	{
-		copyName(name);
+		// Aligned objects are rounded up to whole cache lines
+		if (flags & KMEM_CACHE_HWALIGN) {
+			object_size = (object_size + CACHE_L1_LINE_SIZE - 1) & ~(CACHE_L1_LINE_SIZE - 1);
+		}
+
+		name_ = name;
+		interned_name_ = nullptr;
 		object_size_ = object_size;
 		constructor_ = constructor;
 		destructor_ = destructor;
-		block_ = block;
+		migrate_ = nullptr;
+		flags_ = flags;
 
 		next_color_ = 0;
 		number_of_slabs_ = 0;
-		number_of_allocated_objects_ = 0;
+		empty_slabs_ = 0;
+		min_empty_ = 0;
+		max_empty_ = NULL_INDEX;
 
-		auto slab_size = slabSize(object_size, sizeof(size_t));
+		new (&generation_) std::atomic<size_t>(next_generation_++);
 
-		number_of_blocks_in_slab_ = slab_size / BLOCK_SIZE;
+		// Aligning the first object wastes less than one cache line
+		auto alignment = flags & KMEM_CACHE_HWALIGN ? CACHE_L1_LINE_SIZE : 0;
 
-		num_of_objects_ = numOfObjects(slab_size - sizeof(cache_header_s), object_size, sizeof(size_t));
-		unused_memory_size_ = unusedSpace(slab_size - sizeof(cache_header_s), object_size, sizeof(size_t));
+		auto slab_size = slabSize(object_size + alignment, sizeof(size_t));
 
-		new (&mutex_) std::mutex;
+		if (object_size == 0 || slab_size == 0) {
+			return false;
+		}
 
-		new (&full_) SlabList;
-		new (&partial_) SlabList;
-		new (&empty_) SlabList;
+		number_of_blocks_in_slab_ = slab_size / BLOCK_SIZE;
 
-		error_ = OK;
-	}
+		auto available = slab_size - sizeof(slab_s) - alignment;
 
-	void cache_header_s::copyName(const char name[]) noexcept {
-		for (auto i = 0; i < MAX_NAME_LENGTH; i++) {
-			name_[i] = name[i];
-			if (name[i] == '\0') {
-				break;
-			}
-		}
-	}
+		num_of_objects_ = numOfObjects(available, object_size, sizeof(size_t));
+		unused_memory_size_ = unusedSpace(available, object_size, sizeof(size_t));
 
-	void *cache_header_s::allocate() noexcept {
-		mutex_.lock();
+		// Indexes must fit into the free list word
+		if (num_of_objects_ > slab_s::FREELIST_END) {
+			num_of_objects_ = slab_s::FREELIST_END;
+		}
 
-		// Check if list with partially full slabs has slabs
-		// If it does, allocate from there
-		// If the slab becomes full, move it to the list with the full slabs
-		if (!partial_.isEmpty()) {
-			auto slab = partial_.first();
-			auto ret = slab->allocate();
+		bitmap_words_ = 0;
 
-			if (slab->isFull()) {
-				partial_.remove(slab);
-				full_.insert(slab);
+		// Tracked caches give up objects until the allocation bitmap fits next to them
+		if (flags & KMEM_CACHE_TRACK) {
+			while ((object_size + sizeof(size_t)) * num_of_objects_ + bitmapWords(num_of_objects_) * sizeof(uint64_t) > available) {
+				num_of_objects_--;
 			}
 
-			number_of_allocated_objects_++;
+			bitmap_words_ = bitmapWords(num_of_objects_);
+			unused_memory_size_ = available - (object_size + sizeof(size_t)) * num_of_objects_ - bitmap_words_ * sizeof(uint64_t);
+		}
 
-			mutex_.unlock();
+		new (&mutex_) std::mutex;
 
-			return ret;
+		new (&full_) SlabList;
+		for (auto &partial : partial_) {
+			new (&partial) SlabList;
 		}
+		new (&empty_) SlabList;
+		new (&active_) SlabList;
 
-		// Check if list with empty slabs has slabs
-		// If it does, allocate from there
-		// Move the slab to the list with partially allocated slabs
-		// Corner case - only one object in each slab
-		// In that case move the slab to the list with the full slabs
-		if (!empty_.isEmpty()) {
-			auto slab = empty_.first();
-			auto ret = slab->allocate();
-			
-			empty_.remove(slab);
-
-			if (num_of_objects_ == 1) {
-				full_.insert(slab);
-			}
-			else {
-				partial_.insert(slab);
-			}
+		error_ = OK;
 
-			number_of_allocated_objects_++;
+		return true;
+	}
 
-			mutex_.unlock();
+	void *cache_header_s::allocateSlabMemory() noexcept {
+		bool zeroed;
+		void *ret = nullptr;
 
-			return ret;
+		// Slabs of the caches for hot objects are taken from the huge page regions if there is space there
+		// Otherwise fall back to the normal regions
+		if (flags_ & KMEM_CACHE_HUGEPAGE) {
+			ret = Buddy::allocate(number_of_blocks_in_slab_, zeroed, HUGE_POOL, true);
 		}
 
-		// Allocate one more slab
-		// Allocate object from there
-		// Put the slab into the list with partially allocated slabs
-		// Corner case - only one object in each slab
-		// In that case move the slab to the list with the full slabs
-		try {
-			auto new_slab = reinterpret_cast<slab_s *>(Buddy::allocate(number_of_blocks_in_slab_));
-			new_slab->initialize(next_color_, this);
-
-			next_color_ += CACHE_L1_LINE_SIZE;
-			next_color_ %= unused_memory_size_;
+		// Slabs whose objects can be moved borrow the contiguous reserve, which takes them back by moving the objects
+		if (ret == nullptr) {
+			ret = Buddy::allocate(number_of_blocks_in_slab_, zeroed, migrate_ != nullptr ? RESERVE_POOL : NORMAL_POOL, true);
+		}
 
-			auto ret = new_slab->allocate();
+		return ret;
+	}
 
-			if (num_of_objects_ == 1) {
-				full_.insert(new_slab);
-			}
-			else {
-				partial_.insert(new_slab);
-			}
+	SlabList &cache_header_s::list(SlabState state, size_t bucket) noexcept {
+		switch (state) {
+		case SLAB_EMPTY:
+			return empty_;
+		case SLAB_PARTIAL:
+			return partial_[bucket];
+		case SLAB_FULL:
+			return full_;
+		default:
+			return active_;
+		}
+	}
 
-			number_of_slabs_++;
-			number_of_allocated_objects_++;
+	void cache_header_s::insert(slab_s *slab) noexcept {
+		if (slab->state_ == SLAB_EMPTY) {
+			empty_slabs_++;
+		}
 
-			mutex_.unlock();
+		list(slab->state_, slab->bucket_).insert(slab);
+	}
 
-			return ret;
+	void cache_header_s::remove(slab_s *slab) noexcept {
+		if (slab->state_ == SLAB_EMPTY) {
+			empty_slabs_--;
 		}
-		catch(std::bad_alloc &) {
-			error_ |= NO_MORE_SPACE;
 
-			mutex_.unlock();
+		list(slab->state_, slab->bucket_).remove(slab);
+	}
 
-			return nullptr;
+	void cache_header_s::usedLists(const SlabList *lists[slab_s::PARTIAL_BUCKETS + 2]) const noexcept {
+		for (size_t i = 0; i < slab_s::PARTIAL_BUCKETS; i++) {
+			lists[i] = &partial_[i];
 		}
-	}
 
-	void cache_header_s::deallocate(void *object) noexcept {
-		mutex_.lock();
+		lists[slab_s::PARTIAL_BUCKETS] = &full_;
+		lists[slab_s::PARTIAL_BUCKETS + 1] = &active_;
+	}
 
-		// Try finding the slab in the list with the full slabs
-		// If it is there, deallocate the object
-		// Put the slab into the list with the partially full slabs
-		// Corner case - only one object in each slab
-		// In that case move the slab to the list with the empty slabs
-		auto slab = full_.get(object);
-		if (slab != nullptr) {
-			slab->deallocate(object);
-			full_.remove(slab);
+	slab_s *cache_header_s::activate() noexcept {
+		slab_s *slab = nullptr;
 
-			if (num_of_objects_ == 1) {
-				empty_.insert(slab);
-			}
-			else {
-				partial_.insert(slab);
+		// Prefer the fullest partially full slabs, then the empty ones
+		// Slabs that no thread owns only get more free objects, so both have at least one
+		// If there are none, allocate one more slab
+		for (auto i = slab_s::PARTIAL_BUCKETS; i > 0 && slab == nullptr; i--) {
+			if (!partial_[i - 1].isEmpty()) {
+				slab = partial_[i - 1].first();
 			}
+		}
 
-			number_of_allocated_objects_--;
-
-			mutex_.unlock();
-
-			return;
+		if (slab == nullptr && !empty_.isEmpty()) {
+			slab = empty_.first();
 		}
 
-		// Try finding the slab in the list with the partially full slabs
-		// If it is there, deallocate the object
-		// Check if slab became emtpy
-		// If it did, move the slab to the list with the empty slabs
-		slab = partial_.get(object);
 		if (slab != nullptr) {
-			slab->deallocate(object);
+			remove(slab);
+		}
 
-			if (slab->number_of_allocated_objects_ == 0) {
-				partial_.remove(slab);
-				empty_.insert(slab);
+		if (slab == nullptr) {
+			slab = reinterpret_cast<slab_s *>(allocateSlabMemory());
+
+			if (slab == nullptr) {
+				return nullptr;
 			}
 
-			number_of_allocated_objects_--;
+			slab->initialize(next_color_, this);
 
-			mutex_.unlock();
+			// Remember the slab as the owner of its blocks, so objects can find their slab
+			Buddy::setOwner(slab, number_of_blocks_in_slab_, slab);
 
-			return;
+			// Colors wrap to 0 rather than to the remainder, so they stay multiples of the cache line
+			next_color_ += CACHE_L1_LINE_SIZE;
+			next_color_ = next_color_ > unused_memory_size_ ? 0 : next_color_;
+
+			number_of_slabs_++;
 		}
 
-		// The object does not belong to any slab
-		// Update the error info and return
-		error_ |= DEALLOCATING_WRONG_OBJECT;
+		slab->freeze(&thread_slabs_s::local());
+		slab->state_ = SLAB_ACTIVE;
+		insert(slab);
 
-		mutex_.unlock();
+		return slab;
 	}
 
-	int cache_header_s::shrink() noexcept {
-		mutex_.lock();
-
-		auto ret = 0;
-
-		while (!empty_.isEmpty()) {
-			auto slab = empty_.first();
-			empty_.remove(slab);
-			Buddy::deallocate(slab, number_of_blocks_in_slab_);
-			ret += number_of_blocks_in_slab_;
-		}
+	void cache_header_s::deactivate(slab_s *slab) noexcept {
+		remove(slab);
 
-		mutex_.unlock();
+		auto word = slab->unfreeze();
 
-		return ret;
+		slab->state_ = slab->stateFor(word);
+		slab->bucket_ = slab->state_ == SLAB_PARTIAL ? slab->bucketFor(word) : 0;
+		insert(slab);
 	}
 
-	void cache_header_s::printInfo(std::ostream & os) noexcept {
-		
-		mutex_.lock();
-		AllocatorUtility::writeLock();
+	void cache_header_s::relist(slab_s *slab) noexcept {
+		// Slab owned by a thread is put on the right list when the thread returns it
+		if (slab->state_ == SLAB_ACTIVE) {
+			return;
+		}
 
-		auto fill_ratio = static_cast<double>(number_of_allocated_objects_) / (number_of_slabs_ * num_of_objects_);
+		auto word = slab->remote_free_.load(std::memory_order_acquire);
+		auto state = slab->stateFor(word);
+		auto bucket = state == SLAB_PARTIAL ? slab->bucketFor(word) : 0;
 
-		os << "Name                          -- " << name_ << std::endl;
-		os << "Object size                   -- " << object_size_ << "B" << std::endl;
-		os << "Cache size                    -- " << number_of_slabs_ * number_of_blocks_in_slab_ << " Blocks" << std::endl;
-		os << "Number of slabs               -- " << number_of_slabs_ << std::endl;
-		os << "Number of objects in one slab -- " << num_of_objects_ << std::endl;
-		os << "Fill ratio                    -- " << fill_ratio << std::endl;
+		if (state == slab->state_ && bucket == slab->bucket_) {
+			return;
+		}
 
-		AllocatorUtility::writeUnlock();
-		mutex_.unlock();
+		remove(slab);
+		slab->state_ = state;
+		slab->bucket_ = bucket;
+		insert(slab);
 	}
 
-	int cache_header_s::printErrorInfo(std::ostream & os) noexcept {
-		mutex_.lock();
-		AllocatorUtility::writeLock();
+	size_t cache_header_s::allocatedObjects() const noexcept {
+		size_t ret = 0;
 
-		if (error_ == OK) {
-			os << "No errors" << std::endl;
-			auto ret = error_;
-			AllocatorUtility::writeUnlock();
-			mutex_.unlock();
-			return ret;
-		}
-		if (error_ & NO_MORE_SPACE) {
-			os << "No more space for the allocation" << std::endl;
-		}
+		const SlabList *lists[slab_s::PARTIAL_BUCKETS + 2];
+		usedLists(lists);
 
-		if (error_ & DESTROYING_NON_EMPTY_CACHE) {
-			os << "Destroying a non empty cache is illegal" << std::endl;
-		}
+		for (auto list : lists) {
+			auto slab = list->isEmpty() ? nullptr : list->first();
 
-		if (error_ & DEALLOCATING_WRONG_OBJECT) {
-			os << "Deallocating an object from the wrong slab" << std::endl;
+			while (slab != nullptr) {
+				ret += slab->allocatedObjects();
+				slab = slab->next_;
+			}
 		}
 
-		auto ret = error_;
-		error_ = OK;
-
-		AllocatorUtility::writeUnlock();
-		mutex_.unlock();
-		
 		return ret;
 	}
 
-	#pragma endregion 
+	long long cache_header_s::walk(void(*callback)(void *, void *), void *context) const {
+		if (bitmap_words_ == 0) {
+			return -1;
+		}
 
-	#pragma region cache_block_header_s implementation
+		long long ret = 0;
 
-	void cache_block_header_s::initialize() noexcept {
-		new (&used_) CacheHeaderList;
-		new (&unused_) CacheHeaderList;
+		const SlabList *lists[slab_s::PARTIAL_BUCKETS + 2];
+		usedLists(lists);
 
-		auto pointer_to_headers = reinterpret_cast<cache_header_s *>(this + 1);
-		auto size = BLOCK_SIZE - sizeof(cache_block_header_s);
-		auto num_of_headers = size / sizeof(cache_header_s);
+		for (auto list : lists) {
+			auto slab = list->isEmpty() ? nullptr : list->first();
 
-		for (unsigned int i = 0; i < num_of_headers; i++) {
-			unused_.insert(pointer_to_headers + i);
+			while (slab != nullptr) {
+				ret += slab->walk(callback, context);
+				slab = slab->next_;
+			}
 		}
-	}
-
-	bool cache_block_header_s::hasMoreSpace() const noexcept {
-		return !unused_.isEmpty();
-	}
 
-	bool cache_block_header_s::isEmpty() const noexcept {
-		return used_.isEmpty();
+		return ret;
 	}
 
-	cache_header_s *cache_block_header_s::create(
-		const char name[], 
-		size_t object_size, 
-		void(*constructor)(void *), 
-		void(*destructor)(void *)) throw(std::overflow_error)
-	{
-		if (unused_.isEmpty()) {
-			throw std::overflow_error("No more space for the cache header");
-		}
-
-		auto header = unused_.remove();
-		header->initilaze(name, object_size, constructor, destructor, this);
+	void cache_header_s::printLeaks(std::ostream &os) const {
+		static const size_t MAX_PRINTED = 16;
 
-		used_.insert(header);
+		struct leaks_s {
+			std::ostream *os_;
+			size_t count_;
+		} leaks = { &os, 0 };
 
-		return header;
-	}
+		os << "Leaked objects of the cache " << name_ << ":" << std::endl;
 
-	bool cache_block_header_s::contains(cache_header_s *header) const noexcept {
-		auto pointer_to_headers = reinterpret_cast<const cache_header_s *>(this + 1);
-		auto size = BLOCK_SIZE - sizeof(cache_block_header_s);
-		auto num_of_headers = size / sizeof(cache_header_s);
+		walk([](void *object, void *context) {
+			auto leaks = static_cast<leaks_s *>(context);
 
-		return header >= pointer_to_headers && header < pointer_to_headers + num_of_headers;
-	}
+			if (leaks->count_++ < MAX_PRINTED) {
+				*leaks->os_ << "    " << object << std::endl;
+			}
+		}, &leaks);
 
-	bool cache_block_header_s::destroy(cache_header_s *header) noexcept {
-		if (header->number_of_allocated_objects_ != 0) {
-			header->error_ |= DESTROYING_NON_EMPTY_CACHE;
-			return false;
+		if (leaks.count_ > MAX_PRINTED) {
+			os << "    ... and " << leaks.count_ - MAX_PRINTED << " more" << std::endl;
 		}
 
-		header->shrink();
-
-		used_.remove(header);
-		unused_.insert(header);
+		os << leaks.count_ << " objects of " << object_size_ << "B leaked" << std::endl;
+	}
 
-		return true;
+	void *cache_header_s::allocate() noexcept {
+		void *ret;
+		return allocateBatch(&ret, 1) == 1 ? ret : nullptr;
 	}
 
-	#pragma endregion 
+	size_t cache_header_s::allocateBatch(void *objects[], size_t count) noexcept {
+		auto &entry = thread_slabs_s::local().entryFor(this);
 
-	#pragma region slab_header_s implementation
+		size_t ret = 0;
 
-	void slab_header_s::initialize() noexcept {
-		new (&headers_) CacheBlockList;
+		// If the entry belongs to another cache, or to the destroyed instance of this one, return that slab first
+		if (entry.cache_ != nullptr && (entry.cache_ != this || entry.generation_ != generation_)) {
+			thread_slabs_s::release(entry);
+		}
 
-		new (&mutex_) std::mutex;
+		while (true) {
+			// Take the objects from the slab owned by the thread
+			if (entry.cache_ == this) {
+				while (ret < count) {
+					auto object = entry.slab_->allocate();
+					if (object == nullptr) {
+						break;
+					}
 
-		for (auto i = BUFFER_SIZES_LOWER_BOUND; i < BUFFER_SIZES_UPPER_BOUND; i++) {
-			buffers_[i - BUFFER_SIZES_LOWER_BOUND] = create("Buffer", Buddy::powerToSize(i), nullptr, nullptr);
-		}
-	}
+					objects[ret++] = object;
+				}
 
-	cache_header_s *slab_header_s::create(
-		const char name[], 
-		size_t object_size,
-		void(*constructor)(void *), 
-		void(*destructor)(void *)) noexcept
-	{
-		mutex_.lock();
+				if (ret == count) {
+					return ret;
+				}
+			}
 
-		// If there are header blocks in the list
-		// Find the first block that has more space
-		// Allocate from there
-		if (!headers_.isEmpty()) {
-			auto header_block = headers_.first();
+			mutex_.lock();
 
-			while (header_block != nullptr && !header_block->hasMoreSpace()) {
-				header_block = header_block->next_;
+			// Active slab has no more free objects
+			// Return it to the lists and take the next one
+			if (entry.cache_ == this) {
+				deactivate(entry.slab_);
+				entry.cache_ = nullptr;
 			}
 
-			if (header_block != nullptr) {
-				auto ret = header_block->create(name, object_size, constructor, destructor);
+			auto slab = activate();
+
+			if (slab == nullptr) {
+				error_ |= NO_MORE_SPACE;
+
 				mutex_.unlock();
+
 				return ret;
 			}
-		}
 
-		// If there are no blocks, or all are full, allocate one more
-		// Allocate cache from there
-		try {
-			auto header_block = reinterpret_cast<cache_block_header_s *>(Buddy::allocate(1));
-			header_block->initialize();
-			auto ret = header_block->create(name, object_size, constructor, destructor);
-
-			headers_.insert(header_block);
+			entry.cache_ = this;
+			entry.generation_ = generation_;
+			entry.slab_ = slab;
 
 			mutex_.unlock();
 
-			return ret;
+			// Slow path of the cache checks the decay, the slabs may be taken without touching the buddy allocator
+			Buddy::purgeIdle();
 		}
-		catch(std::bad_alloc &) {
-			// If there is no more space, just return nullptr
-			mutex_.unlock();
-			return nullptr;
+	}
+
+	void *cache_header_s::allocate(slab_s *&slab) noexcept {
+		auto &entry = thread_slabs_s::local().entryFor(this);
+
+		// Object is always taken from the slab the entry holds when the allocation returns
+		void *ret;
+		if (allocateBatch(&ret, 1) != 1) {
+			return nullptr;
+		}
+
+		slab = entry.slab_;
+
+		return ret;
+	}
+
+	void cache_header_s::deallocate(void *object) noexcept {
+		auto &entry = thread_slabs_s::local().entryFor(this);
+
+		// Object of the slab the thread allocates from is known to be in it, so its slab is not looked up
+		// The owner frees to the local list, which never moves the slab to another list
+		if (entry.cache_ == this && entry.generation_ == generation_ && entry.slab_->contains(object) &&
+			entry.slab_->markFree(entry.slab_->indexOf(object)))
+		{
+			entry.slab_->deallocate(object);
+			return;
+		}
+
+		deallocateBatch(&object, 1);
+	}
+
+	void cache_header_s::deallocateAt(slab_s *slab, size_t index) noexcept {
+		auto refused = !slab->markFree(index);
+
+		if (!refused && !slab->release(index)) {
+			return;
+		}
+
+		mutex_.lock();
+
+		if (refused) {
+			error_ |= DEALLOCATING_FREE_OBJECT;
+		}
+		else {
+			relist(slab);
+			slab->pending_--;
+
+			wakeWaiters();
+		}
+
+		SlabList released;
+
+		if (empty_slabs_ > max_empty_) {
+			trimEmpty(released, max_empty_);
+		}
+
+		mutex_.unlock();
+
+		releaseSlabs(released);
+	}
+
+	void cache_header_s::deallocateBatch(void *const objects[], size_t count) noexcept {
+		auto locked = false;
+
+		for (size_t i = 0; i < count; i++) {
+			auto object = objects[i];
+			auto slab = const_cast<slab_s *>(static_cast<const slab_s *>(Buddy::owner(object)));
+
+			// The object does not belong to any slab of this cache
+			// Update the error info and continue
+			if (slab == nullptr || slab->header_ != this || !slab->contains(object)) {
+				if (!locked) {
+					mutex_.lock();
+					locked = true;
+				}
+
+				error_ |= DEALLOCATING_WRONG_OBJECT;
+				continue;
+			}
+
+			// Tracked cache refuses the objects that are already free, they would corrupt the free list
+			if (!slab->markFree(slab->indexOf(object))) {
+				if (!locked) {
+					mutex_.lock();
+					locked = true;
+				}
+
+				error_ |= DEALLOCATING_FREE_OBJECT;
+				continue;
+			}
+
+			// Slab changed its state, move it to the right list
+			// Once locked, the mutex is kept for the rest of the batch
+			if (slab->deallocate(object)) {
+				if (!locked) {
+					mutex_.lock();
+					locked = true;
+				}
+
+				relist(slab);
+				slab->pending_--;
+			}
+		}
+
+		if (!locked) {
+			return;
+		}
+
+		wakeWaiters();
+
+		// Slabs that became empty over the limit are returned after unlocking
+		SlabList released;
+
+		if (empty_slabs_ > max_empty_) {
+			trimEmpty(released, max_empty_);
+		}
+
+		mutex_.unlock();
+
+		releaseSlabs(released);
+	}
+
+	void cache_header_s::wakeWaiters() const noexcept {
+		WaitQueue::wake(Buddy::sizeToPower(number_of_blocks_in_slab_));
+	}
+
+	void cache_header_s::reattach(const char name[]) noexcept {
+		new (&mutex_) std::mutex;
+
+		if (name != nullptr) {
+			name_ = name;
+		}
+
+		constructor_ = nullptr;
+		destructor_ = nullptr;
+		migrate_ = nullptr;
+
+		// Threads that owned the active slabs do not exist any more
+		deactivateAll();
+	}
+
+	void cache_header_s::deactivateAll() noexcept {
+		// Entries of the threads holding these slabs do not match the new generation
+		generation_ = next_generation_++;
+
+		while (!active_.isEmpty()) {
+			deactivate(active_.first());
+		}
+	}
+
+	void cache_header_s::setEmptyLimits(size_t min_empty, size_t max_empty) noexcept {
+		mutex_.lock();
+
+		min_empty_ = min_empty;
+		max_empty_ = max_empty < min_empty ? min_empty : max_empty;
+
+		SlabList released;
+		trimEmpty(released, max_empty_);
+
+		mutex_.unlock();
+
+		releaseSlabs(released);
+	}
+
+	void cache_header_s::trimEmpty(SlabList &released, size_t retained) noexcept {
+		// Oldest empty slabs are taken first, the recently emptied ones are likely still in the processor cache
+		auto slab = empty_.isEmpty() ? nullptr : empty_.first();
+
+		while (slab != nullptr && empty_slabs_ > retained) {
+			auto next = slab->next_;
+
+			if (slab->pending_ == 0) {
+				remove(slab);
+				released.insert(slab);
+				number_of_slabs_--;
+			}
+
+			slab = next;
+		}
+	}
+
+	int cache_header_s::releaseSlabs(SlabList &released) noexcept {
+		auto ret = 0;
+
+		while (!released.isEmpty()) {
+			auto slab = released.first();
+			released.remove(slab);
+
+			Buddy::setOwner(slab, number_of_blocks_in_slab_, nullptr);
+			Buddy::deallocate(slab, number_of_blocks_in_slab_);
+
+			ret += static_cast<int>(number_of_blocks_in_slab_);
+		}
+
+		return ret;
+	}
+
+	bool cache_header_s::destroy() noexcept {
+		mutex_.lock();
+
+		if (allocatedObjects() != 0) {
+			error_ |= DESTROYING_NON_EMPTY_CACHE;
+
+			if (bitmap_words_ != 0) {
+				AllocatorUtility::writeLock();
+				printLeaks(std::cerr);
+				AllocatorUtility::writeUnlock();
+			}
+
+			mutex_.unlock();
+			return false;
+		}
+
+		deactivateAll();
+
+		// All slabs are empty, none of them is kept
+		SlabList released;
+		trimEmpty(released, 0);
+
+		mutex_.unlock();
+
+		releaseSlabs(released);
+
+		return true;
+	}
+
+	int cache_header_s::shrink() noexcept {
+		SlabList released;
+
+		mutex_.lock();
+		trimEmpty(released, min_empty_);
+		mutex_.unlock();
+
+		return releaseSlabs(released);
+	}
+
+	int cache_header_s::defragment() noexcept {
+		if (migrate_ == nullptr) {
+			return -1;
+		}
+
+		bool zeroed;
+		auto candidates = static_cast<defrag_candidate_s *>(Buddy::allocate(1, zeroed));
+
+		// Pass could not even start, which the caller tells apart from nothing to move by the error bit
+		if (candidates == nullptr) {
+			mutex_.lock();
+			error_ |= NO_MORE_SPACE;
+			mutex_.unlock();
+
+			return 0;
+		}
+
+		mutex_.lock();
+
+		size_t count = 0;
+
+		for (auto &partial : partial_) {
+			auto slab = partial.isEmpty() ? nullptr : partial.first();
+
+			while (slab != nullptr && count < MAX_DEFRAG_CANDIDATES) {
+				candidates[count++] = { slab, slab->allocatedObjects() };
+				slab = slab->next_;
+			}
+		}
+
+		// Counts are taken once, since the frees of other threads change them during the sort
+		std::sort(candidates, candidates + count, [](const defrag_candidate_s &lhs, const defrag_candidate_s &rhs) {
+			return lhs.allocated_ < rhs.allocated_;
+		});
+
+		// Sparsest slabs are emptied as long as the fullest ones have the space for their objects
+		// Slabs that no thread owns only lose objects, so the space can only grow
+		size_t victims = 0;
+		size_t targets = count;
+		size_t space = 0;
+
+		while (victims < targets) {
+			auto needed = candidates[victims].allocated_;
+
+			while (space < needed && targets - 1 > victims) {
+				targets--;
+				space += num_of_objects_ - candidates[targets].allocated_;
+			}
+
+			if (space < needed) {
+				break;
+			}
+
+			space -= needed;
+			victims++;
+		}
+
+		if (victims == 0) {
+			mutex_.unlock();
+			Buddy::deallocate(candidates, 1);
+
+			return 0;
+		}
+
+		// Targets follow the victims
+		std::copy(candidates + targets, candidates + count, candidates + victims);
+		count = victims + count - targets;
+
+		// Cache owns the slabs during the pass, so activation skips them and the frees of all threads are remote
+		for (size_t i = 0; i < count; i++) {
+			auto slab = candidates[i].slab_;
+
+			remove(slab);
+			slab->freeze(this);
+			slab->state_ = SLAB_ACTIVE;
+			insert(slab);
+		}
+
+		mutex_.unlock();
+
+		size_t next = 0;
+
+		for (size_t i = 0; i < victims; i++) {
+			migrateSlab(candidates[i].slab_, candidates + victims, count - victims, next);
+		}
+
+		SlabList released;
+
+		mutex_.lock();
+
+		for (size_t i = 0; i < count; i++) {
+			deactivate(candidates[i].slab_);
+		}
+
+		trimEmpty(released, min_empty_);
+
+		mutex_.unlock();
+
+		Buddy::deallocate(candidates, 1);
+
+		return releaseSlabs(released);
+	}
+
+	void cache_header_s::migrateSlab(slab_s *slab, const defrag_candidate_s targets[], size_t count, size_t &next) noexcept {
+		for (size_t i = 0; i < bitmap_words_; i++) {
+			auto word = slab->allocated_[i].load(std::memory_order_relaxed);
+
+			while (word != 0) {
+				auto index = i * slab_s::BITS_IN_WORD + slab_s::lowestBit(word);
+				word &= word - 1;
+
+				// Object freed since the word was read has nothing to move
+				if (!slab->isAllocated(index)) {
+					continue;
+				}
+
+				void *target = nullptr;
+
+				while (next < count && (target = targets[next].slab_->allocate()) == nullptr) {
+					next++;
+				}
+
+				if (target == nullptr) {
+					return;
+				}
+
+				auto object = slab->objectAt(index);
+
+				if (migrate_(object, target) != 0) {
+					// Old place is freed only once, even if the owner freed it during the move
+					if (slab->markFree(index)) {
+						slab->deallocate(object);
+					}
+				}
+				else {
+					auto target_slab = targets[next].slab_;
+					auto target_index = target_slab->indexOf(target);
+
+					target_slab->markFree(target_index);
+					target_slab->release(target_index);
+				}
+			}
+		}
+	}
+
+	bool cache_header_s::evacuate(const void *begin, const void *end) noexcept {
+		auto inRange = [begin, end](const slab_s *slab) {
+			return static_cast<const void *>(slab) >= begin && static_cast<const void *>(slab) < end;
+		};
+
+		// Slab of the calling thread would otherwise stay, and the objects would be moved into it
+		auto &entry = thread_slabs_s::local().entryFor(this);
+
+		if (entry.cache_ == this && inRange(entry.slab_)) {
+			thread_slabs_s::release(entry);
+		}
+
+		bool zeroed;
+		auto victims = static_cast<defrag_candidate_s *>(Buddy::allocate(1, zeroed));
+
+		if (victims == nullptr) {
+			mutex_.lock();
+			error_ |= NO_MORE_SPACE;
+			mutex_.unlock();
+
+			return false;
+		}
+
+		SlabList released;
+		auto cleared = true;
+		size_t count = 0;
+
+		mutex_.lock();
+
+		auto slab = empty_.isEmpty() ? nullptr : empty_.first();
+
+		while (slab != nullptr) {
+			auto next = slab->next_;
+
+			if (inRange(slab) && slab->pending_ == 0) {
+				remove(slab);
+				released.insert(slab);
+				number_of_slabs_--;
+			}
+
+			slab = next;
+		}
+
+		const SlabList *lists[slab_s::PARTIAL_BUCKETS + 1] = { &full_ };
+
+		for (size_t i = 0; i < slab_s::PARTIAL_BUCKETS; i++) {
+			lists[i + 1] = &partial_[i];
+		}
+
+		for (auto list : lists) {
+			slab = list->isEmpty() ? nullptr : list->first();
+
+			for (; slab != nullptr; slab = slab->next_) {
+				if (!inRange(slab)) {
+					continue;
+				}
+
+				if (count == MAX_DEFRAG_CANDIDATES) {
+					cleared = false;
+					break;
+				}
+
+				victims[count++] = { slab, slab->allocatedObjects() };
+			}
+		}
+
+		// Slabs owned by the other threads stay where they are
+		for (slab = active_.isEmpty() ? nullptr : active_.first(); slab != nullptr; slab = slab->next_) {
+			cleared = cleared && !inRange(slab);
+		}
+
+		// As in defragmentation, the cache owns the slabs while their objects move
+		for (size_t i = 0; i < count; i++) {
+			slab = victims[i].slab_;
+
+			remove(slab);
+			slab->freeze(this);
+			slab->state_ = SLAB_ACTIVE;
+			insert(slab);
+		}
+
+		mutex_.unlock();
+
+		for (size_t i = 0; i < count; i++) {
+			cleared = evacuateSlab(victims[i].slab_) && cleared;
+		}
+
+		mutex_.lock();
+
+		for (size_t i = 0; i < count; i++) {
+			slab = victims[i].slab_;
+
+			deactivate(slab);
+
+			if (slab->state_ == SLAB_EMPTY && slab->pending_ == 0) {
+				remove(slab);
+				released.insert(slab);
+				number_of_slabs_--;
+			}
+			else {
+				cleared = false;
+			}
+		}
+
+		mutex_.unlock();
+
+		Buddy::deallocate(victims, 1);
+		releaseSlabs(released);
+
+		return cleared;
+	}
+
+	bool cache_header_s::evacuateSlab(slab_s *slab) noexcept {
+		for (size_t i = 0; i < bitmap_words_; i++) {
+			auto word = slab->allocated_[i].load(std::memory_order_relaxed);
+
+			while (word != 0) {
+				auto index = i * slab_s::BITS_IN_WORD + slab_s::lowestBit(word);
+				word &= word - 1;
+
+				if (!slab->isAllocated(index)) {
+					continue;
+				}
+
+				slab_s *target_slab;
+				auto target = allocate(target_slab);
+
+				if (target == nullptr) {
+					return false;
+				}
+
+				auto object = slab->objectAt(index);
+
+				if (migrate_(object, target) == 0) {
+					deallocateAt(target_slab, target_slab->indexOf(target));
+					return false;
+				}
+
+				if (slab->markFree(index)) {
+					slab->deallocate(object);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	void cache_header_s::printInfo(std::ostream & os) noexcept {
+		
+		mutex_.lock();
+		AllocatorUtility::writeLock();
+
+		auto fill_ratio = static_cast<double>(allocatedObjects()) / (number_of_slabs_ * num_of_objects_);
+
+		os << "Name                          -- " << name_ << std::endl;
+		os << "Object size                   -- " << object_size_ << "B" << std::endl;
+		os << "Cache size                    -- " << number_of_slabs_ * number_of_blocks_in_slab_ << " Blocks" << std::endl;
+		os << "Number of slabs               -- " << number_of_slabs_ << std::endl;
+		os << "Number of objects in one slab -- " << num_of_objects_ << std::endl;
+		os << "Fill ratio                    -- " << fill_ratio << std::endl;
+
+		AllocatorUtility::writeUnlock();
+		mutex_.unlock();
+	}
+
+	int cache_header_s::printErrorInfo(std::ostream & os) noexcept {
+		mutex_.lock();
+		AllocatorUtility::writeLock();
+
+		if (error_ == OK) {
+			os << "No errors" << std::endl;
+			auto ret = error_;
+			AllocatorUtility::writeUnlock();
+			mutex_.unlock();
+			return ret;
+		}
+		if (error_ & NO_MORE_SPACE) {
+			os << "No more space for the allocation" << std::endl;
+		}
+
+		if (error_ & DESTROYING_NON_EMPTY_CACHE) {
+			os << "Destroying a non empty cache is illegal" << std::endl;
+		}
+
+		if (error_ & DEALLOCATING_WRONG_OBJECT) {
+			os << "Deallocating an object from the wrong slab" << std::endl;
+		}
+
+		if (error_ & DEALLOCATING_FREE_OBJECT) {
+			os << "Deallocating an object that is already free" << std::endl;
+		}
+
+		auto ret = error_;
+		error_ = OK;
+
+		AllocatorUtility::writeUnlock();
+		mutex_.unlock();
+		
+		return ret;
+	}
+
+	#pragma endregion 
+
+	#pragma region thread_slabs_s implementation
+
+	std::thread::id thread_slabs_s::initializing_thread_;
+
+	thread_slabs_s::~thread_slabs_s() {
+		if (std::this_thread::get_id() == initializing_thread_) {
+			return;
+		}
+
+		for (auto &entry : entries_) {
+			if (entry.cache_ != nullptr) {
+				release(entry);
+			}
+		}
+	}
+
+	thread_slabs_s &thread_slabs_s::local() noexcept {
+		static thread_local thread_slabs_s slabs;
+		return slabs;
+	}
+
+	active_slab_s &thread_slabs_s::entryFor(const cache_header_s *cache) noexcept {
+		auto index = reinterpret_cast<size_t>(cache) / sizeof(cache_header_s) % NUMBER_OF_ENTRIES;
+		return entries_[index];
+	}
+
+	void thread_slabs_s::release(active_slab_s &entry) noexcept {
+		auto cache = entry.cache_;
+
+		// Generation is checked again under the lock, the cache may be destroyed in the meantime
+		if (cache->generation_ == entry.generation_) {
+			SlabList released;
+
+			cache->mutex_.lock();
+
+			if (cache->generation_ == entry.generation_) {
+				cache->deactivate(entry.slab_);
+				cache->trimEmpty(released, cache->max_empty_);
+				cache->wakeWaiters();
+			}
+
+			cache->mutex_.unlock();
+
+			cache->releaseSlabs(released);
+		}
+
+		entry.cache_ = nullptr;
+	}
+
+	#pragma endregion
+
+	#pragma region cpu_buffer_cache_s implementation
+
+	void cpu_buffer_cache_s::initialize() noexcept {
+		new (&locked_) std::atomic<bool>(false);
+		count_ = 0;
+	}
+
+	void cpu_buffer_cache_s::lock() noexcept {
+		while (locked_.exchange(true, std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void cpu_buffer_cache_s::unlock() noexcept {
+		locked_.store(false, std::memory_order_release);
+	}
+
+	#pragma endregion
+
+	#pragma region slab_header_s implementation
+
+	void slab_header_s::initialize() noexcept {
+		thread_slabs_s::initializing_thread_ = std::this_thread::get_id();
+
+		// Cache headers are objects of this cache, which tracks them so the destroyed ones are recognized,
+		// and aligns them so the mutex of each header stays in its own cache line
+		cache_cache_.initilaze("kmem_cache", sizeof(cache_header_s), nullptr, nullptr, KMEM_CACHE_TRACK | KMEM_CACHE_HWALIGN);
+
+		new (&caches_) CacheHeaderList;
+		new (&mutex_) std::mutex;
+
+		for (auto &name : names_) {
+			name = nullptr;
+		}
+
+		// Buffers of a cache line and more are aligned to the line, their sizes are already whole lines
+		for (auto i = BUFFER_SIZES_LOWER_BOUND; i < BUFFER_SIZES_UPPER_BOUND; i++) {
+			auto size = Buddy::powerToSize(i);
+			buffers_[i - BUFFER_SIZES_LOWER_BOUND] = allocateCache("Buffer", size, nullptr, nullptr, size >= CACHE_L1_LINE_SIZE ? KMEM_CACHE_HWALIGN : 0);
+		}
+
+		// Threads check the generation of the groups they charged, so the headers stay in this cache once freed
+		// Cache is tracked, so the groups of a persistent pool are found when it is attached again
+		groups_ = allocateCache("Group", sizeof(group_header_s), nullptr, nullptr, KMEM_CACHE_TRACK | KMEM_CACHE_HWALIGN);
+
+		new (&cpus_) std::atomic<std::atomic<cpu_buffers_s *> *>(nullptr);
+
+		number_of_cpus_ = Processor::count();
+		if (number_of_cpus_ > MAX_CPUS) {
+			number_of_cpus_ = MAX_CPUS;
+		}
+	}
+
+	cache_header_s *slab_header_s::create(
+		const char name[], 
+		size_t object_size,
+		void(*constructor)(void *), 
+		void(*destructor)(void *),
+		unsigned flags) noexcept
+	{
+		auto hash = hashName(name);
+
+		// Caches are usually created with the names already in the table
+		mutex_.lock();
+		auto interned = internName(name, hash, nullptr);
+		mutex_.unlock();
+
+		if (interned == nullptr) {
+			auto allocated = allocateName(name, hash);
+			if (allocated == nullptr) {
+				return nullptr;
+			}
+
+			// Another thread may have interned the same name in the meantime
+			mutex_.lock();
+			interned = internName(name, hash, allocated);
+			mutex_.unlock();
+
+			if (interned != allocated) {
+				deallocateName(allocated);
+			}
+		}
+
+		auto ret = allocateCache(interned->string(), object_size, constructor, destructor, flags);
+
+		mutex_.lock();
+
+		if (ret == nullptr) {
+			auto removed = releaseName(interned);
+			mutex_.unlock();
+
+			if (removed) {
+				deallocateName(interned);
+			}
+
+			return nullptr;
 		}
+
+		ret->interned_name_ = interned;
+		caches_.insert(ret);
+
+		mutex_.unlock();
+
+		return ret;
 	}
 
 	bool slab_header_s::destroy(cache_header_s *header) noexcept {
+		auto slab = static_cast<const slab_s *>(Buddy::owner(header));
+
+		// Only the live caches created by the users can be destroyed
+		if (slab == nullptr || slab->header_ != &cache_cache_ || !slab->contains(header)
+			|| !slab->isAllocated(slab->indexOf(header)) || header->interned_name_ == nullptr) 
+		{
+			return false;
+		}
+
+		if (!header->destroy()) {
+			return false;
+		}
+
 		mutex_.lock();
 
-		auto header_block = headers_.first();
-		
-		// Pass through the list, find the block with the header
-		// Destroy the cache when block is found
-		// If the block is empty remove and deallocate it
-		while (header_block != nullptr) {
-			if (header_block->contains(header)) {
-				auto ret = header_block->destroy(header);
-
-				if (header_block->isEmpty()) {
-					headers_.remove(header_block);
-					Buddy::deallocate(header_block, 1);
-				}
+		caches_.remove(header);
 
-				mutex_.unlock();
+		auto name = header->interned_name_;
+		auto removed = releaseName(name);
+
+		mutex_.unlock();
+
+		if (removed) {
+			deallocateName(name);
+		}
+
+		cache_cache_.deallocate(header);
+
+		return true;
+	}
+
+	cache_header_s *slab_header_s::allocateCache(
+		const char name[],
+		size_t object_size,
+		void(*constructor)(void *),
+		void(*destructor)(void *),
+		unsigned flags) noexcept
+	{
+		auto ret = static_cast<cache_header_s *>(cache_cache_.allocate());
+
+		if (ret != nullptr && !ret->initilaze(name, object_size, constructor, destructor, flags)) {
+			cache_cache_.deallocate(ret);
+			return nullptr;
+		}
+
+		return ret;
+	}
+
+	cache_name_s *slab_header_s::allocateName(const char name[], size_t hash) noexcept {
+		size_t length = 0;
+		while (length < MAX_NAME_LENGTH - 1 && name[length] != '\0') {
+			length++;
+		}
+
+		auto power = Buddy::sizeToPower(Buddy::greaterOrEqualPowerOfTwo(sizeof(cache_name_s) + length + 1));
+		if (power < BUFFER_SIZES_LOWER_BOUND) {
+			power = BUFFER_SIZES_LOWER_BOUND;
+		}
+
+		auto ret = static_cast<cache_name_s *>(bufferAllocate(power));
+		if (ret == nullptr) {
+			return nullptr;
+		}
+
+		ret->next_ = nullptr;
+		ret->hash_ = hash;
+		ret->references_ = 0;
+
+		std::memcpy(ret->string(), name, length);
+		ret->string()[length] = '\0';
+
+		return ret;
+	}
+
+	cache_name_s *slab_header_s::internName(const char name[], size_t hash, cache_name_s *allocated) noexcept {
+		auto &bucket = names_[hash % NAME_BUCKETS];
+
+		for (auto current = bucket; current != nullptr; current = current->next_) {
+			if (current->hash_ == hash && std::strncmp(current->string(), name, MAX_NAME_LENGTH - 1) == 0) {
+				current->references_++;
+				return current;
+			}
+		}
+
+		if (allocated == nullptr) {
+			return nullptr;
+		}
+
+		allocated->references_ = 1;
+		allocated->next_ = bucket;
+		bucket = allocated;
+
+		return allocated;
+	}
+
+	bool slab_header_s::releaseName(cache_name_s *name) noexcept {
+		if (--name->references_ != 0) {
+			return false;
+		}
+
+		auto current = &names_[name->hash_ % NAME_BUCKETS];
+		while (*current != name) {
+			current = &(*current)->next_;
+		}
+
+		*current = name->next_;
+
+		return true;
+	}
+
+	void slab_header_s::deallocateName(cache_name_s *name) noexcept {
+		auto slab = static_cast<const slab_s *>(Buddy::owner(name));
+		bufferDeallocate(slab->header_, name);
+	}
+
+	size_t slab_header_s::hashName(const char name[]) noexcept {
+		// FNV-1a
+		size_t ret = static_cast<size_t>(0xcbf29ce484222325ull);
+
+		for (size_t i = 0; i < MAX_NAME_LENGTH - 1 && name[i] != '\0'; i++) {
+			ret = (ret ^ static_cast<unsigned char>(name[i])) * static_cast<size_t>(0x100000001b3ull);
+		}
+
+		return ret;
+	}
+
+	slab_header_s::cpu_buffers_s *slab_header_s::cpuBuffers() noexcept {
+		auto cpus = cpus_.load(std::memory_order_acquire);
+		auto index = Processor::current() % number_of_cpus_;
+
+		if (cpus != nullptr) {
+			auto ret = cpus[index].load(std::memory_order_acquire);
+			if (ret != nullptr) {
 				return ret;
 			}
+		}
+
+		// Table and the caches of each processor are allocated on their first use
+		// Memory grows with the number of processors, not with the number of threads
+		mutex_.lock();
+
+		bool zeroed;
+
+		cpus = cpus_.load(std::memory_order_relaxed);
+		if (cpus == nullptr) {
+			cpus = static_cast<std::atomic<cpu_buffers_s *> *>(Buddy::allocate(1, zeroed));
+
+			if (cpus == nullptr) {
+				mutex_.unlock();
+				return nullptr;
+			}
+
+			for (size_t i = 0; i < number_of_cpus_; i++) {
+				new (cpus + i) std::atomic<cpu_buffers_s *>(nullptr);
+			}
+
+			cpus_.store(cpus, std::memory_order_release);
+		}
+
+		auto ret = cpus[index].load(std::memory_order_relaxed);
+		if (ret == nullptr) {
+			ret = static_cast<cpu_buffers_s *>(Buddy::allocate(1, zeroed));
+
+			if (ret == nullptr) {
+				mutex_.unlock();
+				return nullptr;
+			}
+
+			for (auto &cache : ret->caches_) {
+				cache.initialize();
+			}
+
+			cpus[index].store(ret, std::memory_order_release);
+		}
+
+		mutex_.unlock();
+
+		return ret;
+	}
+
+	void *slab_header_s::bufferAllocate(size_t power) noexcept {
+		auto buffer = buffers_[power - BUFFER_SIZES_LOWER_BOUND];
+		auto cpu = cpuBuffers();
+
+		// Without the processor caches allocate directly from the buffer cache
+		if (cpu == nullptr) {
+			return buffer->allocate();
+		}
+
+		auto &cache = cpu->caches_[power - BUFFER_SIZES_LOWER_BOUND];
+
+		cache.lock();
+
+		if (cache.count_ == 0) {
+			cache.count_ = buffer->allocateBatch(cache.objects_, cpu_buffer_cache_s::BATCH);
+		}
+
+		auto ret = cache.count_ == 0 ? nullptr : cache.objects_[--cache.count_];
+
+		cache.unlock();
+
+		return ret;
+	}
+
+	void slab_header_s::bufferDeallocate(cache_header_s *cache, void *buffer) noexcept {
+		auto power = Buddy::sizeToPower(cache->object_size_);
+
+		// Only the small memory buffers go through the processor caches
+		if (power < BUFFER_SIZES_LOWER_BOUND || power >= BUFFER_SIZES_UPPER_BOUND 
+			|| buffers_[power - BUFFER_SIZES_LOWER_BOUND] != cache) 
+		{
+			cache->deallocate(buffer);
+			return;
+		}
+
+		auto cpu = cpuBuffers();
+
+		if (cpu == nullptr) {
+			cache->deallocate(buffer);
+			return;
+		}
+
+		auto &cpu_cache = cpu->caches_[power - BUFFER_SIZES_LOWER_BOUND];
+
+		cpu_cache.lock();
+
+		// Oldest objects are returned, the recently freed ones are likely still in the processor cache
+		if (cpu_cache.count_ == cpu_buffer_cache_s::CAPACITY) {
+			cache->deallocateBatch(cpu_cache.objects_, cpu_buffer_cache_s::BATCH);
+
+			for (auto i = cpu_buffer_cache_s::BATCH; i < cpu_buffer_cache_s::CAPACITY; i++) {
+				cpu_cache.objects_[i - cpu_buffer_cache_s::BATCH] = cpu_cache.objects_[i];
+			}
+
+			cpu_cache.count_ -= cpu_buffer_cache_s::BATCH;
+		}
+
+		cpu_cache.objects_[cpu_cache.count_++] = buffer;
+
+		// Only the allocations on this processor can take the buffer
+		cache->wakeWaiters();
+
+		cpu_cache.unlock();
+	}
+
+	bool slab_header_s::evacuate(const void *begin, const void *end) noexcept {
+		auto ret = true;
+
+		mutex_.lock();
+
+		for (auto cache = caches_.first(); cache != nullptr; cache = cache->next_) {
+			if (cache->migrate_ != nullptr) {
+				ret = cache->evacuate(begin, end) && ret;
+			}
+		}
+
+		mutex_.unlock();
+
+		return ret;
+	}
+
+	void slab_header_s::lockAll() noexcept {
+		// Header is locked first, it keeps the lists of the caches and of the processors from changing
+		mutex_.lock();
+
+		auto cpus = cpus_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; cpus != nullptr && i < number_of_cpus_; i++) {
+			auto cpu = cpus[i].load(std::memory_order_acquire);
+
+			for (size_t j = 0; cpu != nullptr && j < NUMBER_OF_BUFFER_SIZES; j++) {
+				cpu->caches_[j].lock();
+			}
+		}
+
+		// Buffer caches are locked while the processor caches are held, never the other way around
+		cache_cache_.mutex_.lock();
+
+		for (auto buffer : buffers_) {
+			buffer->mutex_.lock();
+		}
+
+		groups_->mutex_.lock();
+
+		for (auto cache = caches_.first(); cache != nullptr; cache = cache->next_) {
+			cache->mutex_.lock();
+		}
+	}
+
+	void slab_header_s::unlockAll() noexcept {
+		for (auto cache = caches_.first(); cache != nullptr; cache = cache->next_) {
+			cache->mutex_.unlock();
+		}
+
+		groups_->mutex_.unlock();
+
+		for (auto buffer : buffers_) {
+			buffer->mutex_.unlock();
+		}
+
+		cache_cache_.mutex_.unlock();
+
+		auto cpus = cpus_.load(std::memory_order_acquire);
+
+		for (size_t i = 0; cpus != nullptr && i < number_of_cpus_; i++) {
+			auto cpu = cpus[i].load(std::memory_order_acquire);
+
+			for (size_t j = 0; cpu != nullptr && j < NUMBER_OF_BUFFER_SIZES; j++) {
+				cpu->caches_[j].unlock();
+			}
+		}
+
+		mutex_.unlock();
+	}
+
+	void slab_header_s::reattach() noexcept {
+		// Thread attaching the pool keeps its slabs when it exits, as the one that initialized it
+		thread_slabs_s::initializing_thread_ = std::this_thread::get_id();
+
+		new (&mutex_) std::mutex;
+
+		// Names of the caches of the allocator are strings of the old process, the interned ones are in the pool
+		cache_cache_.reattach("kmem_cache");
+
+		for (auto buffer : buffers_) {
+			buffer->reattach("Buffer");
+		}
+
+		groups_->reattach("Group");
 
-			header_block = header_block->next_;
+		for (auto cache = caches_.first(); cache != nullptr; cache = cache->next_) {
+			cache->reattach(nullptr);
+		}
+
+		// Threads of this process have no charges yet, so the groups get new generations
+		groups_->walk([](void *object, void *) {
+			auto group = static_cast<group_header_s *>(object);
+
+			new (&group->mutex_) std::mutex;
+			new (&group->generation_) std::atomic<size_t>(group_header_s::next_generation_++);
+			group->reclaim_ = nullptr;
+			group->reclaim_context_ = nullptr;
+		}, nullptr);
+	}
+
+	cache_header_s *slab_header_s::find(const char name[]) noexcept {
+		mutex_.lock();
+
+		auto ret = caches_.first();
+		while (ret != nullptr && std::strcmp(ret->name_, name) != 0) {
+			ret = ret->next_;
 		}
 
 		mutex_.unlock();
 
-		return false;
+		return ret;
 	}
 
 	#pragma endregion 
@@ -5,6 +5,10 @@
 
 #include "SlabUtility.h"
 #include "AllocatorUtility.h"
+#include "Buddy.h"
+#include "GuardedPool.h"
+#include "HeapProfiler.h"
+#include "WaitQueue.h"
 
 namespace os2bn140314d {
 
@@ -12,37 +16,278 @@ namespace os2bn140314d {
 		const char name[], 
 		size_t object_size, 
 		void(*constructor)(void *), 
-		void(*destructor)(void *)) noexcept 
+		void(*destructor)(void *),
+		unsigned flags) noexcept 
 	{
 		auto &header = AllocatorUtility::slabHeader();
-		return header.create(name, object_size, constructor, destructor);
+		return header.create(name, object_size, constructor, destructor, flags);
+	}
+
+	cache_header_s *Slab::createMovable(
+		const char name[],
+		size_t object_size,
+		void(*constructor)(void *),
+		void(*destructor)(void *),
+		int(*migrate)(void *, void *)) noexcept
+	{
+		auto ret = create(name, object_size, constructor, destructor, KMEM_CACHE_TRACK);
+
+		// No other thread knows the cache before it is returned
+		if (ret != nullptr) {
+			ret->migrate_ = migrate;
+		}
+
+		return ret;
+	}
+
+	cache_header_s *Slab::open(
+		const char name[],
+		void(*constructor)(void *),
+		void(*destructor)(void *),
+		int(*migrate)(void *, void *)) noexcept
+	{
+		auto &header = AllocatorUtility::slabHeader();
+		auto ret = header.find(name);
+
+		// Functions are cleared when the pool is attached, the cache is opened before it is used again
+		if (ret != nullptr) {
+			ret->mutex_.lock();
+
+			ret->constructor_ = constructor;
+			ret->destructor_ = destructor;
+			// Moving the objects needs the bitmap of the tracked caches, as for the created movable ones
+			ret->migrate_ = (ret->flags_ & KMEM_CACHE_TRACK) ? migrate : nullptr;
+
+			ret->mutex_.unlock();
+		}
+
+		return ret;
 	}
 
 	int Slab::shrink(cache_header_s * cache) noexcept {
 		return cache->shrink();
 	}
 
+	int Slab::defragment(cache_header_s *cache) noexcept {
+		return cache->defragment();
+	}
+
+	void Slab::setEmptyLimits(cache_header_s *cache, size_t min_empty, size_t max_empty) noexcept {
+		cache->setEmptyLimits(min_empty, max_empty);
+	}
+
 	void *Slab::allocate(cache_header_s * cache) noexcept {
-		return cache->allocate();
+		void *ret = nullptr;
+
+		// A sample of the allocations is served from the guarded pool, if it has space
+		if (GuardedPool::sample()) {
+			ret = GuardedPool::allocate(cache->object_size_, cache);
+		}
+
+		if (ret == nullptr) {
+			ret = cache->allocate();
+		}
+
+		if (HeapProfiler::sample(cache->object_size_)) {
+			HeapProfiler::record(ret, cache->object_size_);
+		}
+
+		return ret;
+	}
+
+	void *Slab::allocateCharged(cache_header_s *cache, group_header_s *group) noexcept {
+		// Group at its limit fails before the cache is touched
+		if (!Group::charge(group, cache->object_size_)) {
+			return nullptr;
+		}
+
+		auto ret = allocate(cache);
+
+		if (ret == nullptr) {
+			Group::uncharge(group, cache->object_size_);
+		}
+
+		return ret;
+	}
+
+	void Slab::deallocateCharged(cache_header_s *cache, group_header_s *group, void *object) noexcept {
+		if (object != nullptr) {
+			Group::uncharge(group, cache->object_size_);
+		}
+
+		deallocate(cache, object);
+	}
+
+	void *Slab::allocateWait(cache_header_s *cache, long long timeout_milliseconds) noexcept {
+		auto attempt = [](void *context) {
+			return allocate(static_cast<cache_header_s *>(context));
+		};
+
+		// New slab needs a buddy block of the slab size, so the cache waits on that queue
+		return WaitQueue::wait(Buddy::sizeToPower(cache->number_of_blocks_in_slab_), attempt, cache, timeout_milliseconds);
 	}
 
 	void Slab::deallocate(cache_header_s * cache, void * object) noexcept {
+		HeapProfiler::remove(object);
+
+		if (GuardedPool::contains(object)) {
+			// Guarded object of another cache is not in this one, which sets the error bit
+			if (!GuardedPool::deallocate(object, cache)) {
+				cache->deallocate(nullptr);
+			}
+
+			return;
+		}
+
 		return cache->deallocate(object);
 	}
 
+	long long Slab::walk(cache_header_s *cache, void(*callback)(void *, void *), void *context) {
+		cache->mutex_.lock();
+
+		auto ret = cache->walk(callback, context);
+
+		cache->mutex_.unlock();
+
+		return ret;
+	}
+
 	void *Slab::bufferAllocate(size_t size) noexcept {
+		return bufferAllocate(size, 1);
+	}
+
+	void *Slab::bufferAllocate(size_t size, size_t alignment) noexcept {
+		void *ret = nullptr;
+
+		if (alignment <= GuardedPool::OBJECT_ALIGNMENT && GuardedPool::sample()) {
+			ret = GuardedPool::allocate(size, nullptr);
+		}
+
+		if (ret == nullptr) {
+			auto &header = AllocatorUtility::slabHeader();
+			auto power = bufferPower(size, alignment);
+
+			// Sizes without a buffer cache, including the ones with no power of two, fail without unwinding
+			if (power < slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+				ret = header.bufferAllocate(power);
+			}
+		}
+
+		if (HeapProfiler::sample(size)) {
+			HeapProfiler::record(ret, size);
+		}
+
+		return ret;
+	}
+
+	void *Slab::bufferAllocateWait(size_t size, long long timeout_milliseconds) noexcept {
+		auto power = bufferPower(size, 1);
+
+		// Sizes without a buffer cache would never be served, so they do not wait
+		if (power >= slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			return nullptr;
+		}
+
 		auto &header = AllocatorUtility::slabHeader();
-		if (size < slab_header_s::BUFFER_SIZES_LOWER_BOUND) {
-			size = slab_header_s::BUFFER_SIZES_LOWER_BOUND;
+		auto cache = header.buffers_[power - slab_header_s::BUFFER_SIZES_LOWER_BOUND];
+
+		auto attempt = [](void *context) {
+			return bufferAllocate(*static_cast<size_t *>(context));
+		};
+
+		return WaitQueue::wait(Buddy::sizeToPower(cache->number_of_blocks_in_slab_), attempt, &size, timeout_milliseconds);
+	}
+
+	void *Slab::bufferAllocateCharged(size_t size, group_header_s *group) noexcept {
+		auto power = bufferPower(size, 1);
+
+		if (power >= slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			return nullptr;
 		}
 
-		return header.buffers_[size - slab_header_s::BUFFER_SIZES_LOWER_BOUND]->allocate();
+		auto charged = Buddy::powerToSize(power);
+
+		if (!Group::charge(group, charged)) {
+			return nullptr;
+		}
+
+		auto ret = bufferAllocate(size);
+
+		if (ret == nullptr) {
+			Group::uncharge(group, charged);
+		}
+
+		return ret;
 	}
 
 	void Slab::bufferDeallocate(const void *buffer) noexcept {
-		auto slab = const_cast<slab_s *>(reinterpret_cast<const slab_s *>(AllocatorUtility::blockStart(buffer)));
-		auto cache = slab->header_;
-		cache->deallocate(const_cast<void *>(buffer));
+		HeapProfiler::remove(buffer);
+
+		if (GuardedPool::contains(buffer)) {
+			GuardedPool::deallocate(const_cast<void *>(buffer), nullptr);
+			return;
+		}
+
+		auto slab = const_cast<slab_s *>(static_cast<const slab_s *>(Buddy::owner(buffer)));
+
+		// Buffer is not a part of any slab
+		if (slab == nullptr) {
+			return;
+		}
+
+		auto &header = AllocatorUtility::slabHeader();
+		header.bufferDeallocate(slab->header_, const_cast<void *>(buffer));
+	}
+
+	void Slab::bufferDeallocate(const void *buffer, size_t size, size_t alignment) noexcept {
+		HeapProfiler::remove(buffer);
+
+		if (GuardedPool::contains(buffer)) {
+			GuardedPool::deallocate(const_cast<void *>(buffer), nullptr);
+			return;
+		}
+
+		auto power = bufferPower(size, alignment);
+
+		if (power >= slab_header_s::BUFFER_SIZES_UPPER_BOUND) {
+			return;
+		}
+
+		// Size picks the buffer cache, so the slab of the buffer is not looked up
+		auto &header = AllocatorUtility::slabHeader();
+		header.bufferDeallocate(header.buffers_[power - slab_header_s::BUFFER_SIZES_LOWER_BOUND], const_cast<void *>(buffer));
+	}
+
+	void Slab::bufferDeallocateCharged(const void *buffer, group_header_s *group) noexcept {
+		size_t charged = 0;
+
+		// Guarded buffer keeps only its requested size, the buffer cache of that size was charged
+		if (GuardedPool::contains(buffer)) {
+			charged = Buddy::powerToSize(bufferPower(GuardedPool::objectSize(buffer), 1));
+		}
+		else if (buffer != nullptr) {
+			auto slab = static_cast<const slab_s *>(Buddy::owner(buffer));
+			charged = slab != nullptr ? slab->header_->object_size_ : 0;
+		}
+
+		if (charged != 0) {
+			Group::uncharge(group, charged);
+		}
+
+		bufferDeallocate(buffer);
+	}
+
+	size_t Slab::bufferPower(size_t size, size_t alignment) noexcept {
+		if (alignment > CACHE_L1_LINE_SIZE) {
+			return NULL_INDEX;
+		}
+
+		auto power = Buddy::sizeToPower(Buddy::greaterOrEqualPowerOfTwo(size));
+
+		// Buffers of a cache line and more are aligned to the line, the smaller ones only to the index size
+		auto minimum = alignment > sizeof(size_t) ? Buddy::sizeToPower(CACHE_L1_LINE_SIZE) : slab_header_s::BUFFER_SIZES_LOWER_BOUND;
+
+		return power < minimum ? minimum : power;
 	}
 
 	void Slab::destroy(cache_header_s * cache) noexcept {
@@ -0,0 +1,91 @@
+/**
+* \file StackTrace.cpp
+* \brief Implementation of the functions for capturing and printing stack traces
+*/
+
+#include "StackTrace.h"
+#include <cstring> // strlen
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+#endif
+
+namespace os2bn140314d {
+
+	void StackTrace::capture(stack_trace_s &trace) noexcept {
+#ifdef _WIN32
+		// Skip this function
+		trace.size_ = CaptureStackBackTrace(1, static_cast<DWORD>(stack_trace_s::MAX_FRAMES), trace.frames_, nullptr);
+#elif defined(__GLIBC__)
+		auto size = backtrace(trace.frames_, static_cast<int>(stack_trace_s::MAX_FRAMES));
+		trace.size_ = size < 0 ? 0 : static_cast<size_t>(size);
+#else
+		trace.size_ = 0;
+#endif
+	}
+
+	void StackTrace::print(const stack_trace_s &trace) noexcept {
+		if (trace.size_ == 0) {
+			write("    <stack trace not available>\n");
+			return;
+		}
+
+#if !defined(_WIN32) && defined(__GLIBC__)
+		backtrace_symbols_fd(trace.frames_, static_cast<int>(trace.size_), STDERR_FILENO);
+#else
+		for (size_t i = 0; i < trace.size_; i++) {
+			write("    #");
+			writeNumber(i, false);
+			write(" ");
+			writeNumber(reinterpret_cast<size_t>(trace.frames_[i]), true);
+			write("\n");
+		}
+#endif
+	}
+
+	void StackTrace::write(const char *string) noexcept {
+		auto length = std::strlen(string);
+
+#ifdef _WIN32
+		DWORD written;
+		WriteFile(GetStdHandle(STD_ERROR_HANDLE), string, static_cast<DWORD>(length), &written, nullptr);
+#else
+		while (length > 0) {
+			auto written = ::write(STDERR_FILENO, string, length);
+			if (written <= 0) {
+				return;
+			}
+
+			string += written;
+			length -= static_cast<size_t>(written);
+		}
+#endif
+	}
+
+	void StackTrace::writeNumber(size_t number, bool hex) noexcept {
+		const char digits[] = "0123456789abcdef";
+		auto base = hex ? 16u : 10u;
+
+		// Digits are written from the end of the buffer
+		char buffer[3 + sizeof(size_t) * 3];
+		auto position = sizeof(buffer) - 1;
+		buffer[position] = '\0';
+
+		do {
+			buffer[--position] = digits[number % base];
+			number /= base;
+		} while (number != 0);
+
+		if (hex) {
+			buffer[--position] = 'x';
+			buffer[--position] = '0';
+		}
+
+		write(buffer + position);
+	}
+}
@@ -0,0 +1,307 @@
+/**
+* \file SystemMemory.cpp
+* \brief Implementation of the functions for obtaining memory from the operating system
+*/
+
+#include "SystemMemory.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace os2bn140314d {
+
+	void *SystemMemory::allocate(size_t size_in_blocks) noexcept {
+		auto size = size_in_blocks * BLOCK_SIZE;
+
+#ifdef _WIN32
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		auto ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return ret == MAP_FAILED ? nullptr : ret;
+#endif
+	}
+
+	void SystemMemory::deallocate(void *memory, size_t size_in_blocks) noexcept {
+		if (memory == nullptr) {
+			return;
+		}
+
+#ifdef _WIN32
+		VirtualFree(memory, 0, MEM_RELEASE);
+#else
+		munmap(memory, size_in_blocks * BLOCK_SIZE);
+#endif
+	}
+
+	void *SystemMemory::allocateHuge(size_t size_in_blocks, bool explicit_pages) noexcept {
+		auto size = size_in_blocks * BLOCK_SIZE;
+
+#ifdef _WIN32
+		if (explicit_pages) {
+			// Fails without the lock pages privilege, in which case normal pages are used
+			auto ret = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (ret != nullptr) {
+				return ret;
+			}
+		}
+
+		// Reservation can only be released from its base, so an aligned range is found by reserving more than needed,
+		// releasing it, and allocating again at the aligned address, which another thread may take in between
+		for (size_t attempt = 0; attempt < HUGE_ALLOCATION_ATTEMPTS; attempt++) {
+			auto reserved = VirtualAlloc(nullptr, size + HUGE_PAGE_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+			if (reserved == nullptr) {
+				return nullptr;
+			}
+
+			auto address = reinterpret_cast<size_t>(reserved);
+			auto aligned = reinterpret_cast<void *>((address + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+
+			VirtualFree(reserved, 0, MEM_RELEASE);
+
+			auto ret = VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (ret != nullptr) {
+				return ret;
+			}
+		}
+
+		return nullptr;
+#else
+#ifdef MAP_HUGETLB
+		if (explicit_pages) {
+			// Fails when no huge pages are reserved in the system, in which case normal pages are used
+			auto ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (ret != MAP_FAILED) {
+				return ret;
+			}
+		}
+#endif
+
+		// Map more than needed, then unmap the parts before and after the aligned memory
+		auto mapped = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED) {
+			return nullptr;
+		}
+
+		auto start = static_cast<byte *>(mapped);
+		auto address = reinterpret_cast<size_t>(start);
+		auto aligned = reinterpret_cast<byte *>((address + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+
+		if (aligned != start) {
+			munmap(start, aligned - start);
+		}
+
+		auto tail = (start + size + HUGE_PAGE_SIZE) - (aligned + size);
+		if (tail != 0) {
+			munmap(aligned + size, tail);
+		}
+
+		adviseHuge(aligned, size);
+
+		return aligned;
+#endif
+	}
+
+	void SystemMemory::adviseHuge(void *memory, size_t size) noexcept {
+#if !defined(_WIN32) && defined(MADV_HUGEPAGE)
+		madvise(memory, size, MADV_HUGEPAGE);
+#else
+		// Windows only provides huge pages through explicit large page allocations
+		(void)memory;
+		(void)size;
+#endif
+	}
+
+	bool SystemMemory::purge(void *memory, size_t size, bool lazy) noexcept {
+		if (size == 0) {
+			return false;
+		}
+
+#ifdef _WIN32
+		// Windows has no way of dropping the pages of an arbitrary range while keeping it committed
+		// Resetting lets the system reclaim them, but the contents are undefined
+		(void)lazy;
+		VirtualAlloc(memory, size, MEM_RESET, PAGE_READWRITE);
+		return false;
+#else
+#ifdef MADV_FREE
+		if (lazy) {
+			madvise(memory, size, MADV_FREE);
+			return false;
+		}
+#endif
+		return madvise(memory, size, MADV_DONTNEED) == 0;
+#endif
+	}
+
+	bool SystemMemory::protect(void *memory, size_t size, bool accessible) noexcept {
+#ifdef _WIN32
+		DWORD old_protection;
+		return VirtualProtect(memory, size, accessible ? PAGE_READWRITE : PAGE_NOACCESS, &old_protection) != 0;
+#else
+		return mprotect(memory, size, accessible ? PROT_READ | PROT_WRITE : PROT_NONE) == 0;
+#endif
+	}
+
+	void *SystemMemory::reserve(void *address, size_t size_in_blocks, bool replace) noexcept {
+		auto size = size_in_blocks * BLOCK_SIZE;
+
+#ifdef _WIN32
+		if (replace) {
+			UnmapViewOfFile(address);
+		}
+
+		return VirtualAlloc(address, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+		auto flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+		// Mapping of this process is replaced in place, so no other mapping can take the range in between
+		if (replace) {
+			flags |= MAP_FIXED;
+		}
+#ifdef MAP_FIXED_NOREPLACE
+		else {
+			flags |= MAP_FIXED_NOREPLACE;
+		}
+#endif
+
+		auto ret = mmap(address, size, PROT_NONE, flags, -1, 0);
+
+		if (ret == MAP_FAILED) {
+			return nullptr;
+		}
+
+		// Without the flag the address is only a hint, which the system does not take if the range is in use
+		if (ret != address) {
+			munmap(ret, size);
+			return nullptr;
+		}
+
+		return ret;
+#endif
+	}
+
+	void *SystemMemory::mapFile(const char *path, size_t size_in_blocks, void *reserved, size_t reserved_blocks, size_t &mapped_blocks) noexcept {
+		mapped_blocks = 0;
+
+#ifdef _WIN32
+		auto file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, size_in_blocks != 0 ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return nullptr;
+		}
+
+		LARGE_INTEGER size;
+		size.QuadPart = static_cast<LONGLONG>(size_in_blocks * BLOCK_SIZE);
+
+		if (size_in_blocks == 0 && !GetFileSizeEx(file, &size)) {
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		if (reserved != nullptr && static_cast<size_t>(size.QuadPart) > reserved_blocks * BLOCK_SIZE) {
+			CloseHandle(file);
+			return nullptr;
+		}
+
+		// Mapping keeps the file open, so both handles are closed right away
+		auto mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+		CloseHandle(file);
+
+		if (mapping == nullptr) {
+			return nullptr;
+		}
+
+		// View can not be placed into a reservation, so the range is released right before it is mapped
+		if (reserved != nullptr) {
+			VirtualFree(reserved, 0, MEM_RELEASE);
+		}
+
+		auto ret = MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0, reserved);
+		CloseHandle(mapping);
+
+		if (ret == nullptr && reserved != nullptr) {
+			VirtualAlloc(reserved, reserved_blocks * BLOCK_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+		}
+
+		if (ret != nullptr) {
+			mapped_blocks = static_cast<size_t>(size.QuadPart) / BLOCK_SIZE;
+		}
+
+		return ret;
+#else
+		auto fd = size_in_blocks != 0 ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0600) : open(path, O_RDWR);
+		if (fd < 0) {
+			return nullptr;
+		}
+
+		auto size = static_cast<off_t>(size_in_blocks * BLOCK_SIZE);
+		struct stat info;
+
+		if (size_in_blocks != 0 ? ftruncate(fd, size) != 0 : fstat(fd, &info) != 0) {
+			close(fd);
+			return nullptr;
+		}
+
+		if (size_in_blocks == 0) {
+			size = info.st_size;
+		}
+
+		// File must not reach past the reservation, the fixed mapping would replace whatever lies there
+		if (size < static_cast<off_t>(BLOCK_SIZE) || (reserved != nullptr && static_cast<size_t>(size) > reserved_blocks * BLOCK_SIZE)) {
+			close(fd);
+			return nullptr;
+		}
+
+		// Range is reserved by this process, so the fixed mapping replaces only the reservation
+		auto flags = reserved != nullptr ? MAP_SHARED | MAP_FIXED : MAP_SHARED;
+
+		// Mapping keeps the file open
+		auto ret = mmap(reserved, static_cast<size_t>(size), PROT_READ | PROT_WRITE, flags, fd, 0);
+		close(fd);
+
+		if (ret == MAP_FAILED) {
+			return nullptr;
+		}
+
+		mapped_blocks = static_cast<size_t>(size) / BLOCK_SIZE;
+
+		return ret;
+#endif
+	}
+
+	bool SystemMemory::flushFile(void *memory, size_t size) noexcept {
+#ifdef _WIN32
+		return FlushViewOfFile(memory, size) != 0;
+#else
+		return msync(memory, size, MS_SYNC) == 0;
+#endif
+	}
+
+	void SystemMemory::unmapFile(void *memory, size_t size_in_blocks) noexcept {
+		if (memory == nullptr) {
+			return;
+		}
+
+#ifdef _WIN32
+		(void)size_in_blocks;
+		UnmapViewOfFile(memory);
+#else
+		munmap(memory, size_in_blocks * BLOCK_SIZE);
+#endif
+	}
+
+	size_t SystemMemory::pageSize() noexcept {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+}
@@ -0,0 +1,87 @@
+/**
+* \file WaitQueue.cpp
+* \brief Implementation of the queues of the allocations waiting for memory
+*/
+
+#include "WaitQueue.h"
+#include <chrono> // steady_clock
+
+namespace os2bn140314d {
+
+	#pragma region WaitQueue implementation
+
+	std::atomic<uint64_t> WaitQueue::waiting_(0);
+
+	wait_queue_s WaitQueue::queues_[POWERS_OF_TWO];
+
+	void *WaitQueue::wait(size_t power, void *(*attempt)(void *), void *context, long long timeout_milliseconds) noexcept {
+		auto ret = attempt(context);
+
+		if (ret != nullptr || timeout_milliseconds == 0 || power >= POWERS_OF_TWO) {
+			return ret;
+		}
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_milliseconds);
+		auto bit = static_cast<uint64_t>(1) << power;
+		auto &queue = queues_[power];
+
+		std::unique_lock<std::mutex> lock(queue.mutex_);
+
+		// Deallocations check the mask before waking, so it is set before the next attempt
+		if (queue.waiters_++ == 0) {
+			waiting_.fetch_or(bit, std::memory_order_relaxed);
+		}
+
+		while (true) {
+			auto ticket = queue.wakeups_;
+
+			lock.unlock();
+			ret = attempt(context);
+			lock.lock();
+
+			if (ret != nullptr) {
+				break;
+			}
+
+			// Sleep until a deallocation after the attempt, it may have been before the lock was taken again
+			auto expired = false;
+
+			while (queue.wakeups_ == ticket && !expired) {
+				if (timeout_milliseconds < 0) {
+					queue.condition_.wait(lock);
+				}
+				else {
+					expired = queue.condition_.wait_until(lock, deadline) == std::cv_status::timeout && queue.wakeups_ == ticket;
+				}
+			}
+
+			if (expired) {
+				break;
+			}
+		}
+
+		if (--queue.waiters_ == 0) {
+			waiting_.fetch_and(~bit, std::memory_order_relaxed);
+		}
+
+		return ret;
+	}
+
+	void WaitQueue::wakeQueues(uint64_t waiting) noexcept {
+		for (size_t power = 0; power < POWERS_OF_TWO && waiting != 0; power++, waiting >>= 1) {
+			if ((waiting & 1) == 0) {
+				continue;
+			}
+
+			auto &queue = queues_[power];
+
+			queue.mutex_.lock();
+			queue.wakeups_++;
+			queue.mutex_.unlock();
+
+			queue.condition_.notify_all();
+		}
+	}
+
+	#pragma endregion
+}
@@ -0,0 +1,164 @@
+#include "Slab.h"
+#include "Buddy.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 4096;
+const int RESERVE_ORDER = 9;
+const int BIG_ORDER = 7;
+const int NUM_OF_OBJECTS = 25000;
+const int KEPT_INTERVAL = 3;
+
+struct item_s {
+	size_t id_;
+	size_t check_;
+	char payload_[48];
+};
+
+item_s *items[NUM_OF_OBJECTS];
+size_t moved = 0;
+
+size_t checkOf(size_t id) {
+	return id * 2654435761u;
+}
+
+int migrate(void *from, void *to) {
+	auto item = static_cast<item_s *>(from);
+
+	std::memcpy(to, from, sizeof(item_s));
+	items[item->id_] = static_cast<item_s *>(to);
+	moved++;
+
+	return 1;
+}
+
+bool inRange(const void *pointer, const void *begin, size_t blocks) {
+	return pointer >= begin && pointer < static_cast<const Block *>(begin) + blocks;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	std::cout << "Reserve made: " << kmem_reserve_contiguous(RESERVE_ORDER, BIG_ORDER) << std::endl;
+	std::cout << "Second reserve refused: " << (kmem_reserve_contiguous(RESERVE_ORDER, BIG_ORDER) == 0) << std::endl;
+
+	// Unmovable blocks fill the normal pool, and every other one is freed, so no big block is left there
+	std::vector<void *> unmovable;
+	void *block;
+
+	while ((block = Buddy::allocate(1)) != nullptr) {
+		unmovable.push_back(block);
+	}
+
+	std::sort(unmovable.begin(), unmovable.end());
+
+	for (size_t i = 0; i < unmovable.size(); i += 2) {
+		Buddy::deallocate(unmovable[i], 1);
+		unmovable[i] = nullptr;
+	}
+
+	// Movable objects borrow the reserve, and most of them are freed again, leaving the slabs scattered
+	auto cache = kmem_cache_create_movable("Movable cache", sizeof(item_s), nullptr, nullptr, migrate);
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		items[i] = static_cast<item_s *>(kmem_cache_alloc(cache));
+		items[i]->id_ = i;
+		items[i]->check_ = checkOf(i);
+	}
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		if (i % KEPT_INTERVAL != 0) {
+			kmem_cache_free(cache, items[i]);
+			items[i] = nullptr;
+		}
+	}
+
+	// Every part of the reserve is taken back by the big allocations
+	std::vector<void *> big;
+
+	auto start = std::chrono::steady_clock::now();
+
+	while ((block = Buddy::allocate(1 << BIG_ORDER)) != nullptr) {
+		big.push_back(block);
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cerr << "Took the reserve back in " << elapsed.count() << " ms, moving " << moved << " objects" << std::endl;
+
+	std::cout << "Big allocations: " << big.size() << std::endl;
+	std::cout << "Objects moved: " << (moved > 0) << std::endl;
+
+	std::sort(big.begin(), big.end());
+
+	auto contiguous = big.size() == static_cast<size_t>(1) << (RESERVE_ORDER - BIG_ORDER);
+	for (size_t i = 1; i < big.size(); i++) {
+		contiguous = contiguous && static_cast<Block *>(big[i]) == static_cast<Block *>(big[i - 1]) + (1 << BIG_ORDER);
+	}
+
+	std::cout << "Reserve contiguous: " << contiguous << std::endl;
+
+	auto reserve = big.empty() ? nullptr : big.front();
+
+	auto outside = true;
+	for (auto pointer : unmovable) {
+		outside = outside && !inRange(pointer, reserve, 1 << RESERVE_ORDER);
+	}
+
+	std::cout << "Unmovable blocks outside the reserve: " << outside << std::endl;
+
+	auto intact = true;
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		if (items[i] != nullptr) {
+			intact = intact && items[i]->id_ == static_cast<size_t>(i) && items[i]->check_ == checkOf(i);
+			intact = intact && !inRange(items[i], reserve, 1 << RESERVE_ORDER);
+		}
+	}
+
+	std::cout << "Objects intact and out of the reserve: " << intact << std::endl;
+
+	// Once freed, the reserve is lent to the movable objects again
+	for (auto pointer : big) {
+		Buddy::deallocate(pointer, 1 << BIG_ORDER);
+	}
+
+	// Slabs with free objects are used first, the new ones borrow the reserve
+	std::vector<void *> objects;
+	auto lent = false;
+
+	while (!lent && objects.size() < static_cast<size_t>(NUM_OF_OBJECTS)) {
+		objects.push_back(kmem_cache_alloc(cache));
+		lent = inRange(objects.back(), reserve, 1 << RESERVE_ORDER);
+	}
+
+	std::cout << "Reserve lent again: " << lent << std::endl;
+
+	for (auto object : objects) {
+		kmem_cache_free(cache, object);
+	}
+
+	for (auto item : items) {
+		if (item != nullptr) {
+			kmem_cache_free(cache, item);
+		}
+	}
+
+	kmem_cache_destroy(cache);
+
+	for (auto pointer : unmovable) {
+		if (pointer != nullptr) {
+			Buddy::deallocate(pointer, 1);
+		}
+	}
+
+	std::cout << "OK" << std::endl;
+
+	free(memory);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "Slab.h"
+#include "Buddy.h"
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 2048;
+const int NUM_OF_THREADS = 4;
+const int ITERATIONS = 200000;
+const size_t ROUND = 16;
+
+/**
+ * Allocates and frees a few blocks of each small order, checking that the blocks do not overlap
+ */
+bool churn(int id) {
+	void *blocks[ROUND];
+
+	for (auto i = 0; i < ITERATIONS / static_cast<int>(ROUND); i++) {
+		for (size_t j = 0; j < ROUND; j++) {
+			auto size = Buddy::powerToSize(j % 4);
+			blocks[j] = Buddy::allocate(size);
+
+			if (blocks[j] == nullptr) {
+				return false;
+			}
+
+			std::memset(blocks[j], id * 16 + static_cast<int>(j), size * BLOCK_SIZE);
+		}
+
+		for (size_t j = 0; j < ROUND; j++) {
+			auto size = Buddy::powerToSize(j % 4);
+			auto bytes = static_cast<unsigned char *>(blocks[j]);
+			auto value = static_cast<unsigned char>(id * 16 + static_cast<int>(j));
+
+			if (bytes[0] != value || bytes[size * BLOCK_SIZE - 1] != value) {
+				return false;
+			}
+
+			Buddy::deallocate(blocks[j], size);
+		}
+	}
+
+	return true;
+}
+
+double measure() {
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto i = 0; i < ITERATIONS; i++) {
+		auto block = Buddy::allocate(1);
+		Buddy::deallocate(block, 1);
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ITERATIONS;
+}
+
+size_t allocateAll(std::vector<void *> &blocks) {
+	void *block;
+
+	while ((block = Buddy::allocate(1)) != nullptr) {
+		blocks.push_back(block);
+	}
+
+	return blocks.size();
+}
+
+void deallocateAll(std::vector<void *> &blocks) {
+	for (auto block : blocks) {
+		Buddy::deallocate(block, 1);
+	}
+
+	blocks.clear();
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	std::cout << "Batch over high refused: " << (kmem_set_cpu_pages(8, 16) == 0) << std::endl;
+	std::cout << "Empty batch refused: " << (kmem_set_cpu_pages(8, 0) == 0) << std::endl;
+
+	// Blocks kept by the processors are returned to the free lists when they run out
+	std::vector<void *> blocks;
+	auto cached_total = allocateAll(blocks);
+	deallocateAll(blocks);
+
+	kmem_set_cpu_pages(0, 0);
+	auto shared_total = allocateAll(blocks);
+	deallocateAll(blocks);
+
+	std::cout << "All memory available: " << (cached_total + 2 >= shared_total) << std::endl;
+
+	// Freed blocks over the high watermark go back to the shared free lists and merge
+	kmem_set_cpu_pages(8, 4);
+
+	for (auto i = 0; i < 64; i++) {
+		blocks.push_back(Buddy::allocate(1));
+	}
+
+	deallocateAll(blocks);
+	std::cout << "Watermark keeps few blocks: " << (kmem_purge() <= 8) << std::endl;
+
+	// Each processor keeps its own lists
+	kmem_set_cpu_pages(64, 16);
+
+	std::vector<std::thread> threads;
+	bool results[NUM_OF_THREADS];
+
+	for (auto i = 0; i < NUM_OF_THREADS; i++) {
+		threads.emplace_back([&results, i]() {
+			results[i] = churn(i + 1);
+		});
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto valid = true;
+	for (auto result : results) {
+		valid = valid && result;
+	}
+
+	std::cout << "Blocks intact: " << valid << std::endl;
+
+	std::cerr << "Cached: " << measure() << " ns per block" << std::endl;
+	kmem_set_cpu_pages(0, 0);
+	std::cerr << "Shared: " << measure() << " ns per block" << std::endl;
+
+	// Without the lists the freed blocks merge back into big ones
+	auto big = Buddy::allocate(NUM_OF_BLOCKS / 8);
+	std::cout << "Memory merged: " << (big != nullptr) << std::endl;
+	Buddy::deallocate(big, NUM_OF_BLOCKS / 8);
+
+	std::cout << "OK" << std::endl;
+
+	free(memory);
+
+	return 0;
+}
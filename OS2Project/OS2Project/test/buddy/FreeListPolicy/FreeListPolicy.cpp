@@ -0,0 +1,227 @@
+#include "Slab.h"
+#include "Buddy.h"
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 2048;
+const int STEPS = 100000;
+const size_t LONG_LIVED = 400;
+const size_t MAX_SHORT_LIFETIME = 64;
+const int SAMPLE_INTERVAL = 100;
+const int MEASURED_ORDER = 4;
+
+/**
+ * One step of the trace, the allocation of the object with the id, or its deallocation
+ */
+struct event_s {
+	bool allocate_;
+	size_t id_;
+	size_t size_;
+	bool long_lived_;
+};
+
+unsigned long long state = 42;
+
+size_t random(size_t bound) {
+	state = state * 6364136223846793005ull + 1442695040888963407ull;
+	return static_cast<size_t>(state >> 33) % bound;
+}
+
+/**
+ * Long lived small objects, replaced now and then, among the short lived bigger ones
+ */
+std::vector<event_s> makeTrace(size_t &objects) {
+	std::vector<event_s> trace;
+	std::vector<size_t> long_lived;
+	std::vector<std::vector<event_s>> expiring(MAX_SHORT_LIFETIME + 1);
+
+	objects = 0;
+
+	for (auto step = 0; step < STEPS; step++) {
+		for (auto &event : expiring[step % expiring.size()]) {
+			trace.push_back(event);
+		}
+
+		expiring[step % expiring.size()].clear();
+
+		if (random(10) == 0) {
+			if (long_lived.size() == LONG_LIVED) {
+				auto index = random(long_lived.size());
+				std::swap(long_lived[index], long_lived.back());
+
+				trace.push_back({ false, long_lived.back(), 0, true });
+				long_lived.pop_back();
+			}
+
+			trace.push_back({ true, objects, 1 + random(2), true });
+			long_lived.push_back(objects++);
+		}
+		else {
+			auto size = static_cast<size_t>(1) << random(4);
+			auto lifetime = 1 + random(MAX_SHORT_LIFETIME);
+
+			trace.push_back({ true, objects, size, false });
+			expiring[(step + lifetime) % expiring.size()].push_back({ false, objects++, 0, false });
+		}
+	}
+
+	for (auto &events : expiring) {
+		for (auto &event : events) {
+			trace.push_back(event);
+		}
+	}
+
+	for (auto id : long_lived) {
+		trace.push_back({ false, id, 0, true });
+	}
+
+	return trace;
+}
+
+/**
+ * Replay the trace, checking that the live blocks keep their contents
+ */
+double replay(const std::vector<event_s> &trace, size_t objects, bool &intact, size_t &failed) {
+	std::vector<size_t *> memory(objects, nullptr);
+	std::vector<size_t> sizes(objects, 0);
+
+	double sum = 0;
+	auto samples = 0;
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		auto &event = trace[i];
+
+		if (event.allocate_) {
+			// Long lived blocks are allocated as the slabs are, which the hybrid policy places apart
+			bool zeroed;
+			memory[event.id_] = static_cast<size_t *>(Buddy::allocate(event.size_, zeroed, NORMAL_POOL, event.long_lived_));
+			sizes[event.id_] = event.size_;
+
+			if (memory[event.id_] == nullptr) {
+				failed++;
+				continue;
+			}
+
+			for (size_t j = 0; j < event.size_; j++) {
+				memory[event.id_][j * BLOCK_SIZE / sizeof(size_t)] = event.id_;
+			}
+		}
+		else if (memory[event.id_] != nullptr) {
+			for (size_t j = 0; j < sizes[event.id_]; j++) {
+				intact = intact && memory[event.id_][j * BLOCK_SIZE / sizeof(size_t)] == event.id_;
+			}
+
+			Buddy::deallocate(memory[event.id_], sizes[event.id_]);
+			memory[event.id_] = nullptr;
+		}
+
+		if (i % SAMPLE_INTERVAL == 0) {
+			sum += kmem_fragmentation(MEASURED_ORDER);
+			samples++;
+		}
+	}
+
+	return sum / samples;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	std::cout << "Invalid policy refused: " << (kmem_set_freelist_policy(0, 3) == 0 ? "yes" : "no") << std::endl;
+
+	// Every other block is freed, in random order, so none of them merge
+	// They are allocated again from the lowest address
+	kmem_set_freelist_policy(-1, KMEM_FREELIST_ADDRESS);
+
+	std::vector<void *> blocks;
+	for (auto i = 0; i < 256; i++) {
+		blocks.push_back(Buddy::allocate(1));
+	}
+
+	std::sort(blocks.begin(), blocks.end());
+
+	std::vector<size_t> freed;
+	for (size_t i = 1; i < blocks.size(); i += 2) {
+		freed.push_back(i);
+	}
+
+	for (size_t i = 0; i < freed.size(); i++) {
+		std::swap(freed[i], freed[i + random(freed.size() - i)]);
+	}
+
+	for (auto index : freed) {
+		Buddy::deallocate(blocks[index], 1);
+	}
+
+	auto ordered = true;
+
+	for (size_t i = 1; i < blocks.size(); i += 2) {
+		auto block = Buddy::allocate(1);
+		ordered = ordered && block == blocks[i];
+	}
+
+	for (auto block : blocks) {
+		Buddy::deallocate(block, 1);
+	}
+
+	std::cout << "Address order: " << (ordered ? "yes" : "no") << std::endl;
+
+	// Hybrid policy gives the block freed last to the short lived allocations, and the lowest one to the long lived ones
+	kmem_set_freelist_policy(0, KMEM_FREELIST_HYBRID);
+
+	for (auto &block : blocks) {
+		block = Buddy::allocate(1);
+	}
+
+	std::sort(blocks.begin(), blocks.end());
+
+	for (auto index : freed) {
+		Buddy::deallocate(blocks[index], 1);
+	}
+
+	bool zeroed;
+	auto recent = Buddy::allocate(1, zeroed, NORMAL_POOL, false);
+	auto lowest = Buddy::allocate(1, zeroed, NORMAL_POOL, true);
+
+	auto lowest_index = freed.back() == 1 ? 3 : 1;
+	std::cout << "Hybrid order: " << (recent == blocks[freed.back()] && lowest == blocks[lowest_index] ? "yes" : "no") << std::endl;
+
+	Buddy::deallocate(recent, 1);
+	Buddy::deallocate(lowest, 1);
+
+	for (size_t i = 0; i < blocks.size(); i += 2) {
+		Buddy::deallocate(blocks[i], 1);
+	}
+
+	size_t objects;
+	auto trace = makeTrace(objects);
+
+	const int policies[] = { KMEM_FREELIST_LIFO, KMEM_FREELIST_ADDRESS, KMEM_FREELIST_HYBRID };
+	const char *names[] = { "LIFO", "Address ordered", "Hybrid" };
+
+	auto intact = true;
+	auto initial = kmem_fragmentation(MEASURED_ORDER);
+
+	for (auto i = 0; i < 3; i++) {
+		kmem_set_freelist_policy(-1, policies[i]);
+
+		size_t failed = 0;
+		auto result = replay(trace, objects, intact, failed);
+
+		// Which policy wins depends on the trace, so the results are only reported
+		std::cerr << names[i] << ": average unusable free space index for order " << MEASURED_ORDER
+			<< " is " << result << ", " << failed << " failed allocations" << std::endl;
+	}
+
+	std::cout << "Blocks intact: " << (intact ? "yes" : "no") << std::endl;
+	std::cout << "Memory coalesced after each replay: " << (kmem_fragmentation(MEASURED_ORDER) == initial ? "yes" : "no") << std::endl;
+
+	free(memory);
+
+	std::cout << "OK" << std::endl;
+}
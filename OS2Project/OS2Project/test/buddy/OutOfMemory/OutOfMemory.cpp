@@ -0,0 +1,57 @@
+#include "Slab.h"
+#include "AllocatorUtility.h"
+#include "Buddy.h"
+#include "TestHelpers.h"
+#include <chrono>
+#include <vector>
+
+using namespace os2bn140314d;
+using namespace os2bn140314d::test;
+
+const int NUM_OF_BLOCKS = 256;
+const int FAILED_ALLOCATIONS = 1000000;
+const size_t OBJECT_SIZE = 256;
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto cache = kmem_cache_create("Storm", OBJECT_SIZE, nullptr, nullptr);
+
+	// Fill the whole memory with the objects of the cache
+	std::vector<void *> objects;
+	void *object;
+	while ((object = kmem_cache_alloc(cache)) != nullptr) {
+		objects.push_back(object);
+	}
+
+	std::cout << "Cache out of space: " << (kmem_cache_error(cache) != 0 ? "yes" : "no") << std::endl;
+
+	// Failed allocations return without unwinding
+	auto start = std::chrono::steady_clock::now();
+
+	size_t failed = 0;
+	for (auto i = 0; i < FAILED_ALLOCATIONS; i++) {
+		failed += Buddy::allocate(1) == nullptr ? 1 : 0;
+		failed += kmem_cache_alloc(cache) == nullptr ? 1 : 0;
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "Failed allocation: " << elapsed / (2 * FAILED_ALLOCATIONS) << " ns" << std::endl;
+
+	std::cout << "All allocations failed: " << (failed == 2 * FAILED_ALLOCATIONS ? "yes" : "no") << std::endl;
+
+	// Sizes that can not be served are refused instead of thrown
+	std::cout << "Zero blocks: " << (Buddy::allocate(0) == nullptr ? "refused" : "allocated") << std::endl;
+	std::cout << "Huge buffer: " << (kmalloc(~static_cast<size_t>(0) / 2) == nullptr ? "refused" : "allocated") << std::endl;
+	std::cout << "Huge cache: " << (kmem_cache_create("Huge", ~static_cast<size_t>(0) / 2, nullptr, nullptr) == nullptr ? "refused" : "created") << std::endl;
+	std::cout << "Foreign block: " << (Buddy::deallocate(&failed, 1) ? "deallocated" : "refused") << std::endl;
+
+	for (auto pointer : objects) {
+		kmem_cache_free(cache, pointer);
+	}
+
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,99 @@
+#include "Slab.h"
+#include "AllocatorUtility.h"
+#include "Buddy.h"
+#include "TestHelpers.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace os2bn140314d;
+using namespace os2bn140314d::test;
+
+const int NUM_OF_BLOCKS = 1024;
+const int HUGE_REGION_BLOCKS = 512;
+const size_t ALLOCATION_SIZE = 256;
+const int PURGE_ORDER = 4;
+const int SHORT_DECAY = 50;
+
+bool allZeros(const byte *pointer) {
+	for (size_t i = 0; i < ALLOCATION_SIZE * BLOCK_SIZE; i++) {
+		if (pointer[i] != 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Fills the block and frees it, so it waits in the purge list
+void dirty(BuddyPool pool) {
+	bool zeroed;
+	auto pointer = static_cast<byte *>(Buddy::allocate(ALLOCATION_SIZE, zeroed, pool));
+	std::memset(pointer, 0xA5, ALLOCATION_SIZE * BLOCK_SIZE);
+	Buddy::deallocate(pointer, ALLOCATION_SIZE);
+}
+
+int main() {
+	try {
+		// Region given by the user may be shared or backed by a file, the mapped huge region is private anonymous memory
+		auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+		kmem_init(memory, NUM_OF_BLOCKS);
+		kmem_add_huge_region(nullptr, HUGE_REGION_BLOCKS);
+
+		kmem_set_purge_policy(PURGE_ORDER, 1000 * 1000, 0);
+
+		dirty(HUGE_POOL);
+
+		// Decay interval has not passed, so nothing should be purged yet
+		bool zeroed;
+		auto pointer = static_cast<byte *>(Buddy::allocate(ALLOCATION_SIZE, zeroed, HUGE_POOL));
+		std::cout << "Zeroed before purge: " << zeroed << std::endl;
+		Buddy::deallocate(pointer, ALLOCATION_SIZE);
+
+		auto purged = kmem_purge();
+		std::cout << "Purged blocks: " << purged << std::endl;
+
+		pointer = static_cast<byte *>(Buddy::allocate(ALLOCATION_SIZE, zeroed, HUGE_POOL));
+		std::cout << "Zeroed after purge: " << zeroed << std::endl;
+
+		auto mapped_ok = purged > 0 && zeroed && allZeros(pointer);
+		Buddy::deallocate(pointer, ALLOCATION_SIZE);
+
+		// Purged memory of the user is returned, but not reported as zeroed
+		dirty(NORMAL_POOL);
+		purged = kmem_purge();
+
+		pointer = static_cast<byte *>(Buddy::allocate(ALLOCATION_SIZE, zeroed, NORMAL_POOL));
+		std::cout << "User memory zeroed after purge: " << zeroed << std::endl;
+
+		auto user_ok = purged > 0 && !zeroed;
+		Buddy::deallocate(pointer, ALLOCATION_SIZE);
+
+		// Block past its decay interval is purged by the next allocation, without kmem_purge
+		kmem_set_purge_policy(PURGE_ORDER, SHORT_DECAY, 0);
+
+		dirty(HUGE_POOL);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2 * SHORT_DECAY));
+
+		auto cache = kmem_cache_create("Purge cache", 64, nullptr, nullptr);
+		auto object = kmem_cache_alloc(cache);
+
+		pointer = static_cast<byte *>(Buddy::allocate(ALLOCATION_SIZE, zeroed, HUGE_POOL));
+		std::cout << "Zeroed after decay: " << zeroed << std::endl;
+
+		auto decay_ok = zeroed && allZeros(pointer);
+		Buddy::deallocate(pointer, ALLOCATION_SIZE);
+
+		kmem_cache_free(cache, object);
+		kmem_cache_destroy(cache);
+
+		std::cout << (mapped_ok && user_ok && decay_ok ? "OK" : "Purge failed") << std::endl;
+
+		free(memory);
+
+		return 0;
+	}
+	catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+	}
+}
@@ -0,0 +1,65 @@
+#include "Slab.h"
+#include "AllocatorUtility.h"
+#include "Buddy.h"
+#include "TestHelpers.h"
+#include <vector>
+
+using namespace os2bn140314d;
+using namespace os2bn140314d::test;
+
+const int FIRST_REGION_BLOCKS = 64;
+const int SECOND_REGION_BLOCKS = 64;
+const size_t AUTO_GROW_BLOCKS = 256;
+
+int main() {
+	try {
+		auto memory = malloc(BLOCK_SIZE * FIRST_REGION_BLOCKS);
+		kmem_init(memory, FIRST_REGION_BLOCKS);
+
+		std::vector<void *> pointers;
+
+		// Exhaust the first region
+		void *pointer;
+		while ((pointer = Buddy::allocate(1)) != nullptr) {
+			pointers.push_back(pointer);
+		}
+
+		std::cout << "First region exhausted after " << std::dec << pointers.size() << " blocks" << std::endl;
+
+		auto second = malloc(BLOCK_SIZE * SECOND_REGION_BLOCKS);
+		kmem_add_region(second, SECOND_REGION_BLOCKS);
+
+		auto allocated = Buddy::allocate(8);
+		writePointer(allocated);
+
+		// Objects from slabs in both regions must find their slab
+		auto cache = kmem_cache_create("Cache", 100, nullptr, nullptr);
+		auto object = kmem_cache_alloc(cache);
+		kmem_cache_free(cache, object);
+
+		auto buffer = kmalloc(1000);
+		kfree(buffer);
+
+		kmem_set_auto_grow(AUTO_GROW_BLOCKS);
+
+		// Larger than any region, must be served from a newly mapped region
+		auto big = Buddy::allocate(AUTO_GROW_BLOCKS);
+		writePointer(big);
+
+		Buddy::deallocate(big, AUTO_GROW_BLOCKS);
+		Buddy::deallocate(allocated, 8);
+
+		for (auto pointer : pointers) {
+			Buddy::deallocate(pointer, 1);
+		}
+
+		kmem_cache_destroy(cache);
+
+		std::cout << "OK" << std::endl;
+
+		return 0;
+	}
+	catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+	}
+}
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Run with LD_PRELOAD set to the shim library, see preload/MallocShim.cpp
+
+// Allocation of the C library itself, which the shim does not replace
+extern "C" void *__libc_malloc(size_t size);
+
+const int NUM_OF_THREADS = 4;
+const int ITERATIONS = 200000;
+const int LIVE_OBJECTS = 256;
+const size_t ALIGNMENTS[] = { 16, 64, 4096, 2 * 1024 * 1024 };
+
+bool aligned(const void *memory, size_t alignment) {
+	return reinterpret_cast<size_t>(memory) % alignment == 0;
+}
+
+bool filled(const void *memory, size_t size, unsigned char value) {
+	auto bytes = static_cast<const unsigned char *>(memory);
+
+	for (size_t i = 0; i < size; i++) {
+		if (bytes[i] != value) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void churn(unsigned seed, std::vector<void *> &handoff, bool &error) {
+	std::vector<void *> live(LIVE_OBJECTS, nullptr);
+
+	for (auto i = 0; i < ITERATIONS; i++) {
+		seed = seed * 1103515245 + 12345;
+		auto index = (seed >> 8) % LIVE_OBJECTS;
+		auto size = static_cast<size_t>((seed >> 16) % 2048 + 1);
+
+		free(live[index]);
+		live[index] = malloc(size);
+
+		if (live[index] == nullptr || !aligned(live[index], alignof(std::max_align_t))) {
+			error = true;
+		}
+	}
+
+	// Half of the objects are freed by another thread
+	for (auto i = 0; i < LIVE_OBJECTS; i++) {
+		if (i % 2 == 0) {
+			handoff.push_back(live[i]);
+		}
+		else {
+			free(live[i]);
+		}
+	}
+}
+
+int main() {
+	// Without the shim, malloc is found in the C library
+	Dl_info info;
+	auto loaded = dladdr(reinterpret_cast<void *>(&malloc), &info) != 0 && std::strstr(info.dli_fname, "libc.") == nullptr;
+	std::cout << "Shim loaded: " << (loaded ? "yes" : "no") << std::endl;
+
+	auto zeroed = static_cast<unsigned char *>(calloc(1000, 100));
+	std::cout << "Calloc zeroed: " << (zeroed != nullptr && filled(zeroed, 100000, 0) ? "yes" : "no") << std::endl;
+	free(zeroed);
+
+	// Contents survive moving between the buffer caches and the buddy allocator
+	auto memory = static_cast<unsigned char *>(malloc(100));
+	std::memset(memory, 0x5a, 100);
+	memory = static_cast<unsigned char *>(realloc(memory, 300000));
+	auto grown = filled(memory, 100, 0x5a);
+	std::memset(memory, 0x5a, 300000);
+	memory = static_cast<unsigned char *>(realloc(memory, 50));
+	std::cout << "Realloc keeps contents: " << (grown && filled(memory, 50, 0x5a) ? "yes" : "no") << std::endl;
+	std::cout << "Usable size covers request: " << (malloc_usable_size(memory) >= 50 ? "yes" : "no") << std::endl;
+	free(memory);
+
+	// Memory of the C library, like the one the dynamic loader allocates before the shim is bound, is passed back to it
+	auto foreign = static_cast<unsigned char *>(__libc_malloc(100));
+	std::memset(foreign, 0x3c, 100);
+	foreign = static_cast<unsigned char *>(realloc(foreign, 5000));
+	std::cout << "Foreign realloc keeps contents: " << (foreign != nullptr && filled(foreign, 100, 0x3c) ? "yes" : "no") << std::endl;
+	free(foreign);
+
+	auto all_aligned = true;
+	for (auto alignment : ALIGNMENTS) {
+		void *pointer = nullptr;
+
+		if (posix_memalign(&pointer, alignment, 3000) != 0 || !aligned(pointer, alignment)) {
+			all_aligned = false;
+		}
+
+		free(pointer);
+
+		pointer = aligned_alloc(alignment, alignment);
+		if (pointer == nullptr || !aligned(pointer, alignment)) {
+			all_aligned = false;
+		}
+
+		free(pointer);
+	}
+
+	std::cout << "Aligned allocations: " << (all_aligned ? "yes" : "no") << std::endl;
+
+	void *refused = nullptr;
+	std::cout << "Bad alignment refused: " << (posix_memalign(&refused, 24, 100) == EINVAL ? "yes" : "no") << std::endl;
+
+	{
+		std::vector<std::string> strings;
+		for (auto i = 0; i < 10000; i++) {
+			strings.push_back(std::string(i % 100 + 20, 'x'));
+		}
+
+		std::cout << "Containers: " << (strings.back().size() == 9999 % 100 + 20 ? "yes" : "no") << std::endl;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<void *> handoff[NUM_OF_THREADS];
+	bool errors[NUM_OF_THREADS] = {};
+	std::vector<std::thread> threads;
+
+	for (auto i = 0; i < NUM_OF_THREADS; i++) {
+		threads.emplace_back(churn, static_cast<unsigned>(i + 1), std::ref(handoff[i]), std::ref(errors[i]));
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto error = false;
+	for (auto i = 0; i < NUM_OF_THREADS; i++) {
+		error = error || errors[i];
+
+		for (auto pointer : handoff[i]) {
+			free(pointer);
+		}
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "Malloc and free pair: " << static_cast<double>(elapsed) / (NUM_OF_THREADS * ITERATIONS) << " ns" << std::endl;
+	std::cout << "Threads: " << (error ? "no" : "yes") << std::endl;
+
+	// Child allocates from the copy of the pool, while the parent keeps allocating
+	std::thread background([] {
+		for (auto i = 0; i < ITERATIONS; i++) {
+			free(malloc(i % 4096 + 1));
+		}
+	});
+
+	auto child = fork();
+
+	if (child == 0) {
+		std::vector<void *> objects;
+		for (auto i = 0; i < 10000; i++) {
+			objects.push_back(malloc(i % 5000 + 1));
+		}
+
+		for (auto object : objects) {
+			free(object);
+		}
+
+		_exit(0);
+	}
+
+	background.join();
+
+	int status = -1;
+	waitpid(child, &status, 0);
+	std::cout << "Fork: " << (WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "yes" : "no") << std::endl;
+
+	std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,70 @@
+#include "Slab.h"
+#include <iostream>
+#include <set>
+
+const int NUM_OF_BLOCKS = 300;
+const int NUM_OF_OBJECTS = 1000;
+const size_t OBJECT_SIZE = 24;
+
+void count(void *object, void *context) {
+	static_cast<std::set<void *> *>(context)->insert(object);
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto cache = kmem_cache_create_flags("Tracked cache", OBJECT_SIZE, nullptr, nullptr, KMEM_CACHE_TRACK);
+	auto untracked = kmem_cache_create("Untracked cache", OBJECT_SIZE, nullptr, nullptr);
+
+	void *objects[NUM_OF_OBJECTS];
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+	}
+
+	// Free every other object, the walk must visit exactly the rest
+	for (auto i = 0; i < NUM_OF_OBJECTS; i += 2) {
+		kmem_cache_free(cache, objects[i]);
+	}
+
+	std::set<void *> live;
+	auto visited = kmem_cache_walk(cache, count, &live);
+
+	auto correct = visited == NUM_OF_OBJECTS / 2 && live.size() == NUM_OF_OBJECTS / 2;
+	for (auto i = 1; i < NUM_OF_OBJECTS; i += 2) {
+		correct = correct && live.count(objects[i]) == 1;
+	}
+
+	std::cout << "Walk: " << (correct ? "correct" : "wrong") << std::endl;
+	std::cout << "Untracked walk: " << kmem_cache_walk(untracked, count, &live) << std::endl;
+
+	// Second free of the same object is refused, so the free list stays intact
+	kmem_cache_free(cache, objects[0]);
+	std::cout << "Double free error: " << kmem_cache_error(cache) << std::endl;
+
+	std::set<void *> reallocated;
+	for (auto i = 0; i < NUM_OF_OBJECTS; i += 2) {
+		objects[i] = kmem_cache_alloc(cache);
+		reallocated.insert(objects[i]);
+	}
+
+	std::cout << "Distinct objects: " << (reallocated.size() == NUM_OF_OBJECTS / 2 ? "yes" : "no") << std::endl;
+
+	// Leave a few objects allocated, destroying the cache reports them
+	for (auto i = 3; i < NUM_OF_OBJECTS; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+
+	kmem_cache_destroy(cache);
+	kmem_cache_error(cache);
+
+	for (auto i = 0; i < 3; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+
+	kmem_cache_destroy(cache);
+	kmem_cache_destroy(untracked);
+
+	std::cout << "OK" << std::endl;
+}
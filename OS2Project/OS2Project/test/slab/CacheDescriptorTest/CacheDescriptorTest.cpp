@@ -0,0 +1,85 @@
+#include "Slab.h"
+#include "SlabStructs.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 1000;
+const int NUM_OF_CACHES = 500;
+const int ROUNDS = 20;
+const size_t OBJECT_SIZE = 64;
+
+kmem_cache_t *caches[NUM_OF_CACHES];
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Caches with the same name share one interned copy of it
+	for (auto round = 0; round < ROUNDS; round++) {
+		for (auto i = 0; i < NUM_OF_CACHES; i++) {
+			caches[i] = kmem_cache_create("Shared name", OBJECT_SIZE, nullptr, nullptr);
+		}
+
+		for (auto i = 0; i < NUM_OF_CACHES; i++) {
+			kmem_cache_destroy(caches[i]);
+		}
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "Create and destroy: " << elapsed * 1000 / (2 * ROUNDS * NUM_OF_CACHES) << " ns" << std::endl;
+
+	auto first = kmem_cache_create("Shared name", OBJECT_SIZE, nullptr, nullptr);
+	auto second = kmem_cache_create("Shared name", OBJECT_SIZE, nullptr, nullptr);
+	auto other = kmem_cache_create("Other name", OBJECT_SIZE, nullptr, nullptr);
+
+	std::cout << "Same name shared: " << (reinterpret_cast<cache_header_s *>(first)->name_ == reinterpret_cast<cache_header_s *>(second)->name_ ? "yes" : "no") << std::endl;
+	std::cout << "Different names shared: " << (reinterpret_cast<cache_header_s *>(first)->name_ == reinterpret_cast<cache_header_s *>(other)->name_ ? "yes" : "no") << std::endl;
+
+	// Headers are aligned, so their mutexes do not share lines with the neighbouring headers
+	std::cout << "Headers aligned: " << (reinterpret_cast<size_t>(first) % CACHE_L1_LINE_SIZE == 0 && reinterpret_cast<size_t>(other) % CACHE_L1_LINE_SIZE == 0 ? "yes" : "no") << std::endl;
+
+	auto aligned = kmem_cache_create_flags("Aligned", OBJECT_SIZE + 1, nullptr, nullptr, KMEM_CACHE_HWALIGN);
+	auto one = kmem_cache_alloc(aligned);
+	auto two = kmem_cache_alloc(aligned);
+	std::cout << "Objects aligned: " << (reinterpret_cast<size_t>(one) % CACHE_L1_LINE_SIZE == 0 && reinterpret_cast<size_t>(two) % CACHE_L1_LINE_SIZE == 0 ? "yes" : "no") << std::endl;
+	kmem_cache_free(aligned, one);
+	kmem_cache_free(aligned, two);
+	kmem_cache_destroy(aligned);
+
+	// The name outlives the first of the caches using it
+	kmem_cache_destroy(first);
+	std::cout << "Name after destroy: " << reinterpret_cast<cache_header_s *>(second)->name_ << std::endl;
+
+	kmem_cache_destroy(second);
+	kmem_cache_destroy(other);
+
+	// Unique names are freed with their caches
+	for (auto round = 0; round < ROUNDS; round++) {
+		for (auto i = 0; i < NUM_OF_CACHES; i++) {
+			caches[i] = kmem_cache_create(("Cache " + std::to_string(i)).c_str(), OBJECT_SIZE, nullptr, nullptr);
+		}
+
+		for (auto i = 0; i < NUM_OF_CACHES; i++) {
+			kmem_cache_destroy(caches[i]);
+		}
+	}
+
+	// Destroying a cache that is not live is ignored
+	auto cache = kmem_cache_create("Destroyed twice", OBJECT_SIZE, nullptr, nullptr);
+	auto object = kmem_cache_alloc(cache);
+
+	kmem_cache_destroy(cache);
+	std::cout << "Cache with objects destroyed: " << (kmem_cache_error(cache) != 0 ? "no" : "yes") << std::endl;
+
+	kmem_cache_free(cache, object);
+	kmem_cache_destroy(cache);
+	kmem_cache_destroy(cache);
+	kmem_cache_destroy(reinterpret_cast<kmem_cache_t *>(object));
+
+	std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,82 @@
+#include "Slab.h"
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+
+const int NUM_OF_BLOCKS = 4000;
+const int NUM_OF_THREADS = 16;
+const int NUM_OF_BUFFERS = 500;
+const int NUM_OF_ROUNDS = 20;
+
+std::vector<unsigned char *> buffers[NUM_OF_THREADS];
+
+std::atomic<bool> error(false);
+
+size_t sizeOf(int index) {
+	return 32u << (index % 8);
+}
+
+void allocateBody(int index) {
+	for (auto i = 0; i < NUM_OF_BUFFERS; i++) {
+		auto size = sizeOf(i);
+		auto buffer = static_cast<unsigned char *>(kmalloc(size));
+
+		if (buffer == nullptr) {
+			error = true;
+			continue;
+		}
+
+		std::memset(buffer, index, size);
+		buffers[index].push_back(buffer);
+	}
+}
+
+void deallocateBody(int index) {
+	// Free the buffers allocated by another thread
+	auto owner = (index + 1) % NUM_OF_THREADS;
+
+	for (size_t i = 0; i < buffers[owner].size(); i++) {
+		auto buffer = buffers[owner][i];
+
+		for (size_t j = 0; j < sizeOf(static_cast<int>(i)); j++) {
+			if (buffer[j] != owner) {
+				error = true;
+				break;
+			}
+		}
+
+		kfree(buffer);
+	}
+}
+
+void run(void(*body)(int)) {
+	std::vector<std::thread> threads;
+
+	for (auto i = 0; i < NUM_OF_THREADS; i++) {
+		threads.push_back(std::thread(body, i));
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	for (auto round = 0; round < NUM_OF_ROUNDS; round++) {
+		run(allocateBody);
+		run(deallocateBody);
+
+		for (auto &vector : buffers) {
+			vector.clear();
+		}
+	}
+
+	std::cout << (error ? "There was an error" : "OK") << std::endl;
+
+	free(memory);
+}
@@ -0,0 +1,94 @@
+#include "Slab.h"
+#include "SlabStructs.h"
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+const int NUM_OF_BLOCKS = 2000;
+const int NUM_OF_THREADS = 8;
+const int NUM_OF_OBJECTS = 2000;
+const int NUM_OF_ROUNDS = 20;
+
+using namespace os2bn140314d;
+
+kmem_cache_t *cache;
+
+std::vector<int *> objects[NUM_OF_THREADS];
+
+std::atomic<int> allocated(0);
+std::atomic<int> freed(0);
+std::atomic<bool> error(false);
+
+void waitFor(std::atomic<int> &counter, int value) {
+	while (counter < value) {
+		std::this_thread::yield();
+	}
+}
+
+void threadBody(int index) {
+	for (auto round = 0; round < NUM_OF_ROUNDS; round++) {
+		for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+			auto pointer = static_cast<int *>(kmem_cache_alloc(cache));
+			*pointer = index;
+			objects[index].push_back(pointer);
+		}
+
+		allocated++;
+		waitFor(allocated, (2 * round + 1) * NUM_OF_THREADS);
+
+		// Free the objects of the neighbour, while it still owns the slabs they came from
+		auto &neighbour = objects[(index + 1) % NUM_OF_THREADS];
+		for (auto pointer : neighbour) {
+			if (*pointer != (index + 1) % NUM_OF_THREADS) {
+				error = true;
+			}
+
+			kmem_cache_free(cache, pointer);
+		}
+
+		freed++;
+		waitFor(freed, (round + 1) * NUM_OF_THREADS);
+
+		objects[index].clear();
+
+		allocated++;
+		waitFor(allocated, (2 * round + 2) * NUM_OF_THREADS);
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	cache = kmem_cache_create("Cross thread cache", sizeof(int) * 4, nullptr, nullptr);
+
+	std::vector<std::thread> threads;
+
+	for (auto i = 0; i < NUM_OF_THREADS; i++) {
+		threads.push_back(std::thread(threadBody, i));
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::cout << (error ? "There was an error" : "Objects OK") << std::endl;
+
+	// Exited threads released their slabs, so the objects freed by the neighbours are back in the slabs they came from
+	auto header = reinterpret_cast<cache_header_s *>(cache);
+	auto no_objects = header->allocatedObjects() == 0;
+	auto all_empty = header->number_of_slabs_ > 0 && header->empty_slabs_ == header->number_of_slabs_;
+
+	std::cout << "No objects left: " << no_objects << std::endl;
+	std::cout << "All slabs empty: " << all_empty << std::endl;
+
+	kmem_cache_info(cache);
+	auto cache_error = kmem_cache_error(cache);
+	kmem_cache_destroy(cache);
+	kmem_cache_error(cache);
+
+	std::cout << (!error && no_objects && all_empty && cache_error == 0 ? "OK" : "Cross thread frees failed") << std::endl;
+
+	free(memory);
+}
@@ -0,0 +1,140 @@
+#include "Slab.h"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+const int NUM_OF_BLOCKS = 4000;
+const int DEFERRED_OBJECTS = 1000;
+const int SLOTS = 64;
+const int READERS = 2;
+const int REPLACEMENTS = 200000;
+const int CRITICAL_SECTIONS = 10000000;
+
+struct node_s {
+	size_t value_;
+	size_t check_;
+};
+
+std::atomic<node_s *> slots[SLOTS];
+std::atomic<bool> done(false);
+std::atomic<size_t> torn(0);
+
+void countObject(void *, void *ctx) {
+	(*static_cast<size_t *>(ctx))++;
+}
+
+size_t liveObjects(kmem_cache_t *cache) {
+	size_t ret = 0;
+	kmem_cache_walk(cache, countObject, &ret);
+	return ret;
+}
+
+void read() {
+	while (!done.load()) {
+		kmem_epoch_enter();
+
+		for (auto &slot : slots) {
+			auto node = slot.load(std::memory_order_acquire);
+
+			if (node->check_ != ~node->value_) {
+				torn++;
+			}
+		}
+
+		kmem_epoch_leave();
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto cache = kmem_cache_create_flags("Deferred cache", sizeof(node_s), nullptr, nullptr, KMEM_CACHE_TRACK);
+
+	// Objects are not returned while a reader that may hold them is in its critical section
+	std::atomic<int> step(0);
+
+	std::thread reader([&step]() {
+		kmem_epoch_enter();
+		step = 1;
+
+		while (step != 2) {
+			std::this_thread::yield();
+		}
+
+		kmem_epoch_leave();
+		step = 3;
+	});
+
+	while (step != 1) {
+		std::this_thread::yield();
+	}
+
+	for (auto i = 0; i < DEFERRED_OBJECTS; i++) {
+		kmem_cache_free_deferred(cache, kmem_cache_alloc(cache));
+	}
+
+	std::cout << "Live objects during reader: " << liveObjects(cache) << std::endl;
+
+	step = 2;
+	while (step != 3) {
+		std::this_thread::yield();
+	}
+
+	reader.join();
+
+	std::cout << "Released by barrier: " << kmem_epoch_barrier() << std::endl;
+	std::cout << "Live objects after barrier: " << liveObjects(cache) << std::endl;
+
+	// Readers traverse the nodes the writer replaces and frees
+	for (size_t i = 0; i < SLOTS; i++) {
+		auto node = static_cast<node_s *>(kmem_cache_alloc(cache));
+		node->value_ = i;
+		node->check_ = ~i;
+		slots[i] = node;
+	}
+
+	std::vector<std::thread> readers;
+	for (auto i = 0; i < READERS; i++) {
+		readers.emplace_back(read);
+	}
+
+	for (size_t i = 0; i < REPLACEMENTS; i++) {
+		auto node = static_cast<node_s *>(kmem_cache_alloc(cache));
+		node->value_ = i;
+		node->check_ = ~i;
+
+		auto old = slots[i % SLOTS].exchange(node, std::memory_order_acq_rel);
+		kmem_cache_free_deferred(cache, old);
+	}
+
+	done = true;
+	for (auto &thread : readers) {
+		thread.join();
+	}
+
+	std::cout << "Torn reads: " << torn << std::endl;
+
+	for (auto &slot : slots) {
+		kmem_cache_free(cache, slot.load());
+	}
+
+	kmem_epoch_barrier();
+	std::cout << "Live objects after replacements: " << liveObjects(cache) << std::endl;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto i = 0; i < CRITICAL_SECTIONS; i++) {
+		kmem_epoch_enter();
+		kmem_epoch_leave();
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "Critical section: " << static_cast<double>(elapsed) / CRITICAL_SECTIONS << " ns" << std::endl;
+
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+}
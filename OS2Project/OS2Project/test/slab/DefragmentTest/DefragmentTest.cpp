@@ -0,0 +1,152 @@
+#include "Slab.h"
+#include "SlabStructs.h"
+#include "Buddy.h"
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <cstring>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 4000;
+const int NUM_OF_OBJECTS = 50000;
+const int KEPT_OBJECTS = NUM_OF_OBJECTS / 5;
+const int PINNED_INTERVAL = 1009;
+const size_t HIGH_ORDER = 2;
+
+struct item_s {
+	size_t id_;
+	size_t check_;
+	char payload_[48];
+};
+
+item_s *items[NUM_OF_OBJECTS];
+size_t moved = 0;
+
+unsigned long long state = 42;
+
+size_t random(size_t bound) {
+	state = state * 6364136223846793005ull + 1442695040888963407ull;
+	return static_cast<size_t>(state >> 33) % bound;
+}
+
+size_t checkOf(size_t id) {
+	return id * 2654435761u;
+}
+
+int migrate(void *from, void *to) {
+	auto item = static_cast<item_s *>(from);
+
+	// Some objects are pinned, and must stay where they are
+	if (item->id_ % PINNED_INTERVAL == 0) {
+		return 0;
+	}
+
+	std::memcpy(to, from, sizeof(item_s));
+	items[item->id_] = static_cast<item_s *>(to);
+	moved++;
+
+	return 1;
+}
+
+size_t availableBlocks(size_t power) {
+	std::vector<void *> blocks;
+
+	for (auto memory = Buddy::allocatePowerOfTwo(power); memory != nullptr; memory = Buddy::allocatePowerOfTwo(power)) {
+		blocks.push_back(memory);
+	}
+
+	for (auto memory : blocks) {
+		Buddy::deallocatePowerOfTwo(memory, power);
+	}
+
+	return blocks.size();
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto plain = kmem_cache_create("Plain cache", sizeof(item_s), nullptr, nullptr);
+	std::cout << "Plain cache: " << kmem_cache_defragment(plain) << std::endl;
+	kmem_cache_destroy(plain);
+
+	auto cache = kmem_cache_create_movable("Movable cache", sizeof(item_s), nullptr, nullptr, migrate);
+	auto header = reinterpret_cast<cache_header_s *>(cache);
+
+	std::vector<size_t> ids;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		items[i] = static_cast<item_s *>(kmem_cache_alloc(cache));
+		items[i]->id_ = i;
+		items[i]->check_ = checkOf(i);
+		ids.push_back(i);
+	}
+
+	// Leave every slab sparsely used
+	for (auto i = 0; i < NUM_OF_OBJECTS - KEPT_OBJECTS; i++) {
+		auto index = random(ids.size());
+		std::swap(ids[index], ids.back());
+
+		kmem_cache_free(cache, items[ids.back()]);
+		items[ids.back()] = nullptr;
+		ids.pop_back();
+	}
+
+	kmem_cache_shrink(cache);
+
+	auto minimum = (KEPT_OBJECTS + header->num_of_objects_ - 1) / header->num_of_objects_;
+	auto before = availableBlocks(HIGH_ORDER);
+
+	std::cout << "Slabs before: " << header->number_of_slabs_ << std::endl;
+
+	auto released = 0;
+	auto blocks = 0;
+
+	// Each pass considers a limited number of slabs
+	while ((blocks = kmem_cache_defragment(cache)) > 0) {
+		released += blocks;
+	}
+
+	std::cout << "Slabs after: " << header->number_of_slabs_ << std::endl;
+	std::cout << "Slabs needed: " << minimum << std::endl;
+	std::cout << "Blocks released: " << (released > 0 ? "yes" : "no") << std::endl;
+	std::cout << "Objects moved: " << (moved > 0 ? "yes" : "no") << std::endl;
+	auto after = availableBlocks(HIGH_ORDER);
+	std::cerr << "Free blocks of order " << HIGH_ORDER << ": " << before << " before, " << after << " after" << std::endl;
+	std::cout << "More high order blocks: " << (after > before ? "yes" : "no") << std::endl;
+
+	auto intact = true;
+	for (auto id : ids) {
+		intact = intact && items[id]->id_ == id && items[id]->check_ == checkOf(id);
+	}
+
+	auto walked = kmem_cache_walk(cache, [](void *, void *) {}, nullptr);
+
+	std::cout << "Objects intact: " << (intact && walked == static_cast<int>(ids.size()) ? "yes" : "no") << std::endl;
+
+	// Without a free block the pass can not start, which is reported rather than looking like nothing to move
+	std::vector<void *> taken;
+	bool zeroed;
+
+	for (auto block = Buddy::allocate(1, zeroed); block != nullptr; block = Buddy::allocate(1, zeroed)) {
+		taken.push_back(block);
+	}
+
+	auto clean = (header->error_ & NO_MORE_SPACE) == 0;
+	auto refused = kmem_cache_defragment(cache) == 0;
+	std::cout << "Exhausted memory reported: " << (clean && refused && (header->error_ & NO_MORE_SPACE) != 0 ? "yes" : "no") << std::endl;
+
+	for (auto block : taken) {
+		Buddy::deallocate(block, 1);
+	}
+
+	for (auto id : ids) {
+		kmem_cache_free(cache, items[id]);
+	}
+
+	kmem_cache_error(cache);
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+}
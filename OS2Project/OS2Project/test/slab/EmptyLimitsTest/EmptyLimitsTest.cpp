@@ -0,0 +1,57 @@
+#include "Slab.h"
+#include "SlabStructs.h"
+#include <iostream>
+#include <vector>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 400;
+const int NUM_OF_SLABS = 20;
+const int MIN_EMPTY = 2;
+const int MAX_EMPTY = 4;
+const size_t OBJECT_SIZE = 64;
+
+void burst(kmem_cache_t *cache) {
+	auto header = reinterpret_cast<cache_header_s *>(cache);
+	std::vector<void *> objects;
+
+	for (size_t i = 0; i < NUM_OF_SLABS * header->num_of_objects_; i++) {
+		objects.push_back(kmem_cache_alloc(cache));
+	}
+
+	for (auto object : objects) {
+		kmem_cache_free(cache, object);
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto limited = kmem_cache_create("Limited cache", OBJECT_SIZE, nullptr, nullptr);
+	auto unlimited = kmem_cache_create("Unlimited cache", OBJECT_SIZE, nullptr, nullptr);
+
+	kmem_cache_set_empty_limits(limited, MIN_EMPTY, MAX_EMPTY);
+
+	burst(limited);
+	burst(unlimited);
+
+	// The thread keeps one more slab as its active one
+	std::cout << "Limited slabs after burst: " << reinterpret_cast<cache_header_s *>(limited)->number_of_slabs_ << std::endl;
+	std::cout << "Unlimited slabs after burst: " << reinterpret_cast<cache_header_s *>(unlimited)->number_of_slabs_ << std::endl;
+
+	kmem_cache_shrink(limited);
+	kmem_cache_shrink(unlimited);
+
+	std::cout << "Limited slabs after shrink: " << reinterpret_cast<cache_header_s *>(limited)->number_of_slabs_ << std::endl;
+	std::cout << "Unlimited slabs after shrink: " << reinterpret_cast<cache_header_s *>(unlimited)->number_of_slabs_ << std::endl;
+
+	// Lowering the limit returns the slabs over it at once
+	kmem_cache_set_empty_limits(limited, 0, 0);
+	std::cout << "Limited slabs without empty ones: " << reinterpret_cast<cache_header_s *>(limited)->number_of_slabs_ << std::endl;
+
+	kmem_cache_destroy(limited);
+	kmem_cache_destroy(unlimited);
+
+	std::cout << "OK" << std::endl;
+}
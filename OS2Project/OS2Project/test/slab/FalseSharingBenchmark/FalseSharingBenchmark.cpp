@@ -0,0 +1,95 @@
+#include "Slab.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+const int NUM_OF_BLOCKS = 8192;
+const int NUM_OF_ROUNDS = 2000;
+const size_t BATCH = 1024;
+const size_t OBJECT_SIZE = 64;
+const size_t MAX_THREADS = 16;
+
+kmem_cache_t *caches[MAX_THREADS];
+
+/**
+ * \brief Allocate and free batches larger than one slab, so the mutex of the cache is taken often
+ */
+void ownCache(int index) {
+	void *objects[BATCH];
+
+	for (auto i = 0; i < NUM_OF_ROUNDS; i++) {
+		for (size_t j = 0; j < BATCH; j++) {
+			objects[j] = kmem_cache_alloc(caches[index]);
+		}
+
+		for (size_t j = 0; j < BATCH; j++) {
+			kmem_cache_free(caches[index], objects[j]);
+		}
+	}
+}
+
+/**
+ * \brief Same pattern through the small memory buffers, whose caches are looked up in the slab header
+ */
+void buffers(int index) {
+	void *objects[BATCH];
+
+	for (auto i = 0; i < NUM_OF_ROUNDS; i++) {
+		for (size_t j = 0; j < BATCH; j++) {
+			objects[j] = kmalloc(OBJECT_SIZE << (j + index) % 4);
+		}
+
+		for (size_t j = 0; j < BATCH; j++) {
+			kfree(objects[j]);
+		}
+	}
+}
+
+double run(void(*function)(int), size_t number_of_threads) {
+	std::vector<std::thread> threads;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < number_of_threads; i++) {
+		threads.push_back(std::thread(function, static_cast<int>(i)));
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	auto seconds = std::chrono::duration<double>(end - start).count();
+
+	return 2 * number_of_threads * static_cast<double>(NUM_OF_ROUNDS) * BATCH / seconds / 1e6;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	size_t number_of_threads = std::thread::hardware_concurrency();
+	if (number_of_threads < 2) {
+		number_of_threads = 2;
+	}
+	if (number_of_threads > MAX_THREADS) {
+		number_of_threads = MAX_THREADS;
+	}
+
+	// Caches created one after another have neighbouring headers
+	for (size_t i = 0; i < number_of_threads; i++) {
+		caches[i] = kmem_cache_create("Neighbour", OBJECT_SIZE, nullptr, nullptr);
+	}
+
+	std::cout << "Threads                 -- " << number_of_threads << std::endl;
+	std::cout << "Neighbouring caches     -- " << run(ownCache, number_of_threads) << " M operations/s" << std::endl;
+	std::cout << "Small memory buffers    -- " << run(buffers, number_of_threads) << " M operations/s" << std::endl;
+
+	for (size_t i = 0; i < number_of_threads; i++) {
+		kmem_cache_error(caches[i]);
+		kmem_cache_destroy(caches[i]);
+	}
+
+	free(memory);
+}
@@ -0,0 +1,157 @@
+#include "Slab.h"
+#include "FixedCache.h"
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 4000;
+const int ITERATIONS = 5000000;
+const int BATCH = 64;
+
+int constructed = 0;
+int destroyed = 0;
+
+struct point_s {
+	long long x_, y_, z_;
+	std::string label_;
+
+	point_s(long long x, long long y, long long z, std::string &&label) : x_(x), y_(y), z_(z), label_(std::move(label)) {
+		constructed++;
+	}
+
+	~point_s() {
+		destroyed++;
+	}
+};
+
+struct throwing_s {
+	explicit throwing_s(bool fail) {
+		if (fail) {
+			throw std::runtime_error("Constructor failed");
+		}
+	}
+};
+
+struct small_s {
+	size_t value_;
+};
+
+typedef FixedCache<point_s>::Layout PointLayout;
+
+static_assert(PointLayout::OBJECT_SIZE % alignof(point_s) == 0, "Objects must be aligned");
+static_assert(FixedCache<small_s, 32>::Layout::OBJECT_SIZE == CACHE_L1_LINE_SIZE, "Over-aligned objects take whole lines");
+
+template <typename Cache>
+size_t allocatedObjects(Cache &cache) {
+	auto header = reinterpret_cast<cache_header_s *>(cache.cache());
+
+	header->mutex_.lock();
+	auto ret = header->allocatedObjects();
+	header->mutex_.unlock();
+
+	return ret;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	{
+		FixedCache<point_s> points("Points");
+		auto header = reinterpret_cast<cache_header_s *>(points.cache());
+
+		// Layout known at compile time matches the one the cache computed
+		std::cout << "Layout matches: " << (header->object_size_ == PointLayout::OBJECT_SIZE
+			&& header->num_of_objects_ == PointLayout::OBJECTS_IN_SLAB
+			&& header->number_of_blocks_in_slab_ * BLOCK_SIZE == PointLayout::SLAB_SIZE
+			&& header->unused_memory_size_ == PointLayout::UNUSED_SPACE ? "yes" : "no") << std::endl;
+
+		{
+			auto point = points.allocate(1, 2, 3, std::string("first"));
+			std::cout << "Constructed: " << point->label_ << " " << point->x_ + point->y_ + point->z_ << std::endl;
+		}
+
+		std::cout << "Constructors and destructors: " << constructed << " " << destroyed << std::endl;
+		std::cout << "Objects after release: " << allocatedObjects(points) << std::endl;
+
+		// Objects freed by another thread go to the remote free list of their slab
+		std::vector<FixedCache<point_s>::Pointer> kept;
+		for (auto i = 0; i < 1000; i++) {
+			kept.push_back(points.allocate(i, i, i, std::string("kept")));
+		}
+
+		std::thread([&kept]() {
+			kept.clear();
+		}).join();
+
+		std::cout << "Objects after remote release: " << allocatedObjects(points) << std::endl;
+	}
+
+	{
+		FixedCache<small_s, 32> aligned("Aligned");
+		auto one = aligned.allocate();
+		auto two = aligned.allocate();
+
+		std::cout << "Objects aligned: " << (reinterpret_cast<size_t>(one.get()) % 32 == 0 && reinterpret_cast<size_t>(two.get()) % 32 == 0 ? "yes" : "no") << std::endl;
+	}
+
+	{
+		FixedCache<throwing_s> throwing("Throwing");
+
+		try {
+			throwing.allocate(true);
+		}
+		catch (std::exception &e) {
+			std::cout << e.what() << ", objects: " << allocatedObjects(throwing) << std::endl;
+		}
+	}
+
+	// Typed cache against the ordinary cache of the same object size
+	{
+		FixedCache<small_s> typed("Typed");
+		auto cache = kmem_cache_create("Untyped", sizeof(small_s), nullptr, nullptr);
+
+		std::vector<FixedCache<small_s>::Pointer> pointers(BATCH);
+		void *objects[BATCH];
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (auto i = 0; i < ITERATIONS / BATCH; i++) {
+			for (auto &pointer : pointers) {
+				pointer = typed.allocate();
+			}
+
+			for (auto &pointer : pointers) {
+				pointer.reset();
+			}
+		}
+
+		auto middle = std::chrono::steady_clock::now();
+
+		for (auto i = 0; i < ITERATIONS / BATCH; i++) {
+			for (auto &object : objects) {
+				object = kmem_cache_alloc(cache);
+			}
+
+			for (auto object : objects) {
+				kmem_cache_free(cache, object);
+			}
+		}
+
+		auto end = std::chrono::steady_clock::now();
+
+		std::cerr << "Typed allocation and free: "
+			<< static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count()) / ITERATIONS << " ns" << std::endl;
+		std::cerr << "Untyped allocation and free: "
+			<< static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count()) / ITERATIONS << " ns" << std::endl;
+
+		kmem_cache_destroy(cache);
+	}
+
+	std::cout << "OK" << std::endl;
+}
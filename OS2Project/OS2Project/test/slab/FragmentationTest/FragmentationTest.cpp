@@ -0,0 +1,67 @@
+#include "Slab.h"
+#include "SlabStructs.h"
+#include <iostream>
+#include <vector>
+#include <utility>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 4000;
+const int NUM_OF_OBJECTS = 50000;
+const int KEPT_OBJECTS = NUM_OF_OBJECTS / 5;
+const int CHURN = NUM_OF_OBJECTS / 20;
+const int ROUNDS = 200;
+const size_t OBJECT_SIZE = 64;
+
+unsigned long long state = 42;
+
+size_t random(size_t bound) {
+	state = state * 6364136223846793005ull + 1442695040888963407ull;
+	return static_cast<size_t>(state >> 33) % bound;
+}
+
+void freeRandom(kmem_cache_t *cache, std::vector<void *> &live, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		auto index = random(live.size());
+		std::swap(live[index], live.back());
+		kmem_cache_free(cache, live.back());
+		live.pop_back();
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto cache = kmem_cache_create("Fragmented cache", OBJECT_SIZE, nullptr, nullptr);
+	auto header = reinterpret_cast<cache_header_s *>(cache);
+
+	std::vector<void *> live;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		live.push_back(kmem_cache_alloc(cache));
+	}
+
+	// Leave every slab sparsely used, then keep allocating and freeing at random
+	freeRandom(cache, live, NUM_OF_OBJECTS - KEPT_OBJECTS);
+
+	for (auto round = 0; round < ROUNDS; round++) {
+		for (auto i = 0; i < CHURN; i++) {
+			live.push_back(kmem_cache_alloc(cache));
+		}
+
+		freeRandom(cache, live, CHURN);
+	}
+
+	kmem_cache_shrink(cache);
+
+	auto minimum = (KEPT_OBJECTS + header->num_of_objects_ - 1) / header->num_of_objects_;
+
+	std::cout << "Slabs after churn: " << header->number_of_slabs_ << std::endl;
+	std::cout << "Slabs needed: " << minimum << std::endl;
+
+	freeRandom(cache, live, live.size());
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+}
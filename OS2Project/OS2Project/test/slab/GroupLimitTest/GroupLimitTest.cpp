@@ -0,0 +1,157 @@
+#include "Slab.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+const int NUM_OF_BLOCKS = 4000;
+const size_t OBJECT_SIZE = 64;
+const size_t LIMIT = 64 * 1024;
+const size_t BATCH = LIMIT / 64;
+const int THREADS = 4;
+const int ITERATIONS = 1000000;
+
+struct reclaim_context_s {
+	kmem_cache_t *cache_;
+	std::vector<void *> *objects_;
+	int calls_;
+};
+
+int reclaimHalf(kmem_group_t *group, size_t, void *ctx) {
+	auto context = static_cast<reclaim_context_s *>(ctx);
+	auto &objects = *context->objects_;
+
+	context->calls_++;
+
+	for (auto i = objects.size() / 2; i > 0; i--) {
+		kmem_cache_free_group(context->cache_, group, objects.back());
+		objects.pop_back();
+	}
+
+	return 1;
+}
+
+std::vector<void *> fill(kmem_cache_t *cache, kmem_group_t *group) {
+	std::vector<void *> ret;
+
+	while (true) {
+		auto object = kmem_cache_alloc_group(cache, group);
+		if (object == nullptr) {
+			break;
+		}
+
+		ret.push_back(object);
+	}
+
+	return ret;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto cache = kmem_cache_create("Group cache", OBJECT_SIZE, nullptr, nullptr);
+	auto group = kmem_group_create(LIMIT);
+
+	// Single thread reaches exactly the limit, the last batch is charged only in part
+	auto objects = fill(cache, group);
+	std::cout << "Objects at the limit: " << objects.size() << std::endl;
+	std::cout << "Usage at the limit: " << (kmem_group_usage(group) == LIMIT) << std::endl;
+
+	// Over the limit without a reclaim function fails, while the cache still has space
+	auto plain = kmem_cache_alloc(cache);
+	std::cout << "Cache not full: " << (plain != nullptr) << std::endl;
+	kmem_cache_free(cache, plain);
+
+	// Reclaim frees half of the objects, and the allocation is tried again
+	reclaim_context_s context = { cache, &objects, 0 };
+	kmem_group_set_reclaim(group, reclaimHalf, &context);
+
+	auto reclaimed = kmem_cache_alloc_group(cache, group);
+	std::cout << "Allocated after reclaim: " << (reclaimed != nullptr && context.calls_ == 1) << std::endl;
+	objects.push_back(reclaimed);
+
+	kmem_group_set_reclaim(group, nullptr, nullptr);
+
+	for (auto object : objects) {
+		kmem_cache_free_group(cache, group, object);
+	}
+	objects.clear();
+
+	// Thread keeps at most two batches of the freed bytes
+	std::cout << "Usage after free: " << (kmem_group_usage(group) <= 2 * BATCH) << std::endl;
+
+	// Buffers are charged by the size of the buffer holding them
+	auto before = kmem_group_usage(group);
+	auto buffer = kmalloc_group(OBJECT_SIZE / 2 + 1, group);
+	kfree_group(group, buffer);
+	std::cout << "Buffer charged and returned: " << (buffer != nullptr && kmem_group_usage(group) == before) << std::endl;
+
+	// Threads share the limit, and return their batches when they exit
+	std::vector<std::thread> threads;
+	std::vector<size_t> counts(THREADS);
+	std::vector<std::vector<void *>> thread_objects(THREADS);
+
+	for (auto i = 0; i < THREADS; i++) {
+		threads.emplace_back([&, i]() {
+			thread_objects[i] = fill(cache, group);
+			counts[i] = thread_objects[i].size();
+		});
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+
+	size_t total = 0;
+	for (auto count : counts) {
+		total += count;
+	}
+
+	std::cout << "Threads within the limit: " << (total * OBJECT_SIZE <= LIMIT && total * OBJECT_SIZE + (THREADS + 1) * 2 * BATCH >= LIMIT) << std::endl;
+
+	for (auto i = 0; i < THREADS; i++) {
+		threads.emplace_back([&, i]() {
+			for (auto object : thread_objects[i]) {
+				kmem_cache_free_group(cache, group, object);
+			}
+		});
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::cout << "Usage after threads exit: " << (kmem_group_usage(group) <= 2 * BATCH) << std::endl;
+
+	// Charges of the destroyed group are dropped, the new group starts empty
+	kmem_group_destroy(group);
+	group = kmem_group_create(LIMIT);
+
+	auto object = kmem_cache_alloc_group(cache, group);
+	kmem_cache_free_group(cache, group, object);
+	std::cout << "New group: " << (object != nullptr && kmem_group_usage(group) <= 2 * BATCH) << std::endl;
+
+	// Charging stays within the thread until a batch is used up
+	auto start = std::chrono::steady_clock::now();
+	for (auto i = 0; i < ITERATIONS; i++) {
+		kmem_cache_free(cache, kmem_cache_alloc(cache));
+	}
+	auto plain_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (auto i = 0; i < ITERATIONS; i++) {
+		kmem_cache_free_group(cache, group, kmem_cache_alloc_group(cache, group));
+	}
+	auto group_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << "Allocation and free: " << plain_time / ITERATIONS << " ns, charged: " << group_time / ITERATIONS << " ns" << std::endl;
+
+	kmem_group_destroy(group);
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+
+	free(memory);
+}
@@ -0,0 +1,73 @@
+#include "Slab.h"
+#include "GuardedPool.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 200;
+const int NUM_OF_SLOTS = 8;
+const int NUM_OF_OBJECTS = 100;
+const size_t OBJECT_SIZE = 40;
+
+int constructed = 0;
+
+void ctor(void *object) {
+	std::memset(object, 0, OBJECT_SIZE);
+	constructed++;
+}
+
+int main(int argc, char *argv[]) {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	// Every allocation is sampled, the ones that do not fit into the pool are served normally
+	kmem_set_guarded_sampling(1, NUM_OF_SLOTS);
+
+	auto cache = kmem_cache_create("Guarded cache", OBJECT_SIZE, ctor, nullptr);
+
+	void *objects[NUM_OF_OBJECTS];
+	auto guarded = 0;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+		std::memset(objects[i], 0xAB, OBJECT_SIZE);
+
+		if (GuardedPool::contains(objects[i])) {
+			guarded++;
+		}
+	}
+
+	std::cout << "Guarded objects: " << guarded << std::endl;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+
+	// Freed slots are reused
+	auto buffer = static_cast<char *>(kmalloc(100));
+	std::memset(buffer, 0xCD, 100);
+	std::cout << "Buffer guarded: " << GuardedPool::contains(buffer) << std::endl;
+	kfree(buffer);
+
+	kmem_cache_error(cache);
+	kmem_cache_destroy(cache);
+
+	std::cout << "OK" << std::endl;
+
+	// Use after free, the fault is reported before the program is terminated
+	if (argc > 1 && std::strcmp(argv[1], "--fault") == 0) {
+		buffer[0] = 0;
+	}
+
+	// Overflow, half of the slots place the object against the guard page after it
+	if (argc > 1 && std::strcmp(argv[1], "--overflow") == 0) {
+		for (auto i = 0; i < 2; i++) {
+			auto object = static_cast<char *>(kmalloc(64));
+			object[64] = 0;
+		}
+	}
+
+	free(memory);
+}
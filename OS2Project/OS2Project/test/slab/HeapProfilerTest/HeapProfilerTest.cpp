@@ -0,0 +1,86 @@
+#include "Slab.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cmath>
+
+const int NUM_OF_BLOCKS = 4000;
+const int NUM_OF_OBJECTS = 20000;
+const size_t OBJECT_SIZE = 64;
+const size_t SAMPLE_BYTES = 4096;
+const char *PROFILE = "heap.prof";
+
+struct totals_s {
+	unsigned long long live_objects, live_bytes, objects, bytes;
+};
+
+totals_s readTotals() {
+	std::ifstream file(PROFILE);
+	std::string line;
+	std::getline(file, line);
+
+	totals_s ret = {};
+	std::sscanf(line.c_str(), "heap profile: %llu: %llu [%llu: %llu]", &ret.live_objects, &ret.live_bytes, &ret.objects, &ret.bytes);
+
+	return ret;
+}
+
+// Unsampling done by pprof for the heap_v2 profiles
+double scaled(unsigned long long objects, unsigned long long bytes) {
+	if (objects == 0) {
+		return 0;
+	}
+
+	auto average = static_cast<double>(bytes) / objects;
+	return bytes / (1 - std::exp(-average / SAMPLE_BYTES));
+}
+
+void *keep[NUM_OF_OBJECTS];
+
+void allocateKept() {
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		keep[i] = kmalloc(OBJECT_SIZE);
+	}
+}
+
+void allocateFreed(kmem_cache_t *cache) {
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		kmem_cache_free(cache, kmem_cache_alloc(cache));
+	}
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	kmem_set_heap_sampling(SAMPLE_BYTES);
+
+	auto cache = kmem_cache_create("Profiled cache", OBJECT_SIZE, nullptr, nullptr);
+
+	allocateKept();
+	allocateFreed(cache);
+
+	kmem_heap_profile(PROFILE);
+
+	auto totals = readTotals();
+	auto live = scaled(totals.live_objects, totals.live_bytes);
+	auto allocated = scaled(totals.objects, totals.bytes);
+
+	// Sampled estimates should be close to the real sizes
+	std::cout << "Live estimate within 10%: " << (std::abs(live - NUM_OF_OBJECTS * OBJECT_SIZE) < 0.1 * NUM_OF_OBJECTS * OBJECT_SIZE ? "yes" : "no") << std::endl;
+	std::cout << "Allocated estimate within 10%: " << (std::abs(allocated - 2 * NUM_OF_OBJECTS * OBJECT_SIZE) < 0.2 * NUM_OF_OBJECTS * OBJECT_SIZE ? "yes" : "no") << std::endl;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		kfree(keep[i]);
+	}
+
+	kmem_heap_profile(PROFILE);
+	std::cout << "Live objects after free: " << readTotals().live_objects << std::endl;
+
+	kmem_cache_destroy(cache);
+
+	std::remove(PROFILE);
+
+	std::cout << "OK" << std::endl;
+}
@@ -0,0 +1,80 @@
+#include "Slab.h"
+#include "AllocatorUtility.h"
+#include "Buddy.h"
+#include <iostream>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 100;
+const int HUGE_REGION_BLOCKS = 1024;
+const int USER_REGION_BLOCKS = 1100;
+const int NUM_OF_OBJECTS = 1000;
+
+// Checks that the memory belongs to a region of the huge pool
+bool inHugePool(const void *memory) {
+	auto region = AllocatorUtility::buddyHeader().regionOf(memory);
+	return region != nullptr && region->pool_ == HUGE_POOL;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	kmem_add_huge_region(nullptr, HUGE_REGION_BLOCKS);
+
+	auto cache = kmem_cache_create_flags("Hot cache", 64, nullptr, nullptr, KMEM_CACHE_HUGEPAGE);
+
+	void *objects[NUM_OF_OBJECTS];
+	auto objects_huge = true;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		objects[i] = kmem_cache_alloc(cache);
+		objects_huge = objects_huge && objects[i] != nullptr && inHugePool(objects[i]);
+	}
+
+	std::cout << "Objects in the huge pool: " << objects_huge << std::endl;
+
+	// The first slab is carved from the start of the first huge page
+	auto slab = reinterpret_cast<size_t>(Buddy::owner(objects[0]));
+	auto slab_aligned = slab % HUGE_PAGE_SIZE == 0;
+	std::cout << "First slab huge page aligned: " << slab_aligned << std::endl;
+
+	for (auto i = 0; i < NUM_OF_OBJECTS; i++) {
+		kmem_cache_free(cache, objects[i]);
+	}
+
+	kmem_cache_info(cache);
+	auto error = kmem_cache_error(cache);
+	kmem_cache_destroy(cache);
+
+	// Memory of the user is moved off the block alignment malloc may give, the usable part must still be aligned
+	auto user_memory = static_cast<byte *>(malloc(BLOCK_SIZE * (USER_REGION_BLOCKS + 1)));
+	kmem_add_huge_region(user_memory + BLOCK_SIZE / 2, USER_REGION_BLOCKS);
+
+	auto &header = AllocatorUtility::buddyHeader();
+	auto huge_regions = 0;
+	auto regions_aligned = true;
+
+	for (size_t i = 0; i < header.number_of_regions_.load(); i++) {
+		auto &region = header.regions_[i];
+
+		if (region.pool_ == HUGE_POOL) {
+			huge_regions++;
+			regions_aligned = regions_aligned && reinterpret_cast<size_t>(region.memory_) % HUGE_PAGE_SIZE == 0;
+		}
+	}
+
+	std::cout << "Huge regions added: " << (huge_regions == 2) << std::endl;
+	std::cout << "Huge regions aligned: " << regions_aligned << std::endl;
+
+	bool zeroed;
+	auto huge_block = Buddy::allocate(HUGE_PAGE_SIZE / BLOCK_SIZE, zeroed, HUGE_POOL);
+	auto block_ok = huge_block != nullptr && inHugePool(huge_block) && reinterpret_cast<size_t>(huge_block) % HUGE_PAGE_SIZE == 0;
+	std::cout << "Huge page block aligned: " << block_ok << std::endl;
+	Buddy::deallocate(huge_block, HUGE_PAGE_SIZE / BLOCK_SIZE);
+
+	std::cout << (huge_regions == 2 && regions_aligned && block_ok && objects_huge && slab_aligned && error == 0 ? "OK" : "Huge pages failed") << std::endl;
+
+	free(user_memory);
+	free(memory);
+}
@@ -0,0 +1,93 @@
+#include "Slab.h"
+#include "MemoryResource.h"
+#include "Buddy.h"
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+using namespace os2bn140314d;
+
+const int NUM_OF_BLOCKS = 4000;
+const int ROUNDS = 1000;
+const int BIG_VECTOR = 100000;
+const int NODES = 100000;
+
+template <typename Map>
+double churn(Map &map) {
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto i = 0; i < NODES; i++) {
+		map[i] = i;
+	}
+
+	for (auto i = 0; i < NODES; i++) {
+		map.erase(i);
+	}
+
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()) / NODES;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	// Big vectors come from the buddy allocator, leaking them would exhaust the memory
+	for (auto i = 0; i < ROUNDS; i++) {
+		std::vector<int, Allocator<int>> big(BIG_VECTOR, i);
+	}
+
+	std::cout << "Big vectors returned" << std::endl;
+
+	{
+		std::map<int, int, std::less<int>, Allocator<std::pair<const int, int>>> map;
+
+		for (auto i = 0; i < 1000; i++) {
+			map[i] = i;
+		}
+
+		std::cout << "Map nodes from the allocator: " << (Buddy::owner(&*map.begin()) != nullptr ? "yes" : "no") << std::endl;
+	}
+
+	std::cout << "Line aligned: " << (reinterpret_cast<size_t>(SizedAllocator::allocate(40, CACHE_L1_LINE_SIZE)) % CACHE_L1_LINE_SIZE == 0 ? "yes" : "no") << std::endl;
+	std::cout << "Over-aligned refused: " << (SizedAllocator::allocate(40, 2 * CACHE_L1_LINE_SIZE) == nullptr ? "yes" : "no") << std::endl;
+
+	{
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator<std::pair<const int, int>>> map;
+		std::cerr << "Allocator map insert and erase: " << churn(map) << " ns" << std::endl;
+	}
+
+#ifdef KMEM_MEMORY_RESOURCE
+	{
+		CachePoolResource pool;
+
+		std::pmr::unordered_map<int, int> map(&pool);
+		std::pmr::vector<int> vector(&pool);
+
+		for (auto i = 0; i < 1000; i++) {
+			map[i] = i;
+			vector.push_back(i);
+		}
+
+		std::cout << "Pool nodes from the allocator: " << (Buddy::owner(&*map.begin()) != nullptr ? "yes" : "no") << std::endl;
+		std::cout << "Pool vector from the allocator: " << (Buddy::owner(vector.data()) != nullptr || vector.capacity() * sizeof(int) > CachePoolResource::MAX_POOLED_SIZE ? "yes" : "no") << std::endl;
+
+		map.clear();
+		std::cerr << "Pool map insert and erase: " << churn(map) << " ns" << std::endl;
+	}
+
+	{
+		std::pmr::unordered_map<int, int> map(BufferResource::instance());
+		std::cerr << "Buffer map insert and erase: " << churn(map) << " ns" << std::endl;
+	}
+
+	{
+		std::pmr::unordered_map<int, int> map(std::pmr::new_delete_resource());
+		std::cerr << "Default map insert and erase: " << churn(map) << " ns" << std::endl;
+	}
+#endif
+
+	std::cout << "OK" << std::endl;
+}
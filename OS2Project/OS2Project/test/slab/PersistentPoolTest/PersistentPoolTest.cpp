@@ -0,0 +1,233 @@
+#include "Slab.h"
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+const int NUM_OF_BLOCKS = 1024;
+const int NODES = 10000;
+const size_t LAYOUT_BLOCKS = 12345;
+const char *PATH = "/tmp/PersistentPoolTest.pool";
+
+struct node_s {
+	node_s *next_;
+	int value_;
+};
+
+struct root_s {
+	node_s *first_;
+	int count_;
+	void *plain_address_;
+};
+
+int constructed = 0;
+
+void construct(void *) {
+	constructed++;
+}
+
+// Runs the test program again in the given mode, the new process has its own layout of the address space
+int inProcess(const char *program, const char *mode) {
+	auto child = fork();
+
+	if (child == 0) {
+		execlp(program, program, mode, static_cast<char *>(nullptr));
+		_exit(127);
+	}
+
+	int status;
+	waitpid(child, &status, 0);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Address the system picks for a mapping of the pool's size, where the pool would be without the reserved range
+void *plainAddress() {
+	auto size = NUM_OF_BLOCKS * BLOCK_SIZE;
+	auto ret = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	munmap(ret, size);
+	return ret;
+}
+
+int build() {
+	// Memory mapped before the pool moves the addresses the system picks later
+	mmap(nullptr, LAYOUT_BLOCKS * BLOCK_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (!kmem_init_persistent(PATH, NUM_OF_BLOCKS)) {
+		return 1;
+	}
+
+	auto nodes = kmem_cache_create("Nodes", sizeof(node_s), nullptr, nullptr);
+	auto root = static_cast<root_s *>(kmalloc(sizeof(root_s)));
+
+	root->first_ = nullptr;
+	root->count_ = 0;
+	root->plain_address_ = plainAddress();
+
+	for (auto i = 0; i < NODES; i++) {
+		auto node = static_cast<node_s *>(kmem_cache_alloc(nodes));
+		if (node == nullptr) {
+			return 2;
+		}
+
+		node->value_ = i;
+		node->next_ = root->first_;
+		root->first_ = node;
+		root->count_++;
+	}
+
+	kmem_set_root(root);
+
+	return kmem_detach() ? 0 : 3;
+}
+
+bool verify(root_s *root) {
+	auto count = 0;
+	auto expected = root->count_ - 1;
+
+	for (auto node = root->first_; node != nullptr; node = node->next_) {
+		if (node->value_ != expected--) {
+			return false;
+		}
+
+		count++;
+	}
+
+	return count == root->count_;
+}
+
+int check() {
+	if (!kmem_attach(PATH)) {
+		return 1;
+	}
+
+	auto root = static_cast<root_s *>(kmem_root());
+	if (!verify(root) || root->count_ != NODES || kmem_cache_open("Nodes", nullptr, nullptr) == nullptr) {
+		return 2;
+	}
+
+	return kmem_detach() ? 0 : 3;
+}
+
+// Process that exits without detaching leaves the pool unusable
+int leaveDirty() {
+	return kmem_attach(PATH) ? 0 : 1;
+}
+
+// Range the pool needs is taken before the allocator reserves it
+int taken() {
+	auto size = NUM_OF_BLOCKS * BLOCK_SIZE;
+	auto other = mmap(KMEM_PERSISTENT_ADDRESS, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (other != KMEM_PERSISTENT_ADDRESS) {
+		return 1;
+	}
+
+	std::memset(other, 0x5A, size);
+
+	if (kmem_attach(PATH)) {
+		return 2;
+	}
+
+	// Mapping that took the range is left as it was
+	return static_cast<unsigned char *>(other)[size - 1] == 0x5A ? 0 : 3;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		if (std::strcmp(argv[1], "build") == 0) {
+			return kmem_reserve_persistent(nullptr, NUM_OF_BLOCKS) ? build() : 4;
+		}
+
+		if (std::strcmp(argv[1], "check") == 0) {
+			return check();
+		}
+
+		if (std::strcmp(argv[1], "dirty") == 0) {
+			return leaveDirty();
+		}
+
+		if (std::strcmp(argv[1], "taken") == 0) {
+			return taken();
+		}
+
+		return 5;
+	}
+
+	// Range is reserved before anything else maps memory, as the processes using the pool should do
+	std::cout << "Range reserved: " << kmem_reserve_persistent(nullptr, NUM_OF_BLOCKS) << std::endl;
+	std::cout << "Second reserve fails: " << (kmem_reserve_persistent(nullptr, NUM_OF_BLOCKS) == 0) << std::endl;
+
+	std::cout << "Bad sizes refused: " << (kmem_init_persistent(PATH, -1) == 0 && kmem_init_persistent(PATH, 4) == 0) << std::endl;
+	std::cout << "Too big for the range: " << (kmem_init_persistent(PATH, NUM_OF_BLOCKS + 1) == 0) << std::endl;
+	std::cout << "Built in another process: " << (inProcess(argv[0], "build") == 0) << std::endl;
+
+	// This process maps its memory in another order, so a plain mapping would land elsewhere than in the building process
+	auto layout = malloc(LAYOUT_BLOCKS * BLOCK_SIZE / 3);
+	mmap(nullptr, 3 * LAYOUT_BLOCKS * BLOCK_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	// Pool is mapped at the start of the reserved range, so the pointers in it are valid
+	auto start = std::chrono::steady_clock::now();
+	auto attached = kmem_attach(PATH);
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << "Attach: " << elapsed << " us" << std::endl;
+	std::cout << "Attached: " << attached << std::endl;
+	std::cout << "Second attach fails: " << (kmem_attach(PATH) == 0) << std::endl;
+
+	auto root = static_cast<root_s *>(kmem_root());
+	auto offset = reinterpret_cast<char *>(root) - static_cast<char *>(KMEM_PERSISTENT_ADDRESS);
+	std::cout << "Pool at the reserved address: " << (offset > 0 && offset < static_cast<long>(NUM_OF_BLOCKS * BLOCK_SIZE)) << std::endl;
+	std::cout << "Layout differs: " << (root != nullptr && root->plain_address_ != plainAddress()) << std::endl;
+	std::cout << "List kept: " << (root != nullptr && verify(root)) << std::endl;
+
+	std::cout << "Unknown cache: " << (kmem_cache_open("Missing", nullptr, nullptr) == nullptr) << std::endl;
+
+	// Functions of the reopened cache are the ones of this process
+	auto nodes = kmem_cache_open("Nodes", construct, nullptr);
+	std::cout << "Cache opened: " << (nodes != nullptr) << std::endl;
+
+	// Half of the nodes are freed, and the new ones take their place
+	for (auto i = 0; i < NODES / 2; i++) {
+		auto node = root->first_;
+		root->first_ = node->next_;
+		root->count_--;
+		kmem_cache_free(nodes, node);
+	}
+
+	for (auto i = 0; i < NODES / 2; i++) {
+		auto node = static_cast<node_s *>(kmem_cache_alloc(nodes));
+		node->value_ = root->count_;
+		node->next_ = root->first_;
+		root->first_ = node;
+		root->count_++;
+	}
+
+	std::cout << "Allocated after attach: " << (verify(root) && root->count_ == NODES) << std::endl;
+	std::cout << "Constructor set: " << (constructed > 0) << std::endl;
+	std::cout << "Purge disabled: " << (kmem_purge() == 0) << std::endl;
+
+	std::cout << "Detached: " << kmem_detach() << std::endl;
+	std::cout << "Second detach fails: " << (kmem_detach() == 0) << std::endl;
+	std::cout << "Root after detach: " << (kmem_root() == nullptr) << std::endl;
+
+	// Changes of this process are in the file for the next one
+	std::cout << "Attached in another process: " << (inProcess(argv[0], "check") == 0) << std::endl;
+
+	// Attach must fail rather than map over memory the process already uses
+	std::cout << "Taken range refused: " << (inProcess(argv[0], "taken") == 0) << std::endl;
+
+	inProcess(argv[0], "dirty");
+	std::cout << "Dirty pool refused: " << (kmem_attach(PATH) == 0) << std::endl;
+
+	std::remove(PATH);
+
+	std::cout << "Missing file refused: " << (kmem_attach(PATH) == 0) << std::endl;
+
+	free(layout);
+
+	std::cout << "OK" << std::endl;
+}
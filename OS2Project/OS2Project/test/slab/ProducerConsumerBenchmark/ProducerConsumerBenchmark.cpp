@@ -0,0 +1,119 @@
+#include "Slab.h"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+const int NUM_OF_BLOCKS = 4096;
+const int NUM_OF_MESSAGES = 2000000;
+const int NUM_OF_PAIRS = 4;
+const size_t QUEUE_SIZE = 1024;
+const size_t MESSAGE_SIZE = 64;
+
+/**
+ * \brief Bounded queue with one producer and one consumer
+ */
+struct Queue {
+	std::atomic<size_t> head{ 0 };
+	char padding_head[CACHE_L1_LINE_SIZE];
+	std::atomic<size_t> tail{ 0 };
+	char padding_tail[CACHE_L1_LINE_SIZE];
+	void *messages[QUEUE_SIZE];
+
+	void push(void *message) {
+		auto tail_value = tail.load(std::memory_order_relaxed);
+		while (tail_value - head.load(std::memory_order_acquire) == QUEUE_SIZE) {
+			std::this_thread::yield();
+		}
+
+		messages[tail_value % QUEUE_SIZE] = message;
+		tail.store(tail_value + 1, std::memory_order_release);
+	}
+
+	void *pop() {
+		auto head_value = head.load(std::memory_order_relaxed);
+		while (tail.load(std::memory_order_acquire) == head_value) {
+			std::this_thread::yield();
+		}
+
+		auto ret = messages[head_value % QUEUE_SIZE];
+		head.store(head_value + 1, std::memory_order_release);
+		return ret;
+	}
+};
+
+kmem_cache_t *cache;
+
+Queue queues[NUM_OF_PAIRS];
+
+void producer(int index) {
+	for (auto i = 0; i < NUM_OF_MESSAGES; i++) {
+		auto message = static_cast<int *>(kmem_cache_alloc(cache));
+		*message = i;
+		queues[index].push(message);
+	}
+}
+
+void consumer(int index) {
+	for (auto i = 0; i < NUM_OF_MESSAGES; i++) {
+		auto message = queues[index].pop();
+		kmem_cache_free(cache, message);
+	}
+}
+
+void local(int index) {
+	void *messages[QUEUE_SIZE];
+
+	for (auto i = 0; i < NUM_OF_MESSAGES / static_cast<int>(QUEUE_SIZE); i++) {
+		// Messages are written as the producers write them, so both runs touch the same memory
+		for (size_t j = 0; j < QUEUE_SIZE; j++) {
+			messages[j] = kmem_cache_alloc(cache);
+			*static_cast<int *>(messages[j]) = index;
+		}
+
+		for (size_t j = 0; j < QUEUE_SIZE; j++) {
+			kmem_cache_free(cache, messages[j]);
+		}
+	}
+}
+
+double run(bool remote) {
+	std::vector<std::thread> threads;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto i = 0; i < NUM_OF_PAIRS; i++) {
+		if (remote) {
+			threads.push_back(std::thread(producer, i));
+			threads.push_back(std::thread(consumer, i));
+		}
+		else {
+			threads.push_back(std::thread(local, i));
+		}
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	auto seconds = std::chrono::duration<double>(end - start).count();
+
+	return NUM_OF_PAIRS * static_cast<double>(NUM_OF_MESSAGES) / seconds / 1e6;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	cache = kmem_cache_create("Messages", MESSAGE_SIZE, nullptr, nullptr);
+
+	std::cout << "Same thread frees       -- " << run(false) << " M objects/s" << std::endl;
+	std::cout << "Producer/consumer frees -- " << run(true) << " M objects/s" << std::endl;
+
+	kmem_cache_error(cache);
+	kmem_cache_destroy(cache);
+
+	free(memory);
+}
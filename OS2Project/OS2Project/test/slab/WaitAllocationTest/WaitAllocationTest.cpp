@@ -0,0 +1,141 @@
+#include "Slab.h"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+const int NUM_OF_BLOCKS = 256;
+const int TIMEOUT = 100;
+const int SMALL_SIZE = 64;
+const int BIG_SIZE = 8 * BLOCK_SIZE;
+
+long long elapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<void *> fill(kmem_cache_t *cache) {
+	std::vector<void *> ret;
+
+	while (true) {
+		auto object = kmem_cache_alloc(cache);
+		if (object == nullptr) {
+			break;
+		}
+
+		ret.push_back(object);
+	}
+
+	return ret;
+}
+
+int main() {
+	auto memory = malloc(BLOCK_SIZE * NUM_OF_BLOCKS);
+	kmem_init(memory, NUM_OF_BLOCKS);
+
+	auto small = kmem_cache_create("Small", SMALL_SIZE, nullptr, nullptr);
+	auto big = kmem_cache_create("Big", BIG_SIZE, nullptr, nullptr);
+
+	auto objects = fill(small);
+	std::cout << "Small objects: " << objects.size() << std::endl;
+
+	// Without a free the allocation fails once the timeout expires
+	auto start = std::chrono::steady_clock::now();
+	auto object = kmem_cache_alloc_wait(small, TIMEOUT);
+	auto elapsed = elapsedMilliseconds(start);
+	std::cout << "Timed out: " << (object == nullptr && elapsed >= TIMEOUT) << std::endl;
+
+	start = std::chrono::steady_clock::now();
+	object = kmem_cache_alloc_wait(small, 0);
+	elapsed = elapsedMilliseconds(start);
+	std::cout << "No wait: " << (object == nullptr && elapsed < TIMEOUT) << std::endl;
+
+	// Free from another thread wakes the waiter
+	std::atomic<void *> taken(nullptr);
+	auto freed = objects.back();
+	objects.pop_back();
+
+	std::thread waiter([&]() {
+		taken.store(kmem_cache_alloc_wait(small, -1));
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(TIMEOUT));
+	kmem_cache_free(small, freed);
+	waiter.join();
+
+	std::cout << "Woken by free: " << (taken.load() == freed) << std::endl;
+	objects.push_back(taken.load());
+
+	// Small frees do not merge into a block big enough for a slab of the big cache
+	taken.store(nullptr);
+
+	std::thread big_waiter([&]() {
+		taken.store(kmem_cache_alloc_wait(big, 4 * TIMEOUT));
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(TIMEOUT));
+
+	for (size_t i = 0; i < objects.size(); i += 2) {
+		kmem_cache_free(small, objects[i]);
+		objects[i] = nullptr;
+	}
+
+	big_waiter.join();
+	std::cout << "Big waiter timed out: " << (taken.load() == nullptr) << std::endl;
+
+	// Shrinking the small cache returns whole slabs, which merge for the big waiter
+	std::thread big_waiter_again([&]() {
+		taken.store(kmem_cache_alloc_wait(big, -1));
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(TIMEOUT));
+
+	for (auto small_object : objects) {
+		if (small_object != nullptr) {
+			kmem_cache_free(small, small_object);
+		}
+	}
+
+	kmem_cache_shrink(small);
+	big_waiter_again.join();
+
+	std::cout << "Big waiter woken by shrink: " << (taken.load() != nullptr) << std::endl;
+	kmem_cache_free(big, taken.load());
+
+	// Buffers wait the same way, sizes without a buffer cache return at once
+	std::cout << "No buffer cache: " << (kmalloc_wait(BLOCK_SIZE * NUM_OF_BLOCKS, -1) == nullptr) << std::endl;
+
+	std::vector<void *> buffers;
+
+	while (true) {
+		auto buffer = kmalloc(SMALL_SIZE);
+		if (buffer == nullptr) {
+			break;
+		}
+
+		buffers.push_back(buffer);
+	}
+
+	void *buffer_taken = nullptr;
+
+	std::thread buffer_waiter([&]() {
+		buffer_taken = kmalloc_wait(SMALL_SIZE, -1);
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(TIMEOUT));
+
+	for (auto buffer : buffers) {
+		kfree(buffer);
+	}
+
+	buffer_waiter.join();
+	std::cout << "Buffer waiter woken: " << (buffer_taken != nullptr) << std::endl;
+	kfree(buffer_taken);
+
+	kmem_cache_destroy(small);
+	kmem_cache_destroy(big);
+
+	std::cout << "OK" << std::endl;
+
+	free(memory);
+}